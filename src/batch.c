@@ -0,0 +1,219 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "cli.h"
+#include "quantization.h"
+
+#define INPUT_SUFFIX ".in"
+#define OUTPUT_SUFFIX ".out"
+#define ERRORS_SUFFIX ".err"
+
+/*
+ * Work shared by all threads of one batch run. Threads claim inputs by
+ * incrementing "next", so no locking is needed.
+ */
+struct BatchJob
+{
+    char **inputs;
+    size_t inputsCount;
+    atomic_size_t next;
+    atomic_bool failed;
+};
+typedef struct BatchJob BatchJob;
+
+/*
+ * Thread body, processes inputs until none are left
+ */
+static void *batchWorker(void *argument);
+
+/*
+ * Runs commands from single input file, writing answers next to it.
+ * Returns false if file could not be processed.
+ */
+static bool processFile(const char *input);
+
+/*
+ * Returns newly allocated path of the file that belongs to given input and
+ * has given suffix, or NULL if allocation failed.
+ */
+static char *siblingPath(const char *input, const char *suffix);
+
+/*
+ * Returns number of worker threads to use when caller did not specify it
+ */
+static unsigned defaultWorkers();
+
+int runBatch(char **inputs, size_t inputsCount, unsigned workers)
+{
+    if (workers == 0) workers = defaultWorkers();
+    if (workers > inputsCount) workers = inputsCount;
+    if (workers == 0) return 0; // nothing to do
+
+    BatchJob job;
+    job.inputs = inputs;
+    job.inputsCount = inputsCount;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+    if (threads == NULL) return 1;
+
+    // calling thread works too, so we start one thread less
+    unsigned started = 0;
+    while (started < workers - 1 &&
+           pthread_create(&threads[started], NULL, batchWorker, &job) == 0)
+    {
+        ++started;
+    }
+
+    batchWorker(&job);
+
+    for (unsigned i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    return atomic_load(&job.failed) ? 1 : 0;
+}
+
+static void *batchWorker(void *argument)
+{
+    BatchJob *job = argument;
+
+    while (true)
+    {
+        size_t claimed = atomic_fetch_add(&job->next, 1);
+        if (claimed >= job->inputsCount) break;
+
+        if (!processFile(job->inputs[claimed]))
+        {
+            atomic_store(&job->failed, true);
+        }
+    }
+
+    return NULL;
+}
+
+static bool processFile(const char *input)
+{
+    bool success = false;
+    char *outputPath = siblingPath(input, OUTPUT_SUFFIX);
+    char *errorsPath = siblingPath(input, ERRORS_SUFFIX);
+    FILE *inputFile = fopen(input, "r");
+
+    // answers are not created for input which can not be read
+    FILE *outputFile = inputFile != NULL && outputPath != NULL ?
+                       fopen(outputPath, "w") : NULL;
+    FILE *errorsFile = outputFile != NULL && errorsPath != NULL ?
+                       fopen(errorsPath, "w") : NULL;
+    Quantization *quantization = quantCreate();
+
+    if (inputFile == NULL || outputFile == NULL || errorsFile == NULL)
+    {
+        fprintf(stderr, "Cannot process %s\n", input);
+    }
+    else if (quantization != NULL)
+    {
+        success = runCommands(quantization, inputFile, outputFile,
+                              errorsFile) == 0;
+    }
+
+    quantDestroy(quantization);
+    if (inputFile != NULL) fclose(inputFile);
+    if (outputFile != NULL) fclose(outputFile);
+    if (errorsFile != NULL) fclose(errorsFile);
+    free(outputPath);
+    free(errorsPath);
+
+    return success;
+}
+
+static char *siblingPath(const char *input, const char *suffix)
+{
+    size_t length = strlen(input);
+    size_t inputSuffixLength = strlen(INPUT_SUFFIX);
+
+    // "name.in" becomes "name<suffix>", everything else gets suffix appended
+    if (length > inputSuffixLength &&
+        strcmp(input + length - inputSuffixLength, INPUT_SUFFIX) == 0)
+    {
+        length -= inputSuffixLength;
+    }
+
+    char *path = malloc(sizeof(char) * (length + strlen(suffix) + 1));
+    if (path == NULL) return NULL;
+
+    memcpy(path, input, length);
+    strcpy(path + length, suffix);
+
+    return path;
+}
+
+static unsigned defaultWorkers()
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (unsigned) processors : 1;
+}
+
+int runManifest(const char *manifest, unsigned workers)
+{
+    FILE *manifestFile = fopen(manifest, "r");
+    if (manifestFile == NULL)
+    {
+        fprintf(stderr, "Cannot open manifest %s\n", manifest);
+        return 1;
+    }
+
+    char **inputs = NULL;
+    size_t inputsCount = 0;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    bool memFail = false;
+
+    while (!memFail &&
+           (lineLength = getline(&line, &lineCapacity, manifestFile)) != -1)
+    {
+        if (lineLength > 0 && line[lineLength - 1] == '\n')
+        {
+            line[--lineLength] = '\0';
+        }
+        if (lineLength == 0 || line[0] == '#') continue;
+
+        if (inputsCount == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            char **expanded = realloc(inputs, sizeof(char *) * capacity);
+            if (expanded == NULL)
+            {
+                memFail = true;
+                break;
+            }
+            inputs = expanded;
+        }
+
+        inputs[inputsCount] = strdup(line);
+        if (inputs[inputsCount] == NULL) memFail = true;
+        else ++inputsCount;
+    }
+
+    free(line);
+    fclose(manifestFile);
+
+    int exitCode = memFail ? 1 : runBatch(inputs, inputsCount, workers);
+
+    for (size_t i = 0; i < inputsCount; ++i)
+    {
+        free(inputs[i]);
+    }
+    free(inputs);
+
+    return exitCode;
+}
@@ -0,0 +1,23 @@
+#ifndef QUANTIZATION_BATCH_H
+#define QUANTIZATION_BATCH_H
+
+#include <stddef.h>
+
+/*
+ * Processes every input file on its own, fresh set of histories. Files are
+ * distributed among "workers" threads, or among as many threads as there are
+ * online processors if "workers" is 0. Answers for "<name>.in" are written to
+ * "<name>.out" and error messages to "<name>.err"; files without ".in" suffix
+ * get ".out" and ".err" appended instead.
+ * Returns 0 if all files were processed, 1 otherwise.
+ */
+int runBatch(char **inputs, size_t inputsCount, unsigned workers);
+
+/*
+ * Reads manifest file listing one input path per line (empty lines and lines
+ * starting with '#' are skipped) and runs them as in runBatch.
+ * Returns 0 if all files were processed, 1 otherwise.
+ */
+int runManifest(const char *manifest, unsigned workers);
+
+#endif //QUANTIZATION_BATCH_H
@@ -0,0 +1,217 @@
+#ifndef QUANTIZATION_CHILDREN_H
+#define QUANTIZATION_CHILDREN_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+#include "types.h"
+
+/*
+ * Access to children of Tree nodes. Small alphabets use array indexed by
+ * state, large ones use bitmap of existing children and array holding only
+ * them, in which child's position is the number of existing children with
+ * lower states (popcount of the bitmap below its bit). Pointers to existing
+ * children are charged to the pool of the node, so that arrays count against
+ * its limit.
+ */
+
+/*
+ * Sets node to have no children
+ */
+static inline void initializeChildren(Tree *node)
+{
+#if DENSE_CHILDREN
+    for (unsigned i = 0; i < STATES; ++i)
+    {
+        node->next[i] = NULL;
+    }
+#else
+    for (unsigned i = 0; i < CHILDREN_WORDS; ++i)
+    {
+        node->present[i] = 0;
+    }
+    node->next = NULL;
+#endif
+}
+
+#if !DENSE_CHILDREN
+/*
+ * Returns position of given state's child in packed array
+ */
+static inline unsigned childRank(const Tree *node, int symbol)
+{
+    unsigned word = (unsigned) symbol / 64;
+    uint64_t below = (((uint64_t) 1) << (symbol % 64)) - 1;
+    unsigned rank = __builtin_popcountll(node->present[word] & below);
+
+    for (unsigned i = 0; i < word; ++i)
+    {
+        rank += __builtin_popcountll(node->present[i]);
+    }
+
+    return rank;
+}
+
+/*
+ * Returns number of existing children
+ */
+static inline unsigned childrenCount(const Tree *node)
+{
+    unsigned count = 0;
+
+    for (unsigned i = 0; i < CHILDREN_WORDS; ++i)
+    {
+        count += __builtin_popcountll(node->present[i]);
+    }
+
+    return count;
+}
+#endif
+
+/*
+ * Releases memory used for keeping children, but not children themselves
+ */
+static inline void releaseChildren(Tree *node)
+{
+#if DENSE_CHILDREN
+    (void) node;
+#else
+    poolFree(poolOf(node), node->next, sizeof(Tree *) * childrenCount(node));
+    node->next = NULL;
+#endif
+}
+
+/*
+ * Gives node, which was copied together with its children pointers, children
+ * array of its own. Returns false if there was not enough memory, in that case
+ * node has no children.
+ */
+static inline bool duplicateChildren(Tree *copy)
+{
+#if DENSE_CHILDREN
+    (void) copy;
+    return true;
+#else
+    if (copy->next == NULL) return true;
+
+    unsigned count = childrenCount(copy);
+    Tree **children = poolMalloc(poolOf(copy), sizeof(Tree *) * count);
+    if (children == NULL)
+    {
+        initializeChildren(copy);
+        return false;
+    }
+
+    memcpy(children, copy->next, sizeof(Tree *) * count);
+    copy->next = children;
+    return true;
+#endif
+}
+
+/*
+ * Returns child for given state, or NULL if there is none
+ */
+static inline Tree *getChild(const Tree *node, int symbol)
+{
+#if DENSE_CHILDREN
+    return node->next[symbol];
+#else
+    uint64_t bit = ((uint64_t) 1) << (symbol % 64);
+    if ((node->present[symbol / 64] & bit) == 0) return NULL;
+
+    return node->next[childRank(node, symbol)];
+#endif
+}
+
+/*
+ * Sets child for given state, NULL removes it. Returns false, leaving node
+ * unchanged, if memory for larger children array could not be allocated or
+ * would exceed the limit of the pool.
+ */
+static inline bool setChild(Tree *node, int symbol, Tree *child)
+{
+#if DENSE_CHILDREN
+    node->next[symbol] = child;
+    return true;
+#else
+    uint64_t bit = ((uint64_t) 1) << (symbol % 64);
+    uint64_t *word = &node->present[symbol / 64];
+    unsigned rank = childRank(node, symbol);
+    unsigned count = childrenCount(node);
+
+    if ((*word & bit) != 0) // replacing existing child
+    {
+        if (child != NULL)
+        {
+            node->next[rank] = child;
+            return true;
+        }
+
+        // array keeps its size, only pointers in use stay charged
+        memmove(node->next + rank, node->next + rank + 1,
+                sizeof(Tree *) * (count - rank - 1));
+        *word &= ~bit;
+        poolDischarge(poolOf(node), sizeof(Tree *));
+        if (count == 1) releaseChildren(node);
+        return true;
+    }
+
+    if (child == NULL) return true;
+
+    Tree **expanded = poolRealloc(poolOf(node), node->next,
+                                  sizeof(Tree *) * count,
+                                  sizeof(Tree *) * (count + 1));
+    if (expanded == NULL) return false;
+
+    memmove(expanded + rank + 1, expanded + rank,
+            sizeof(Tree *) * (count - rank));
+    expanded[rank] = child;
+    node->next = expanded;
+    *word |= bit;
+    return true;
+#endif
+}
+
+/*
+ * Returns first child with state greater than *symbol, and stores its state in
+ * *symbol. Returns NULL if there are no more children. Starting with *symbol
+ * equal to -1 visits all children in order of their states.
+ */
+static inline Tree *nextChild(const Tree *node, int *symbol)
+{
+#if DENSE_CHILDREN
+    for (int i = *symbol + 1; i < STATES; ++i)
+    {
+        if (node->next[i] != NULL)
+        {
+            *symbol = i;
+            return node->next[i];
+        }
+    }
+
+    return NULL;
+#else
+    int start = *symbol + 1;
+    if (start >= STATES) return NULL;
+
+    for (unsigned word = start / 64; word < CHILDREN_WORDS; ++word)
+    {
+        uint64_t bits = node->present[word];
+        if (word == (unsigned) start / 64)
+        {
+            bits &= ~((((uint64_t) 1) << (start % 64)) - 1);
+        }
+
+        if (bits != 0)
+        {
+            *symbol = (int) (word * 64 + __builtin_ctzll(bits));
+            return node->next[childRank(node, *symbol)];
+        }
+    }
+
+    return NULL;
+#endif
+}
+
+#endif //QUANTIZATION_CHILDREN_H
@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "classes.h"
+#include "snapshot.h"
+#include "tree.h"
+
+/*
+ * Class of equal histories met by batch of updates, in union-find forest over
+ * distinct nodes of the batch sorted by address. "parent" is position of class
+ * it was merged into, or its own position, "energy" energy of the class after
+ * updates applied so far, and "changed" tells it must be spread to all nodes
+ * of the class.
+ */
+struct BatchClass
+{
+    Tree *node;
+    size_t parent;
+    Energy energy;
+    bool changed;
+};
+typedef struct BatchClass BatchClass;
+
+/*
+ * Does work of equalHistories, when "argumentsB" are given, or otherwise of
+ * energyHistories. Classes are followed in union-find forest while updates are
+ * applied, equalities being added at once, and energy of every changed class
+ * is spread once at the end.
+ */
+static void updateInBatch(const char **argumentsA, const char **argumentsB,
+                          const Energy *energies, size_t count,
+                          Tree *histories, bool *errors, bool *memFail);
+
+/*
+ * Returns classes of given nodes, which may repeat or be NULL, storing their
+ * number in "classesCount". Nodes which are already equal belong to the same
+ * class. Returns NULL, setting "memFail", if there was not enough memory.
+ */
+static BatchClass *batchClasses(Tree **nodes, size_t count,
+                                size_t *classesCount, bool *memFail);
+
+/*
+ * Merges classes of nodes already equal, walking equalities from each class
+ * once. Returns false if there was not enough memory.
+ */
+static bool joinEqualClasses(BatchClass *classes, size_t count);
+
+/*
+ * Returns position of class of given node, before any merging, or "count" if
+ * node is not in the batch
+ */
+static size_t classPosition(const BatchClass *classes, size_t count,
+                            const Tree *node);
+
+/*
+ * Returns position of class given node belongs to after merging so far
+ */
+static size_t classOf(BatchClass *classes, size_t count, const Tree *node);
+
+/*
+ * Compares nodes of two classes by address, for qsort
+ */
+static int compareClasses(const void *a, const void *b);
+
+void energyHistories(const char **arguments, const Energy *energies,
+                     size_t count, Tree *histories, bool *errors,
+                     bool *memFail)
+{
+    updateInBatch(arguments, NULL, energies, count, histories, errors,
+                  memFail);
+}
+
+void equalHistories(const char **argumentsA, const char **argumentsB,
+                    size_t count, Tree *histories, bool *errors,
+                    bool *memFail)
+{
+    updateInBatch(argumentsA, argumentsB, NULL, count, histories, errors,
+                  memFail);
+}
+
+static void updateInBatch(const char **argumentsA, const char **argumentsB,
+                          const Energy *energies, size_t count,
+                          Tree *histories, bool *errors, bool *memFail)
+{
+    // nodes of the second histories follow those of the first ones
+    size_t nodesCount = argumentsB == NULL ? count : 2 * count;
+    Tree **nodes = calloc(nodesCount > 0 ? nodesCount : 1, sizeof(Tree *));
+    if (nodes == NULL)
+    {
+        *memFail = true;
+        return;
+    }
+
+    // paths of all histories are made writable first, so that no node of
+    // the batch is replaced by a copy later
+    for (size_t i = 0; i < count && !*memFail; ++i)
+    {
+        if (errors[i]) continue;
+
+        nodes[i] = writableHistory(argumentsA[i], histories, memFail);
+        if (argumentsB != NULL && nodes[i] != NULL)
+            nodes[count + i] = writableHistory(argumentsB[i], histories,
+                                               memFail);
+
+        if (nodes[i] == NULL ||
+            (argumentsB != NULL && nodes[count + i] == NULL))
+            errors[i] = true;
+    }
+
+    size_t classesCount = 0;
+    BatchClass *classes = *memFail ? NULL :
+                          batchClasses(nodes, nodesCount, &classesCount,
+                                       memFail);
+    if (classes == NULL)
+    {
+        free(nodes);
+        return;
+    }
+
+    for (size_t i = 0; i < count && !*memFail; ++i)
+    {
+        if (errors[i]) continue;
+
+        Tree *historyA = nodes[i];
+        size_t classA = classOf(classes, classesCount, historyA);
+        if (argumentsB == NULL)
+        {
+            classes[classA].energy = energies[i];
+            classes[classA].changed = true;
+            continue;
+        }
+
+        Tree *historyB = nodes[count + i];
+        if (alreadyEqual(historyA, historyB) || historyA == historyB) continue;
+
+        size_t classB = classOf(classes, classesCount, historyB);
+        Energy energyA = classes[classA].energy;
+        Energy energyB = classes[classB].energy;
+        if (energyA == 0 && energyB == 0)
+        {
+            errors[i] = true;
+            continue;
+        }
+
+        // nodes are writable, so they stay where they are
+        if (!linkNodes(&historyA, &historyB, memFail)) break;
+
+        classes[classB].parent = classA;
+        classes[classA].energy = energyA == 0 ? energyB :
+                                 energyB == 0 ? energyA :
+                                 average(energyA, energyB);
+        classes[classA].changed = true;
+    }
+
+    for (size_t i = 0; i < classesCount && !*memFail; ++i)
+    {
+        if (classes[i].parent == i && classes[i].changed)
+            spreadEnergy(classes[i].node, classes[i].energy, memFail);
+    }
+
+    free(classes);
+    free(nodes);
+}
+
+static BatchClass *batchClasses(Tree **nodes, size_t count,
+                                size_t *classesCount, bool *memFail)
+{
+    BatchClass *classes = malloc(sizeof(BatchClass) * (count > 0 ? count : 1));
+    if (classes == NULL)
+    {
+        *memFail = true;
+        return NULL;
+    }
+
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (nodes[i] != NULL) classes[found++].node = nodes[i];
+    }
+
+    // classes are sorted, so that node is found by binary search
+    qsort(classes, found, sizeof(BatchClass), compareClasses);
+
+    size_t distinct = 0;
+    for (size_t i = 0; i < found; ++i)
+    {
+        if (distinct > 0 && classes[distinct - 1].node == classes[i].node)
+            continue;
+
+        classes[distinct].node = classes[i].node;
+        classes[distinct].parent = distinct;
+        classes[distinct].energy = classes[i].node->energy;
+        classes[distinct].changed = false;
+        ++distinct;
+    }
+
+    if (!joinEqualClasses(classes, distinct))
+    {
+        free(classes);
+        *memFail = true;
+        return NULL;
+    }
+
+    *classesCount = distinct;
+    return classes;
+}
+
+static bool joinEqualClasses(BatchClass *classes, size_t count)
+{
+    // every node reached stays marked until all classes are walked
+    size_t capacity = count > 0 ? count : 1;
+    size_t reached = 0;
+    Tree **queue = malloc(sizeof(Tree *) * capacity);
+    bool enough = queue != NULL;
+
+    for (size_t i = 0; i < count && enough; ++i)
+    {
+        size_t next = reached;
+        enough = queueNode(&queue, &reached, &capacity, classes[i].node);
+
+        for (; next < reached && enough; ++next)
+        {
+            Tree *node = queue[next];
+            size_t position = classPosition(classes, count, node);
+            if (position < count) classes[position].parent = i;
+
+            EqualsList *equals = node->equalsList;
+            for (; equals != NULL && enough; equals = equals->next)
+            {
+                enough = queueNode(&queue, &reached, &capacity,
+                                   otherHistory(equals->this, node));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < reached; ++i)
+    {
+        unMarkVisited(queue[i]);
+    }
+
+    free(queue);
+    return enough;
+}
+
+static size_t classPosition(const BatchClass *classes, size_t count,
+                            const Tree *node)
+{
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if ((uintptr_t) classes[middle].node < (uintptr_t) node)
+            low = middle + 1;
+        else high = middle;
+    }
+
+    return low < count && classes[low].node == node ? low : count;
+}
+
+static size_t classOf(BatchClass *classes, size_t count, const Tree *node)
+{
+    size_t position = classPosition(classes, count, node);
+
+    // path is halved on the way, so that later searches are short
+    while (classes[position].parent != position)
+    {
+        classes[position].parent = classes[classes[position].parent].parent;
+        position = classes[position].parent;
+    }
+
+    return position;
+}
+
+static int compareClasses(const void *a, const void *b)
+{
+    uintptr_t nodeA = (uintptr_t) ((const BatchClass *) a)->node;
+    uintptr_t nodeB = (uintptr_t) ((const BatchClass *) b)->node;
+
+    return (nodeA > nodeB) - (nodeA < nodeB);
+}
@@ -0,0 +1,30 @@
+#ifndef QUANTIZATION_CLASSES_H
+#define QUANTIZATION_CLASSES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Works like energyHistory called for every history in turn, setting "errors"
+ * of histories it would set "error" for, but every class of equal histories is
+ * given its final energy once, like in equalHistories.
+ */
+void energyHistories(const char **arguments, const Energy *energies,
+                     size_t count, Tree *histories, bool *errors,
+                     bool *memFail);
+
+/*
+ * Works like equalHistory called for every pair of "argumentsA" and
+ * "argumentsB" in turn, setting "errors" of pairs it would set "error" for,
+ * but energies are not spread after every equality. They are worked out for
+ * classes of equal histories as equalities are added, and each class changed
+ * is given its final energy once, at the end. Pairs with "errors" already set
+ * are skipped. Takes time proportional to size of classes met, instead of to
+ * their size times number of pairs.
+ */
+void equalHistories(const char **argumentsA, const char **argumentsB,
+                    size_t count, Tree *histories, bool *errors,
+                    bool *memFail);
+
+#endif //QUANTIZATION_CLASSES_H
@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cli.h"
+#include "interface.h"
+#include "output.h"
+
+/*
+ * Largest number of VALID and ENERGY queries answered together
+ */
+#define PENDING_LOOKUPS 256
+
+/*
+ * Run of queries read but not answered yet. "commands" are lines holding
+ * them, released once they are answered.
+ */
+struct PendingLookups
+{
+    char *commands[PENDING_LOOKUPS];
+    const char *histories[PENDING_LOOKUPS];
+    int operations[PENDING_LOOKUPS];
+    size_t count;
+};
+typedef struct PendingLookups PendingLookups;
+
+/*
+ * Answers all pending queries, in order, with one batched lookup
+ */
+static void answerLookups(Quantization *quantization, PendingLookups *pending,
+                          FILE *output, FILE *errors);
+
+/*
+ * Executes EQUAL_BATCH or ENERGY_BATCH on pairs read from given file,
+ * answering every pair like the command it stands for would be answered.
+ * Returns QUANT_ERROR if file could not be read, QUANT_NO_MEMORY if memory ran
+ * out, otherwise QUANT_OK.
+ */
+static int updatePairsFile(Quantization *quantization, int operation,
+                           const char *path, FILE *output, FILE *errors,
+                           UpdateLog *log, void *context);
+
+/*
+ * Returns given histories in one string, separated by spaces, or NULL if
+ * memory ran out
+ */
+static char *joinHistories(const char **histories, size_t count);
+
+int runCommands(Quantization *quantization, FILE *input, FILE *output,
+                FILE *errors)
+{
+    return runLoggedCommands(quantization, input, output, errors, NULL, NULL);
+}
+
+int runLoggedCommands(Quantization *quantization, FILE *input, FILE *output,
+                      FILE *errors, UpdateLog *log, void *context)
+{
+    char *buffer = malloc(sizeof(char) * CHAR_BUFFER);
+    if (buffer == NULL) return 1;
+    for (int i = 0; i < CHAR_BUFFER; ++i)
+    {
+        buffer[i] = '\0';
+    }
+
+    unsigned bufferSize = CHAR_BUFFER;
+    bool unexpectedFileEnd = false;
+    char *command;
+    PendingLookups pending;
+    pending.count = 0;
+
+    while ((command = readCommand(&buffer, &bufferSize, &unexpectedFileEnd,
+                                  input)) != NULL)
+    {
+        char *argument1 = NULL;
+        char *argument2 = NULL;
+        int operation = ERROR;
+        int status = QUANT_OK;
+        bool valid = false;
+        Energy energy = 0;
+        Version version = 0;
+        Aggregate aggregate;
+        Statistics statistics;
+
+        analyzeInput(command, &argument1, &argument2, &operation);
+
+        // queries are answered in runs, so that their lookups overlap
+        if (operation == VALID || operation == ENERGY_SHORT)
+        {
+            pending.commands[pending.count] = command;
+            pending.histories[pending.count] = argument1;
+            pending.operations[pending.count++] = operation;
+
+            if (pending.count == PENDING_LOOKUPS || !inputReady(input))
+                answerLookups(quantization, &pending, output, errors);
+            quantMaintain(quantization);
+            continue;
+        }
+        answerLookups(quantization, &pending, output, errors);
+
+        switch (operation)
+        {
+            case DECLARE:
+                status = quantDeclare(quantization, argument1);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case REMOVE:
+                status = quantRemove(quantization, argument1);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case VALID:
+                status = quantValid(quantization, argument1, &valid);
+                if (status == QUANT_OK) printValid(output, valid);
+                break;
+            case ENERGY:
+                if (!parseEnergy(argument2, &energy))
+                {
+                    status = QUANT_INVALID_ARGUMENT;
+                    break;
+                }
+                status = quantSetEnergy(quantization, argument1, energy);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case ENERGY_SHORT:
+                status = quantGetEnergy(quantization, argument1, &energy);
+                if (status == QUANT_OK) printEnergy(output, energy);
+                break;
+            case EQUAL:
+                status = quantEqual(quantization, argument1, argument2);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case COUNT:
+            case SUM:
+            case MIN:
+            case MAX:
+                status = quantAggregate(quantization, argument1, &aggregate);
+                if (status == QUANT_OK &&
+                    !printAggregate(output, operation, &aggregate))
+                    status = QUANT_ERROR;
+                break;
+            case LOAD:
+                status = loadHistoriesFile(quantization, argument1, log,
+                                           context);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case EQUAL_BATCH:
+            case ENERGY_BATCH:
+                status = updatePairsFile(quantization, operation, argument1,
+                                         output, errors, log, context);
+                break;
+            case BEGIN:
+                status = quantBegin(quantization);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case COMMIT:
+                status = quantCommit(quantization);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case ROLLBACK:
+                status = quantRollback(quantization);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case SNAPSHOT:
+                status = quantSnapshot(quantization, &version);
+                if (status == QUANT_OK) printVersion(output, version);
+                break;
+            case RELEASE:
+                if (!parseVersion(argument1, &version))
+                {
+                    status = QUANT_ERROR;
+                    break;
+                }
+                status = quantRelease(quantization, version);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case VALID_AT:
+                if (!parseVersion(argument1, &version))
+                {
+                    status = QUANT_ERROR;
+                    break;
+                }
+                status = quantValidAt(quantization, version, argument2, &valid);
+                if (status == QUANT_OK) printValid(output, valid);
+                break;
+            case ENERGY_AT:
+                if (!parseVersion(argument1, &version))
+                {
+                    status = QUANT_ERROR;
+                    break;
+                }
+                status = quantGetEnergyAt(quantization, version, argument2,
+                                          &energy);
+                if (status == QUANT_OK) printEnergy(output, energy);
+                break;
+            case FREEZE:
+                status = quantFreeze(quantization);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case COMPACT:
+                status = quantCompact(quantization);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case STATS:
+                status = quantStatistics(quantization, &statistics);
+                if (status == QUANT_OK) printStatistics(output, &statistics);
+                break;
+            case DEFRAG:
+                status = quantDefragment(quantization);
+                if (status == QUANT_OK) printConfirmation(output);
+                break;
+            case PASS:
+                break;
+            case ERROR:
+            default:
+                status = QUANT_INVALID_ARGUMENT;
+                break;
+        }
+
+        // loaded histories were already logged in place of their file
+        if (log != NULL && operation != LOAD)
+            log(context, operation, argument1, argument2, status);
+        free(command);
+
+        if (status == QUANT_NO_MEMORY) // out of memory is critical error
+        {
+            free(buffer);
+            return 1;
+        }
+
+        if (status != QUANT_OK)
+        {
+            // malformed command never reached the library, but still makes
+            // transaction it belongs to fail
+            if (operation == ERROR || operation == ENERGY ||
+                operation == LOAD || operation == EQUAL_BATCH ||
+                operation == ENERGY_BATCH)
+                quantAbort(quantization);
+            printError(errors);
+        }
+
+        quantMaintain(quantization);
+    }
+
+    answerLookups(quantization, &pending, output, errors);
+    if (unexpectedFileEnd) printError(errors);
+
+    free(buffer);
+    return 0;
+}
+
+static void answerLookups(Quantization *quantization, PendingLookups *pending,
+                          FILE *output, FILE *errors)
+{
+    int statuses[PENDING_LOOKUPS];
+    bool valid[PENDING_LOOKUPS];
+    Energy energies[PENDING_LOOKUPS];
+
+    quantLookupBatch(quantization, pending->histories, pending->count,
+                     statuses, valid, energies);
+
+    for (size_t i = 0; i < pending->count; ++i)
+    {
+        if (statuses[i] != QUANT_OK) printError(errors);
+        else if (pending->operations[i] == VALID) printValid(output, valid[i]);
+        else if (energies[i] == 0) printError(errors);
+        else printEnergy(output, energies[i]);
+
+        free(pending->commands[i]);
+    }
+
+    pending->count = 0;
+}
+
+static int updatePairsFile(Quantization *quantization, int operation,
+                           const char *path, FILE *output, FILE *errors,
+                           UpdateLog *log, void *context)
+{
+    char *contents = NULL;
+    const char **first = NULL;
+    const char **second = NULL;
+    size_t count = 0;
+
+    if (!readPairsFile(path, &contents, &first, &second, &count))
+        return QUANT_ERROR;
+
+    int status = QUANT_NO_MEMORY;
+    int *statuses = malloc(sizeof(int) * (count > 0 ? count : 1));
+    Energy *energies = operation == ENERGY_BATCH ?
+                       malloc(sizeof(Energy) * (count > 0 ? count : 1)) : NULL;
+
+    if (statuses != NULL && operation == EQUAL_BATCH)
+    {
+        status = quantEqualBatch(quantization, first, second, count,
+                                 statuses);
+    }
+    else if (statuses != NULL && energies != NULL)
+    {
+        // malformed energy is passed as 0, which is rejected as well
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (second[i] == NULL || !parseEnergy(second[i], &energies[i]))
+                energies[i] = 0;
+        }
+        status = quantEnergyBatch(quantization, first, energies, count,
+                                  statuses);
+    }
+
+    int single = operation == EQUAL_BATCH ? EQUAL : ENERGY;
+    for (size_t i = 0; i < count && status != QUANT_NO_MEMORY; ++i)
+    {
+        if (statuses[i] == QUANT_OK) printConfirmation(output);
+        else printError(errors);
+
+        if (log != NULL) log(context, single, first[i], second[i], statuses[i]);
+    }
+
+    free(energies);
+    free(statuses);
+    free(second);
+    free(first);
+    free(contents);
+    return status == QUANT_NO_MEMORY ? status : QUANT_OK;
+}
+
+int loadHistoriesFile(Quantization *quantization, const char *path,
+                      UpdateLog *log, void *context)
+{
+    char *contents = NULL;
+    const char **histories = NULL;
+    size_t count = 0;
+
+    if (!readHistoriesFile(path, &contents, &histories, &count))
+        return QUANT_ERROR;
+
+    // histories are joined before they are declared, so that running out of
+    // memory leaves nothing declared which the log misses
+    char *joined = NULL;
+    if (log != NULL && (joined = joinHistories(histories, count)) == NULL)
+    {
+        free(histories);
+        free(contents);
+        return QUANT_NO_MEMORY;
+    }
+
+    int status = quantLoad(quantization, histories, count);
+    if (log != NULL && status == QUANT_OK)
+        log(context, LOAD, joined, NULL, status);
+
+    free(joined);
+    free(histories);
+    free(contents);
+    return status;
+}
+
+static char *joinHistories(const char **histories, size_t count)
+{
+    size_t length = 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        length += strlen(histories[i]) + 1;
+    }
+
+    char *joined = malloc(length);
+    if (joined == NULL) return NULL;
+
+    char *end = joined;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t historyLength = strlen(histories[i]);
+        if (i > 0) *end++ = ' ';
+        memcpy(end, histories[i], historyLength);
+        end += historyLength;
+    }
+    *end = '\0';
+
+    return joined;
+}
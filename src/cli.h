@@ -0,0 +1,41 @@
+#ifndef QUANTIZATION_CLI_H
+#define QUANTIZATION_CLI_H
+
+#include <stdio.h>
+#include "quantization.h"
+
+/*
+ * Reads commands line by line from "input" and executes them on given context.
+ * Answers are written to "output", error messages to "errors".
+ * Returns exit code of the session: 0 when input was fully processed, 1 when
+ * it had to be interrupted because memory ran out.
+ */
+int runCommands(Quantization *quantization, FILE *input, FILE *output,
+                FILE *errors);
+
+/*
+ * Receives every command executed by runLoggedCommands, given by its operation
+ * and arguments, with status it ended with. Pairs of EQUAL_BATCH and
+ * ENERGY_BATCH are passed one by one, as EQUAL and ENERGY. LOAD is passed
+ * only once it succeeded, with histories it declared, separated by spaces, in
+ * place of the path of their file.
+ */
+typedef void UpdateLog(void *context, int operation, const char *argument1,
+                       const char *argument2, int status);
+
+/*
+ * Works like runCommands, passing every command to "log" with "context"
+ * after it is executed, so that its updates can be repeated elsewhere
+ */
+int runLoggedCommands(Quantization *quantization, FILE *input, FILE *output,
+                      FILE *errors, UpdateLog *log, void *context);
+
+/*
+ * Declares every history listed in given file, one per line, passing them to
+ * "log" as LOAD if it is not NULL. Returns status like quantLoad, or
+ * QUANT_ERROR if file could not be read.
+ */
+int loadHistoriesFile(Quantization *quantization, const char *path,
+                      UpdateLog *log, void *context);
+
+#endif //QUANTIZATION_CLI_H
@@ -0,0 +1,208 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "compaction.h"
+#include "children.h"
+#include "pool.h"
+#include "snapshot.h"
+#include "tree.h"
+
+/*
+ * Set of subtrees that may be shared, keyed by their children. Nodes in it
+ * have "visited" set until compaction ends.
+ */
+struct SubtreeTable
+{
+    Tree **slots;
+    size_t capacity;
+    size_t count;
+};
+typedef struct SubtreeTable SubtreeTable;
+
+/*
+ * Initial number of slots of subtree table, always a power of two
+ */
+#define SUBTREE_TABLE_INITIAL_CAPACITY 1024
+
+/*
+ * Replaces children of node with their shared equivalents. Returns true if
+ * all of them, and so their subtrees, are free of energy and equalities.
+ */
+static bool shareChildren(Tree *node, SubtreeTable *table, bool *memFail);
+
+/*
+ * Returns node that should replace given one: structurally identical node
+ * found earlier, or node itself, which is remembered for the next ones.
+ * Returns NULL if node or any of its descendants has energy or equalities,
+ * or, setting "memFail", if there was not enough memory.
+ */
+static Tree *shareSubtree(Tree *node, SubtreeTable *table, bool *memFail);
+
+/*
+ * Returns slot of table holding node with the same children as given one, or
+ * the empty slot where such node would be stored
+ */
+static Tree **findSubtree(const SubtreeTable *table, const Tree *node);
+
+/*
+ * Returns hash of node's children
+ */
+static size_t hashChildren(const Tree *node);
+
+/*
+ * Checks whether both nodes have the same children
+ */
+static bool sameChildren(const Tree *nodeA, const Tree *nodeB);
+
+/*
+ * Doubles number of table slots, returns false if there was not enough memory
+ */
+static bool growSubtreeTable(SubtreeTable *table);
+
+size_t compactTree(Tree *histories, bool *memFail)
+{
+    Pool *pool = poolOf(histories);
+    size_t before = poolLiveObjects(pool);
+
+    SubtreeTable table;
+    table.slots = calloc(SUBTREE_TABLE_INITIAL_CAPACITY, sizeof(Tree *));
+    table.capacity = SUBTREE_TABLE_INITIAL_CAPACITY;
+    table.count = 0;
+    if (table.slots == NULL)
+    {
+        *memFail = true;
+        return 0;
+    }
+
+    forgetNodes(stateOf(histories));
+
+    // tree stays consistent at every step, so compaction stopped by lack of
+    // memory simply merges fewer subtrees
+    shareChildren(histories, &table, memFail);
+    stateOf(histories)->compacted = true;
+
+    for (size_t i = 0; i < table.capacity; ++i)
+    {
+        if (table.slots[i] != NULL) unMarkVisited(table.slots[i]);
+    }
+    free(table.slots);
+
+    return (before - poolLiveObjects(pool)) * sizeof(Tree);
+}
+
+static bool shareChildren(Tree *node, SubtreeTable *table, bool *memFail)
+{
+    bool shareable = true;
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        Tree *shared = shareSubtree(child, table, memFail);
+        if (*memFail) return false;
+
+        if (shared == NULL) shareable = false;
+        else if (shared != child)
+        {
+            // replacing existing child never needs memory
+            setChild(node, symbol, shared);
+            addReference(shared);
+            dropReference(child);
+        }
+    }
+
+    return shareable;
+}
+
+static Tree *shareSubtree(Tree *node, SubtreeTable *table, bool *memFail)
+{
+    // node already in the table has been shared by another parent
+    if (isVisited(node)) return node;
+
+    if (!shareChildren(node, table, memFail)) return NULL;
+    if (node->energy != 0 || node->equalsList != NULL || node->spilled)
+        return NULL;
+
+    if (table->count * 2 >= table->capacity && !growSubtreeTable(table))
+    {
+        *memFail = true;
+        return NULL;
+    }
+
+    Tree **slot = findSubtree(table, node);
+    if (*slot != NULL && (*slot)->references < MAX_REFERENCES) return *slot;
+
+    // subtree with saturated counter is left to parents it has, this equal
+    // one is shared by the next ones instead
+    if (*slot != NULL) unMarkVisited(*slot);
+    else ++table->count;
+
+    *slot = node;
+    markVisited(node);
+
+    return node;
+}
+
+static Tree **findSubtree(const SubtreeTable *table, const Tree *node)
+{
+    size_t mask = table->capacity - 1;
+    size_t position = hashChildren(node) & mask;
+
+    while (table->slots[position] != NULL &&
+           !sameChildren(table->slots[position], node))
+    {
+        position = (position + 1) & mask;
+    }
+
+    return &table->slots[position];
+}
+
+static size_t hashChildren(const Tree *node)
+{
+    // children are already shared, so their addresses identify them
+    uint64_t hash = 14695981039346656037u;
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        hash = (hash ^ (uint64_t) symbol) * 1099511628211u;
+        hash = (hash ^ (uint64_t) (uintptr_t) child) * 1099511628211u;
+    }
+
+    return (size_t) (hash ^ (hash >> 29));
+}
+
+static bool sameChildren(const Tree *nodeA, const Tree *nodeB)
+{
+    int symbolA = -1;
+    int symbolB = -1;
+
+    while (true)
+    {
+        Tree *childA = nextChild(nodeA, &symbolA);
+        Tree *childB = nextChild(nodeB, &symbolB);
+
+        if (childA != childB || (childA != NULL && symbolA != symbolB))
+            return false;
+        if (childA == NULL) return true;
+    }
+}
+
+static bool growSubtreeTable(SubtreeTable *table)
+{
+    SubtreeTable grown;
+    grown.capacity = table->capacity * 2;
+    grown.count = table->count;
+    grown.slots = calloc(grown.capacity, sizeof(Tree *));
+    if (grown.slots == NULL) return false;
+
+    for (size_t i = 0; i < table->capacity; ++i)
+    {
+        if (table->slots[i] == NULL) continue;
+
+        *findSubtree(&grown, table->slots[i]) = table->slots[i];
+    }
+
+    free(table->slots);
+    *table = grown;
+
+    return true;
+}
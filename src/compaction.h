@@ -0,0 +1,18 @@
+#ifndef QUANTIZATION_COMPACTION_H
+#define QUANTIZATION_COMPACTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Merges identical subtrees, in which no history has energy or equalities, so
+ * that each of them is kept once and shared by all its parents. Shared nodes
+ * are copied again only when one of their histories changes. Must not be
+ * called while transaction is open or any snapshot is not released. Returns
+ * number of bytes given back, sets "memFail" if there was not enough memory to
+ * finish, which leaves histories valid but compacted partly.
+ */
+size_t compactTree(Tree *histories, bool *memFail);
+
+#endif //QUANTIZATION_COMPACTION_H
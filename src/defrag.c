@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include "defrag.h"
+#include "children.h"
+#include "pool.h"
+#include "tiering.h"
+#include "tree.h"
+
+/*
+ * Smallest number of bytes held by pool for which defragmentation is started
+ * without being asked for
+ */
+#define DEFRAG_MIN_BYTES ((size_t) 1 << 20)
+
+/*
+ * Checks whether pass of defragmentation should be started by itself: more
+ * than half of pool memory is empty space, and since the last pass at least as
+ * many nodes were released as there are now, so that passes take constant
+ * amortised time per change.
+ */
+static bool isFragmented(const TreeState *state, const Pool *pool);
+
+/*
+ * Finds again nodes on the path to the node moved last. Returns number of
+ * states of that path that still lead to a node.
+ */
+static size_t findDefragPath(Tree *histories, TreeState *state);
+
+/*
+ * Makes room for defragmentation path of given length, returns false if there
+ * was not enough memory
+ */
+static bool reserveDefragPath(TreeState *state, size_t depth);
+
+/*
+ * Moves node, hanging from parent under given state, to the place for the
+ * next node of defragmentation pass. Returns the moved node, or NULL if there
+ * was not enough memory.
+ */
+static Tree *relocateNode(Tree *parent, int symbol, Tree *node);
+
+/*
+ * Ends defragmentation pass
+ */
+static void finishDefragmentation(TreeState *state, Pool *pool);
+
+void startDefragmentation(Tree *histories)
+{
+    TreeState *state = stateOf(histories);
+
+    state->defragmenting = true;
+    state->defragDepth = 0;
+}
+
+bool defragmentTree(Tree *histories, size_t budget)
+{
+    TreeState *state = stateOf(histories);
+    Pool *pool = poolOf(histories);
+
+    // journal and snapshots keep pointers to nodes, which would be left behind
+    if (state->journal != NULL || state->versions > 0)
+        return state->defragmenting;
+
+    if (!state->defragmenting)
+    {
+        if (!isFragmented(state, pool)) return false;
+        startDefragmentation(histories);
+    }
+
+    if (!reserveDefragPath(state, state->defragDepth + 1))
+    {
+        finishDefragmentation(state, pool);
+        return false;
+    }
+
+    // the next node in depth first order is a child of node at "level" with
+    // state greater than "symbol"; children of node moved last come first,
+    // unless it was removed meanwhile or is shared
+    size_t reached = findDefragPath(histories, state);
+    size_t level = reached;
+    int symbol = -1;
+    if (reached < state->defragDepth ||
+        (reached > 0 && state->defragNodes[reached]->references > 1))
+    {
+        level = reached == state->defragDepth ? reached - 1 : reached;
+        symbol = state->defragPath[level];
+    }
+
+    while (budget > 0)
+    {
+        Tree *parent = state->defragNodes[level];
+        Tree *next = nextChild(parent, &symbol);
+
+        if (next == NULL)
+        {
+            if (level == 0)
+            {
+                finishDefragmentation(state, pool);
+                return false;
+            }
+
+            --level;
+            symbol = state->defragPath[level];
+            continue;
+        }
+
+        if (!reserveDefragPath(state, level + 2))
+        {
+            finishDefragmentation(state, pool);
+            return false;
+        }
+
+        // nodes shared by compaction have many parents, they stay in place
+        // together with their subtrees
+        if (next->references == 1)
+        {
+            next = relocateNode(parent, symbol, next);
+            if (next == NULL)
+            {
+                finishDefragmentation(state, pool);
+                return false;
+            }
+        }
+
+        state->defragPath[level] = symbol;
+        state->defragNodes[level + 1] = next;
+        state->defragDepth = level + 1;
+        --budget;
+
+        if (next->references == 1)
+        {
+            ++level;
+            symbol = -1;
+        }
+    }
+
+    return true;
+}
+
+static bool isFragmented(const TreeState *state, const Pool *pool)
+{
+    size_t reserved = poolReservedBytes(pool);
+    size_t live = poolLiveObjects(pool);
+
+    return reserved >= DEFRAG_MIN_BYTES &&
+           live * sizeof(Tree) * 2 < reserved &&
+           poolReleasedObjects(pool) - state->defragReleased >= live;
+}
+
+static size_t findDefragPath(Tree *histories, TreeState *state)
+{
+    state->defragNodes[0] = histories;
+
+    for (size_t level = 0; level < state->defragDepth; ++level)
+    {
+        Tree *next = getChild(state->defragNodes[level],
+                              state->defragPath[level]);
+        if (next == NULL) return level;
+
+        state->defragNodes[level + 1] = next;
+    }
+
+    return state->defragDepth;
+}
+
+static bool reserveDefragPath(TreeState *state, size_t depth)
+{
+    if (depth <= state->defragCapacity) return true;
+
+    size_t capacity = state->defragCapacity == 0 ? 64 :
+                      state->defragCapacity;
+    while (capacity < depth) capacity *= 2;
+
+    int *path = realloc(state->defragPath, sizeof(int) * capacity);
+    if (path == NULL) return false;
+    state->defragPath = path;
+
+    Tree **nodes = realloc(state->defragNodes, sizeof(Tree *) * capacity);
+    if (nodes == NULL) return false;
+    state->defragNodes = nodes;
+
+    state->defragCapacity = capacity;
+    return true;
+}
+
+static Tree *relocateNode(Tree *parent, int symbol, Tree *node)
+{
+    Tree *moved = poolAllocateSequential(poolOf(node));
+    if (moved == NULL) return NULL;
+
+    forgetNodes(stateOf(node));
+
+    // children array of large alphabet node is taken over as it is
+    *moved = *node;
+    setChild(parent, symbol, moved);
+
+    Tree *child;
+    for (int state = -1; (child = nextChild(moved, &state)) != NULL;)
+    {
+        child->parent = moved;
+    }
+
+    for (EqualsList *equals = moved->equalsList; equals != NULL;
+         equals = equals->next)
+    {
+        if (equals->this->historyA == node) equals->this->historyA = moved;
+        if (equals->this->historyB == node) equals->this->historyB = moved;
+    }
+
+    if (moved->spilled) moveSpilled(node, moved);
+
+    poolRelease(node);
+
+    return moved;
+}
+
+static void finishDefragmentation(TreeState *state, Pool *pool)
+{
+    poolFinishSequential(pool);
+
+    state->defragmenting = false;
+    state->defragDepth = 0;
+    state->defragReleased = poolReleasedObjects(pool);
+}
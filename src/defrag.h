@@ -0,0 +1,25 @@
+#ifndef QUANTIZATION_DEFRAG_H
+#define QUANTIZATION_DEFRAG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Starts pass of defragmentation, which moves nodes of histories into
+ * consecutive memory in depth first order, so that walk from the root to any
+ * history touches as few cache lines and pages as possible. Pass that was in
+ * progress starts over.
+ */
+void startDefragmentation(Tree *histories);
+
+/*
+ * Moves at most "budget" nodes as part of defragmentation pass, so that the
+ * pass can be spread over time between other operations. Pass is started
+ * without being asked for when pool holds mostly empty space. Nothing is moved
+ * while transaction is open or any snapshot is not released. Returns true if
+ * the pass is not finished yet.
+ */
+bool defragmentTree(Tree *histories, size_t budget);
+
+#endif //QUANTIZATION_DEFRAG_H
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include "finger.h"
+#include "children.h"
+#include "pool.h"
+#include "symbols.h"
+
+/*
+ * Number of characters of history finger makes room for at first
+ */
+#define FINGER_INITIAL_CAPACITY 64
+
+/*
+ * Makes room for finger holding given number of characters, returns false if
+ * there was not enough memory or it would exceed the memory limit
+ */
+static bool reserveFinger(TreeState *state, size_t length);
+
+/*
+ * Returns size of block holding nodes and history of finger with given
+ * capacity, nodes come first
+ */
+static size_t fingerBytes(size_t capacity);
+
+Tree *followHistory(const char *argument, size_t length,
+                    Tree *histories, size_t *walked)
+{
+    TreeState *state = stateOf(histories);
+    size_t i = 0;
+
+    if (histories != state->root || !reserveFinger(state, length))
+    {
+        for (; i < length; i += SYMBOL_WIDTH)
+        {
+            Tree *next = getChild(histories, symbolAt(argument + i));
+            if (next == NULL) break;
+
+            histories = next;
+        }
+
+        *walked = i;
+        return histories;
+    }
+
+    size_t common = length < state->fingerLength ? length :
+                    state->fingerLength;
+    while (i < common && argument[i] == state->fingerHistory[i]) ++i;
+    i -= i % SYMBOL_WIDTH;
+
+    size_t shared = i;
+    state->fingerNodes[0] = histories;
+    histories = state->fingerNodes[i / SYMBOL_WIDTH];
+
+    for (; i < length; i += SYMBOL_WIDTH)
+    {
+        Tree *next = getChild(histories, symbolAt(argument + i));
+        if (next == NULL) break;
+
+        memcpy(state->fingerHistory + i, argument + i, SYMBOL_WIDTH);
+        state->fingerNodes[i / SYMBOL_WIDTH + 1] = next;
+        histories = next;
+    }
+
+    // finger going deeper than the history on the same path is kept
+    if (i > shared) state->fingerLength = i;
+
+    *walked = i;
+    return histories;
+}
+
+static bool reserveFinger(TreeState *state, size_t length)
+{
+    if (length <= state->fingerCapacity) return true;
+
+    size_t capacity = state->fingerCapacity == 0 ? FINGER_INITIAL_CAPACITY :
+                      state->fingerCapacity;
+    while (capacity < length) capacity *= 2;
+
+    // finger is only a shortcut, it must not make update fail on the limit
+    Pool *pool = poolOf(state->root);
+    size_t held = state->fingerNodes == NULL ? 0 :
+                  fingerBytes(state->fingerCapacity);
+    if (!poolFits(pool, fingerBytes(capacity) - held)) return false;
+
+    Tree **nodes = poolRealloc(pool, state->fingerNodes, held,
+                               fingerBytes(capacity));
+    if (nodes == NULL) return false;
+
+    char *history = (char *) (nodes + capacity / SYMBOL_WIDTH + 1);
+    memmove(history, nodes + state->fingerCapacity / SYMBOL_WIDTH + 1,
+            state->fingerLength);
+    state->fingerNodes = nodes;
+    state->fingerHistory = history;
+    state->fingerCapacity = capacity;
+    return true;
+}
+
+static size_t fingerBytes(size_t capacity)
+{
+    return sizeof(Tree *) * (capacity / SYMBOL_WIDTH + 1) + capacity;
+}
+
+void cutFinger(TreeState *state, size_t length)
+{
+    if (state->fingerLength > length) state->fingerLength = length;
+}
@@ -0,0 +1,22 @@
+#ifndef QUANTIZATION_FINGER_H
+#define QUANTIZATION_FINGER_H
+
+#include <stddef.h>
+#include "tree.h"
+
+/*
+ * Walks first "length" characters of history from the root as far as they are
+ * declared, starting from the longest prefix it shares with the finger, which
+ * is moved to the walked path. Returns the deepest node reached and stores
+ * number of characters walked in "walked". Histories which are not current,
+ * e.g. snapshots, are walked from the root.
+ */
+Tree *followHistory(const char *argument, size_t length,
+                    Tree *histories, size_t *walked);
+
+/*
+ * Shortens finger of histories to at most "length" characters, 0 forgets it
+ */
+void cutFinger(TreeState *state, size_t length);
+
+#endif //QUANTIZATION_FINGER_H
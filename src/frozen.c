@@ -0,0 +1,532 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frozen.h"
+#include "children.h"
+#include "symbols.h"
+#include "tree.h"
+
+/*
+ * Number of 64-bit words of shape covered by a single rank directory entry
+ */
+#define RANK_BLOCK_WORDS 8
+
+/*
+ * "shape" holds LOUDS bits, 2 * nodesCount - 1 of them, and "ranks" number of
+ * bits 1 before each block of RANK_BLOCK_WORDS words. "states" holds state of
+ * every node but the root, which is node 0. "classes" holds for every node
+ * "classWidth" bits: 0 if node has no energy, otherwise position of its
+ * energy in "energies" increased by one. "energies" holds "energiesCount"
+ * distinct energies in increasing order. "borrowed" tells that arrays are
+ * parts of an image, owned by someone else.
+ */
+struct Frozen
+{
+    uint64_t *shape;
+    uint64_t *ranks;
+    uint8_t *states;
+    uint64_t *classes;
+    Energy *energies;
+    size_t energiesCount;
+    size_t nodesCount;
+    unsigned classWidth;
+    bool borrowed;
+};
+
+/*
+ * Beginning of image of frozen histories. It is followed by words of shape,
+ * ranks, classes and energies, then by states.
+ */
+struct FrozenImage
+{
+    uint64_t nodesCount;
+    uint64_t energiesCount;
+    uint64_t classWidth;
+};
+typedef struct FrozenImage FrozenImage;
+
+/*
+ * Stores number of words of shape, ranks and classes of frozen histories
+ */
+static void countWords(const Frozen *frozen, size_t *shapeWords,
+                       size_t *blocks, size_t *classWords);
+
+/*
+ * Writes tree shape and states in breadth first order, "order" must have room
+ * for every node and receives them in that order.
+ */
+static void encodeShape(Frozen *frozen, const Tree *histories,
+                        const Tree **order);
+
+/*
+ * Fills rank directory of shape
+ */
+static void buildRanks(Frozen *frozen);
+
+/*
+ * Builds table of distinct energies of given nodes and class of every node.
+ * Returns false if allocation failed.
+ */
+static bool encodeEnergies(Frozen *frozen, const Tree **order);
+
+/*
+ * Compares two energies, for qsort
+ */
+static int compareEnergies(const void *a, const void *b);
+
+/*
+ * Returns position of "rank"-th bit 0 of shape, counted from 1
+ */
+static size_t selectZero(const Frozen *frozen, size_t rank);
+
+/*
+ * Returns number of the first child of given node, or, when it has no
+ * children, of the first child of the next node having any. Works for node
+ * equal to number of nodes too, returning number of nodes.
+ */
+static size_t firstChild(const Frozen *frozen, size_t node);
+
+/*
+ * Returns child of given node for given state, or 0 if there is none
+ */
+static size_t childOf(const Frozen *frozen, size_t node, int symbol);
+
+/*
+ * Returns node holding given history, or 0 if it is not declared
+ */
+static size_t findFrozen(const char *argument, const Frozen *frozen);
+
+/*
+ * Returns energy of given node, 0 if it has none
+ */
+static Energy nodeEnergy(const Frozen *frozen, size_t node);
+
+Frozen *freezeTree(const Tree *histories)
+{
+    Frozen *frozen = calloc(1, sizeof(Frozen));
+    if (frozen == NULL) return NULL;
+
+    size_t nodesCount = countNodes(histories, UINT64_MAX);
+    size_t shapeWords = (2 * nodesCount - 1 + 63) / 64;
+    size_t blocks = (shapeWords + RANK_BLOCK_WORDS - 1) / RANK_BLOCK_WORDS;
+    const Tree **order = malloc(sizeof(Tree *) * nodesCount);
+
+    frozen->nodesCount = nodesCount;
+    frozen->shape = calloc(shapeWords, sizeof(uint64_t));
+    frozen->ranks = malloc(sizeof(uint64_t) * blocks);
+    frozen->states = malloc(sizeof(uint8_t) * nodesCount);
+
+    if (order == NULL || frozen->shape == NULL || frozen->ranks == NULL ||
+        frozen->states == NULL)
+    {
+        free(order);
+        removeFrozen(frozen);
+        return NULL;
+    }
+
+    encodeShape(frozen, histories, order);
+    buildRanks(frozen);
+    bool encoded = encodeEnergies(frozen, order);
+    free(order);
+
+    if (!encoded)
+    {
+        removeFrozen(frozen);
+        return NULL;
+    }
+
+    return frozen;
+}
+
+void removeFrozen(Frozen *frozen)
+{
+    if (frozen == NULL) return;
+
+    if (frozen->borrowed)
+    {
+        free(frozen);
+        return;
+    }
+
+    free(frozen->shape);
+    free(frozen->ranks);
+    free(frozen->states);
+    free(frozen->classes);
+    free(frozen->energies);
+    free(frozen);
+}
+
+static void encodeShape(Frozen *frozen, const Tree *histories,
+                        const Tree **order)
+{
+    size_t added = 1;
+    size_t bit = 0;
+
+    order[0] = histories;
+    frozen->states[0] = 0;
+
+    for (size_t node = 0; node < added; ++node)
+    {
+        Tree *child;
+        for (int symbol = -1;
+             (child = nextChild(order[node], &symbol)) != NULL;)
+        {
+            frozen->shape[bit / 64] |= ((uint64_t) 1) << (bit % 64);
+            ++bit;
+
+            frozen->states[added] = (uint8_t) symbol;
+            order[added++] = child;
+        }
+
+        ++bit; // bit 0 ending the node
+    }
+}
+
+static void buildRanks(Frozen *frozen)
+{
+    size_t shapeWords = (2 * frozen->nodesCount - 1 + 63) / 64;
+    uint64_t ones = 0;
+
+    for (size_t word = 0; word < shapeWords; ++word)
+    {
+        if (word % RANK_BLOCK_WORDS == 0)
+            frozen->ranks[word / RANK_BLOCK_WORDS] = ones;
+        ones += __builtin_popcountll(frozen->shape[word]);
+    }
+}
+
+static bool encodeEnergies(Frozen *frozen, const Tree **order)
+{
+    size_t count = 0;
+    for (size_t node = 1; node < frozen->nodesCount; ++node)
+    {
+        if (order[node]->energy != 0) ++count;
+    }
+    if (count == 0) return true; // width 0, every class is 0
+
+    frozen->energies = malloc(sizeof(Energy) * count);
+    if (frozen->energies == NULL) return false;
+
+    count = 0;
+    for (size_t node = 1; node < frozen->nodesCount; ++node)
+    {
+        if (order[node]->energy != 0)
+            frozen->energies[count++] = order[node]->energy;
+    }
+
+    qsort(frozen->energies, count, sizeof(Energy), compareEnergies);
+
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (distinct == 0 || frozen->energies[distinct - 1] !=
+                             frozen->energies[i])
+            frozen->energies[distinct++] = frozen->energies[i];
+    }
+
+    // table shrinks, so failure to give memory back is harmless
+    Energy *shrunk = realloc(frozen->energies, sizeof(Energy) * distinct);
+    if (shrunk != NULL) frozen->energies = shrunk;
+    frozen->energiesCount = distinct;
+
+    unsigned width = 0;
+    while (width < 64 && (distinct >> width) != 0) ++width;
+    frozen->classWidth = width;
+
+    size_t words = (frozen->nodesCount * width + 63) / 64;
+    frozen->classes = calloc(words, sizeof(uint64_t));
+    if (frozen->classes == NULL) return false;
+
+    for (size_t node = 1; node < frozen->nodesCount; ++node)
+    {
+        Energy energy = order[node]->energy;
+        if (energy == 0) continue;
+
+        // energy is in the table, so search ends on it
+        size_t low = 0;
+        size_t high = distinct - 1;
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (frozen->energies[middle] < energy) low = middle + 1;
+            else high = middle;
+        }
+
+        uint64_t class = low + 1;
+        size_t bit = node * width;
+        frozen->classes[bit / 64] |= class << (bit % 64);
+        if (bit % 64 + width > 64)
+            frozen->classes[bit / 64 + 1] |= class >> (64 - bit % 64);
+    }
+
+    return true;
+}
+
+static int compareEnergies(const void *a, const void *b)
+{
+    Energy energyA = *(const Energy *) a;
+    Energy energyB = *(const Energy *) b;
+
+    return (energyA > energyB) - (energyA < energyB);
+}
+
+static size_t selectZero(const Frozen *frozen, size_t rank)
+{
+    size_t shapeWords = (2 * frozen->nodesCount - 1 + 63) / 64;
+    size_t blocks = (shapeWords + RANK_BLOCK_WORDS - 1) / RANK_BLOCK_WORDS;
+
+    // last block with fewer than "rank" zeros before it
+    size_t low = 0;
+    size_t high = blocks - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        size_t zeros = middle * RANK_BLOCK_WORDS * 64 - frozen->ranks[middle];
+        if (zeros < rank) low = middle;
+        else high = middle - 1;
+    }
+
+    size_t word = low * RANK_BLOCK_WORDS;
+    rank -= word * 64 - frozen->ranks[low];
+
+    while (true)
+    {
+        // bits past the end of shape are zeros, but are never reached
+        uint64_t zeros = ~frozen->shape[word];
+        unsigned inWord = __builtin_popcountll(zeros);
+        if (rank <= inWord)
+        {
+            while (--rank > 0) zeros &= zeros - 1;
+            return word * 64 + __builtin_ctzll(zeros);
+        }
+
+        rank -= inWord;
+        ++word;
+    }
+}
+
+static size_t firstChild(const Frozen *frozen, size_t node)
+{
+    if (node == 0) return 1;
+
+    // every node before this one ended with bit 0, the rest are its children
+    return selectZero(frozen, node) + 1 - node + 1;
+}
+
+static size_t childOf(const Frozen *frozen, size_t node, int symbol)
+{
+    size_t low = firstChild(frozen, node);
+    size_t end = firstChild(frozen, node + 1);
+    size_t high = end;
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (frozen->states[middle] < symbol) low = middle + 1;
+        else high = middle;
+    }
+
+    if (low < end && frozen->states[low] == symbol)
+        return low;
+
+    return 0;
+}
+
+static size_t findFrozen(const char *argument, const Frozen *frozen)
+{
+    size_t node = 0;
+    size_t length = strlen(argument);
+
+    for (size_t i = 0; i < length; i += SYMBOL_WIDTH)
+    {
+        node = childOf(frozen, node, symbolAt(argument + i));
+        if (node == 0) return 0;
+    }
+
+    return node;
+}
+
+static Energy nodeEnergy(const Frozen *frozen, size_t node)
+{
+    unsigned width = frozen->classWidth;
+    if (width == 0) return 0;
+
+    size_t bit = node * width;
+    uint64_t class = frozen->classes[bit / 64] >> (bit % 64);
+    if (bit % 64 + width > 64)
+        class |= frozen->classes[bit / 64 + 1] << (64 - bit % 64);
+    if (width < 64) class &= (((uint64_t) 1) << width) - 1;
+
+    return class == 0 ? 0 : frozen->energies[class - 1];
+}
+
+bool validFrozen(const char *argument, const Frozen *frozen)
+{
+    return findFrozen(argument, frozen) != 0;
+}
+
+Energy energyFrozen(const char *argument, const Frozen *frozen)
+{
+    size_t node = findFrozen(argument, frozen);
+    if (node == 0) return 0;
+
+    return nodeEnergy(frozen, node);
+}
+
+bool aggregateFrozen(const char *argument, const Frozen *frozen,
+                     size_t minimumLength, Aggregate *aggregate)
+{
+    // empty history stands for the root, which is node 0
+    size_t node = findFrozen(argument, frozen);
+    if (node == 0 && argument[0] != '\0') return false;
+
+    aggregate->count = 0;
+    aggregate->energySum = 0;
+    aggregate->minEnergy = 0;
+    aggregate->maxEnergy = 0;
+
+    // descendants on every level are consecutive in breadth first order
+    size_t length = strlen(argument) / SYMBOL_WIDTH;
+    size_t first = node;
+    size_t last = node + 1;
+
+    for (; first < last; ++length)
+    {
+        if (length >= minimumLength)
+        {
+            aggregate->count += last - first;
+            for (size_t i = first; i < last; ++i)
+            {
+                Energy energy = nodeEnergy(frozen, i);
+                if (energy == 0) continue;
+
+                aggregate->energySum += energy;
+                if (aggregate->minEnergy == 0 || energy < aggregate->minEnergy)
+                    aggregate->minEnergy = energy;
+                if (energy > aggregate->maxEnergy)
+                    aggregate->maxEnergy = energy;
+            }
+        }
+
+        first = firstChild(frozen, first);
+        last = firstChild(frozen, last);
+    }
+
+    return true;
+}
+
+size_t frozenImageBytes(const Frozen *frozen)
+{
+    size_t shapeWords, blocks, classWords;
+    countWords(frozen, &shapeWords, &blocks, &classWords);
+
+    return sizeof(FrozenImage) +
+           sizeof(uint64_t) * (shapeWords + blocks + classWords) +
+           sizeof(Energy) * frozen->energiesCount +
+           sizeof(uint8_t) * frozen->nodesCount;
+}
+
+void writeFrozenImage(const Frozen *frozen, void *image)
+{
+    size_t shapeWords, blocks, classWords;
+    countWords(frozen, &shapeWords, &blocks, &classWords);
+
+    FrozenImage *header = image;
+    header->nodesCount = frozen->nodesCount;
+    header->energiesCount = frozen->energiesCount;
+    header->classWidth = frozen->classWidth;
+
+    uint64_t *words = (uint64_t *) (header + 1);
+    memcpy(words, frozen->shape, sizeof(uint64_t) * shapeWords);
+    words += shapeWords;
+    memcpy(words, frozen->ranks, sizeof(uint64_t) * blocks);
+    words += blocks;
+    if (classWords > 0)
+        memcpy(words, frozen->classes, sizeof(uint64_t) * classWords);
+    words += classWords;
+    if (frozen->energiesCount > 0)
+        memcpy(words, frozen->energies,
+               sizeof(Energy) * frozen->energiesCount);
+    words += frozen->energiesCount;
+    memcpy(words, frozen->states, sizeof(uint8_t) * frozen->nodesCount);
+}
+
+Frozen *openFrozenImage(const void *image)
+{
+    Frozen *frozen = calloc(1, sizeof(Frozen));
+    if (frozen == NULL) return NULL;
+
+    const FrozenImage *header = image;
+    frozen->nodesCount = header->nodesCount;
+    frozen->energiesCount = header->energiesCount;
+    frozen->classWidth = (unsigned) header->classWidth;
+    frozen->borrowed = true;
+
+    size_t shapeWords, blocks, classWords;
+    countWords(frozen, &shapeWords, &blocks, &classWords);
+
+    // histories are only read, arrays are not const for the sake of Frozen
+    uint64_t *words = (uint64_t *) (header + 1);
+    frozen->shape = words;
+    words += shapeWords;
+    frozen->ranks = words;
+    words += blocks;
+    frozen->classes = classWords > 0 ? words : NULL;
+    words += classWords;
+    frozen->energies = frozen->energiesCount > 0 ? words : NULL;
+    words += frozen->energiesCount;
+    frozen->states = (uint8_t *) words;
+
+    return frozen;
+}
+
+size_t frozenNodes(const Frozen *frozen)
+{
+    return frozen->nodesCount;
+}
+
+void frozenParents(const Frozen *frozen, size_t *parents)
+{
+    // children of every node in turn are numbered consecutively
+    size_t node = 0;
+    size_t child = 1;
+
+    for (size_t bit = 0; child < frozen->nodesCount; ++bit)
+    {
+        if (frozen->shape[bit / 64] >> (bit % 64) & 1)
+            parents[child++] = node;
+        else
+            ++node;
+    }
+}
+
+int frozenState(const Frozen *frozen, size_t node)
+{
+    return frozen->states[node];
+}
+
+Energy frozenEnergy(const Frozen *frozen, size_t node)
+{
+    return nodeEnergy(frozen, node);
+}
+
+static void countWords(const Frozen *frozen, size_t *shapeWords,
+                       size_t *blocks, size_t *classWords)
+{
+    *shapeWords = (2 * frozen->nodesCount - 1 + 63) / 64;
+    *blocks = (*shapeWords + RANK_BLOCK_WORDS - 1) / RANK_BLOCK_WORDS;
+    *classWords = (frozen->nodesCount * frozen->classWidth + 63) / 64;
+}
+
+void frozenStatistics(const Frozen *frozen, Statistics *statistics)
+{
+    size_t nodesCount = frozen->nodesCount;
+    size_t shapeWords, blocks, classWords;
+    countWords(frozen, &shapeWords, &blocks, &classWords);
+
+    statistics->nodes = nodesCount;
+    statistics->bytes = sizeof(Frozen) +
+                        sizeof(uint64_t) * (shapeWords + blocks + classWords) +
+                        sizeof(uint8_t) * nodesCount +
+                        sizeof(Energy) * frozen->energiesCount;
+}
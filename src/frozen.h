@@ -0,0 +1,97 @@
+#ifndef QUANTIZATION_FROZEN_H
+#define QUANTIZATION_FROZEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Read only, succinct copy of histories. Nodes are numbered in breadth first
+ * order and shape of the tree is kept as LOUDS bit vector, in which every node
+ * in turn is written as bit 1 for each of its children followed by bit 0. Next
+ * to it there is a state of every node, so the whole tree takes about ten bits
+ * per node. Energies are kept as indexes into table of distinct energies,
+ * packed in as few bits as their number needs.
+ */
+typedef struct Frozen Frozen;
+
+/*
+ * Makes frozen copy of given histories, which are left unchanged. Equalities
+ * are not kept, energies they share are simply copied. Returns NULL if
+ * allocation failed.
+ */
+Frozen *freezeTree(const Tree *histories);
+
+/*
+ * Releases frozen histories
+ */
+void removeFrozen(Frozen *frozen);
+
+/*
+ * Checks if given history is valid, like validHistory
+ */
+bool validFrozen(const char *argument, const Frozen *frozen);
+
+/*
+ * Returns energy of given history, or 0 if it has none or is not declared,
+ * like energyShortHistory
+ */
+Energy energyFrozen(const char *argument, const Frozen *frozen);
+
+/*
+ * Stores summary of given history and all histories it is prefix of, that are
+ * at least "minimumLength" states long, in "aggregate". Empty history stands
+ * for the root of frozen tree. Returns false if history is not declared. Takes
+ * time proportional to size of the subtree, as summaries are not kept.
+ */
+bool aggregateFrozen(const char *argument, const Frozen *frozen,
+                     size_t minimumLength, Aggregate *aggregate);
+
+/*
+ * Returns number of bytes image of frozen histories takes, see
+ * writeFrozenImage
+ */
+size_t frozenImageBytes(const Frozen *frozen);
+
+/*
+ * Writes frozen histories as single block, which can be placed anywhere, e.g.
+ * in a mapped file. "image" must have frozenImageBytes bytes, aligned to 8.
+ */
+void writeFrozenImage(const Frozen *frozen, void *image);
+
+/*
+ * Returns frozen histories read straight from image, which must stay in place
+ * until they are released with removeFrozen. Returns NULL if allocation
+ * failed.
+ */
+Frozen *openFrozenImage(const void *image);
+
+/*
+ * Returns number of nodes of frozen histories, the root included
+ */
+size_t frozenNodes(const Frozen *frozen);
+
+/*
+ * Stores number of parent of every node but the root, which is node 0, at its
+ * position of "parents". Nodes are numbered in breadth first order, so
+ * parent comes before its children.
+ */
+void frozenParents(const Frozen *frozen, size_t *parents);
+
+/*
+ * Returns state under which given node hangs from its parent
+ */
+int frozenState(const Frozen *frozen, size_t node);
+
+/*
+ * Returns energy of given node, 0 if it has none
+ */
+Energy frozenEnergy(const Frozen *frozen, size_t node);
+
+/*
+ * Stores number of nodes of frozen histories and bytes they take in
+ * "statistics". Does not change "reclaimed".
+ */
+void frozenStatistics(const Frozen *frozen, Statistics *statistics);
+
+#endif //QUANTIZATION_FROZEN_H
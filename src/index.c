@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+#include "index.h"
+#include "children.h"
+#include "pool.h"
+#include "symbols.h"
+
+/*
+ * Slot of index, empty unless "generation" is that of the index
+ */
+struct IndexEntry
+{
+    HistoryKey key;
+    Tree *node;
+    uint32_t generation;
+};
+typedef struct IndexEntry IndexEntry;
+
+/*
+ * Hash table from keys of histories at least INDEX_MIN_STATES long to their
+ * nodes, so that they are found without walking the tree. Histories are added
+ * when declared or found by a walk, removal takes out its whole subtree.
+ * Changes which replace or release nodes in other ways empty the index at
+ * once by starting new "generation". Collisions are resolved by linear
+ * probing, "count" entries of the current generation are kept in "capacity"
+ * slots. Index is charged to the pool of histories; its first slots even
+ * beyond the limit, while it grows only within it.
+ */
+struct HistoryIndex
+{
+    IndexEntry *entries;
+    size_t capacity;
+    size_t count;
+    uint32_t generation;
+};
+
+/*
+ * Shortest history kept in index, shorter ones are walked quickly enough
+ */
+#define INDEX_MIN_STATES 32
+
+/*
+ * Number of slots index starts with
+ */
+#define INDEX_INITIAL_CAPACITY 1024
+
+/*
+ * Modulus of hashes of histories, prime 2^61 - 1
+ */
+#define INDEX_MODULUS ((((uint64_t) 1) << 61) - 1)
+
+/*
+ * Bases of the two hashes of histories
+ */
+#define INDEX_FIRST_BASE ((uint64_t) 0x0E6C2B4D7A3F9135 % INDEX_MODULUS)
+#define INDEX_SECOND_BASE ((uint64_t) 0x13A5C7E9F0B2D461 % INDEX_MODULUS)
+
+/*
+ * Returns a * b modulo INDEX_MODULUS, both below it
+ */
+static uint64_t multiplyModulo(uint64_t a, uint64_t b);
+
+/*
+ * Returns slot of index where history with given key is, or where it would
+ * be put
+ */
+static IndexEntry *indexSlot(const HistoryIndex *index, const HistoryKey *key);
+
+/*
+ * Takes history with given key out of index if it leads to "node"
+ */
+static void removeIndexed(HistoryIndex *index, const HistoryKey *key,
+                          const Tree *node);
+
+bool indexTree(Tree *histories, bool enabled)
+{
+    TreeState *state = stateOf(histories);
+    Pool *pool = poolOf(histories);
+
+    if (!enabled)
+    {
+        if (state->index == NULL) return true;
+
+        poolDischarge(pool, sizeof(HistoryIndex) +
+                            sizeof(IndexEntry) * state->index->capacity);
+        free(state->index->entries);
+        free(state->index);
+        state->index = NULL;
+        return true;
+    }
+
+    if (state->index != NULL) return true;
+
+    HistoryIndex *index = malloc(sizeof(HistoryIndex));
+    IndexEntry *entries = calloc(INDEX_INITIAL_CAPACITY, sizeof(IndexEntry));
+    if (index == NULL || entries == NULL)
+    {
+        free(index);
+        free(entries);
+        return false;
+    }
+
+    poolCharge(pool, sizeof(HistoryIndex) +
+                     sizeof(IndexEntry) * INDEX_INITIAL_CAPACITY);
+    index->entries = entries;
+    index->capacity = INDEX_INITIAL_CAPACITY;
+    index->count = 0;
+    index->generation = 1;
+    state->index = index;
+    return true;
+}
+
+bool isIndexed(const TreeState *state, const Tree *histories, size_t length)
+{
+    // snapshots have other roots, they are not indexed
+    return state->index != NULL && histories == state->root &&
+           length >= INDEX_MIN_STATES * SYMBOL_WIDTH;
+}
+
+void hashHistory(const char *argument, size_t length, HistoryKey *key)
+{
+    key->first = 0;
+    key->second = 0;
+    key->length = 0;
+
+    for (size_t i = 0; i < length; i += SYMBOL_WIDTH)
+    {
+        extendKey(key, symbolAt(argument + i));
+    }
+}
+
+void extendKey(HistoryKey *key, int symbol)
+{
+    // states are counted from 1, so that leading state 0 changes the hash
+    uint64_t value = (uint64_t) symbol + 1;
+
+    key->first = multiplyModulo(key->first, INDEX_FIRST_BASE) + value;
+    if (key->first >= INDEX_MODULUS) key->first -= INDEX_MODULUS;
+    key->second = multiplyModulo(key->second, INDEX_SECOND_BASE) + value;
+    if (key->second >= INDEX_MODULUS) key->second -= INDEX_MODULUS;
+    ++key->length;
+}
+
+static uint64_t multiplyModulo(uint64_t a, uint64_t b)
+{
+    // 2^61 is 1 modulo 2^61 - 1, so high bits are simply added to low ones
+    unsigned __int128 product = (unsigned __int128) a * b;
+    uint64_t result = ((uint64_t) product & INDEX_MODULUS) +
+                      (uint64_t) (product >> 61);
+    result = (result & INDEX_MODULUS) + (result >> 61);
+
+    return result >= INDEX_MODULUS ? result - INDEX_MODULUS : result;
+}
+
+static IndexEntry *indexSlot(const HistoryIndex *index, const HistoryKey *key)
+{
+    size_t mask = index->capacity - 1;
+    size_t slot = (size_t) (key->first ^ (key->second >> 7)) & mask;
+
+    while (true)
+    {
+        IndexEntry *entry = &index->entries[slot];
+        if (entry->generation != index->generation) return entry;
+        if (entry->key.first == key->first &&
+            entry->key.second == key->second &&
+            entry->key.length == key->length)
+            return entry;
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+Tree *findIndexed(const HistoryIndex *index, const HistoryKey *key)
+{
+    IndexEntry *entry = indexSlot(index, key);
+
+    return entry->generation == index->generation ? entry->node : NULL;
+}
+
+void addIndexed(HistoryIndex *index, const HistoryKey *key, Tree *node)
+{
+    // table is kept at most half full
+    if (2 * (index->count + 1) > index->capacity)
+    {
+        size_t capacity = index->capacity * 2;
+        Pool *pool = poolOf(node);
+        if (!poolFits(pool, sizeof(IndexEntry) * capacity)) return;
+
+        IndexEntry *entries = calloc(capacity, sizeof(IndexEntry));
+        if (entries == NULL) return;
+
+        HistoryIndex grown = *index;
+        grown.entries = entries;
+        grown.capacity = capacity;
+
+        for (size_t i = 0; i < index->capacity; ++i)
+        {
+            IndexEntry *entry = &index->entries[i];
+            if (entry->generation == index->generation)
+                *indexSlot(&grown, &entry->key) = *entry;
+        }
+
+        free(index->entries);
+        poolDischarge(pool, sizeof(IndexEntry) * index->capacity);
+        poolCharge(pool, sizeof(IndexEntry) * capacity);
+        *index = grown;
+    }
+
+    IndexEntry *entry = indexSlot(index, key);
+    if (entry->generation != index->generation) ++index->count;
+
+    entry->key = *key;
+    entry->node = node;
+    entry->generation = index->generation;
+}
+
+static void removeIndexed(HistoryIndex *index, const HistoryKey *key,
+                          const Tree *node)
+{
+    IndexEntry *entry = indexSlot(index, key);
+    if (entry->generation != index->generation || entry->node != node) return;
+
+    // entries after the removed one are moved back, unless it would put them
+    // before the slot they hash to
+    size_t mask = index->capacity - 1;
+    size_t hole = (size_t) (entry - index->entries);
+    size_t slot = hole;
+
+    while (true)
+    {
+        slot = (slot + 1) & mask;
+        IndexEntry *next = &index->entries[slot];
+        if (next->generation != index->generation) break;
+
+        size_t home = (size_t) (next->key.first ^ (next->key.second >> 7)) &
+                      mask;
+        bool movable = hole <= slot ? home <= hole || home > slot :
+                       home <= hole && home > slot;
+        if (movable)
+        {
+            index->entries[hole] = *next;
+            hole = slot;
+        }
+    }
+
+    index->entries[hole].generation = 0;
+    --index->count;
+}
+
+void unindexSubtree(HistoryIndex *index, const Tree *histories,
+                    HistoryKey *key)
+{
+    if (index->count == 0) return;
+
+    if (key->length >= INDEX_MIN_STATES)
+    {
+        removeIndexed(index, key, histories);
+        if (index->count == 0) return;
+    }
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        HistoryKey childKey = *key;
+        extendKey(&childKey, symbol);
+        unindexSubtree(index, child, &childKey);
+    }
+}
+
+void forgetIndexed(HistoryIndex *index)
+{
+    if (index->count == 0) return;
+
+    // slots of older generations are empty, unless generation wraps around
+    index->count = 0;
+    if (++index->generation == 0)
+    {
+        memset(index->entries, 0, sizeof(IndexEntry) * index->capacity);
+        index->generation = 1;
+    }
+}
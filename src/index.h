@@ -0,0 +1,76 @@
+#ifndef QUANTIZATION_INDEX_H
+#define QUANTIZATION_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "tree.h"
+
+/*
+ * Key of history in index: two polynomial hashes of its states modulo
+ * INDEX_MODULUS, with different bases, and its length in states. Key of
+ * history one state longer is computed from it in constant time.
+ */
+struct HistoryKey
+{
+    uint64_t first;
+    uint64_t second;
+    size_t length;
+};
+typedef struct HistoryKey HistoryKey;
+
+/*
+ * Hash table of long histories, see index.c
+ */
+typedef struct HistoryIndex HistoryIndex;
+
+/*
+ * Turns on or off hash index of long histories, in which lookups find their
+ * nodes without walking the tree, falling back to the walk when history is
+ * not there. Index is filled as histories are declared and found, and costs
+ * about 40 bytes per history in it. Returns false if allocation failed.
+ */
+bool indexTree(Tree *histories, bool enabled);
+
+/*
+ * Checks whether history of given length in characters is indexed in given
+ * histories
+ */
+bool isIndexed(const TreeState *state, const Tree *histories, size_t length);
+
+/*
+ * Stores key of first "length" characters of history in "key"
+ */
+void hashHistory(const char *argument, size_t length, HistoryKey *key);
+
+/*
+ * Makes key of history one state longer out of "key"
+ */
+void extendKey(HistoryKey *key, int symbol);
+
+/*
+ * Returns node of history with given key, or NULL if it is not in index
+ */
+Tree *findIndexed(const HistoryIndex *index, const HistoryKey *key);
+
+/*
+ * Puts history with given key and node into index. Index is only a shortcut,
+ * so if there is not enough memory to grow it, or growing it would exceed the
+ * memory limit, history is left out.
+ */
+void addIndexed(HistoryIndex *index, const HistoryKey *key, Tree *node);
+
+/*
+ * Takes every history of subtree out of index, "key" is key of its root.
+ * Nothing is walked while index is empty.
+ */
+void unindexSubtree(HistoryIndex *index, const Tree *histories,
+                    HistoryKey *key);
+
+/*
+ * Empties index at once, for changes which replace or release nodes it may
+ * hold
+ */
+void forgetIndexed(HistoryIndex *index);
+
+#endif //QUANTIZATION_INDEX_H
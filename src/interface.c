@@ -2,11 +2,14 @@
 // Created by filip on 08.07.19.
 //
 
+#include <poll.h>
+#include <stdint.h>
 #include "interface.h"
+#include "symbols.h"
 
 /*
  * Function checking whether the argument is correct history. Correct argument is a
- * string consisting of only 0, 1, 2 and 3. (For STATES 4)
+ * string consisting of only 0, 1, 2 and 3. (For STATES 4, see symbols.h for others)
  * Also, depending on the value of lineEnd argument, function will expect either
  * '\n' or '\0' at the end. True means argument is correct, false means the
  * opposite. Empty strings are considered erroneous.
@@ -40,12 +43,91 @@ static void removeEndl(char *argument);
  */
 static bool isCharBetween(char checked, char from, char to);
 
+/*
+ * Returns operation of subtree summary command with given name, or ERROR if
+ * name does not belong to one.
+ */
+static int aggregateOperation(const char *name);
+
+/*
+ * Returns operation of command reading given file, or ERROR if name does not
+ * belong to one.
+ */
+static int fileOperation(const char *name);
+
+/*
+ * Returns operation of command without arguments given whole line holding it,
+ * or ERROR if it is not one
+ */
+static int bareOperation(const char *line);
+
+/*
+ * Returns operation of query about snapshot with given name, or ERROR if name
+ * does not belong to one.
+ */
+static int versionedOperation(const char *name);
+
 /*
  * Returns count of how many spaces there are in given string. Stops counting
  * when the amount of spaces found reaches max.
  */
 static int countSpaces(char *input, unsigned max);
 
+/*
+ * Number of digits in the largest 64-bit number
+ */
+#define NUMBER_DIGITS 20
+
+/*
+ * Parses decimal number, checking on the way that it consists of digits only,
+ * is not empty and fits in 64 bits. Digits are converted eight at a time.
+ * Returns false if any of these does not hold.
+ */
+static bool parseNumber(const char *argument, uint64_t *value);
+
+/*
+ * Checks whether all eight characters packed in "chunk" are digits
+ */
+static bool areDigits(uint64_t chunk);
+
+/*
+ * Returns value of eight digits packed in "chunk", the first one in the lowest
+ * byte
+ */
+static uint64_t digitsValue(uint64_t chunk);
+
+static int bareOperation(const char *line)
+{
+    if (strcmp(line, "BEGIN\n") == 0) return BEGIN;
+    if (strcmp(line, "COMMIT\n") == 0) return COMMIT;
+    if (strcmp(line, "ROLLBACK\n") == 0) return ROLLBACK;
+    if (strcmp(line, "SNAPSHOT\n") == 0) return SNAPSHOT;
+    if (strcmp(line, "FREEZE\n") == 0) return FREEZE;
+    if (strcmp(line, "COMPACT\n") == 0) return COMPACT;
+    if (strcmp(line, "STATS\n") == 0) return STATS;
+    if (strcmp(line, "DEFRAG\n") == 0) return DEFRAG;
+    if (strcmp(line, "LAG\n") == 0) return LAG;
+
+    return ERROR;
+}
+
+static int fileOperation(const char *name)
+{
+    if (strcmp(name, "LOAD") == 0) return LOAD;
+    if (strcmp(name, "EQUAL_BATCH") == 0) return EQUAL_BATCH;
+    if (strcmp(name, "ENERGY_BATCH") == 0) return ENERGY_BATCH;
+
+    return ERROR;
+}
+
+static int versionedOperation(const char *name)
+{
+    if (strcmp(name, "VALID_AT") == 0) return VALID_AT;
+    if (strcmp(name, "ENERGY_AT") == 0) return ENERGY_AT;
+
+    return ERROR;
+}
+
 void
 analyzeInput(char *input, char **argument1, char **argument2, int *operation)
 {
@@ -58,9 +140,10 @@ analyzeInput(char *input, char **argument1, char **argument2, int *operation)
     // We must count spaces before strtok() gets rid of them
     int spacesCount = countSpaces(input, SPACES_LONG_INPUT + 1);
 
-    strtok(input, " ");
-    *argument1 = strtok(NULL, " ");
-    *argument2 = strtok(NULL, " ");
+    char *savePointer = NULL;
+    strtok_r(input, " ", &savePointer);
+    *argument1 = strtok_r(NULL, " ", &savePointer);
+    *argument2 = strtok_r(NULL, " ", &savePointer);
     *operation = ERROR;
 
     // DECLARE X
@@ -131,8 +214,9 @@ analyzeInput(char *input, char **argument1, char **argument2, int *operation)
         }
         else // 2 argument version of Energy
         {
+            // digits are checked while energy is parsed
             if (!isCorrectHistory(*argument1, false) ||
-                !isCorrectNumber(*argument2, true) ||
+                !entireLineRead(*argument2) ||
                 spacesCount > SPACES_LONG_INPUT)
             {
                 *operation = ERROR;
@@ -162,6 +246,76 @@ analyzeInput(char *input, char **argument1, char **argument2, int *operation)
         }
     }
 
+    // COUNT X, SUM X, MIN X, MAX X
+    else if (aggregateOperation(input) != ERROR)
+    {
+        if (!isCorrectHistory(*argument1, true) ||
+            spacesCount > SPACES_SHORT_INPUT)
+        {
+            *operation = ERROR;
+            return;
+        }
+        else
+        {
+            removeEndl(*argument1);
+            *operation = aggregateOperation(input);
+        }
+    }
+
+    // LOAD FILE, EQUAL_BATCH FILE, ENERGY_BATCH FILE
+    else if (fileOperation(input) != ERROR)
+    {
+        if (*argument1 == NULL || !entireLineRead(*argument1) ||
+            strlen(*argument1) < 2 || spacesCount > SPACES_SHORT_INPUT)
+        {
+            *operation = ERROR;
+            return;
+        }
+        else
+        {
+            removeEndl(*argument1);
+            *operation = fileOperation(input);
+        }
+    }
+
+    // VALID_AT V X, ENERGY_AT V X
+    else if (versionedOperation(input) != ERROR)
+    {
+        if (!isCorrectNumber(*argument1, false) ||
+            !isCorrectHistory(*argument2, true) ||
+            spacesCount > SPACES_LONG_INPUT)
+        {
+            *operation = ERROR;
+        }
+        else
+        {
+            removeEndl(*argument2);
+            *operation = versionedOperation(input);
+        }
+    }
+
+    // RELEASE V
+    else if (strcmp(input, "RELEASE") == 0)
+    {
+        if (!isCorrectNumber(*argument1, true) ||
+            spacesCount > SPACES_SHORT_INPUT)
+        {
+            *operation = ERROR;
+            return;
+        }
+        else
+        {
+            removeEndl(*argument1);
+            *operation = RELEASE;
+        }
+    }
+
+    // BEGIN, COMMIT, ROLLBACK, SNAPSHOT, FREEZE, COMPACT, STATS, DEFRAG, LAG
+    else if (bareOperation(input) != ERROR)
+    {
+        *operation = bareOperation(input);
+    }
+
     // Unrecognised input
     else
     {
@@ -169,6 +323,16 @@ analyzeInput(char *input, char **argument1, char **argument2, int *operation)
     }
 }
 
+static int aggregateOperation(const char *name)
+{
+    if (strcmp(name, "COUNT") == 0) return COUNT;
+    if (strcmp(name, "SUM") == 0) return SUM;
+    if (strcmp(name, "MIN") == 0) return MIN;
+    if (strcmp(name, "MAX") == 0) return MAX;
+
+    return ERROR;
+}
+
 static int countSpaces(char *input, unsigned max)
 {
     unsigned spaces = 0;
@@ -187,13 +351,13 @@ static void removeEndl(char *argument)
     argument[strlen(argument) - 1] = '\0';
 }
 
-char *getInput(bool *terminate, char *buffer, unsigned bufferSize)
+char *getInput(bool *terminate, char *buffer, unsigned bufferSize, FILE *input)
 {
     resetString(buffer);
 
     char *command = malloc(sizeof(char) * bufferSize);
 
-    if (fgets(buffer, bufferSize, stdin) == NULL)
+    if (fgets(buffer, bufferSize, input) == NULL)
     {
         *terminate = true;
         free(command);
@@ -212,24 +376,14 @@ static bool isCorrectHistory(char *argument, bool lineEnd)
     if (argument == NULL) return false;
     unsigned length = strlen(argument);
 
-    for (unsigned i = 0; i < length; ++i)
+    if (lineEnd)
     {
-        if ((i == length - 1) && (lineEnd))
-        {
-            if (argument[i] != '\n')
-            {
-                return false;
-            }
-        }
-
-        // STATES - 1 so we don`t include '4'
-        else if (!isCharBetween(argument[i], '0', '0' + STATES - 1))
-        {
-            return false;
-        }
+        if (length == 0 || argument[length - 1] != '\n') return false;
+        --length;
     }
 
-    return true;
+    // Same definition of states as the one used when walking histories
+    return isSymbolSequence(argument, length);
 }
 
 static void resetString(char *string)
@@ -276,8 +430,8 @@ bool entireLineRead(char *command)
     return command[strlen(command) - 1] == '\n' ? true : false;
 }
 
-void
-readNextPart(char **command, char **buffer, unsigned *bufferSize, bool *endOfFile)
+void readNextPart(char **command, char **buffer, unsigned *bufferSize,
+                  bool *endOfFile, FILE *input)
 {
     // double the buffer size
     *bufferSize = (*bufferSize) * 2;
@@ -289,7 +443,7 @@ readNextPart(char **command, char **buffer, unsigned *bufferSize, bool *endOfFil
     resetString(*buffer);
 
     // unexpected end of file
-    if (fgets(*buffer, (*bufferSize), stdin) == NULL)
+    if (fgets(*buffer, (*bufferSize), input) == NULL)
     {
         *endOfFile = true;
         return;
@@ -306,4 +460,209 @@ readNextPart(char **command, char **buffer, unsigned *bufferSize, bool *endOfFil
         strcpy(*command + oldCommandSize, *buffer);
         return;
     }
-}
\ No newline at end of file
+}
+
+char *readCommand(char **buffer, unsigned *bufferSize, bool *unexpectedFileEnd,
+                  FILE *input)
+{
+    bool terminate = false;
+    char *command = getInput(&terminate, *buffer, *bufferSize, input);
+    if (command == NULL) return NULL;
+
+    while (!entireLineRead(command))
+    {
+        readNextPart(&command, buffer, bufferSize, unexpectedFileEnd, input);
+        if (*unexpectedFileEnd)
+        {
+            free(command);
+            return NULL;
+        }
+    }
+
+    return command;
+}
+
+bool parseEnergy(const char *argument, Energy *energy)
+{
+    uint64_t parsed;
+    if (!parseNumber(argument, &parsed) || parsed == 0) return false;
+
+    *energy = parsed;
+    return true;
+}
+
+bool parseVersion(const char *argument, Version *version)
+{
+    uint64_t parsed;
+    if (!parseNumber(argument, &parsed) || parsed == 0) return false;
+
+    *version = parsed;
+    return true;
+}
+
+static bool parseNumber(const char *argument, uint64_t *value)
+{
+    size_t length = strlen(argument);
+    if (length == 0) return false;
+
+    // leading zeros do not count towards the limit of digits
+    size_t first = 0;
+    while (first < length && argument[first] == '0') ++first;
+
+    const char *digits = argument + first;
+    size_t count = length - first;
+    if (count > NUMBER_DIGITS) return false;
+
+    // whole chunks hold at most 16 digits, which cannot overflow
+    uint64_t parsed = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, digits + i, sizeof(chunk));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        chunk = __builtin_bswap64(chunk);
+#endif
+        if (!areDigits(chunk)) return false;
+
+        parsed = parsed * 100000000 + digitsValue(chunk);
+    }
+
+    for (; i < count; ++i)
+    {
+        if (!isCharBetween(digits[i], '0', '9') ||
+            __builtin_mul_overflow(parsed, 10, &parsed) ||
+            __builtin_add_overflow(parsed, digits[i] - '0', &parsed))
+            return false;
+    }
+
+    *value = parsed;
+    return true;
+}
+
+static bool areDigits(uint64_t chunk)
+{
+    // only bytes from '0' to '9' have high half 3 both before and after
+    // adding 6 to them
+    uint64_t high = 0xF0F0F0F0F0F0F0F0;
+    uint64_t zeros = 0x3030303030303030;
+
+    return (chunk & high) == zeros &&
+           ((chunk + 0x0606060606060606) & high) == zeros;
+}
+
+static uint64_t digitsValue(uint64_t chunk)
+{
+    chunk -= 0x3030303030303030;
+
+    // neighbouring digits, pairs and quadruples are joined in turn
+    chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FF;
+    chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFF;
+    chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFF;
+
+    return chunk;
+}
+
+bool readHistoriesFile(const char *path, char **contents,
+                       const char ***histories, size_t *count)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    size_t size = 0;
+    size_t capacity = CHAR_BUFFER;
+    char *data = malloc(capacity);
+    size_t read;
+
+    while (data != NULL &&
+           (read = fread(data + size, 1, capacity - size - 1, file)) > 0)
+    {
+        size += read;
+        if (size + 1 == capacity)
+        {
+            capacity *= 2;
+            char *expanded = realloc(data, capacity);
+            if (expanded == NULL) free(data);
+            data = expanded;
+        }
+    }
+
+    bool failed = data == NULL || ferror(file);
+    fclose(file);
+    if (failed)
+    {
+        free(data);
+        return false;
+    }
+    data[size] = '\0';
+
+    size_t lines = 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (data[i] == '\n') ++lines;
+    }
+
+    const char **found = malloc(sizeof(char *) * lines);
+    if (found == NULL)
+    {
+        free(data);
+        return false;
+    }
+
+    size_t foundCount = 0;
+    char *line = data;
+    while (*line != '\0')
+    {
+        char *end = strchr(line, '\n');
+        if (end != NULL) *end = '\0';
+
+        if (*line != '\0') found[foundCount++] = line;
+        if (end == NULL) break;
+        line = end + 1;
+    }
+
+    *contents = data;
+    *histories = found;
+    *count = foundCount;
+    return true;
+}
+
+bool readPairsFile(const char *path, char **contents, const char ***first,
+                   const char ***second, size_t *count)
+{
+    if (!readHistoriesFile(path, contents, first, count)) return false;
+
+    *second = malloc(sizeof(char *) * (*count > 0 ? *count : 1));
+    if (*second == NULL)
+    {
+        free(*first);
+        free(*contents);
+        return false;
+    }
+
+    for (size_t i = 0; i < *count; ++i)
+    {
+        // lines lie in contents, which may be changed
+        char *line = *contents + ((*first)[i] - *contents);
+        char *space = strchr(line, ' ');
+
+        (*second)[i] = NULL;
+        if (space == NULL || space == line || space[1] == '\0' ||
+            strchr(space + 1, ' ') != NULL)
+            continue;
+
+        *space = '\0';
+        (*second)[i] = space + 1;
+    }
+
+    return true;
+}
+
+bool inputReady(FILE *input)
+{
+    struct pollfd descriptor;
+    descriptor.fd = fileno(input);
+    descriptor.events = POLLIN;
+
+    return poll(&descriptor, 1, 0) > 0;
+}
@@ -19,6 +19,25 @@
 #define EQUAL 6
 #define PASS 7
 #define ERROR 8
+#define COUNT 9
+#define SUM 10
+#define MIN 11
+#define MAX 12
+#define LOAD 13
+#define BEGIN 14
+#define COMMIT 15
+#define ROLLBACK 16
+#define SNAPSHOT 17
+#define RELEASE 18
+#define VALID_AT 19
+#define ENERGY_AT 20
+#define FREEZE 21
+#define COMPACT 22
+#define STATS 23
+#define DEFRAG 24
+#define EQUAL_BATCH 25
+#define ENERGY_BATCH 26
+#define LAG 27
 
 #define SPACES_SHORT_INPUT 1
 #define SPACES_LONG_INPUT 2
@@ -37,13 +56,13 @@ analyzeInput(char *input, char **argument1, char **argument2, int *operation);
 
 /*
  * Function for reading user input
- * Reads line of text from standard input. If it was the last one, sets terminate
- * to true.
+ * Reads line of text from given input stream. If it was the last one, sets
+ * terminate to true.
  */
-char *getInput(bool *terminate, char *buffer, unsigned bufferSize);
+char *getInput(bool *terminate, char *buffer, unsigned bufferSize, FILE *input);
 
 /*
- * Checks whether entire line of text from stdin was read, or it was too large
+ * Checks whether entire line of text from input was read, or it was too large
  */
 bool entireLineRead(char *command);
 
@@ -51,7 +70,53 @@ bool entireLineRead(char *command);
  * If line of text was too long, then expands command so the rest of fits too.
  * Terminates if file ends unexpectedly, and sets endOFFile to true.
  */
-void
-readNextPart(char **command, char **buffer, unsigned *bufferSize, bool *endOfFile);
+void readNextPart(char **command, char **buffer, unsigned *bufferSize,
+                  bool *endOfFile, FILE *input);
+
+/*
+ * Reads entire next line from input, expanding buffer when the line does not fit
+ * in it. Returns NULL when there are no more lines, and sets unexpectedFileEnd
+ * to true if input ended in the middle of a line.
+ */
+char *readCommand(char **buffer, unsigned *bufferSize, bool *unexpectedFileEnd,
+                  FILE *input);
+
+/*
+ * Checks whether reading the next command will not block. Answers are held
+ * back only then, so that interactive user gets them at once.
+ */
+bool inputReady(FILE *input);
+
+/*
+ * Reads file holding one history per line. On success "contents" holds
+ * whole file, which must be freed by the caller, and "histories" array of
+ * pointers into it, which must be freed too. Empty lines are skipped and lines
+ * are not validated. Returns false if file could not be read.
+ */
+bool readHistoriesFile(const char *path, char **contents,
+                       const char ***histories, size_t *count);
+
+/*
+ * Reads file holding two arguments separated by single space per line, like
+ * readHistoriesFile, storing the first ones in "first" and the second ones in
+ * "second". Second argument of line not made of exactly two arguments is
+ * NULL. Both arrays must be freed by the caller.
+ */
+bool readPairsFile(const char *path, char **contents, const char ***first,
+                   const char ***second, size_t *count);
+
+/*
+ * Parses argument to Energy value, checking that it is a decimal number, which
+ * analyzeInput leaves to it. Returns false if argument is not a number, value
+ * does not fit in Energy or is equal to 0.
+ */
+bool parseEnergy(const char *argument, Energy *energy);
+
+/*
+ * Parses argument, which already passed number validation in analyzeInput, to
+ * snapshot version. Returns false if value does not fit in Version or is equal
+ * to 0, which is never a version.
+ */
+bool parseVersion(const char *argument, Version *version);
 
 #endif //QUANTIZATION_INTERFACE_H
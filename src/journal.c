@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include "journal.h"
+#include "children.h"
+#include "pool.h"
+#include "tree.h"
+
+/*
+ * Kinds of changes recorded in journal: new subtree attached to existing node,
+ * subtree detached by removal, overwritten energy, and equality that was added
+ * or cut because one of its histories was removed.
+ */
+#define JOURNAL_CREATED 1
+#define JOURNAL_REMOVED 2
+#define JOURNAL_ENERGY 3
+#define JOURNAL_EQUAL_ADDED 4
+#define JOURNAL_EQUAL_CUT 5
+
+/*
+ * Initial number of entries journal makes room for
+ */
+#define JOURNAL_INITIAL_CAPACITY 64
+
+/*
+ * Single recorded change. Subtrees are described by their root and state under
+ * which it hangs from its parent, removed ones by the parent too, as root of
+ * subtree shared by compaction may point to another one. Cut equalities are
+ * described by list cells taken out of both histories, so that putting them
+ * back needs no memory.
+ */
+struct JournalEntry
+{
+    int kind;
+    int symbol;
+    union
+    {
+        Tree *node;
+        Equals *equals;
+        struct
+        {
+            Tree *node;
+            Tree *parent;
+        } removed;
+        struct
+        {
+            Tree *node;
+            Energy previous;
+        } energy;
+        struct
+        {
+            EqualsList *cellA;
+            EqualsList *cellB;
+        } cut;
+    };
+};
+typedef struct JournalEntry JournalEntry;
+
+/*
+ * "pool" is that of histories journal is attached to, NULL while it is not.
+ * Entries are charged to it only meanwhile, as journal kept between updates
+ * outlives histories that are frozen.
+ */
+struct Journal
+{
+    JournalEntry *entries;
+    size_t count;
+    size_t capacity;
+    bool failed;
+    Pool *pool;
+};
+
+/*
+ * Adds entry of given kind to journal and returns it, or NULL if there was not
+ * enough memory
+ */
+static JournalEntry *appendEntry(Journal *journal, int kind);
+
+/*
+ * Reverts single change recorded in journal
+ */
+static void revertEntry(JournalEntry *entry, bool *memFail);
+
+Journal *initializeJournal()
+{
+    Journal *journal = malloc(sizeof(Journal));
+    if (journal == NULL) return NULL;
+
+    journal->entries = NULL;
+    journal->count = 0;
+    journal->capacity = 0;
+    journal->failed = false;
+    journal->pool = NULL;
+
+    return journal;
+}
+
+void removeJournal(Journal *journal)
+{
+    if (journal == NULL) return;
+
+    free(journal->entries);
+    free(journal);
+}
+
+void attachJournal(Tree *histories, Journal *journal)
+{
+    TreeState *state = stateOf(histories);
+    Pool *pool = poolOf(histories);
+
+    if (state->journal != NULL)
+    {
+        poolDischarge(pool, sizeof(JournalEntry) * state->journal->capacity);
+        state->journal->pool = NULL;
+    }
+
+    // entries are charged even beyond the limit, as journal which could not
+    // record a change could not revert the update refused by the limit
+    if (journal != NULL)
+    {
+        poolCharge(pool, sizeof(JournalEntry) * journal->capacity);
+        journal->pool = pool;
+    }
+
+    state->journal = journal;
+}
+
+bool journalFailed(const Journal *journal)
+{
+    return journal->failed;
+}
+
+bool reserveEntries(Journal *journal, size_t count)
+{
+    if (journal->count + count <= journal->capacity) return true;
+
+    size_t capacity = journal->capacity == 0 ? JOURNAL_INITIAL_CAPACITY :
+                      journal->capacity;
+    while (capacity < journal->count + count) capacity *= 2;
+
+    JournalEntry *expanded = realloc(journal->entries,
+                                     sizeof(JournalEntry) * capacity);
+    if (expanded == NULL)
+    {
+        journal->failed = true;
+        return false;
+    }
+
+    if (journal->pool != NULL)
+    {
+        poolCharge(journal->pool,
+                   sizeof(JournalEntry) * (capacity - journal->capacity));
+    }
+
+    journal->entries = expanded;
+    journal->capacity = capacity;
+    return true;
+}
+
+static JournalEntry *appendEntry(Journal *journal, int kind)
+{
+    if (!reserveEntries(journal, 1)) return NULL;
+
+    JournalEntry *entry = &journal->entries[journal->count++];
+    entry->kind = kind;
+    entry->symbol = 0;
+
+    return entry;
+}
+
+bool recordCreated(Journal *journal, Tree *node, int symbol)
+{
+    JournalEntry *entry = appendEntry(journal, JOURNAL_CREATED);
+    if (entry == NULL) return false;
+
+    entry->symbol = symbol;
+    entry->node = node;
+    return true;
+}
+
+void recordRemoved(Journal *journal, Tree *node, Tree *parent, int symbol)
+{
+    JournalEntry *entry = appendEntry(journal, JOURNAL_REMOVED);
+    entry->symbol = symbol;
+    entry->removed.node = node;
+    entry->removed.parent = parent;
+}
+
+bool recordEnergy(Journal *journal, Tree *node, Energy previous)
+{
+    JournalEntry *entry = appendEntry(journal, JOURNAL_ENERGY);
+    if (entry == NULL) return false;
+
+    entry->energy.node = node;
+    entry->energy.previous = previous;
+    return true;
+}
+
+void recordEqualAdded(Journal *journal, Equals *equals)
+{
+    appendEntry(journal, JOURNAL_EQUAL_ADDED)->equals = equals;
+}
+
+void recordEqualCut(Journal *journal, EqualsList *cellA, EqualsList *cellB)
+{
+    JournalEntry *entry = appendEntry(journal, JOURNAL_EQUAL_CUT);
+    entry->cut.cellA = cellA;
+    entry->cut.cellB = cellB;
+}
+
+void commitJournal(Journal *journal)
+{
+    for (size_t i = 0; i < journal->count; ++i)
+    {
+        JournalEntry *entry = &journal->entries[i];
+
+        if (entry->kind == JOURNAL_REMOVED)
+        {
+            // its equalities were already cut
+            releaseSubtree(entry->removed.node);
+        }
+        else if (entry->kind == JOURNAL_EQUAL_CUT)
+        {
+            // histories of cut equality are released by later entries
+            Equals *equals = entry->cut.cellA->this;
+            Pool *poolA = poolOf(equals->historyA);
+            poolFree(poolOf(equals->historyB), entry->cut.cellB,
+                     sizeof(EqualsList));
+            poolFree(poolA, entry->cut.cellA, sizeof(EqualsList));
+            poolFree(poolA, equals, sizeof(Equals));
+        }
+    }
+
+    journal->count = 0;
+}
+
+void rollbackJournal(Journal *journal, bool *memFail)
+{
+    rollbackJournalTo(journal, 0, memFail);
+}
+
+size_t journalLength(const Journal *journal)
+{
+    return journal->count;
+}
+
+void rollbackJournalTo(Journal *journal, size_t length, bool *memFail)
+{
+    // every change is reverted on the state it was made in
+    while (journal->count > length && !*memFail)
+    {
+        revertEntry(&journal->entries[--journal->count], memFail);
+    }
+}
+
+static void revertEntry(JournalEntry *entry, bool *memFail)
+{
+    Tree *node = entry->node;
+    Equals *equals = entry->equals;
+
+    switch (entry->kind)
+    {
+        case JOURNAL_CREATED:
+            // finger may hold the node, which is released
+            forgetNodes(stateOf(node));
+            setChild(node->parent, entry->symbol, NULL);
+            subtractSubtree(node->parent, node);
+            recurrentRemoval(node);
+            break;
+        case JOURNAL_REMOVED:
+            node = entry->removed.node;
+            if (!setChild(entry->removed.parent, entry->symbol, node))
+            {
+                *memFail = true;
+                return;
+            }
+            node->parent = entry->removed.parent;
+            addSubtree(node->parent, node);
+            break;
+        case JOURNAL_ENERGY:
+            assignEnergy(entry->energy.node, entry->energy.previous);
+            break;
+        case JOURNAL_EQUAL_ADDED:
+            poolFree(poolOf(equals->historyB),
+                     unlinkEquals(equals->historyB, equals),
+                     sizeof(EqualsList));
+            poolFree(poolOf(equals->historyA),
+                     unlinkEquals(equals->historyA, equals),
+                     sizeof(EqualsList));
+            poolFree(poolOf(equals->historyA), equals, sizeof(Equals));
+            break;
+        case JOURNAL_EQUAL_CUT:
+            equals = entry->cut.cellA->this;
+            entry->cut.cellA->next = equals->historyA->equalsList;
+            equals->historyA->equalsList = entry->cut.cellA;
+            entry->cut.cellB->next = equals->historyB->equalsList;
+            equals->historyB->equalsList = entry->cut.cellB;
+            break;
+        default:
+            break;
+    }
+}
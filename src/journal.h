@@ -0,0 +1,99 @@
+#ifndef QUANTIZATION_JOURNAL_H
+#define QUANTIZATION_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Undo log of a transaction. While journal is attached to histories, every
+ * change made to them is recorded, so that it can be reverted in time
+ * proportional to the number of changes instead of size of histories. Removed
+ * subtrees and equalities are kept aside until the journal is committed. One
+ * journal may be attached to several data structures, which is needed when
+ * equalities join them.
+ */
+typedef struct Journal Journal;
+
+/*
+ * Creates new, empty journal. Returns NULL if allocation failed.
+ */
+Journal *initializeJournal();
+
+/*
+ * Releases journal, which must be empty, i.e. committed or rolled back.
+ */
+void removeJournal(Journal *journal);
+
+/*
+ * Starts recording changes of given histories in "journal", NULL stops it.
+ */
+void attachJournal(Tree *histories, Journal *journal);
+
+/*
+ * Makes recorded changes permanent: releases removed subtrees and equalities
+ * kept for rollback and empties the journal.
+ */
+void commitJournal(Journal *journal);
+
+/*
+ * Reverts recorded changes, newest first, and empties the journal. Sets
+ * "memFail" if children array of large alphabet node could not be expanded
+ * to take back removed subtree, which leaves histories partly reverted.
+ */
+void rollbackJournal(Journal *journal, bool *memFail);
+
+/*
+ * Returns number of changes recorded in journal, which can be passed to
+ * rollbackJournalTo later
+ */
+size_t journalLength(const Journal *journal);
+
+/*
+ * Reverts changes recorded after journal had given length, newest first, like
+ * rollbackJournal. Changes recorded before are kept in the journal.
+ */
+void rollbackJournalTo(Journal *journal, size_t length, bool *memFail);
+
+/*
+ * Checks whether some change could not be recorded because memory ran out.
+ * Such journal can no longer be rolled back correctly.
+ */
+bool journalFailed(const Journal *journal);
+
+/*
+ * Makes sure that "count" more entries can be added to journal without
+ * allocating memory. Returns false, marking journal as failed, if it could not.
+ */
+bool reserveEntries(Journal *journal, size_t count);
+
+/*
+ * Records that subtree rooted at "node", hanging under "symbol", was created
+ */
+bool recordCreated(Journal *journal, Tree *node, int symbol);
+
+/*
+ * Records that subtree rooted at "node", hanging from "parent" under "symbol",
+ * was detached by removal. Journal must already have room for it.
+ */
+void recordRemoved(Journal *journal, Tree *node, Tree *parent, int symbol);
+
+/*
+ * Records energy node had before it was changed. Returns false if there was
+ * not enough memory.
+ */
+bool recordEnergy(Journal *journal, Tree *node, Energy previous);
+
+/*
+ * Records equality that was added. Journal must already have room for it.
+ */
+void recordEqualAdded(Journal *journal, Equals *equals);
+
+/*
+ * Records equality cut because one of its histories was removed, by list cells
+ * taken out of its first and second history. Journal must already have room
+ * for it.
+ */
+void recordEqualCut(Journal *journal, EqualsList *cellA, EqualsList *cellB);
+
+#endif //QUANTIZATION_JOURNAL_H
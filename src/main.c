@@ -1,108 +1,211 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdbool.h>
+#include <string.h>
+#include "batch.h"
+#include "cli.h"
 #include "interface.h"
-#include "quantum_operations.h"
-#include "output.h"
-#include "types.h"
+#include "quantization.h"
+#include "replication.h"
+#include "sharded.h"
 
-int main()
+/*
+ * Environment variable which, when set, makes the program release every piece
+ * of memory before exiting, so that leak checkers see none left. Otherwise it
+ * is left to the system, which is much faster for large histories.
+ */
+#define FULL_TEARDOWN_VARIABLE "QUANTIZATION_FULL_TEARDOWN"
+
+/*
+ * Prints available command line options to stderr
+ */
+static void printUsage(const char *program);
+
+int main(int argc, char **argv)
 {
-    char *buffer = malloc(sizeof(char) * CHAR_BUFFER);
-    if (buffer == NULL) return 1;
-    for (int i = 0; i < CHAR_BUFFER; ++i)
+    unsigned workers = 0;
+    unsigned shards = 0;
+    unsigned shardDepth = SHARD_DEPTH_AUTO;
+    const char *bulkDeclare = NULL;
+    size_t memoryLimit = 0;
+    bool indexed = false;
+    const char *spillPath = NULL;
+    size_t residentBytes = 0;
+    const char *primaryPath = NULL;
+    const char *replicaPath = NULL;
+    unsigned replicas = 1;
+    char **batchInputs = NULL;
+    size_t batchCount = 0;
+    const char *manifest = NULL;
+    bool sessionOptions = false;
+    int i = 1;
+
+    for (; i < argc; ++i)
     {
-        buffer[i] = '\0';
+        // every option but number of workers belongs to a single session of
+        // commands, which batch runs do not have
+        if (strcmp(argv[i], "--jobs") != 0 &&
+            strcmp(argv[i], "--batch") != 0 &&
+            strcmp(argv[i], "--manifest") != 0)
+            sessionOptions = true;
+
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+        {
+            workers = (unsigned) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+        {
+            shards = (unsigned) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--shard-depth") == 0 && i + 1 < argc)
+        {
+            shardDepth = (unsigned) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--bulk-declare") == 0 && i + 1 < argc)
+        {
+            bulkDeclare = argv[++i];
+        }
+        else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc)
+        {
+            memoryLimit = (size_t) strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--index") == 0)
+        {
+            indexed = true;
+        }
+        else if (strcmp(argv[i], "--spill") == 0 && i + 1 < argc)
+        {
+            spillPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resident") == 0 && i + 1 < argc)
+        {
+            residentBytes = (size_t) strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--primary") == 0 && i + 1 < argc)
+        {
+            primaryPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replicas") == 0 && i + 1 < argc)
+        {
+            replicas = (unsigned) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--replica") == 0 && i + 1 < argc)
+        {
+            replicaPath = argv[++i];
+        }
+        // every argument after --batch is an input
+        else if (strcmp(argv[i], "--batch") == 0 && manifest == NULL)
+        {
+            batchInputs = argv + i + 1;
+            batchCount = (size_t) (argc - i - 1);
+            break;
+        }
+        else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc &&
+                 manifest == NULL)
+        {
+            manifest = argv[++i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
     }
 
-    Tree *histories = initializeTree();
-    if (histories == NULL)
+    if ((batchInputs != NULL || manifest != NULL) && sessionOptions)
     {
-        free(buffer);
-        return 1; // Failed to allocate memory for main data structure
+        printUsage(argv[0]);
+        return 1;
     }
 
-    unsigned bufferSize = CHAR_BUFFER;
-    bool terminate = false;
+    if (batchInputs != NULL) return runBatch(batchInputs, batchCount, workers);
+    if (manifest != NULL) return runManifest(manifest, workers);
 
-    while (!terminate)
+    if ((shards > 0 && (memoryLimit != 0 || indexed || spillPath != NULL)) ||
+        ((shards > 0 || replicaPath != NULL) && primaryPath != NULL) ||
+        (shards > 0 && replicaPath != NULL) ||
+        (replicaPath != NULL && (bulkDeclare != NULL || memoryLimit != 0)))
     {
-        bool unexpectedFileEnd = false;
-
-        char *command = getInput(&terminate, buffer,
-                                 bufferSize); // todo memfail?
-        if (command == NULL) break;
+        printUsage(argv[0]);
+        return 1;
+    }
 
-        while (!entireLineRead(command) && !unexpectedFileEnd)
-        {
-            readNextPart(&command, &buffer, &bufferSize, &unexpectedFileEnd);
-            if (unexpectedFileEnd)
-            {
-                printError();
-                terminate = true;
-                free(command);
-            }
-        }
-        if (terminate) break;
+    if (shards > 0)
+    {
+        return runShardedCommands(shards, shardDepth, bulkDeclare, stdin,
+                                  stdout, stderr);
+    }
 
-        char *argument1 = NULL;
-        char *argument2 = NULL;
-        bool memFail = false;
-        bool error = false;
-        int operation = ERROR;
+    Quantization *quantization = quantCreate();
+    if (quantization == NULL)
+    {
+        return 1; // Failed to allocate memory for main data structure
+    }
 
-        analyzeInput(command, &argument1, &argument2, &operation);
+    if (memoryLimit != 0) quantSetMemoryLimit(quantization, memoryLimit);
+    if (indexed && quantSetIndex(quantization, true) != QUANT_OK)
+    {
+        quantDestroy(quantization);
+        return 1;
+    }
+    if (spillPath != NULL &&
+        quantSetTiering(quantization, spillPath, residentBytes) != QUANT_OK)
+    {
+        fprintf(stderr, "Cannot create spill file %s\n", spillPath);
+        quantDestroy(quantization);
+        return 1;
+    }
 
-        switch (operation)
-        {
-            case DECLARE:
-                declareHistory(argument1, histories, &memFail);
-                if (!memFail) printConfirmation();
-                break;
-            case REMOVE:
-                removeHistory(argument1, histories);
-                printConfirmation();
-                break;
-            case VALID:
-                printValid(validHistory(argument1, histories));
-                break;
-            case ENERGY:
-                energyHistory(argument1, argument2, histories, &error);
-                if (!error && !memFail) printConfirmation();
-                break;
-            case ENERGY_SHORT:
-                printEnergy(energyShortHistory(argument1, histories));
-                break;
-            case EQUAL:
-                equalHistory(argument1, argument2, histories, &error, &memFail);
-                if (!error && !memFail) printConfirmation();
-                break;
-            case PASS:
-                break;
-            case ERROR:
-            default:
-                printError();
-                break;
-        }
+    if (replicaPath != NULL)
+    {
+        int exitCode = runReplica(quantization, replicaPath, stdin, stdout,
+                                  stderr);
 
-        if (memFail) // out of memory is critical error and terminates program
-        {
-            removeTree(histories);
-            free(command);
-            free(buffer);
-            return 1;
-        }
+        if (getenv(FULL_TEARDOWN_VARIABLE) != NULL) quantDestroy(quantization);
+        return exitCode;
+    }
 
-        if (error)
-        {
-            printError();
-        }
+    // replicas get no copy of histories, so they connect before any update
+    Primary *primary = NULL;
+    if (primaryPath != NULL &&
+        (primary = primaryCreate(primaryPath, replicas)) == NULL)
+    {
+        fprintf(stderr, "Cannot listen for replicas at %s\n", primaryPath);
+        quantDestroy(quantization);
+        return 1;
+    }
 
-        free(command);
+    int status = bulkDeclare == NULL ? QUANT_OK :
+                 loadHistoriesFile(quantization, bulkDeclare,
+                                   primary == NULL ? NULL : primaryRecord,
+                                   primary);
+    if (status != QUANT_OK)
+    {
+        fprintf(stderr, "Cannot declare histories from %s\n", bulkDeclare);
+        primaryDestroy(primary);
+        quantDestroy(quantization);
+        return 1;
     }
 
-    free(buffer);
-    removeTree(histories);
-    return 0;
+    int exitCode = primary == NULL ?
+                   runCommands(quantization, stdin, stdout, stderr) :
+                   runLoggedCommands(quantization, stdin, stdout, stderr,
+                                     primaryRecord, primary);
+    primaryDestroy(primary);
+
+    if (getenv(FULL_TEARDOWN_VARIABLE) != NULL) quantDestroy(quantization);
+    return exitCode;
 }
 
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--jobs N] [--batch FILE... | --manifest FILE]\n"
+                    "       %s [--shards N [--shard-depth K]]"
+                    " [--bulk-declare FILE]\n"
+                    "       %s [--memory-limit BYTES] [--index]"
+                    " [--bulk-declare FILE]\n"
+                    "          [--spill FILE [--resident BYTES]]"
+                    " [--primary SOCKET [--replicas N]]\n"
+                    "       %s [--index] [--spill FILE [--resident BYTES]]"
+                    " --replica SOCKET\n",
+            program, program, program, program);
+}
@@ -3,25 +3,135 @@
 //
 
 #include "output.h"
+#include "interface.h"
 
-void printError()
+/*
+ * Room for the largest 64-bit number and line end
+ */
+#define NUMBER_LENGTH 21
+
+/*
+ * Decimal digits of every number below 100, two characters each
+ */
+static const char digitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/*
+ * Writes decimal digits of number so that they end just before "end", two at
+ * a time, and returns the first of them
+ */
+static char *formatNumber(uint64_t number, char *end);
+
+/*
+ * Prints number followed by line end
+ */
+static void printNumber(FILE *output, uint64_t number);
+
+void printError(FILE *errors)
 {
-    fprintf(stderr, "ERROR\n");
+    fprintf(errors, "ERROR\n");
 }
 
-void printValid(bool valid)
+void printValid(FILE *output, bool valid)
 {
-    fprintf(stdout, valid ? "YES\n" : "NO\n");
+    fprintf(output, valid ? "YES\n" : "NO\n");
 }
 
-void printEnergy(Energy energy)
+void printEnergy(FILE *output, Energy energy)
 {
-    if (energy == 0) printError();
+    printNumber(output, energy);
+}
+
+static char *formatNumber(uint64_t number, char *end)
+{
+    while (number >= 100)
+    {
+        unsigned pair = (unsigned) (number % 100) * 2;
+        number /= 100;
+        end -= 2;
+        memcpy(end, digitPairs + pair, 2);
+    }
+
+    if (number >= 10)
+    {
+        end -= 2;
+        memcpy(end, digitPairs + number * 2, 2);
+    }
+    else *--end = (char) ('0' + number);
 
-    else fprintf(stdout, "%" PRIu64 "\n", energy);
+    return end;
+}
+
+static void printNumber(FILE *output, uint64_t number)
+{
+    char text[NUMBER_LENGTH];
+    text[NUMBER_LENGTH - 1] = '\n';
+
+    char *first = formatNumber(number, text + NUMBER_LENGTH - 1);
+    fwrite(first, 1, text + NUMBER_LENGTH - first, output);
+}
+
+void printEnergySum(FILE *output, EnergySum sum)
+{
+    // printf has no conversion for 128-bit integers, so digits are made here
+    char digits[40];
+    unsigned position = sizeof(digits);
+    digits[--position] = '\0';
+
+    do
+    {
+        digits[--position] = (char) ('0' + (unsigned) (sum % 10));
+        sum /= 10;
+    } while (sum != 0);
+
+    fprintf(output, "%s\n", digits + position);
+}
+
+bool printAggregate(FILE *output, int operation, const Aggregate *aggregate)
+{
+    switch (operation)
+    {
+        case COUNT:
+            printNumber(output, aggregate->count);
+            return true;
+        case SUM:
+            printEnergySum(output, aggregate->energySum);
+            return true;
+        case MIN:
+            if (aggregate->minEnergy == 0) return false;
+            printEnergy(output, aggregate->minEnergy);
+            return true;
+        case MAX:
+            if (aggregate->maxEnergy == 0) return false;
+            printEnergy(output, aggregate->maxEnergy);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void printVersion(FILE *output, Version version)
+{
+    printNumber(output, version);
+}
+
+void printLag(FILE *output, size_t updates)
+{
+    printNumber(output, updates);
+}
+
+void printStatistics(FILE *output, const Statistics *statistics)
+{
+    fprintf(output, "nodes %" PRIu64 " bytes %" PRIu64 " reclaimed %" PRIu64
+                    "\n", statistics->nodes, statistics->bytes,
+            statistics->reclaimed);
 }
 
-void printConfirmation()
+void printConfirmation(FILE *output)
 {
-    fprintf(stdout, "OK\n");
+    fprintf(output, "OK\n");
 }
\ No newline at end of file
@@ -10,24 +10,51 @@
 #include "types.h"
 
 /*
- * Prints error message to stderr
+ * Prints error message to given error stream
  */
-void printError();
+void printError(FILE *errors);
 
 /*
  * Prints "YES" or "NO" dependent on value of valid. Meant to be used with
  * function checking whether given history is valid or not
  */
-void printValid(bool valid);
+void printValid(FILE *output, bool valid);
 
 /*
  * Prints given energy value
  */
-void printEnergy(Energy energy);
+void printEnergy(FILE *output, Energy energy);
+
+/*
+ * Prints given sum of energies
+ */
+void printEnergySum(FILE *output, EnergySum sum);
+
+/*
+ * Prints the part of subtree summary requested by operation: COUNT, SUM, MIN
+ * or MAX. Returns false, printing nothing, if smallest or largest energy was
+ * requested but no history in the subtree has energy.
+ */
+bool printAggregate(FILE *output, int operation, const Aggregate *aggregate);
+
+/*
+ * Prints version of snapshot
+ */
+void printVersion(FILE *output, Version version);
+
+/*
+ * Prints number of updates replica received but did not apply yet
+ */
+void printLag(FILE *output, size_t updates);
+
+/*
+ * Prints memory statistics as "nodes N bytes B reclaimed R"
+ */
+void printStatistics(FILE *output, const Statistics *statistics);
 
 /*
  * Prints "OK"
  */
-void printConfirmation();
+void printConfirmation(FILE *output);
 
 #endif //QUANTIZATION_OUTPUT_H
\ No newline at end of file
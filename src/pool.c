@@ -0,0 +1,423 @@
+// madvise is not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "pool.h"
+
+/*
+ * Space reserved at the beginning of every chunk for its header. It is a
+ * multiple of 16, so objects keep alignment needed by 128-bit integers.
+ */
+#define POOL_HEADER_BYTES 128
+
+/*
+ * Alignment of every object handed out by pool
+ */
+#define POOL_OBJECT_ALIGNMENT 16
+
+/*
+ * Header of a chunk. Objects that were never handed out are taken from
+ * "used" onwards, freed ones are kept on "freeList", linked through their
+ * first bytes.
+ */
+struct PoolChunk
+{
+    struct Pool *pool;
+    struct PoolChunk *previous;
+    struct PoolChunk *next;
+    struct PoolChunk *previousAvailable;
+    struct PoolChunk *nextAvailable;
+    void *freeList;
+    size_t live;
+    size_t used;
+    bool available;
+};
+typedef struct PoolChunk PoolChunk;
+
+_Static_assert(sizeof(PoolChunk) <= POOL_HEADER_BYTES,
+               "chunk header does not fit in reserved space");
+
+/*
+ * "chunks" lists every chunk, "available" only those that still have room and
+ * may be used by poolAllocate. "sequential" is the chunk being filled by
+ * poolAllocateSequential, it is kept off "available" until it is finished.
+ * "charged" counts bytes of memory its user took for objects outside of
+ * chunks, such as their arrays, atomically, as teardown releases them from
+ * several threads. "limit" is number of bytes pool may hold, 0 if there is no
+ * limit, and "refusedObjects" counts allocations that failed because of it.
+ */
+struct Pool
+{
+    size_t objectSize;
+    size_t capacity;
+    PoolChunk *chunks;
+    PoolChunk *available;
+    PoolChunk *sequential;
+    void *context;
+    size_t liveObjects;
+    size_t releasedObjects;
+    size_t refusedObjects;
+    size_t chunksCount;
+    atomic_size_t charged;
+    size_t limit;
+};
+
+/*
+ * Returns chunk given object belongs to
+ */
+static PoolChunk *chunkOf(const void *object);
+
+/*
+ * Takes new chunk from the system, returns NULL if it failed or if the chunk
+ * would not fit in the limit
+ */
+static PoolChunk *newChunk(Pool *pool);
+
+/*
+ * Returns chunk to the system. Its pages are given back at once, allocator
+ * would otherwise keep them for later.
+ */
+static void releaseChunk(PoolChunk *chunk);
+
+/*
+ * Adds chunk to list of chunks poolAllocate may use
+ */
+static void makeAvailable(PoolChunk *chunk);
+
+/*
+ * Removes chunk from list of chunks poolAllocate may use
+ */
+static void makeUnavailable(PoolChunk *chunk);
+
+/*
+ * Checks whether another object can be taken from chunk
+ */
+static bool hasRoom(const PoolChunk *chunk);
+
+/*
+ * Takes single object from chunk, which must have room for it
+ */
+static void *takeObject(PoolChunk *chunk);
+
+Pool *poolCreate(size_t objectSize)
+{
+    Pool *pool = malloc(sizeof(Pool));
+    if (pool == NULL) return NULL;
+
+    if (objectSize < sizeof(void *)) objectSize = sizeof(void *);
+    objectSize = (objectSize + POOL_OBJECT_ALIGNMENT - 1) /
+                 POOL_OBJECT_ALIGNMENT * POOL_OBJECT_ALIGNMENT;
+
+    pool->objectSize = objectSize;
+    pool->capacity = (POOL_CHUNK_BYTES - POOL_HEADER_BYTES) / objectSize;
+    pool->chunks = NULL;
+    pool->available = NULL;
+    pool->sequential = NULL;
+    pool->context = NULL;
+    pool->liveObjects = 0;
+    pool->releasedObjects = 0;
+    pool->refusedObjects = 0;
+    pool->chunksCount = 0;
+    atomic_init(&pool->charged, 0);
+    pool->limit = 0;
+
+    return pool;
+}
+
+void poolDestroy(Pool *pool)
+{
+    if (pool == NULL) return;
+
+    while (pool->chunks != NULL)
+    {
+        PoolChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+
+    free(pool);
+}
+
+static PoolChunk *chunkOf(const void *object)
+{
+    return (PoolChunk *) ((uintptr_t) object & ~(POOL_CHUNK_BYTES - 1));
+}
+
+Pool *poolOf(const void *object)
+{
+    return chunkOf(object)->pool;
+}
+
+static PoolChunk *newChunk(Pool *pool)
+{
+    if (!poolFits(pool, POOL_CHUNK_BYTES))
+    {
+        ++pool->refusedObjects;
+        return NULL;
+    }
+
+    void *memory = NULL;
+    if (posix_memalign(&memory, POOL_CHUNK_BYTES, POOL_CHUNK_BYTES) != 0)
+    {
+        return NULL;
+    }
+
+    PoolChunk *chunk = memory;
+    chunk->pool = pool;
+    chunk->previous = NULL;
+    chunk->next = pool->chunks;
+    chunk->previousAvailable = NULL;
+    chunk->nextAvailable = NULL;
+    chunk->freeList = NULL;
+    chunk->live = 0;
+    chunk->used = 0;
+    chunk->available = false;
+
+    if (pool->chunks != NULL) pool->chunks->previous = chunk;
+    pool->chunks = chunk;
+    ++pool->chunksCount;
+
+    return chunk;
+}
+
+static void releaseChunk(PoolChunk *chunk)
+{
+    Pool *pool = chunk->pool;
+
+    if (chunk->available) makeUnavailable(chunk);
+
+    if (chunk->previous != NULL) chunk->previous->next = chunk->next;
+    else pool->chunks = chunk->next;
+    if (chunk->next != NULL) chunk->next->previous = chunk->previous;
+
+    --pool->chunksCount;
+
+    // the first page holds bookkeeping of the allocator, which free writes to
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize > 0 && (size_t) pageSize < POOL_CHUNK_BYTES)
+    {
+        madvise((char *) chunk + pageSize, POOL_CHUNK_BYTES - pageSize,
+                MADV_DONTNEED);
+    }
+
+    free(chunk);
+}
+
+static void makeAvailable(PoolChunk *chunk)
+{
+    Pool *pool = chunk->pool;
+
+    chunk->previousAvailable = NULL;
+    chunk->nextAvailable = pool->available;
+    if (pool->available != NULL) pool->available->previousAvailable = chunk;
+    pool->available = chunk;
+    chunk->available = true;
+}
+
+static void makeUnavailable(PoolChunk *chunk)
+{
+    Pool *pool = chunk->pool;
+
+    if (chunk->previousAvailable != NULL)
+        chunk->previousAvailable->nextAvailable = chunk->nextAvailable;
+    else pool->available = chunk->nextAvailable;
+    if (chunk->nextAvailable != NULL)
+        chunk->nextAvailable->previousAvailable = chunk->previousAvailable;
+
+    chunk->previousAvailable = NULL;
+    chunk->nextAvailable = NULL;
+    chunk->available = false;
+}
+
+static bool hasRoom(const PoolChunk *chunk)
+{
+    return chunk->freeList != NULL || chunk->used < chunk->pool->capacity;
+}
+
+static void *takeObject(PoolChunk *chunk)
+{
+    void *object;
+
+    if (chunk->freeList != NULL)
+    {
+        object = chunk->freeList;
+        chunk->freeList = *(void **) object;
+    }
+    else
+    {
+        object = (char *) chunk + POOL_HEADER_BYTES +
+                 chunk->used * chunk->pool->objectSize;
+        ++chunk->used;
+    }
+
+    ++chunk->live;
+    ++chunk->pool->liveObjects;
+
+    return object;
+}
+
+void *poolAllocate(Pool *pool)
+{
+    PoolChunk *chunk = pool->available;
+
+    if (chunk == NULL)
+    {
+        chunk = newChunk(pool);
+        if (chunk == NULL) return NULL;
+
+        makeAvailable(chunk);
+    }
+
+    void *object = takeObject(chunk);
+    if (!hasRoom(chunk)) makeUnavailable(chunk);
+
+    return object;
+}
+
+void *poolAllocateSequential(Pool *pool)
+{
+    PoolChunk *chunk = pool->sequential;
+
+    if (chunk == NULL || chunk->used == pool->capacity)
+    {
+        chunk = newChunk(pool);
+        if (chunk == NULL) return NULL;
+
+        pool->sequential = chunk;
+    }
+
+    // objects freed meanwhile are left for poolAllocate, so order is kept
+    void *object = (char *) chunk + POOL_HEADER_BYTES +
+                   chunk->used * pool->objectSize;
+    ++chunk->used;
+    ++chunk->live;
+    ++pool->liveObjects;
+
+    return object;
+}
+
+void poolFinishSequential(Pool *pool)
+{
+    PoolChunk *chunk = pool->sequential;
+    if (chunk == NULL) return;
+
+    pool->sequential = NULL;
+    if (!chunk->available && hasRoom(chunk)) makeAvailable(chunk);
+}
+
+void poolRelease(void *object)
+{
+    PoolChunk *chunk = chunkOf(object);
+    Pool *pool = chunk->pool;
+
+    *(void **) object = chunk->freeList;
+    chunk->freeList = object;
+    --chunk->live;
+    --pool->liveObjects;
+    ++pool->releasedObjects;
+
+    // empty chunk is kept only when no other one has room left
+    bool otherAvailable = pool->available != NULL &&
+                          (pool->available != chunk ||
+                           chunk->nextAvailable != NULL);
+    if (chunk->live == 0 && chunk != pool->sequential && otherAvailable)
+    {
+        releaseChunk(chunk);
+        return;
+    }
+
+    if (!chunk->available && chunk != pool->sequential) makeAvailable(chunk);
+}
+
+void poolSetContext(Pool *pool, void *context)
+{
+    pool->context = context;
+}
+
+void *poolContext(const Pool *pool)
+{
+    return pool->context;
+}
+
+size_t poolLiveObjects(const Pool *pool)
+{
+    return pool->liveObjects;
+}
+
+size_t poolReleasedObjects(const Pool *pool)
+{
+    return pool->releasedObjects;
+}
+
+size_t poolReservedBytes(const Pool *pool)
+{
+    return sizeof(Pool) + pool->chunksCount * POOL_CHUNK_BYTES +
+           atomic_load_explicit(&pool->charged, memory_order_relaxed);
+}
+
+void poolSetLimit(Pool *pool, size_t bytes)
+{
+    pool->limit = bytes;
+}
+
+size_t poolRefusedObjects(const Pool *pool)
+{
+    return pool->refusedObjects;
+}
+
+bool poolFits(const Pool *pool, size_t bytes)
+{
+    return pool->limit == 0 || poolReservedBytes(pool) + bytes <= pool->limit;
+}
+
+void poolCharge(Pool *pool, size_t bytes)
+{
+    atomic_fetch_add_explicit(&pool->charged, bytes, memory_order_relaxed);
+}
+
+void poolDischarge(Pool *pool, size_t bytes)
+{
+    atomic_fetch_sub_explicit(&pool->charged, bytes, memory_order_relaxed);
+}
+
+void *poolMalloc(Pool *pool, size_t bytes)
+{
+    if (!poolFits(pool, bytes))
+    {
+        ++pool->refusedObjects;
+        return NULL;
+    }
+
+    void *memory = malloc(bytes);
+    if (memory != NULL) poolCharge(pool, bytes);
+
+    return memory;
+}
+
+void *poolRealloc(Pool *pool, void *memory, size_t oldBytes, size_t bytes)
+{
+    if (bytes > oldBytes && !poolFits(pool, bytes - oldBytes))
+    {
+        ++pool->refusedObjects;
+        return NULL;
+    }
+
+    void *resized = realloc(memory, bytes);
+    if (resized == NULL) return NULL;
+
+    poolDischarge(pool, oldBytes);
+    poolCharge(pool, bytes);
+    return resized;
+}
+
+void poolFree(Pool *pool, void *memory, size_t bytes)
+{
+    if (memory == NULL) return;
+
+    free(memory);
+    poolDischarge(pool, bytes);
+}
@@ -0,0 +1,138 @@
+#ifndef QUANTIZATION_POOL_H
+#define QUANTIZATION_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Size of a single chunk of memory pool takes from the system. Chunks are
+ * aligned to their size, so the chunk holding any object can be found from
+ * object address alone.
+ */
+#define POOL_CHUNK_BYTES ((size_t) 1 << 16)
+
+/*
+ * Allocator of equally sized objects. Objects are carved out of large chunks,
+ * which keeps neighbouring tree nodes close in memory and makes releasing
+ * everything at once cheap.
+ */
+typedef struct Pool Pool;
+
+/*
+ * Creates pool for objects of given size, returns NULL if allocation failed
+ */
+Pool *poolCreate(size_t objectSize);
+
+/*
+ * Releases pool together with every object still allocated from it
+ */
+void poolDestroy(Pool *pool);
+
+/*
+ * Returns pool given object was allocated from
+ */
+Pool *poolOf(const void *object);
+
+/*
+ * Returns memory for one object, or NULL if allocation failed. Space freed
+ * earlier is reused first.
+ */
+void *poolAllocate(Pool *pool);
+
+/*
+ * Returns memory for one object placed directly after the previous object
+ * allocated this way, whenever it still fits in the same chunk. Meant for
+ * building whole subtrees in the order they are later walked. Must be followed
+ * by poolFinishSequential once the sequence is complete.
+ */
+void *poolAllocateSequential(Pool *pool);
+
+/*
+ * Makes space left after sequential allocation available for poolAllocate
+ */
+void poolFinishSequential(Pool *pool);
+
+/*
+ * Gives object back to its pool. Chunks left without objects are returned to
+ * the system.
+ */
+void poolRelease(void *object);
+
+/*
+ * Attaches data of pool user to the pool, so that it can be found from any
+ * object allocated from it. Pool itself never uses it.
+ */
+void poolSetContext(Pool *pool, void *context);
+
+/*
+ * Returns data attached with poolSetContext, NULL if there is none
+ */
+void *poolContext(const Pool *pool);
+
+/*
+ * Returns number of objects currently allocated from pool
+ */
+size_t poolLiveObjects(const Pool *pool);
+
+/*
+ * Returns number of objects given back to pool since it was created
+ */
+size_t poolReleasedObjects(const Pool *pool);
+
+/*
+ * Returns number of bytes pool currently holds from the system, its chunks
+ * together with memory charged to it
+ */
+size_t poolReservedBytes(const Pool *pool);
+
+/*
+ * Limits number of bytes pool may hold from the system, as returned by
+ * poolReservedBytes, 0 removes the limit. Allocations that would need a chunk
+ * or charge beyond the limit fail. Memory already held is kept even when the
+ * limit is lower.
+ */
+void poolSetLimit(Pool *pool, size_t bytes);
+
+/*
+ * Returns number of allocations that failed because of the limit
+ */
+size_t poolRefusedObjects(const Pool *pool);
+
+/*
+ * Checks whether given number of bytes more would fit in the limit
+ */
+bool poolFits(const Pool *pool, size_t bytes);
+
+/*
+ * Counts bytes, which pool user took from the system for its objects, as held
+ * by the pool, even beyond the limit
+ */
+void poolCharge(Pool *pool, size_t bytes);
+
+/*
+ * Stops counting bytes counted by poolCharge. Unlike the rest of pool, it may
+ * be called by several threads at once.
+ */
+void poolDischarge(Pool *pool, size_t bytes);
+
+/*
+ * Works like malloc, charging given bytes to pool. Allocation that would not
+ * fit in the limit fails and is counted as refused.
+ */
+void *poolMalloc(Pool *pool, size_t bytes);
+
+/*
+ * Works like realloc of memory charged "oldBytes" to pool, charging the
+ * difference. Growth that would not fit in the limit fails and is counted as
+ * refused, memory is left as it was then.
+ */
+void *poolRealloc(Pool *pool, void *memory, size_t oldBytes, size_t bytes);
+
+/*
+ * Works like free of memory charged given bytes to pool, may be called by
+ * several threads at once. NULL is ignored.
+ */
+void poolFree(Pool *pool, void *memory, size_t bytes);
+
+#endif //QUANTIZATION_POOL_H
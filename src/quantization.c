@@ -0,0 +1,819 @@
+#include <stdlib.h>
+#include <string.h>
+#include "quantization.h"
+#include "classes.h"
+#include "compaction.h"
+#include "defrag.h"
+#include "frozen.h"
+#include "index.h"
+#include "journal.h"
+#include "quantum_operations.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "tiering.h"
+#include "tree.h"
+
+/*
+ * "journal" is not NULL while transaction is open, "aborted" tells that one of
+ * its updates failed. "versions" holds snapshot with given version at position
+ * one lower, NULL after it is released. After freezing "histories" are
+ * released and only "frozen" is left. "reclaimed" sums bytes given back by
+ * compaction. "memoryLimit" is 0 unless it was set, then "statement" records
+ * single update made outside of transaction.
+ */
+struct Quantization
+{
+    Tree *histories;
+    Frozen *frozen;
+    Journal *journal;
+    bool aborted;
+    Tree **versions;
+    size_t versionsCount;
+    size_t versionsCapacity;
+    uint64_t reclaimed;
+    size_t memoryLimit;
+    Journal *statement;
+};
+
+/*
+ * Position update started from: length of the journal recording it and number
+ * of nodes refused by memory limit before it
+ */
+struct Update
+{
+    size_t start;
+    size_t refused;
+};
+typedef struct Update Update;
+
+/*
+ * Initial number of versions room is made for
+ */
+#define VERSIONS_INITIAL_CAPACITY 16
+
+/*
+ * Checks whether given string is non empty and consists only of quantum states
+ */
+static bool isHistory(const char *history);
+
+/*
+ * Returns status of finished update: QUANT_NO_MEMORY if open transaction could
+ * not record it, given status otherwise. Failed update aborts the transaction.
+ */
+static int updateStatus(Quantization *quantization, int status);
+
+/*
+ * Does work of quantEqualBatch, when "historiesB" are given, or otherwise of
+ * quantEnergyBatch
+ */
+static int updateBatch(Quantization *quantization, const char **historiesA,
+                       const char **historiesB, const Energy *energies,
+                       size_t count, int *statuses);
+
+/*
+ * Closes open transaction, whose changes were already committed or rolled back
+ */
+static void closeTransaction(Quantization *quantization);
+
+/*
+ * Number of nodes moved by defragmentation between two commands
+ */
+#define DEFRAG_SLICE_NODES 256
+
+/*
+ * Number of nodes looked at by spilling between two commands
+ */
+#define TIER_SLICE_NODES 4096
+
+/*
+ * Number of histories quantLookupBatch looks up together
+ */
+#define LOOKUP_BATCH 256
+
+/*
+ * Checks whether any snapshot is not released
+ */
+static bool hasSnapshots(Quantization *quantization);
+
+/*
+ * Returns snapshot with given version, or NULL if there is no such snapshot
+ */
+static Tree *versionOf(Quantization *quantization, Version version);
+
+/*
+ * Prepares update, so that it can be reverted if it does not fit in memory
+ * limit: outside of transaction "statement" journal starts recording it.
+ * Returns false if memory ran out.
+ */
+static bool beginUpdate(Quantization *quantization, Update *update);
+
+/*
+ * Finishes update started with beginUpdate, which ended with given status.
+ * Update stopped by memory limit is reverted and QUANT_OVER_LIMIT returned.
+ */
+static int finishUpdate(Quantization *quantization, const Update *update,
+                        int status);
+
+/*
+ * Reverts changes recorded by journal after its first "length" entries.
+ * Memory limit is lifted meanwhile, as children arrays of restored nodes may
+ * not fit in it while changes being reverted still hold their memory.
+ * Returns false if memory ran out.
+ */
+static bool revertJournal(Quantization *quantization, Journal *journal,
+                          size_t length);
+
+Quantization *quantCreate()
+{
+    Quantization *quantization = malloc(sizeof(Quantization));
+    if (quantization == NULL) return NULL;
+
+    quantization->frozen = NULL;
+    quantization->journal = NULL;
+    quantization->aborted = false;
+    quantization->versions = NULL;
+    quantization->versionsCount = 0;
+    quantization->versionsCapacity = 0;
+    quantization->reclaimed = 0;
+    quantization->memoryLimit = 0;
+    quantization->statement = NULL;
+    quantization->histories = initializeTree();
+    if (quantization->histories == NULL)
+    {
+        free(quantization);
+        return NULL;
+    }
+
+    return quantization;
+}
+
+void quantDestroy(Quantization *quantization)
+{
+    if (quantization == NULL) return;
+
+    // removed subtrees kept for rollback are released by commit
+    if (quantization->journal != NULL)
+    {
+        commitJournal(quantization->journal);
+        closeTransaction(quantization);
+    }
+
+    for (size_t i = 0; i < quantization->versionsCount; ++i)
+    {
+        if (quantization->versions[i] != NULL)
+            releaseSnapshot(quantization->versions[i]);
+    }
+    free(quantization->versions);
+
+    if (quantization->histories != NULL) removeTree(quantization->histories);
+    removeFrozen(quantization->frozen);
+    removeJournal(quantization->statement);
+    free(quantization);
+}
+
+static bool isHistory(const char *history)
+{
+    if (history == NULL) return false;
+
+    return isSymbolSequence(history, strlen(history));
+}
+
+int quantDeclare(Quantization *quantization, const char *history)
+{
+    if (!isHistory(history))
+        return updateStatus(quantization, QUANT_INVALID_ARGUMENT);
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    Update update;
+    if (!beginUpdate(quantization, &update))
+        return updateStatus(quantization, QUANT_NO_MEMORY);
+
+    bool memFail = false;
+    declareHistory(history, quantization->histories, &memFail);
+
+    int status = memFail ? QUANT_NO_MEMORY : QUANT_OK;
+    return updateStatus(quantization,
+                        finishUpdate(quantization, &update, status));
+}
+
+int quantLoad(Quantization *quantization, const char **histories,
+              size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!isHistory(histories[i]))
+            return updateStatus(quantization, QUANT_INVALID_ARGUMENT);
+    }
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    Update update;
+    if (!beginUpdate(quantization, &update))
+        return updateStatus(quantization, QUANT_NO_MEMORY);
+
+    bool memFail = false;
+    loadHistories(histories, count, quantization->histories, &memFail);
+
+    int status = memFail ? QUANT_NO_MEMORY : QUANT_OK;
+    return updateStatus(quantization,
+                        finishUpdate(quantization, &update, status));
+}
+
+int quantRemove(Quantization *quantization, const char *history)
+{
+    if (!isHistory(history))
+        return updateStatus(quantization, QUANT_INVALID_ARGUMENT);
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    Update update;
+    if (!beginUpdate(quantization, &update))
+        return updateStatus(quantization, QUANT_NO_MEMORY);
+
+    bool memFail = false;
+    removeHistory(history, quantization->histories, &memFail);
+
+    int status = memFail ? QUANT_NO_MEMORY : QUANT_OK;
+    return updateStatus(quantization,
+                        finishUpdate(quantization, &update, status));
+}
+
+int quantValid(Quantization *quantization, const char *history, bool *valid)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+
+    if (quantization->frozen != NULL)
+        *valid = validFrozen(history, quantization->frozen);
+    else *valid = validHistory(history, quantization->histories);
+
+    return QUANT_OK;
+}
+
+int quantSetEnergy(Quantization *quantization, const char *history,
+                   Energy energy)
+{
+    if (!isHistory(history) || energy == 0)
+        return updateStatus(quantization, QUANT_INVALID_ARGUMENT);
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    Update update;
+    if (!beginUpdate(quantization, &update))
+        return updateStatus(quantization, QUANT_NO_MEMORY);
+
+    bool error = false;
+    bool memFail = false;
+    energyHistory(history, energy, quantization->histories, &error, &memFail);
+
+    int status = finishUpdate(quantization, &update,
+                              memFail ? QUANT_NO_MEMORY :
+                              error ? QUANT_ERROR : QUANT_OK);
+    if (status == QUANT_NO_MEMORY) return status;
+    return updateStatus(quantization, status);
+}
+
+int quantEnergyBatch(Quantization *quantization, const char **histories,
+                     const Energy *energies, size_t count, int *statuses)
+{
+    return updateBatch(quantization, histories, NULL, energies, count,
+                       statuses);
+}
+
+int quantGetEnergy(Quantization *quantization, const char *history,
+                   Energy *energy)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+
+    Energy found = quantization->frozen != NULL ?
+                   energyFrozen(history, quantization->frozen) :
+                   energyShortHistory(history, quantization->histories);
+    if (found == 0) return QUANT_ERROR; // not declared or no energy assigned
+
+    *energy = found;
+    return QUANT_OK;
+}
+
+int quantEqual(Quantization *quantization, const char *historyA,
+               const char *historyB)
+{
+    if (!isHistory(historyA) || !isHistory(historyB))
+        return updateStatus(quantization, QUANT_INVALID_ARGUMENT);
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    Update update;
+    if (!beginUpdate(quantization, &update))
+        return updateStatus(quantization, QUANT_NO_MEMORY);
+
+    bool error = false;
+    bool memFail = false;
+    equalHistory(historyA, historyB, quantization->histories, &error, &memFail);
+
+    int status = finishUpdate(quantization, &update,
+                              memFail ? QUANT_NO_MEMORY :
+                              error ? QUANT_ERROR : QUANT_OK);
+    if (status == QUANT_NO_MEMORY) return status;
+    return updateStatus(quantization, status);
+}
+
+int quantEqualBatch(Quantization *quantization, const char **historiesA,
+                    const char **historiesB, size_t count, int *statuses)
+{
+    return updateBatch(quantization, historiesA, historiesB, NULL, count,
+                       statuses);
+}
+
+static int updateBatch(Quantization *quantization, const char **historiesA,
+                       const char **historiesB, const Energy *energies,
+                       size_t count, int *statuses)
+{
+    bool *errors = malloc(sizeof(bool) * (count > 0 ? count : 1));
+    if (errors == NULL) return updateStatus(quantization, QUANT_NO_MEMORY);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        bool correct = isHistory(historiesA[i]) &&
+                       (historiesB != NULL ? isHistory(historiesB[i]) :
+                        energies[i] != 0);
+        statuses[i] = !correct ? QUANT_INVALID_ARGUMENT :
+                      quantization->frozen != NULL ? QUANT_ERROR : QUANT_OK;
+        errors[i] = statuses[i] != QUANT_OK;
+    }
+
+    int status = QUANT_OK;
+    Update update;
+    if (quantization->frozen == NULL && !beginUpdate(quantization, &update))
+        status = QUANT_NO_MEMORY;
+
+    if (quantization->frozen == NULL && status == QUANT_OK)
+    {
+        bool memFail = false;
+        if (historiesB != NULL)
+            equalHistories(historiesA, historiesB, count,
+                           quantization->histories, errors, &memFail);
+        else
+            energyHistories(historiesA, energies, count,
+                            quantization->histories, errors, &memFail);
+
+        status = finishUpdate(quantization, &update,
+                              memFail ? QUANT_NO_MEMORY : QUANT_OK);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (status != QUANT_OK) statuses[i] = status;
+        else if (errors[i] && statuses[i] == QUANT_OK)
+            statuses[i] = QUANT_ERROR;
+
+        // failed pair aborts transaction, like failed update
+        if (statuses[i] != QUANT_OK && statuses[i] != QUANT_NO_MEMORY &&
+            updateStatus(quantization, statuses[i]) == QUANT_NO_MEMORY)
+            status = QUANT_NO_MEMORY;
+    }
+
+    free(errors);
+    return status;
+}
+
+Energy quantEqualEnergy(Energy energyA, Energy energyB)
+{
+    if (energyA == 0) return energyB;
+    if (energyB == 0) return energyA;
+
+    return average(energyA, energyB);
+}
+
+int quantEquivalent(Quantization *quantization, const char *historyA,
+                    const char *historyB, bool *equivalent)
+{
+    if (!isHistory(historyA) || !isHistory(historyB))
+        return QUANT_INVALID_ARGUMENT;
+
+    // frozen histories keep no equalities
+    if (quantization->frozen != NULL)
+    {
+        if (!validFrozen(historyA, quantization->frozen) ||
+            !validFrozen(historyB, quantization->frozen)) return QUANT_ERROR;
+
+        *equivalent = strcmp(historyA, historyB) == 0;
+        return QUANT_OK;
+    }
+
+    Tree *nodeA = findHistory(historyA, quantization->histories);
+    Tree *nodeB = nodeA == NULL ? NULL :
+                  findHistory(historyB, quantization->histories);
+    if (nodeA == NULL || nodeB == NULL) return QUANT_ERROR;
+
+    bool memFail = false;
+    *equivalent = sameClass(nodeA, nodeB, &memFail);
+
+    return memFail ? QUANT_NO_MEMORY : QUANT_OK;
+}
+
+int quantShare(Quantization *quantization, const char *history)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    Tree *node = findHistory(history, quantization->histories);
+    if (node == NULL) return QUANT_ERROR;
+
+    // the mark is not an update, nodes shared with snapshots may carry it
+    bool memFail = false;
+    shareClass(node, &memFail);
+
+    return memFail ? QUANT_NO_MEMORY : QUANT_OK;
+}
+
+int quantShared(Quantization *quantization, const char *history, bool subtree,
+                bool *shared)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+
+    *shared = false;
+    if (quantization->frozen != NULL) return QUANT_OK;
+
+    Tree *node = findHistory(history, quantization->histories);
+    if (node != NULL)
+        *shared = subtree ? subtreeSpansTrees(node) : spansTrees(node);
+
+    return QUANT_OK;
+}
+
+void quantMergeAggregate(Aggregate *into, const Aggregate *from)
+{
+    mergeAggregate(into, from);
+}
+
+int quantAggregate(Quantization *quantization, const char *history,
+                   Aggregate *aggregate)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+
+    bool found = quantization->frozen != NULL ?
+                 aggregateFrozen(history, quantization->frozen, 0, aggregate) :
+                 aggregateHistory(history, quantization->histories, aggregate);
+    if (!found) return QUANT_ERROR;
+
+    return QUANT_OK;
+}
+
+int quantLookupBatch(Quantization *quantization, const char **histories,
+                     size_t count, int *statuses, bool *valid,
+                     Energy *energies)
+{
+    const char *correct[LOOKUP_BATCH];
+    size_t positions[LOOKUP_BATCH];
+    Tree *found[LOOKUP_BATCH];
+
+    for (size_t first = 0; first < count; first += LOOKUP_BATCH)
+    {
+        size_t last = first + LOOKUP_BATCH < count ? first + LOOKUP_BATCH :
+                      count;
+        size_t correctCount = 0;
+
+        for (size_t i = first; i < last; ++i)
+        {
+            statuses[i] = isHistory(histories[i]) ? QUANT_OK :
+                          QUANT_INVALID_ARGUMENT;
+            valid[i] = false;
+            energies[i] = 0;
+
+            if (statuses[i] != QUANT_OK) continue;
+
+            if (quantization->frozen != NULL)
+            {
+                valid[i] = validFrozen(histories[i], quantization->frozen);
+                energies[i] = energyFrozen(histories[i], quantization->frozen);
+                continue;
+            }
+
+            positions[correctCount] = i;
+            correct[correctCount++] = histories[i];
+        }
+
+        findHistories(correct, correctCount, quantization->histories, found);
+
+        bool spilled = quantization->frozen == NULL &&
+                       hasSpilled(quantization->histories);
+        for (size_t j = 0; j < correctCount; ++j)
+        {
+            // walk stops at stub of spilled subtree, which is read from file
+            if (found[j] == NULL && spilled)
+            {
+                Tree *histories = quantization->histories;
+                valid[positions[j]] = validHistory(correct[j], histories);
+                energies[positions[j]] = energyShortHistory(correct[j],
+                                                            histories);
+                continue;
+            }
+
+            valid[positions[j]] = found[j] != NULL;
+            if (found[j] != NULL) energies[positions[j]] = found[j]->energy;
+        }
+    }
+
+    return QUANT_OK;
+}
+
+int quantBegin(Quantization *quantization)
+{
+    if (quantization->journal != NULL || quantization->frozen != NULL)
+        return QUANT_ERROR;
+
+    quantization->journal = initializeJournal();
+    if (quantization->journal == NULL) return QUANT_NO_MEMORY;
+
+    quantization->aborted = false;
+    attachJournal(quantization->histories, quantization->journal);
+
+    return QUANT_OK;
+}
+
+int quantCommit(Quantization *quantization)
+{
+    if (quantization->journal == NULL) return QUANT_ERROR;
+    if (quantization->aborted)
+    {
+        int status = quantRollback(quantization);
+        return status == QUANT_OK ? QUANT_ERROR : status;
+    }
+
+    commitJournal(quantization->journal);
+    closeTransaction(quantization);
+
+    return QUANT_OK;
+}
+
+int quantRollback(Quantization *quantization)
+{
+    if (quantization->journal == NULL) return QUANT_ERROR;
+    if (journalFailed(quantization->journal)) return QUANT_NO_MEMORY;
+
+    if (!revertJournal(quantization, quantization->journal, 0))
+        return QUANT_NO_MEMORY;
+
+    closeTransaction(quantization);
+
+    return QUANT_OK;
+}
+
+void quantAbort(Quantization *quantization)
+{
+    if (quantization->journal != NULL) quantization->aborted = true;
+}
+
+static void closeTransaction(Quantization *quantization)
+{
+    attachJournal(quantization->histories, NULL);
+    removeJournal(quantization->journal);
+    quantization->journal = NULL;
+    quantization->aborted = false;
+}
+
+static bool beginUpdate(Quantization *quantization, Update *update)
+{
+    if (quantization->memoryLimit == 0) return true;
+
+    update->refused = refusedNodes(quantization->histories);
+    if (quantization->journal != NULL)
+    {
+        update->start = journalLength(quantization->journal);
+        return true;
+    }
+
+    if (quantization->statement == NULL)
+    {
+        quantization->statement = initializeJournal();
+        if (quantization->statement == NULL) return false;
+    }
+
+    update->start = 0;
+    attachJournal(quantization->histories, quantization->statement);
+    return true;
+}
+
+static int finishUpdate(Quantization *quantization, const Update *update,
+                        int status)
+{
+    if (quantization->memoryLimit == 0) return status;
+
+    Journal *journal = quantization->journal != NULL ? quantization->journal :
+                       quantization->statement;
+
+    // journal that could not record every change cannot revert them either
+    if (refusedNodes(quantization->histories) != update->refused &&
+        !journalFailed(journal))
+    {
+        status = revertJournal(quantization, journal, update->start) ?
+                 QUANT_OVER_LIMIT : QUANT_NO_MEMORY;
+    }
+
+    if (quantization->journal != NULL) return status;
+
+    commitJournal(journal);
+    attachJournal(quantization->histories, NULL);
+    if (journalFailed(journal))
+    {
+        removeJournal(journal);
+        quantization->statement = NULL;
+    }
+
+    return status;
+}
+
+static bool revertJournal(Quantization *quantization, Journal *journal,
+                          size_t length)
+{
+    bool memFail = false;
+
+    limitTreeMemory(quantization->histories, 0);
+    rollbackJournalTo(journal, length, &memFail);
+    limitTreeMemory(quantization->histories, quantization->memoryLimit);
+
+    return !memFail;
+}
+
+static int updateStatus(Quantization *quantization, int status)
+{
+    if (quantization->journal == NULL) return status;
+    if (journalFailed(quantization->journal)) return QUANT_NO_MEMORY;
+
+    if (status != QUANT_OK) quantization->aborted = true;
+    return status;
+}
+
+int quantSnapshot(Quantization *quantization, Version *version)
+{
+    // snapshot taken inside transaction would hold its uncommitted updates
+    if (quantization->journal != NULL || quantization->frozen != NULL)
+        return QUANT_ERROR;
+
+    if (quantization->versionsCount == quantization->versionsCapacity)
+    {
+        size_t capacity = quantization->versionsCapacity == 0 ?
+                          VERSIONS_INITIAL_CAPACITY :
+                          quantization->versionsCapacity * 2;
+        Tree **expanded = realloc(quantization->versions,
+                                  sizeof(Tree *) * capacity);
+        if (expanded == NULL) return QUANT_NO_MEMORY;
+
+        quantization->versions = expanded;
+        quantization->versionsCapacity = capacity;
+    }
+
+    size_t refused = refusedNodes(quantization->histories);
+    Tree *snapshot = snapshotTree(quantization->histories);
+    if (snapshot == NULL)
+    {
+        return refusedNodes(quantization->histories) != refused ?
+               QUANT_OVER_LIMIT : QUANT_NO_MEMORY;
+    }
+
+    quantization->versions[quantization->versionsCount++] = snapshot;
+    *version = quantization->versionsCount;
+
+    return QUANT_OK;
+}
+
+int quantRelease(Quantization *quantization, Version version)
+{
+    Tree *snapshot = versionOf(quantization, version);
+    if (snapshot == NULL) return QUANT_ERROR;
+
+    releaseSnapshot(snapshot);
+    quantization->versions[version - 1] = NULL;
+
+    return QUANT_OK;
+}
+
+int quantValidAt(Quantization *quantization, Version version,
+                 const char *history, bool *valid)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+
+    Tree *snapshot = versionOf(quantization, version);
+    if (snapshot == NULL) return QUANT_ERROR;
+
+    *valid = validHistory(history, snapshot);
+
+    return QUANT_OK;
+}
+
+int quantGetEnergyAt(Quantization *quantization, Version version,
+                     const char *history, Energy *energy)
+{
+    if (!isHistory(history)) return QUANT_INVALID_ARGUMENT;
+
+    Tree *snapshot = versionOf(quantization, version);
+    if (snapshot == NULL) return QUANT_ERROR;
+
+    Energy found = energyShortHistory(history, snapshot);
+    if (found == 0) return QUANT_ERROR;
+
+    *energy = found;
+    return QUANT_OK;
+}
+
+static Tree *versionOf(Quantization *quantization, Version version)
+{
+    if (version == 0 || version > quantization->versionsCount) return NULL;
+
+    return quantization->versions[version - 1];
+}
+
+int quantFreeze(Quantization *quantization)
+{
+    if (quantization->journal != NULL || quantization->frozen != NULL)
+        return QUANT_ERROR;
+
+    // snapshots share nodes with histories, which are released
+    if (hasSnapshots(quantization)) return QUANT_ERROR;
+
+    if (!thawTree(quantization->histories)) return QUANT_NO_MEMORY;
+
+    quantization->frozen = freezeTree(quantization->histories);
+    if (quantization->frozen == NULL) return QUANT_NO_MEMORY;
+
+    removeTree(quantization->histories);
+    quantization->histories = NULL;
+
+    return QUANT_OK;
+}
+
+int quantCompact(Quantization *quantization)
+{
+    // rollback and snapshots expect every node to have a single parent
+    if (quantization->journal != NULL || quantization->frozen != NULL ||
+        hasSnapshots(quantization))
+        return QUANT_ERROR;
+
+    bool memFail = false;
+    quantization->reclaimed += compactTree(quantization->histories, &memFail);
+
+    return memFail ? QUANT_NO_MEMORY : QUANT_OK;
+}
+
+int quantStatistics(Quantization *quantization, Statistics *statistics)
+{
+    if (quantization->frozen != NULL)
+        frozenStatistics(quantization->frozen, statistics);
+    else treeStatistics(quantization->histories, statistics);
+
+    statistics->reclaimed = quantization->reclaimed;
+
+    return QUANT_OK;
+}
+
+int quantDefragment(Quantization *quantization)
+{
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    startDefragmentation(quantization->histories);
+
+    return QUANT_OK;
+}
+
+void quantMaintain(Quantization *quantization)
+{
+    if (quantization->frozen != NULL) return;
+
+    defragmentTree(quantization->histories, DEFRAG_SLICE_NODES);
+    spillTree(quantization->histories, TIER_SLICE_NODES);
+}
+
+int quantSetMemoryLimit(Quantization *quantization, size_t bytes)
+{
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    quantization->memoryLimit = bytes;
+    limitTreeMemory(quantization->histories, bytes);
+
+    return QUANT_OK;
+}
+
+int quantSetIndex(Quantization *quantization, bool enabled)
+{
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    if (!indexTree(quantization->histories, enabled)) return QUANT_NO_MEMORY;
+
+    return QUANT_OK;
+}
+
+int quantSetTiering(Quantization *quantization, const char *path,
+                    size_t residentBytes)
+{
+    if (quantization->frozen != NULL) return QUANT_ERROR;
+
+    if (!tierTree(quantization->histories, path, residentBytes))
+        return QUANT_ERROR;
+
+    return QUANT_OK;
+}
+
+static bool hasSnapshots(Quantization *quantization)
+{
+    for (size_t i = 0; i < quantization->versionsCount; ++i)
+    {
+        if (quantization->versions[i] != NULL) return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,323 @@
+#ifndef QUANTIZATION_QUANTIZATION_H
+#define QUANTIZATION_QUANTIZATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Public interface of libquantization. Every piece of state lives in the
+ * Quantization context, so any number of independent instances can be used in
+ * one process, each from its own thread. A single instance is not synchronised
+ * and must not be used by two threads at the same time.
+ *
+ * Functions never print anything, they report the outcome with one of the
+ * status codes below and return values through pointer arguments.
+ */
+
+/*
+ * Operation succeeded
+ */
+#define QUANT_OK 0
+
+/*
+ * Operation is not allowed for the current state, e.g. history is not declared
+ * or has no energy assigned
+ */
+#define QUANT_ERROR 1
+
+/*
+ * Argument is malformed, e.g. history contains characters outside of the
+ * alphabet, or energy is equal to 0
+ */
+#define QUANT_INVALID_ARGUMENT 2
+
+/*
+ * Memory allocation failed
+ */
+#define QUANT_NO_MEMORY 3
+
+/*
+ * Update was rejected, because histories would not fit in memory limit set
+ * with quantSetMemoryLimit. Histories are left as they were before it.
+ */
+#define QUANT_OVER_LIMIT 4
+
+/*
+ * Opaque handle holding one independent set of histories
+ */
+typedef struct Quantization Quantization;
+
+/*
+ * Creates new, empty context. Returns NULL if allocation failed.
+ */
+Quantization *quantCreate();
+
+/*
+ * Releases context and everything it holds. Passing NULL is allowed.
+ */
+void quantDestroy(Quantization *quantization);
+
+/*
+ * Declares given history and all its prefixes as valid.
+ */
+int quantDeclare(Quantization *quantization, const char *history);
+
+/*
+ * Declares all given histories, like quantDeclare called for each of them, but
+ * much faster for large batches. Nothing is declared if any history is
+ * malformed.
+ */
+int quantLoad(Quantization *quantization, const char **histories,
+              size_t count);
+
+/*
+ * Removes given history and every history it is prefix of.
+ */
+int quantRemove(Quantization *quantization, const char *history);
+
+/*
+ * Stores in "valid" whether given history is declared.
+ */
+int quantValid(Quantization *quantization, const char *history, bool *valid);
+
+/*
+ * Assigns energy to declared history, and to every history equal to it.
+ */
+int quantSetEnergy(Quantization *quantization, const char *history,
+                   Energy energy);
+
+/*
+ * Assigns energies to "count" histories, with the same outcome as
+ * quantSetEnergy called for each of them in turn, storing status it would
+ * return in "statuses". Every class of equal histories is given its final
+ * energy once, so it is much faster when the same large classes are assigned
+ * many times. Returns QUANT_OK once statuses are stored, QUANT_NO_MEMORY if
+ * memory ran out, or QUANT_OVER_LIMIT if changes do not fit in memory limit
+ * together, then no energy is assigned.
+ */
+int quantEnergyBatch(Quantization *quantization, const char **histories,
+                     const Energy *energies, size_t count, int *statuses);
+
+/*
+ * Stores energy of given history in "energy". Returns QUANT_ERROR if history
+ * is not declared or has no energy assigned.
+ */
+int quantGetEnergy(Quantization *quantization, const char *history,
+                   Energy *energy);
+
+/*
+ * Puts two declared histories into equality relation. At least one of them
+ * must have energy assigned.
+ */
+int quantEqual(Quantization *quantization, const char *historyA,
+               const char *historyB);
+
+/*
+ * Puts histories at the same positions of "historiesA" and "historiesB" into
+ * equality relation, with the same outcome as quantEqual called for each pair
+ * in turn, storing status it would return in "statuses". All equalities are
+ * added first and energy of every class of equal histories they join is
+ * spread once at the end, instead of after each of them. Returns like
+ * quantEnergyBatch.
+ */
+int quantEqualBatch(Quantization *quantization, const char **historiesA,
+                    const char **historiesB, size_t count, int *statuses);
+
+/*
+ * Returns energy quantEqual gives to both histories when they have energies
+ * "energyA" and "energyB", 0 meaning no energy. Returns 0 if neither has it.
+ */
+Energy quantEqualEnergy(Energy energyA, Energy energyB);
+
+/*
+ * Checks whether two declared histories are in the same class of equal
+ * histories, storing the answer in "equivalent". Takes time proportional to
+ * size of the class. Returns QUANT_ERROR if either history is not declared.
+ */
+int quantEquivalent(Quantization *quantization, const char *historyA,
+                    const char *historyB, bool *equivalent);
+
+/*
+ * Marks class of equal histories of given history as equal to histories kept
+ * outside of this context, so that caller which keeps such equalities itself
+ * can tell which histories they reach, see quantShared. Histories stay marked
+ * until they are removed, also when the class is split or transaction that
+ * shared it is rolled back, and histories made equal to them later are marked
+ * too. Returns QUANT_ERROR if history is not declared or histories are frozen.
+ */
+int quantShare(Quantization *quantization, const char *history);
+
+/*
+ * Stores in "shared" whether given history, or any history it is prefix of
+ * if "subtree" is set, was marked by quantShare, false if it is not declared.
+ * Subtree is walked whole, unless no class was ever shared.
+ */
+int quantShared(Quantization *quantization, const char *history, bool subtree,
+                bool *shared);
+
+/*
+ * Stores in "aggregate" summary of given history and all histories it is
+ * prefix of: their number, sum of energies and smallest and largest energy.
+ * Takes time proportional to length of the history if built with
+ * SUBTREE_AGGREGATES, to size of its subtree otherwise.
+ */
+int quantAggregate(Quantization *quantization, const char *history,
+                   Aggregate *aggregate);
+
+/*
+ * Adds summary "from" to summary "into", so that it describes histories of
+ * both of them, which must not overlap
+ */
+void quantMergeAggregate(Aggregate *into, const Aggregate *from);
+
+/*
+ * Looks up "count" histories at once, much faster than one by one on large
+ * histories, as lookups are interleaved and memory latency of one of them is
+ * hidden behind the others. For every history stores at the same position
+ * status quantValid would return, whether it is declared in "valid" and its
+ * energy in "energies", 0 if it has none or is not declared.
+ */
+int quantLookupBatch(Quantization *quantization, const char **histories,
+                     size_t count, int *statuses, bool *valid,
+                     Energy *energies);
+
+/*
+ * Opens transaction. Until it is closed, every update is recorded, so that all
+ * of them can be reverted together. Returns QUANT_ERROR if transaction is
+ * already open, they cannot be nested.
+ */
+int quantBegin(Quantization *quantization);
+
+/*
+ * Closes open transaction keeping its updates. If any update in it failed, or
+ * quantAbort was called, updates are reverted instead and QUANT_ERROR is
+ * returned, so that the transaction is applied either whole or not at all.
+ * Returns QUANT_ERROR if there is no open transaction too.
+ */
+int quantCommit(Quantization *quantization);
+
+/*
+ * Closes open transaction reverting all its updates. Takes time proportional
+ * to the number of changes they made. Returns QUANT_ERROR if there is no open
+ * transaction.
+ */
+int quantRollback(Quantization *quantization);
+
+/*
+ * Marks open transaction as failed, so that quantCommit reverts it. Meant for
+ * failures noticed outside of the library, e.g. malformed commands. Does
+ * nothing when no transaction is open.
+ */
+void quantAbort(Quantization *quantization);
+
+/*
+ * Takes snapshot of all histories and stores its version in "version".
+ * Snapshot can be queried until it is released, while histories keep changing.
+ * Takes constant time, nodes are copied only when they change, so memory used
+ * by snapshot is proportional to changes made after it was taken. Returns
+ * QUANT_ERROR inside transaction.
+ */
+int quantSnapshot(Quantization *quantization, Version *version);
+
+/*
+ * Releases snapshot with given version. Returns QUANT_ERROR if there is no
+ * such snapshot.
+ */
+int quantRelease(Quantization *quantization, Version version);
+
+/*
+ * Works like quantValid, but on snapshot with given version. Returns
+ * QUANT_ERROR if there is no such snapshot.
+ */
+int quantValidAt(Quantization *quantization, Version version,
+                 const char *history, bool *valid);
+
+/*
+ * Works like quantGetEnergy, but on snapshot with given version.
+ */
+int quantGetEnergyAt(Quantization *quantization, Version version,
+                     const char *history, Energy *energy);
+
+/*
+ * Converts histories into compact, read only form, which takes a few bits per
+ * history instead of tens of bytes. Afterwards queries keep working, aggregates
+ * taking time proportional to size of the subtree, but every update, snapshot
+ * and transaction returns QUANT_ERROR. Equalities are dropped, energies they
+ * shared are kept. Spilled histories are brought back first, QUANT_NO_MEMORY
+ * is returned if they do not fit. Returns QUANT_ERROR inside transaction, when
+ * histories are already frozen, or while any snapshot is not released.
+ */
+int quantFreeze(Quantization *quantization);
+
+/*
+ * Merges identical subtrees of histories that have neither energy nor
+ * equalities, so that each is kept once. Histories behave exactly as before,
+ * nodes are copied back when they change. Takes time proportional to number
+ * of histories, so it is meant to be run now and then, e.g. after a large
+ * load. Returns QUANT_ERROR inside transaction, after freezing, or while any
+ * snapshot is not released.
+ */
+int quantCompact(Quantization *quantization);
+
+/*
+ * Stores in "statistics" number of nodes kept, bytes reserved for them, their
+ * equalities, children arrays, journal, index and finger, and bytes given back
+ * by compaction so far.
+ */
+int quantStatistics(Quantization *quantization, Statistics *statistics);
+
+/*
+ * Starts moving histories into consecutive memory, in the order they are
+ * walked, which makes lookups faster after many declarations and removals.
+ * The work is done by quantMaintain. Returns QUANT_ERROR after freezing.
+ */
+int quantDefragment(Quantization *quantization);
+
+/*
+ * Does a small, bounded part of background work, meant to be called between
+ * other operations: moves a few hundred nodes as part of defragmentation, and
+ * spills a few cold subtrees if histories are tiered. Defragmentation starts
+ * by itself once memory held by histories is mostly empty space. Both wait
+ * while transaction is open or any snapshot is not released.
+ */
+void quantMaintain(Quantization *quantization);
+
+/*
+ * Limits memory held by histories and their snapshots, as reported by
+ * quantStatistics, to given number of bytes, 0 removes the limit. Updates and
+ * snapshots that would need more return QUANT_OVER_LIMIT and change nothing,
+ * so that the context can be used further. To make it possible, while the
+ * limit is set every update is recorded as in transaction, which makes it a
+ * little slower. Journal entries are counted too, but never refused, and index
+ * and finger just stop growing at the limit. Limit lower than memory already
+ * held is allowed, then only updates that fit in memory held keep succeeding.
+ * Returns QUANT_ERROR after freezing.
+ */
+int quantSetMemoryLimit(Quantization *quantization, size_t bytes);
+
+/*
+ * Turns on or off index of long histories, which finds declared histories of
+ * a few dozen states and more in constant time, instead of time proportional
+ * to their length. Worth it when such histories are queried over and over,
+ * it makes updates a little slower and takes memory for every history looked
+ * up. Returns QUANT_ERROR after freezing.
+ */
+int quantSetIndex(Quantization *quantization, bool enabled);
+
+/*
+ * Keeps histories in two tiers: once nodes take more than "residentBytes",
+ * subtrees not used for a while are spilled to scratch file created at given
+ * path, which must not exist yet and is removed at once, so it never outlives
+ * the context. Spilled histories are read straight from the file, which the
+ * system maps into memory as needed, while updating them brings their whole
+ * subtree back first. Spilling is done by quantMaintain, subtrees with
+ * equalities are never spilled, and nothing is spilled after quantCompact,
+ * though subtrees spilled before stay so. Returns QUANT_ERROR
+ * after freezing, when histories are already tiered, or the file could not be
+ * created.
+ */
+int quantSetTiering(Quantization *quantization, const char *path,
+                    size_t residentBytes);
+
+#endif //QUANTIZATION_QUANTIZATION_H
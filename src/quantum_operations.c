@@ -2,87 +2,159 @@
 // Created by filip on 08.07.19.
 //
 
-#include <errno.h>
 #include "quantum_operations.h"
+#include "children.h"
+#include "finger.h"
+#include "frozen.h"
+#include "index.h"
+#include "journal.h"
+#include "pool.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "teardown.h"
+#include "tiering.h"
+#include "tree.h"
 
 /*
- * This function returns index associated with given char, necessary to access
- * proper node in the histories tree. For example: for char '0' int 0 is returned,
- * for char '1' int 1 etc. Function takes advantage of the fact chars are in
- * order from lowest to highest, so for example if we subtract '0' from '1' we get 1.
+ * Removes equalities of all nodes in subtree and drops reference to it, which
+ * leaves nodes shared with snapshots there
  */
-static int charToIndex(char argument);
+static void dropShared(Tree *histories);
 
 /*
- * Marks node as unvisited
+ * Removes equalities of all nodes in subtree and releases their children
+ * arrays, leaving node memory itself to be released together with the pool.
  */
-static void unMarkVisited(Tree *node);
+static void clearSubtree(Tree *histories);
 
 /*
- * Helper function for history removal. It calls itself on all available "next"
- * nodes, and then removes node given as argument.
+ * Returns journal recording changes of histories given node belongs to, or
+ * NULL if they are not recorded
  */
-static void recurrentRemoval(Tree *histories);
+static Journal *journalOf(const Tree *node);
 
 /*
- * Function sets all "next" pointers to NULL, and energy to 0, which means no
- * energy assigned. Intended to be used on newly made nodes. Also sets visited
- * to false.
+ * Number of lookups findHistories advances together. Each of them waits for
+ * its next node to reach cache while the others take their steps.
  */
-static void allNull(Tree *newNode);
+#define LOOKUP_WINDOW 16
 
 /*
- * Function parses given string to Energy value, sets "error" to true if there
- * were any errors.
+ * Lookup in progress: "position" is the rest of history, "node" the node
+ * reached so far and "index" position of the history in the batch. Found
+ * history is put into index of histories with "key" if "indexed" is true.
  */
-static Energy parseToEnergy(char *argument, bool **error);
+struct Lookup
+{
+    const char *position;
+    Tree *node;
+    size_t index;
+    bool indexed;
+    HistoryKey key;
+};
+typedef struct Lookup Lookup;
 
 /*
- * Function walks through histories tree and returns node described with
- * "argument" string
- * Sets "error" to true if there is no such history
+ * Counts equalities of all nodes in subtree, those joining two of its nodes
+ * are counted twice
  */
-static Tree *getHistory(char *argument, Tree *histories, bool **error);
+static size_t countEqualities(Tree *histories);
 
 /*
- * Makes new Equals data structure, used to connect two histories in equality
- * relation. Sets "memFail" to true if there is not enough memory available
+ * Takes all equalities of nodes in subtree out of equality lists, recording
+ * them in journal, which must already have room for them
  */
-static Equals *makeNewEquals(Tree *historyA, Tree *historyB, bool **memFail);
+static void cutEqualities(Tree *histories, Journal *journal);
+
+/*
+ * Makes writable every node outside of "removed" subtree that is equal to a
+ * node of "histories" subtree. Returns false if there was not enough memory.
+ */
+static bool writableEqualities(Tree *histories, const Tree *removed,
+                               bool *memFail);
+
+/*
+ * Checks whether node belongs to subtree of "root"
+ */
+static bool isInside(const Tree *node, const Tree *root);
+
+/*
+ * Node on the path kept while loading sorted histories. "added" counts nodes
+ * created below it so far, "created" tells whether node itself is new.
+ */
+struct LoadFrame
+{
+    Tree *node;
+    uint64_t added;
+    bool created;
+};
+typedef struct LoadFrame LoadFrame;
+
+/*
+ * Range of histories which share first "depth" states, waiting to be sorted
+ */
+struct SortRange
+{
+    size_t start;
+    size_t count;
+    size_t depth;
+};
+typedef struct SortRange SortRange;
 
 /*
- * Adds Equals data structure to list kept by given history.
- * Sets "memFail" to true if there is not enough memory available
+ * Ranges smaller than this are sorted by insertion instead of distribution
  */
-static void addToEquals(Equals *newEquals, Tree *history, bool **memFail);
+#define INSERTION_SORT_LIMIT 32
 
 /*
- * Updates all nodes which are in equality relation with given node
+ * Sorts histories by states, most significant first, with radix sort.
+ * Returns false if there was not enough memory.
  */
-static void
-updateEquals(Tree *node, Energy energy);
+static bool sortHistories(const char **histories, size_t count);
 
 /*
- * Checks if given node has been already visited in current run of energy update
- * in entire equality relation
+ * Sorts small range of histories that share first "depth" states by insertion
  */
-static bool isVisited(Tree *node);
+static void insertionSort(const char **histories, size_t count, size_t depth);
 
 /*
- * Marks node as visited in current run of energy update in entire equality relation
+ * Compares histories by states, starting from given depth. Returns negative
+ * number, 0 or positive number like strcmp.
  */
-static void markVisited(Tree *node);
+static int compareHistories(const char *historyA, const char *historyB,
+                            size_t depth);
 
 /*
- * Runs updateEquals for all nodes equalized with given node
+ * Returns radix sort bucket of history at given depth: 0 if history ends
+ * there, and state increased by one otherwise
  */
-static void visitAllEquals(Tree *node, Energy energy);
+static unsigned bucketAt(const char *history, size_t depth);
 
 /*
- * This function removes all EqualsList and Equals associated with given node.
- * It also removes appropriate EqualsList from each node it was equalized with
+ * Finishes node at "depth" of loading path: fixes its count of histories and
+ * passes number of new nodes to its parent frame.
  */
-static void removeAllEquals(Tree *node);
+static void finishFrame(LoadFrame *path, size_t depth);
+
+/*
+ * Function walks through histories tree and returns node described with
+ * "argument" string
+ * Sets "error" to true if there is no such history
+ */
+static Tree *getHistory(const char *argument, Tree *histories, bool **error);
+
+/*
+ * Makes new Equals data structure, used to connect two histories in equality
+ * relation, charged to the pool of "historyA". Sets "memFail" to true if there
+ * is not enough memory available
+ */
+static Equals *makeNewEquals(Tree *historyA, Tree *historyB, bool **memFail);
+
+/*
+ * Adds Equals data structure to list kept by given history, in given cell
+ * charged to the pool of the history
+ */
+static void addToEquals(Equals *newEquals, Tree *history, EqualsList *cell);
 
 /*
  * Removes given equality  node`s equality list. Note that "Equals"
@@ -92,12 +164,6 @@ static void removeAllEquals(Tree *node);
  */
 static void removeFromEquals(Tree *node, Equals *equals);
 
-/*
- * Checks if histories are already equalized. Returns true if they are, false
- * otherwise
- */
-static bool alreadyEqual(Tree *historyA, Tree *historyB);
-
 /*
  * Checks if given history has any energy assigned
  */
@@ -107,120 +173,872 @@ static bool hasEnergy(Tree *history);
  * Updates energy on two equalized histories, meant to be used on newly equated
  * histories
  */
-static void updateEnergy(Tree *historyA, Tree *historyB);
+static void updateEnergy(Tree *historyA, Tree *historyB, bool *memFail);
 
 /*
- * Calculates average of two energy values
+ * Walks class of equal histories of given node, marking each of its nodes as
+ * spanning if "mark" is set. Returns true as soon as "wanted" node is reached,
+ * which ends the walk. Sets "memFail" if there was not enough memory.
  */
-static Energy average(Energy energyA, Energy energyB);
+static bool walkClass(Tree *node, const Tree *wanted, bool mark,
+                      bool *memFail);
+
+/*
+ * Number of nodes of class of equal histories spreadEnergy has room for at
+ * first
+ */
+#define CLASS_INITIAL_CAPACITY 16
+
+/*
+ * Assigns energy to single node and updates aggregates of all its ancestors.
+ * Previous energy is recorded if histories have a journal. Returns the node,
+ * which is its copy if it was shared with a snapshot, or NULL, setting
+ * "memFail", if there was not enough memory.
+ */
+static Tree *setEnergy(Tree *node, Energy energy, bool *memFail);
+
+#if SUBTREE_AGGREGATES
+/*
+ * Recalculates smallest and largest energy in node`s subtree from its own energy
+ * and aggregates of its children. Returns true if any of them changed.
+ */
+static bool refreshExtremes(Tree *node);
+#else
+/*
+ * Adds to "aggregate" given node and all its descendants, walking them
+ */
+static void summarizeSubtree(const Tree *node, Aggregate *aggregate);
+#endif
+
+/*
+ * Updates aggregates after "created" new nodes were added as a chain ending
+ * with "deepest" node
+ */
+static void addCreatedNodes(Tree *deepest, unsigned created);
 
 Tree *initializeTree()
 {
-    Tree *start = malloc(sizeof(Tree));
+    Pool *pool = poolCreate(sizeof(Tree));
+    if (pool == NULL) return NULL;
+
+    TreeState *state = malloc(sizeof(TreeState));
+    Tree *start = poolAllocate(pool);
 
     // mem alloc fail
-    if (start == NULL)
+    if (state == NULL || start == NULL)
     {
+        free(state);
+        poolDestroy(pool);
         return NULL;
     }
 
+    state->journal = NULL;
+    state->versions = 0;
+    state->compacted = false;
+    state->path = NULL;
+    state->pathCapacity = 0;
+    state->defragmenting = false;
+    state->defragPath = NULL;
+    state->defragNodes = NULL;
+    state->defragDepth = 0;
+    state->defragCapacity = 0;
+    state->defragReleased = 0;
+    state->root = start;
+    state->fingerHistory = NULL;
+    state->fingerNodes = NULL;
+    state->fingerLength = 0;
+    state->fingerCapacity = 0;
+    state->equalized = false;
+    state->joined = false;
+    state->index = NULL;
+    state->tiers = NULL;
+    state->teardown = NULL;
+    poolSetContext(pool, state);
+
     allNull(start);
 
     return start;
 }
 
-static void allNull(Tree *newNode)
+void allNull(Tree *newNode)
 {
-    for (unsigned i = 0; i < STATES; ++i)
-    {
-        newNode->next[i] = NULL;
-    }
+    initializeChildren(newNode);
 
+    newNode->parent = NULL;
     newNode->equalsList = NULL;
     newNode->energy = 0;
     newNode->visited = false;
+    newNode->spilled = false;
+    newNode->spanning = false;
+    newNode->lastUsed = 0;
+    newNode->references = 1;
+#if SUBTREE_AGGREGATES
+    newNode->aggregate.count = 1;
+    newNode->aggregate.energySum = 0;
+    newNode->aggregate.minEnergy = 0;
+    newNode->aggregate.maxEnergy = 0;
+#endif
 }
 
 void removeTree(Tree *histories)
 {
-    for (unsigned i = 0; i < STATES; ++i)
+    Pool *pool = poolOf(histories);
+    TreeState *state = poolContext(pool);
+
+    // nodes owning no memory are released with the pool at once
+    bool nodesOwnMemory = state->equalized || !DENSE_CHILDREN;
+    if (nodesOwnMemory &&
+        (poolLiveObjects(pool) < TEARDOWN_PARALLEL_NODES ||
+         !tearDownInParallel(histories, NULL, clearSubtree)))
     {
-        if (histories->next[i] != NULL)
-        {
-            removeTree(histories->next[i]);
-        }
+        clearSubtree(histories);
     }
 
-    removeAllEquals(histories);
-    free(histories);
+    free(state->path);
+    free(state->defragPath);
+    free(state->defragNodes);
+    free(state->fingerNodes);
+    indexTree(histories, false);
+    removeTiers(state->tiers);
+    removeTeardownPool(state->teardown);
+    free(state);
+    poolDestroy(pool);
 }
 
-static int charToIndex(char argument)
+static void clearSubtree(Tree *histories)
 {
-    return argument - '0';
+    // subtree shared by compaction is cleared by the last of its parents, one
+    // with saturated counter by the first of them
+    if (histories->references > 1 && histories->references < MAX_REFERENCES)
+    {
+        --histories->references;
+        return;
+    }
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        clearSubtree(child);
+    }
+
+    removeAllEquals(histories);
+    releaseChildren(histories);
+
+    // the other parents find the node empty
+    histories->equalsList = NULL;
+    initializeChildren(histories);
 }
 
-void declareHistory(char *argument, Tree *histories, bool *memFail)
+void declareHistory(const char *argument, Tree *histories, bool *memFail)
 {
+    Tree *root = histories;
     unsigned length = strlen(argument);
-    for (unsigned i = 0; i < length; ++i)
+    unsigned created = 0;
+    Tree *firstCreated = NULL;
+    int firstSymbol = 0;
+    size_t walked = 0;
+
+    // only nodes after the declared prefix have to be made
+    histories = reachHistory(argument, length, histories, &walked, memFail);
+    if (*memFail) return;
+
+    for (unsigned i = walked; i < length; i += SYMBOL_WIDTH)
     {
+        int symbol = symbolAt(argument + i);
+        Tree *next = getChild(histories, symbol);
+
         // History was not already declared, so we must make new one
-        if (histories->next[charToIndex(argument[i])] == NULL)
+        if (next == NULL)
         {
-            histories->next[charToIndex(argument[i])] = malloc(sizeof(Tree));
+            // nodes above the first new one get new child and counts
+            if (created == 0 && sharesNodes(root))
+            {
+                histories = writablePrefix(argument, i, root, memFail);
+                if (histories == NULL) return;
+            }
+
+            next = poolAllocate(poolOf(histories));
             // Memory allocation unsuccessful
-            if (histories->next[charToIndex(argument[i])] == NULL)
+            if (next == NULL)
             {
                 *memFail = true;
-                return;
+                break;
             }
 
-            allNull(histories->next[charToIndex(argument[i])]);
+            allNull(next);
+
+            if (!setChild(histories, symbol, next))
+            {
+                poolRelease(next);
+                *memFail = true;
+                break;
+            }
+
+            next->parent = histories;
+            if (created++ == 0)
+            {
+                firstCreated = next;
+                firstSymbol = symbol;
+            }
         }
 
-        histories = histories->next[charToIndex(argument[i])];
+        histories = next;
+    }
+
+    if (created == 0) return;
+
+    addCreatedNodes(histories, created);
+    touchPath(stateOf(root), histories);
+
+    Journal *journal = journalOf(histories);
+    if (journal != NULL && !recordCreated(journal, firstCreated, firstSymbol))
+        *memFail = true;
+
+    TreeState *state = stateOf(root);
+    if (!*memFail && isIndexed(state, root, length))
+    {
+        HistoryKey key;
+        hashHistory(argument, length, &key);
+        addIndexed(state->index, &key, histories);
     }
 }
 
-void removeHistory(char *argument, Tree *histories)
+static void addCreatedNodes(Tree *deepest, unsigned created)
 {
-    Tree *lastNotRemoved = histories; // We must set its "next" to NULL
-    unsigned length = strlen(argument);
+#if SUBTREE_AGGREGATES
+    uint64_t count = 0;
 
-    for (unsigned i = 0; i < length; ++i)
+    for (Tree *node = deepest; node != NULL; node = node->parent)
     {
-        if (histories->next[charToIndex(argument[i])] == NULL) return;
+        // new nodes form a chain, so each of them has all deeper ones below
+        if (count < created) node->aggregate.count = ++count;
+        else node->aggregate.count += created;
+    }
+#else
+    (void) deepest;
+    (void) created;
+#endif
+}
+
+void loadHistories(const char **histories, size_t count, Tree *root,
+                   bool *memFail)
+{
+    if (count == 0) return;
+
+    const char **sorted = malloc(sizeof(char *) * count);
+    if (sorted == NULL)
+    {
+        *memFail = true;
+        return;
+    }
+    memcpy(sorted, histories, sizeof(char *) * count);
+
+    size_t longest = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t length = strlen(sorted[i]) / SYMBOL_WIDTH;
+        if (length > longest) longest = length;
+    }
+
+    LoadFrame *path = malloc(sizeof(LoadFrame) * (longest + 1));
+    if (path == NULL || !sortHistories(sorted, count))
+    {
+        free(path);
+        free(sorted);
+        *memFail = true;
+        return;
+    }
 
-        if (i == length - 1)
+    Pool *pool = poolOf(root);
+    Journal *journal = journalOf(root);
+    path[0].node = root;
+    path[0].added = 0;
+    path[0].created = false;
+    size_t depth = 0;
+    const char *previous = "";
+
+    for (size_t i = 0; i < count && !*memFail; ++i)
+    {
+        const char *history = sorted[i];
+        size_t length = strlen(history) / SYMBOL_WIDTH;
+
+        // nodes shared with previous history are already on the path
+        size_t common = 0;
+        while (common < depth && common < length &&
+               memcmp(previous + common * SYMBOL_WIDTH,
+                      history + common * SYMBOL_WIDTH, SYMBOL_WIDTH) == 0)
         {
-            lastNotRemoved = histories;
+            ++common;
         }
+        while (depth > common) finishFrame(path, depth--);
+
+        for (; depth < length; ++depth)
+        {
+            int symbol = symbolAt(history + depth * SYMBOL_WIDTH);
+            Tree *parent = path[depth].node;
+            bool created = path[depth].created;
+
+            // spilled subtree is brought back before histories join it
+            if (!created && parent->spilled && !thawSubtree(parent))
+            {
+                *memFail = true;
+                break;
+            }
+
+            // children of new node can only come from this history, because
+            // histories sharing the longer prefix would be sorted next to it
+            Tree *next = created ? NULL : getChild(parent, symbol);
+            if (next == NULL)
+            {
+                // copies of shared nodes replace them on the path too
+                if (!created && sharesNodes(root))
+                {
+                    Tree *writable = writablePrefix(history,
+                                                    depth * SYMBOL_WIDTH, root,
+                                                    memFail);
+                    if (writable == NULL) break;
+
+                    for (size_t above = 1; above <= depth; ++above)
+                    {
+                        const char *step = history + (above - 1) * SYMBOL_WIDTH;
+                        path[above].node = getChild(path[above - 1].node,
+                                                    symbolAt(step));
+                    }
+                    parent = writable;
+                }
+
+                next = poolAllocateSequential(pool);
+                if (next == NULL)
+                {
+                    *memFail = true;
+                    break;
+                }
+
+                allNull(next);
+                if (!setChild(parent, symbol, next))
+                {
+                    poolRelease(next);
+                    *memFail = true;
+                    break;
+                }
+
+                next->parent = parent;
+
+                // only roots of new subtrees are needed to revert them
+                if (journal != NULL && !created &&
+                    !recordCreated(journal, next, symbol))
+                {
+                    *memFail = true;
+                }
+                created = true;
+            }
 
-        histories = histories->next[charToIndex(argument[i])];
+            path[depth + 1].node = next;
+            path[depth + 1].added = 0;
+            path[depth + 1].created = created;
+            if (*memFail)
+            {
+                ++depth;
+                break;
+            }
+        }
+
+        previous = history;
     }
 
-    lastNotRemoved->next[charToIndex(argument[length - 1])] = NULL;
+    while (depth > 0) finishFrame(path, depth--);
+#if SUBTREE_AGGREGATES
+    root->aggregate.count += path[0].added;
+#endif
+
+    poolFinishSequential(pool);
+    free(path);
+    free(sorted);
+}
+
+static void finishFrame(LoadFrame *path, size_t depth)
+{
+    LoadFrame *frame = &path[depth];
+    uint64_t contribution = frame->added;
+
+    if (frame->created) ++contribution;
+#if SUBTREE_AGGREGATES
+    frame->node->aggregate.count = frame->created ? contribution :
+                                   frame->node->aggregate.count + frame->added;
+#endif
 
-    recurrentRemoval(histories);
+    path[depth - 1].added += contribution;
 }
 
-static void recurrentRemoval(Tree *histories)
+static bool sortHistories(const char **histories, size_t count)
 {
-    for (unsigned i = 0; i < STATES; ++i)
+    const char **buffer = malloc(sizeof(char *) * count);
+    // pending ranges are disjoint and hold at least two histories each
+    SortRange *pending = malloc(sizeof(SortRange) * (count / 2 + 1));
+    if (buffer == NULL || pending == NULL)
     {
-        if (histories->next[i] != NULL)
+        free(buffer);
+        free(pending);
+        return false;
+    }
+
+    size_t pendingCount = 0;
+    pending[pendingCount++] = (SortRange) {0, count, 0};
+
+    while (pendingCount > 0)
+    {
+        SortRange range = pending[--pendingCount];
+        const char **part = histories + range.start;
+
+        if (range.count < INSERTION_SORT_LIMIT)
+        {
+            insertionSort(part, range.count, range.depth);
+            continue;
+        }
+
+        size_t bucketStart[STATES + 2] = {0};
+        for (size_t i = 0; i < range.count; ++i)
+        {
+            ++bucketStart[bucketAt(part[i], range.depth) + 1];
+        }
+        for (unsigned bucket = 1; bucket < STATES + 2; ++bucket)
+        {
+            bucketStart[bucket] += bucketStart[bucket - 1];
+        }
+
+        size_t position[STATES + 1];
+        memcpy(position, bucketStart, sizeof(position));
+        for (size_t i = 0; i < range.count; ++i)
         {
-            recurrentRemoval(histories->next[i]);
-            histories->next[i] = NULL;
+            buffer[position[bucketAt(part[i], range.depth)]++] = part[i];
+        }
+        memcpy(part, buffer, sizeof(char *) * range.count);
+
+        // histories that ended (bucket 0) are already in place
+        for (unsigned bucket = 1; bucket < STATES + 1; ++bucket)
+        {
+            size_t size = bucketStart[bucket + 1] - bucketStart[bucket];
+            if (size > 1)
+            {
+                pending[pendingCount++] = (SortRange) {
+                        range.start + bucketStart[bucket], size,
+                        range.depth + 1};
+            }
         }
     }
 
+    free(pending);
+    free(buffer);
+    return true;
+}
+
+static unsigned bucketAt(const char *history, size_t depth)
+{
+    const char *symbol = history + depth * SYMBOL_WIDTH;
+    return *symbol == '\0' ? 0 : (unsigned) symbolAt(symbol) + 1;
+}
+
+static void insertionSort(const char **histories, size_t count, size_t depth)
+{
+    for (size_t i = 1; i < count; ++i)
+    {
+        const char *inserted = histories[i];
+        size_t j = i;
+
+        while (j > 0 && compareHistories(histories[j - 1], inserted, depth) > 0)
+        {
+            histories[j] = histories[j - 1];
+            --j;
+        }
+
+        histories[j] = inserted;
+    }
+}
+
+static int compareHistories(const char *historyA, const char *historyB,
+                            size_t depth)
+{
+    while (true)
+    {
+        unsigned bucketA = bucketAt(historyA, depth);
+        unsigned bucketB = bucketAt(historyB, depth);
+
+        if (bucketA != bucketB) return bucketA < bucketB ? -1 : 1;
+        if (bucketA == 0) return 0;
+
+        ++depth;
+    }
+}
+
+void removeHistory(const char *argument, Tree *histories, bool *memFail)
+{
+    Tree *root = histories;
+    Tree *lastNotRemoved = histories; // We must set its "next" to NULL
+    Journal *journal = journalOf(histories);
+    unsigned length = strlen(argument);
+    size_t walked = 0;
+
+    histories = reachHistory(argument, length, histories, &walked, memFail);
+    if (*memFail || walked < length) return;
+
+    // parent is found again below if it may be shared
+    int symbol = symbolAt(argument + length - SYMBOL_WIDTH);
+    lastNotRemoved = histories->parent;
+
+    // journal must have room for everything before anything is changed
+    if (journal != NULL &&
+        !reserveEntries(journal, countEqualities(histories) + 1))
+    {
+        *memFail = true;
+        return;
+    }
+
+    if (sharesNodes(root))
+    {
+        lastNotRemoved = writablePrefix(argument, length - SYMBOL_WIDTH, root,
+                                        memFail);
+        if (lastNotRemoved == NULL) return;
+    }
+
+    // cut equalities are restored to the same nodes on rollback, so nodes
+    // outside of the subtree may not be replaced by copies later
+    if (journal != NULL && !writableEqualities(histories, histories, memFail))
+        return;
+
+    // removing child never needs memory
+    setChild(lastNotRemoved, symbol, NULL);
+    cutFinger(stateOf(root), length - SYMBOL_WIDTH);
+
+    HistoryIndex *index = stateOf(root)->index;
+    if (index != NULL)
+    {
+        HistoryKey key;
+        hashHistory(argument, length, &key);
+        unindexSubtree(index, histories, &key);
+    }
+
+    subtractSubtree(lastNotRemoved, histories);
+
+    if (journal == NULL)
+    {
+        releaseSubtree(histories);
+        return;
+    }
+
+    // subtree is kept until commit, but no energy may reach it meanwhile
+    cutEqualities(histories, journal);
+    recordRemoved(journal, histories, lastNotRemoved, symbol);
+}
+
+static size_t countEqualities(Tree *histories)
+{
+    size_t count = 0;
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        count += countEqualities(child);
+    }
+
+    for (EqualsList *equals = histories->equalsList; equals != NULL;
+         equals = equals->next)
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+static bool writableEqualities(Tree *histories, const Tree *removed,
+                               bool *memFail)
+{
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        if (!writableEqualities(child, removed, memFail)) return false;
+    }
+
+    for (EqualsList *equals = histories->equalsList; equals != NULL;
+         equals = equals->next)
+    {
+        Tree *otherHistory = equals->this->historyA == histories ?
+                             equals->this->historyB : equals->this->historyA;
+
+        if (!isInside(otherHistory, removed) &&
+            writableNode(otherHistory, memFail) == NULL) return false;
+    }
+
+    return true;
+}
+
+static bool isInside(const Tree *node, const Tree *root)
+{
+    for (; node != NULL; node = node->parent)
+    {
+        if (node == root) return true;
+    }
+
+    return false;
+}
+
+static void cutEqualities(Tree *histories, Journal *journal)
+{
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        cutEqualities(child, journal);
+    }
+
+    while (histories->equalsList != NULL)
+    {
+        EqualsList *cell = histories->equalsList;
+        Equals *equals = cell->this;
+        bool isA = equals->historyA == histories;
+        Tree *otherHistory = isA ? equals->historyB : equals->historyA;
+
+        histories->equalsList = cell->next;
+        EqualsList *otherCell = unlinkEquals(otherHistory, equals);
+
+        recordEqualCut(journal, isA ? cell : otherCell,
+                       isA ? otherCell : cell);
+    }
+}
+
+void addSubtree(Tree *node, const Tree *added)
+{
+#if SUBTREE_AGGREGATES
+    bool extremesChanged = true;
+
+    for (; node != NULL; node = node->parent)
+    {
+        node->aggregate.count += added->aggregate.count;
+        node->aggregate.energySum += added->aggregate.energySum;
+
+        if (extremesChanged) extremesChanged = refreshExtremes(node);
+    }
+#else
+    (void) node;
+    (void) added;
+#endif
+}
+
+void subtractSubtree(Tree *node, const Tree *removed)
+{
+#if SUBTREE_AGGREGATES
+    bool extremesChanged = true;
+
+    for (; node != NULL; node = node->parent)
+    {
+        node->aggregate.count -= removed->aggregate.count;
+        node->aggregate.energySum -= removed->aggregate.energySum;
+
+        // ancestors of node whose extremes did not change keep theirs too
+        if (extremesChanged) extremesChanged = refreshExtremes(node);
+    }
+#else
+    (void) node;
+    (void) removed;
+#endif
+}
+
+uint64_t countNodes(const Tree *node, uint64_t limit)
+{
+#if SUBTREE_AGGREGATES
+    return node->aggregate.count < limit ? node->aggregate.count : limit;
+#else
+    uint64_t count = 1;
+    if (node->spilled) count = frozenNodes(spilledImage(node));
+
+    Tree *child;
+    for (int symbol = -1;
+         count < limit && (child = nextChild(node, &symbol)) != NULL;)
+    {
+        count += countNodes(child, limit - count);
+    }
+
+    return count < limit ? count : limit;
+#endif
+}
+
+#if SUBTREE_AGGREGATES
+static bool refreshExtremes(Tree *node)
+{
+    Energy minEnergy = node->energy;
+    Energy maxEnergy = node->energy;
+    Tree *child;
+
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        if (child->aggregate.maxEnergy == 0) continue; // no energy below
+
+        if (minEnergy == 0 || child->aggregate.minEnergy < minEnergy)
+            minEnergy = child->aggregate.minEnergy;
+        if (child->aggregate.maxEnergy > maxEnergy)
+            maxEnergy = child->aggregate.maxEnergy;
+    }
+
+    // extremes of spilled descendants are kept with their image
+    const Aggregate *below = node->spilled ? spilledBelow(node) : NULL;
+    if (below != NULL && below->maxEnergy != 0)
+    {
+        if (minEnergy == 0 || below->minEnergy < minEnergy)
+            minEnergy = below->minEnergy;
+        if (below->maxEnergy > maxEnergy) maxEnergy = below->maxEnergy;
+    }
+
+    bool changed = minEnergy != node->aggregate.minEnergy ||
+                   maxEnergy != node->aggregate.maxEnergy;
+    node->aggregate.minEnergy = minEnergy;
+    node->aggregate.maxEnergy = maxEnergy;
+
+    return changed;
+}
+#endif
+
+static Tree *setEnergy(Tree *node, Energy energy, bool *memFail)
+{
+    // node is made writable even if energy does not change, because nodes
+    // whose equalities are being visited must never be replaced
+    node = writableNode(node, memFail);
+    if (node == NULL || node->energy == energy) return node;
+
+    Journal *journal = journalOf(node);
+    // failure is remembered by journal too, it can`t be rolled back
+    if (journal != NULL && !recordEnergy(journal, node, node->energy))
+    {
+        *memFail = true;
+        return NULL;
+    }
+
+    assignEnergy(node, energy);
+    return node;
+}
+
+void assignEnergy(Tree *node, Energy energy)
+{
+    Energy previous = node->energy;
+    if (previous == energy) return;
+
+    node->energy = energy;
+
+#if SUBTREE_AGGREGATES
+    bool extremesChanged = true;
+    for (; node != NULL; node = node->parent)
+    {
+        node->aggregate.energySum += energy;
+        node->aggregate.energySum -= previous;
+
+        if (extremesChanged) extremesChanged = refreshExtremes(node);
+    }
+#endif
+}
+
+bool aggregateHistory(const char *argument, Tree *histories,
+                      Aggregate *aggregate)
+{
+    size_t length = strlen(argument);
+    size_t walked = 0;
+    Tree *history = walkHistory(argument, length, histories, &walked);
+
+    // subtree spilled with the node is summarized from the file
+    if (walked < length && history->spilled)
+        return aggregateFrozen(argument + walked, spilledImage(history), 0,
+                               aggregate);
+    if (walked < length) return false;
+
+#if SUBTREE_AGGREGATES
+    *aggregate = history->aggregate;
+#else
+    *aggregate = (Aggregate) {0, 0, 0, 0};
+    summarizeSubtree(history, aggregate);
+#endif
+    return true;
+}
+
+#if !SUBTREE_AGGREGATES
+static void summarizeSubtree(const Tree *node, Aggregate *aggregate)
+{
+    Aggregate own = {1, node->energy, node->energy, node->energy};
+    mergeAggregate(aggregate, &own);
+
+    // descendants of spilled node are summarized from the file, its own
+    // energy may have changed since
+    Aggregate below;
+    if (node->spilled &&
+        aggregateFrozen("", spilledImage(node), 1, &below))
+    {
+        mergeAggregate(aggregate, &below);
+    }
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        summarizeSubtree(child, aggregate);
+    }
+}
+#endif
+
+void mergeAggregate(Aggregate *into, const Aggregate *from)
+{
+    into->count += from->count;
+    into->energySum += from->energySum;
+
+    if (from->maxEnergy == 0) return;
+
+    if (into->minEnergy == 0 || from->minEnergy < into->minEnergy)
+        into->minEnergy = from->minEnergy;
+    if (from->maxEnergy > into->maxEnergy)
+        into->maxEnergy = from->maxEnergy;
+}
+
+void recurrentRemoval(Tree *histories)
+{
+    // subtree shared by compaction has no equalities, it is released by the
+    // last of its parents; one with saturated counter is never released, so
+    // it only loses equalities it might keep from before snapshots ended
+    if (histories->references == MAX_REFERENCES)
+    {
+        stripEqualities(histories);
+        return;
+    }
+    if (histories->references > 1)
+    {
+        --histories->references;
+        return;
+    }
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        recurrentRemoval(child);
+    }
+
+    if (histories->spilled) releaseSpilled(histories);
     removeAllEquals(histories);
-    free(histories);
+    releaseChildren(histories);
+    poolRelease(histories);
 }
 
-static void removeAllEquals(Tree *node)
+void releaseSubtree(Tree *histories)
+{
+    // nodes shared with snapshots stay there, without equalities
+    void (*release)(Tree *) = stateOf(histories)->versions > 0 ?
+                              dropShared : recurrentRemoval;
+
+    if (countNodes(histories, TEARDOWN_PARALLEL_NODES) <
+        TEARDOWN_PARALLEL_NODES ||
+        !tearDownInParallel(histories, histories, release))
+    {
+        release(histories);
+    }
+}
+
+static void dropShared(Tree *histories)
+{
+    stripEqualities(histories);
+    dropReference(histories);
+}
+
+void removeAllEquals(Tree *node)
 {
     EqualsList *equals = node->equalsList;
 
@@ -237,21 +1055,28 @@ static void removeAllEquals(Tree *node)
         removeFromEquals(otherHistory, equals->this);
         EqualsList *toRemove = equals;
         equals = equals->next;
-        free(toRemove->this);
-        free(toRemove);
+        poolFree(poolOf(toRemove->this->historyA), toRemove->this,
+                 sizeof(Equals));
+        poolFree(poolOf(node), toRemove, sizeof(EqualsList));
 
     }
 }
 
 static void removeFromEquals(Tree *node, Equals *equals)
+{
+    // Equals will be removed by removeAllEquals, here we just remove node
+    poolFree(poolOf(node), unlinkEquals(node, equals), sizeof(EqualsList));
+}
+
+EqualsList *unlinkEquals(Tree *node, Equals *equals)
 {
     // special case - first node is set to be removed. It`s different because we
     // modify node parameter
     if (node->equalsList->this == equals)
     {
-        EqualsList *toRemove = node->equalsList;
+        EqualsList *unlinked = node->equalsList;
         node->equalsList = node->equalsList->next;
-        free(toRemove); // Equals will be removed by removeAllEquals, here we just remove node
+        return unlinked;
     }
     else
     {
@@ -264,115 +1089,279 @@ static void removeFromEquals(Tree *node, Equals *equals)
             this = this->next;
         }
         previous->next = this->next;
-        free(this);
+        return this;
     }
 }
 
-bool validHistory(char *argument, Tree *histories)
+Tree *findHistory(const char *argument, Tree *histories)
 {
     bool error = false;
     bool *pError = &error;
-    getHistory(argument, histories, &pError);
+    Tree *history = getHistory(argument, histories, &pError);
 
-    if (*pError) return false;
-
-    else return true;
+    return error ? NULL : history;
 }
 
-void
-energyHistory(char *argument, char *argument2, Tree *histories, bool *error)
+void findHistories(const char **arguments, size_t count, Tree *histories,
+                   Tree **found)
 {
-    Energy energy = parseToEnergy(argument2, &error);
-    if (*error) return;
+    // frozen histories have no tree, but pass no histories either
+    if (count == 0) return;
+
+    TreeState *state = stateOf(histories);
+    Lookup window[LOOKUP_WINDOW];
+    size_t active = 0;
+    size_t started = 0;
+
+    while (active > 0 || started < count)
+    {
+        // finished lookups make room for the next ones
+        while (active < LOOKUP_WINDOW && started < count)
+        {
+            Lookup *lookup = &window[active];
+            const char *argument = arguments[started];
+            size_t length = strlen(argument);
 
-    Tree *energyHolder = getHistory(argument, histories, &error);
-    if (*error) return;
+            lookup->indexed = isIndexed(state, histories, length);
+            if (lookup->indexed)
+            {
+                hashHistory(argument, length, &lookup->key);
+                found[started] = findIndexed(state->index, &lookup->key);
+                if (found[started] != NULL)
+                {
+                    touchPath(state, found[started]);
+                    ++started;
+                    continue;
+                }
+            }
+
+            lookup->position = argument;
+            lookup->node = histories;
+            lookup->index = started++;
+            ++active;
+        }
 
-    energyHolder->energy = energy;
+        for (size_t i = 0; i < active;)
+        {
+            Lookup *lookup = &window[i];
+
+            if (lookup->node == NULL || *lookup->position == '\0')
+            {
+                found[lookup->index] = lookup->node;
+                if (lookup->indexed && lookup->node != NULL)
+                    addIndexed(state->index, &lookup->key, lookup->node);
+                touchPath(state, lookup->node);
+                *lookup = window[--active];
+                continue;
+            }
 
-    markVisited(energyHolder);
-    visitAllEquals(energyHolder, energy);
-    unMarkVisited(energyHolder);
+            lookup->node = getChild(lookup->node, symbolAt(lookup->position));
+            lookup->position += SYMBOL_WIDTH;
+            if (lookup->node != NULL) __builtin_prefetch(lookup->node);
+            ++i;
+        }
+    }
 }
 
-static void
-updateEquals(Tree *node, Energy energy)
+bool validHistory(const char *argument, Tree *histories)
 {
-    if (isVisited(node)) return;
+    size_t length = strlen(argument);
+    size_t walked = 0;
+    Tree *history = walkHistory(argument, length, histories, &walked);
 
-    else
+    // rest of history spilled with the node is looked up in the file
+    if (walked < length && history->spilled)
+        return validFrozen(argument + walked, spilledImage(history));
+
+    return walked == length;
+}
+
+void energyHistory(const char *argument, Energy energy, Tree *histories,
+                   bool *error, bool *memFail)
+{
+    Tree *energyHolder = writableHistory(argument, histories, memFail);
+    if (energyHolder == NULL)
     {
-        node->energy = energy;
-        markVisited(node);
-        visitAllEquals(node, energy);
-        unMarkVisited(node);
+        if (!*memFail) *error = true;
+        return;
     }
+
+    spreadEnergy(energyHolder, energy, memFail);
 }
 
-static void
-visitAllEquals(Tree *node, Energy energy)
+void spreadEnergy(Tree *node, Energy energy, bool *memFail)
 {
-    EqualsList *equals = node->equalsList;
+    node = setEnergy(node, energy, memFail);
+    if (node == NULL || node->equalsList == NULL) return;
+
+    // every node reached stays marked until the whole class is walked, so
+    // that equalities of each of them are followed once
+    bool spanning = false;
+    size_t capacity = CLASS_INITIAL_CAPACITY;
+    size_t reached = 0;
+    Tree **queue = malloc(sizeof(Tree *) * capacity);
+    if (queue == NULL || !queueNode(&queue, &reached, &capacity, node))
+    {
+        free(queue);
+        *memFail = true;
+        return;
+    }
 
-    while (equals != NULL)
+    for (size_t next = 0; next < reached && !*memFail; ++next)
     {
-        equals->this->historyA == node ?
-        updateEquals(equals->this->historyB, energy) :
-        updateEquals(equals->this->historyA, energy);
+        spanning = spanning || queue[next]->spanning;
 
-        equals = equals->next;
+        EqualsList *equals = queue[next]->equalsList;
+        for (; equals != NULL && !*memFail; equals = equals->next)
+        {
+            Tree *other = otherHistory(equals->this, queue[next]);
+            if (isVisited(other)) continue;
+
+            // node is made writable before it is marked, so nodes in the
+            // queue are never replaced by copies
+            other = setEnergy(other, energy, memFail);
+            if (other != NULL &&
+                !queueNode(&queue, &reached, &capacity, other))
+                *memFail = true;
+        }
+    }
+
+    // class shared with histories kept elsewhere is marked as a whole
+    for (size_t i = 0; i < reached; ++i)
+    {
+        unMarkVisited(queue[i]);
+        if (spanning) queue[i]->spanning = true;
     }
+
+    free(queue);
 }
 
-static void markVisited(Tree *node)
+Tree *otherHistory(const Equals *equals, const Tree *history)
 {
-    node->visited = true;
+    return equals->historyA == history ? equals->historyB : equals->historyA;
 }
 
-static void unMarkVisited(Tree *node)
+bool spansTrees(const Tree *node)
 {
-    node->visited = false;
+    return node->spanning;
 }
 
-static bool isVisited(Tree *node)
+bool subtreeSpansTrees(const Tree *node)
 {
-    return node->visited;
+    if (!stateOf(node)->joined) return false;
+    if (spansTrees(node)) return true;
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        if (subtreeSpansTrees(child)) return true;
+    }
+
+    return false;
+}
+
+void shareClass(Tree *node, bool *memFail)
+{
+    stateOf(node)->joined = true;
+    walkClass(node, NULL, true, memFail);
 }
 
-static Energy parseToEnergy(char *argument, bool **error)
+bool sameClass(Tree *nodeA, Tree *nodeB, bool *memFail)
 {
-    errno = 0;
-    Energy energy = strtoull(argument, NULL, 10);
+    return nodeA == nodeB || walkClass(nodeA, nodeB, false, memFail);
+}
 
-    if (errno == EINVAL || errno == ERANGE || energy == 0)
+static bool walkClass(Tree *node, const Tree *wanted, bool mark,
+                      bool *memFail)
+{
+    if (mark) node->spanning = true;
+    if (node->equalsList == NULL) return false;
+
+    size_t capacity = CLASS_INITIAL_CAPACITY;
+    size_t reached = 0;
+    bool found = false;
+    Tree **queue = malloc(sizeof(Tree *) * capacity);
+    if (queue == NULL || !queueNode(&queue, &reached, &capacity, node))
     {
-        **error = true;
-        return 0;
+        free(queue);
+        *memFail = true;
+        return false;
+    }
+
+    for (size_t next = 0; next < reached && !found && !*memFail; ++next)
+    {
+        EqualsList *equals = queue[next]->equalsList;
+        for (; equals != NULL && !found; equals = equals->next)
+        {
+            Tree *other = otherHistory(equals->this, queue[next]);
+            found = other == wanted;
+            if (!queueNode(&queue, &reached, &capacity, other))
+            {
+                *memFail = true;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < reached; ++i)
+    {
+        unMarkVisited(queue[i]);
+        if (mark) queue[i]->spanning = true;
     }
 
-    else return energy;
+    free(queue);
+    return found;
 }
 
-Energy energyShortHistory(char *argument, Tree *histories)
+void markVisited(Tree *node)
 {
-    bool error = false;
-    bool *pError = &error;
+    node->visited = true;
+}
 
-    Tree *energyHolder = getHistory(argument, histories, &pError);
+void unMarkVisited(Tree *node)
+{
+    node->visited = false;
+}
 
-    if (*pError == true) return 0;
+bool isVisited(Tree *node)
+{
+    return node->visited;
+}
 
-        // 0 means no energy assigned, and it will be checked for by output function
-    else return energyHolder->energy;
+Energy energyShortHistory(const char *argument, Tree *histories)
+{
+    size_t length = strlen(argument);
+    size_t walked = 0;
+    Tree *energyHolder = walkHistory(argument, length, histories, &walked);
+
+    if (walked < length && energyHolder->spilled)
+        return energyFrozen(argument + walked, spilledImage(energyHolder));
+    if (walked < length) return 0;
+
+    // 0 means no energy assigned, and it will be checked for by output function
+    return energyHolder->energy;
 }
 
-void equalHistory(char *argument, char *argument2, Tree *histories, bool *error,
-                  bool *memFail)
+void equalHistory(const char *argument, const char *argument2, Tree *histories,
+                  bool *error, bool *memFail)
 {
-    Tree *historyA = getHistory(argument, histories, &error);
-    Tree *historyB = getHistory(argument2, histories, &error);
-    if (*error) return;
+    // paths of both histories are made writable, so pair of them never has
+    // to be copied
+    Tree *historyA = writableHistory(argument, histories, memFail);
+    Tree *historyB = historyA == NULL ? NULL :
+                     writableHistory(argument2, histories, memFail);
+    if (*memFail) return;
+    if (historyA == NULL || historyB == NULL)
+    {
+        *error = true;
+        return;
+    }
 
+    equalNodes(historyA, historyB, error, memFail);
+}
+
+void equalNodes(Tree *historyA, Tree *historyB, bool *error, bool *memFail)
+{
     if (alreadyEqual(historyA, historyB)) return;
     if (historyA == historyB) return;
 
@@ -382,48 +1371,87 @@ void equalHistory(char *argument, char *argument2, Tree *histories, bool *error,
         return;
     }
 
-    Equals *newEquals = makeNewEquals(historyA, historyB, &memFail);
-    if (*memFail) return;
+    if (!linkNodes(&historyA, &historyB, memFail)) return;
 
-    addToEquals(newEquals, historyA, &memFail);
-    if (*memFail) return;
+    updateEnergy(historyA, historyB, memFail);
+}
 
-    addToEquals(newEquals, historyB, &memFail);
-    if (*memFail) return;
+bool linkNodes(Tree **historyA, Tree **historyB, bool *memFail)
+{
+    if (!writablePair(historyA, historyB, memFail)) return false;
 
-    updateEnergy(historyA, historyB);
+    Tree *nodeA = *historyA;
+    Tree *nodeB = *historyB;
+
+    // equality is recorded by the journal of its first history
+    Journal *journal = journalOf(nodeA);
+    if (journal != NULL && !reserveEntries(journal, 1))
+    {
+        *memFail = true;
+        return false;
+    }
+
+    // everything is allocated first, so that equality refused by memory limit
+    // leaves nothing behind
+    Pool *poolA = poolOf(nodeA);
+    Pool *poolB = poolOf(nodeB);
+    Equals *newEquals = makeNewEquals(nodeA, nodeB, &memFail);
+    EqualsList *cellA = poolMalloc(poolA, sizeof(EqualsList));
+    EqualsList *cellB = poolMalloc(poolB, sizeof(EqualsList));
+    if (*memFail || cellA == NULL || cellB == NULL)
+    {
+        poolFree(poolA, newEquals, sizeof(Equals));
+        poolFree(poolA, cellA, sizeof(EqualsList));
+        poolFree(poolB, cellB, sizeof(EqualsList));
+        *memFail = true;
+        return false;
+    }
+
+    stateOf(nodeA)->equalized = true;
+
+    addToEquals(newEquals, nodeA, cellA);
+    addToEquals(newEquals, nodeB, cellB);
+
+    if (journal != NULL) recordEqualAdded(journal, newEquals);
+
+    return true;
 }
 
-static void updateEnergy(Tree *historyA, Tree *historyB)
+static void updateEnergy(Tree *historyA, Tree *historyB, bool *memFail)
 {
     Energy energy;
 
     if (historyA->energy <= 0) // A has no energy
-    {
         energy = historyB->energy;
-        historyA->energy = energy;
-    }
     else if (historyB->energy <= 0) // B has no energy
-    {
         energy = historyA->energy;
-        historyB->energy = energy;
-    }
     else // Both have energy, so we must calculate average
-    {
         energy = average(historyA->energy, historyB->energy);
-        historyA->energy = energy;
-        historyB->energy = energy;
-    }
 
+    // histories are already equal, so it doesnt matter whether we start with
+    // history A or B
+    spreadEnergy(historyA, energy, memFail);
+}
+
+bool queueNode(Tree ***queue, size_t *length, size_t *capacity, Tree *node)
+{
+    if (isVisited(node)) return true;
+
+    if (*length == *capacity)
+    {
+        Tree **expanded = realloc(*queue, sizeof(Tree *) * *capacity * 2);
+        if (expanded == NULL) return false;
 
+        *queue = expanded;
+        *capacity *= 2;
+    }
 
-    // It doesnt matter whether we start with history A or B
-    markVisited(historyA);
-    visitAllEquals(historyA, energy);
-    unMarkVisited(historyA);
+    markVisited(node);
+    (*queue)[(*length)++] = node;
+    return true;
 }
 
-static Energy average(Energy energyA, Energy energyB)
+Energy average(Energy energyA, Energy energyB)
 {
     // We don`t want to overflow, so we can`t just do a+b/2
     return (energyA / 2) + (energyB / 2) + ((energyA % 2 + energyB % 2) / 2);
@@ -434,7 +1462,7 @@ static bool hasEnergy(Tree *history)
     return history->energy > 0 ? true : false;
 }
 
-static bool alreadyEqual(Tree *historyA, Tree *historyB)
+bool alreadyEqual(Tree *historyA, Tree *historyB)
 {
     EqualsList *equals = historyA->equalsList;
 
@@ -450,7 +1478,7 @@ static bool alreadyEqual(Tree *historyA, Tree *historyB)
     return false;
 }
 
-static void addToEquals(Equals *newEquals, Tree *history, bool **memFail)
+static void addToEquals(Equals *newEquals, Tree *history, EqualsList *cell)
 {
     EqualsList *equalsList = history->equalsList;
     EqualsList *previous = NULL;
@@ -461,40 +1489,19 @@ static void addToEquals(Equals *newEquals, Tree *history, bool **memFail)
         equalsList = equalsList->next;
     }
 
-    // previous->next == NULL, new node will be added here
-    if (previous != NULL)
-    {
-        previous->next = malloc(sizeof(EqualsList));
-        if (previous->next == NULL)
-        {
-            **memFail = true;
-            return;
-        }
+    cell->next = NULL;
+    cell->this = newEquals;
 
-        equalsList = previous->next;
-        equalsList->next = NULL;
-        equalsList->this = newEquals;
-    }
+    // previous->next == NULL, new node will be added here
+    if (previous != NULL) previous->next = cell;
 
     // first node, history->equalsList == NULL
-    else
-    {
-        history->equalsList = malloc(sizeof(EqualsList));
-        if (history->equalsList == NULL)
-        {
-            **memFail = true;
-            return;
-        }
-
-        equalsList = history->equalsList;
-        equalsList->next = NULL;
-        equalsList->this = newEquals;
-    }
+    else history->equalsList = cell;
 }
 
 static Equals *makeNewEquals(Tree *historyA, Tree *historyB, bool **memFail)
 {
-    Equals *newEquals = malloc(sizeof(Equals));
+    Equals *newEquals = poolMalloc(poolOf(historyA), sizeof(Equals));
 
     if (newEquals == NULL)
     {
@@ -510,21 +1517,82 @@ static Equals *makeNewEquals(Tree *historyA, Tree *historyB, bool **memFail)
     }
 }
 
-static Tree *getHistory(char *argument, Tree *histories, bool **error)
+static Tree *getHistory(const char *argument, Tree *histories, bool **error)
 {
-    unsigned length = strlen(argument);
-    for (unsigned i = 0; i < length; ++i)
+    size_t length = strlen(argument);
+    size_t walked = 0;
+    bool memFail = false;
+
+    // history whose subtree cannot be brought back is not found
+    histories = reachHistory(argument, length, histories, &walked, &memFail);
+    if (walked < length)
     {
-        if (histories->next[charToIndex(argument[i])] == NULL)
-        {
-            **error = true;
-            return NULL;
-        }
-        else
+        **error = true;
+        return NULL;
+    }
+
+    return histories;
+}
+
+Tree *walkHistory(const char *argument, size_t length, Tree *histories,
+                  size_t *walked)
+{
+    TreeState *state = stateOf(histories);
+    HistoryKey key;
+    bool indexed = isIndexed(state, histories, length);
+
+    if (indexed)
+    {
+        hashHistory(argument, length, &key);
+        Tree *found = findIndexed(state->index, &key);
+        if (found != NULL)
         {
-            histories = histories->next[charToIndex(argument[i])];
+            *walked = length;
+            touchPath(state, found);
+            return found;
         }
     }
 
-    return histories;
-}
\ No newline at end of file
+    Tree *reached = followHistory(argument, length, histories, walked);
+    if (indexed && *walked == length)
+        addIndexed(state->index, &key, reached);
+
+    touchPath(state, reached);
+    return reached;
+}
+
+void forgetNodes(TreeState *state)
+{
+    cutFinger(state, 0);
+
+    if (state->index != NULL) forgetIndexed(state->index);
+}
+
+TreeState *stateOf(const Tree *node)
+{
+    return poolContext(poolOf(node));
+}
+
+static Journal *journalOf(const Tree *node)
+{
+    return stateOf(node)->journal;
+}
+
+void treeStatistics(Tree *histories, Statistics *statistics)
+{
+    Pool *pool = poolOf(histories);
+
+    statistics->nodes = poolLiveObjects(pool);
+    statistics->bytes = poolReservedBytes(pool);
+}
+
+void limitTreeMemory(Tree *histories, size_t bytes)
+{
+    poolSetLimit(poolOf(histories), bytes);
+}
+
+size_t refusedNodes(const Tree *histories)
+{
+    return poolRefusedObjects(poolOf(histories));
+}
+
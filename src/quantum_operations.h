@@ -16,39 +16,112 @@
  * was failure allocating memory, in this case it is set to true. In all other
  * cases it should be false
  */
-void declareHistory(char *argument, Tree *histories, bool *memFail);
+void declareHistory(const char *argument, Tree *histories, bool *memFail);
+
+/*
+ * Declares many histories at once. Histories are sorted first, so that nodes
+ * shared by consecutive histories are walked only once, and new nodes are
+ * placed in memory in the order of depth first walk. Sets "memFail" if out
+ * of memory, in that case only part of histories may be declared.
+ */
+void loadHistories(const char **histories, size_t count, Tree *root,
+                   bool *memFail);
 
 /*
  * Every history that is postfix of history passed as argument, will be no longer
- * considered valid after executing this function.
+ * considered valid after executing this function. Memory is needed only when
+ * histories share nodes with snapshots or have a journal, "memFail" is set if
+ * there was not enough of it.
  */
-void removeHistory(char *argument, Tree *histories);
+void removeHistory(const char *argument, Tree *histories, bool *memFail);
 
 /*
  * Checks if given history is valid, returns true if it is, false if it isn`t
  */
-bool validHistory(char *argument, Tree *histories);
+bool validHistory(const char *argument, Tree *histories);
 
 /*
- * Assigns energy given as argument2 to history given as argument.
- * Sets "error" to true if history is not declared, or "memFail" if out of memory
+ * Assigns energy to history given as argument.
+ * Sets "error" to true if history is not declared, and "memFail" if there was
+ * not enough memory to copy nodes shared with snapshots.
  */
-void
-energyHistory(char *argument, char *argument2, Tree *histories, bool *error);
+void energyHistory(const char *argument, Energy energy, Tree *histories,
+                   bool *error, bool *memFail);
 
 /*
  * Returns the energy value for given history, or 0 if no energy assigned or no
  * such history
  */
-Energy energyShortHistory(char *argument, Tree *histories);
+Energy energyShortHistory(const char *argument, Tree *histories);
 
 /*
  * Function puts two histories given as "argument" and "argument2" into equality
  * relation, their energies will be the same from now on. "memFail" is set to
  * true if out of memory, "error" is set in case of remaining errors.
  */
-void equalHistory(char *argument, char *argument2, Tree *histories, bool *error,
-                  bool *memFail);
+void equalHistory(const char *argument, const char *argument2, Tree *histories,
+                  bool *error, bool *memFail);
+
+/*
+ * Works like equalHistory, but on nodes that were already found
+ */
+void equalNodes(Tree *historyA, Tree *historyB, bool *error, bool *memFail);
+
+/*
+ * Checks whether class of equal histories of given node may be equal to
+ * histories kept outside of this data structure. Class is known to be so from
+ * shareClass until the node is removed, also when it is split again, and
+ * histories made equal to it later inherit the mark.
+ */
+bool spansTrees(const Tree *node);
+
+/*
+ * Checks whether any node of subtree of given node may be equal to histories
+ * kept outside of this data structure, like spansTrees. Takes time
+ * proportional to size of the subtree, unless no class was ever shared.
+ */
+bool subtreeSpansTrees(const Tree *node);
+
+/*
+ * Marks class of equal histories of given node as equal to histories kept
+ * outside of this data structure, see spansTrees. Sets "memFail" if there was
+ * not enough memory.
+ */
+void shareClass(Tree *node, bool *memFail);
+
+/*
+ * Checks whether two nodes are in the same class of equal histories. Sets
+ * "memFail" if there was not enough memory.
+ */
+bool sameClass(Tree *nodeA, Tree *nodeB, bool *memFail);
+
+/*
+ * Returns node holding given history, or NULL if it is not declared. Spilled
+ * subtree holding the history is brought back, NULL is returned also if there
+ * was not enough memory for it.
+ */
+Tree *findHistory(const char *argument, Tree *histories);
+
+/*
+ * Finds nodes of many histories at once, storing node of each history, or NULL
+ * if it is not declared, at the same position of "found". Lookups are
+ * interleaved, each taking one step at a time, so that memory latency of one
+ * of them is hidden behind the others.
+ */
+void findHistories(const char **arguments, size_t count, Tree *histories,
+                   Tree **found);
+
+/*
+ * Stores summary of given history and all histories it is prefix of in
+ * "aggregate". Returns false if history is not declared.
+ */
+bool aggregateHistory(const char *argument, Tree *histories,
+                      Aggregate *aggregate);
+
+/*
+ * Adds histories described by "from" to those described by "into"
+ */
+void mergeAggregate(Aggregate *into, const Aggregate *from);
 
 /*
  * Function creates new data structure for holding histories.
@@ -59,8 +132,29 @@ void equalHistory(char *argument, char *argument2, Tree *histories, bool *error,
 Tree *initializeTree();
 
 /*
- * Function removes the data structure made for holding histories.
+ * Function removes the data structure made for holding histories. All its
+ * snapshots must be released first.
  */
 void removeTree(Tree *histories);
 
+/*
+ * Stores number of nodes of histories, together with those shared with
+ * snapshots, and bytes reserved for them and memory charged to their pool in
+ * "statistics". Does not change "reclaimed".
+ */
+void treeStatistics(Tree *histories, Statistics *statistics);
+
+/*
+ * Limits bytes reserved for nodes of histories and their snapshots, together
+ * with memory charged to their pool, as given by treeStatistics, 0 removes the
+ * limit. Allocation of node, equality or children array beyond the limit fails
+ * like any other, with "memFail" set.
+ */
+void limitTreeMemory(Tree *histories, size_t bytes);
+
+/*
+ * Returns number of node allocations that failed because of the limit
+ */
+size_t refusedNodes(const Tree *histories);
+
 #endif //QUANTIZATION_QUANTUM_OPERATIONS_H
\ No newline at end of file
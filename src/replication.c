@@ -0,0 +1,789 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "replication.h"
+#include "cli.h"
+#include "interface.h"
+#include "output.h"
+
+/*
+ * Number of bytes of updates primary holds before shipping them at first
+ */
+#define RECORDS_INITIAL_CAPACITY 4096
+
+/*
+ * Number of updates replica applies at once, queries wait at most that long
+ */
+#define REPLICA_APPLY_SLICE 256
+
+/*
+ * Number of bytes replica reads from primary at once, at first
+ */
+#define REPLICA_READ_BYTES 65536
+
+/*
+ * Replica may be started before primary, so it tries to connect this many
+ * times, REPLICA_CONNECT_WAIT_MS milliseconds apart
+ */
+#define REPLICA_CONNECT_ATTEMPTS 50
+#define REPLICA_CONNECT_WAIT_MS 100
+
+/*
+ * Connection of primary to one replica, which sends one byte back for every
+ * update it applied, "acknowledged" of them so far. "socket" is -1 once
+ * replica disconnected.
+ */
+struct ReplicaLink
+{
+    int socket;
+    uint64_t acknowledged;
+};
+typedef struct ReplicaLink ReplicaLink;
+
+/*
+ * "shipped" updates were sent to replicas so far. Updates waiting to be
+ * shipped, "pendingCount" of them, are kept as command lines in "pending",
+ * which holds "pendingLength" of "pendingCapacity" bytes. "inTransaction"
+ * tells they are held until transaction is committed.
+ */
+struct Primary
+{
+    int listener;
+    char *path;
+    ReplicaLink *replicas;
+    unsigned replicasCount;
+    uint64_t shipped;
+    bool inTransaction;
+    char *pending;
+    size_t pendingLength;
+    size_t pendingCapacity;
+    size_t pendingCount;
+};
+
+/*
+ * Replica side: histories, guarded by "lock", as updates are applied by
+ * another thread than the one answering queries. Updates "received" and
+ * "applied" so far are counted for LAG. "diverged" tells that replica stopped
+ * following primary, as update ended with other status than on primary or
+ * memory ran out.
+ */
+struct ReplicaState
+{
+    Quantization *quantization;
+    pthread_mutex_t lock;
+    int socket;
+    atomic_size_t received;
+    atomic_size_t applied;
+    atomic_bool diverged;
+};
+typedef struct ReplicaState ReplicaState;
+
+/*
+ * Appends update as command line with status primary got, given name and
+ * arguments, which may be NULL, to updates waiting to be shipped. Returns
+ * false if memory ran out.
+ */
+static bool appendRecord(Primary *primary, int status, const char *name,
+                         const char *argument1, const char *argument2);
+
+/*
+ * Ships all waiting updates to every replica
+ */
+static void shipPending(Primary *primary);
+
+/*
+ * Sends data to replica, taking acknowledgements it sends meanwhile, so that
+ * neither side waits for the other forever. Returns false if replica
+ * disconnected.
+ */
+static bool shipTo(ReplicaLink *replica, const char *data, size_t length);
+
+/*
+ * Waits until replica acknowledged given number of updates. Returns false if
+ * replica disconnected.
+ */
+static bool awaitReplica(ReplicaLink *replica, uint64_t acknowledged);
+
+/*
+ * Takes all acknowledgements replica sent, without waiting. Returns false if
+ * replica disconnected.
+ */
+static bool takeAcknowledgements(ReplicaLink *replica);
+
+/*
+ * Closes connection to replica, which gets no more updates
+ */
+static void dropReplica(ReplicaLink *replica);
+
+/*
+ * Returns socket connected to primary at given path, or -1 if it could not
+ * be reached
+ */
+static int connectPrimary(const char *path);
+
+/*
+ * Thread body, applies updates primary ships until it disconnects
+ */
+static void *applyUpdates(void *argument);
+
+/*
+ * Applies update given as command line without line end. Returns false if it
+ * ended with other status than on primary, e.g. because memory ran out, so
+ * that histories no longer follow primary.
+ */
+static bool applyUpdate(Quantization *quantization, char *record);
+
+/*
+ * Declares histories of LOAD record, given separated by spaces, returning
+ * status like quantLoad
+ */
+static int loadRecord(Quantization *quantization, char *histories);
+
+/*
+ * Sends acknowledgements of "updates" applied updates to primary, as many as
+ * it has room for without waiting, leaving the rest in "updates". Returns
+ * false if primary disconnected.
+ */
+static bool acknowledge(int socket, size_t *updates);
+
+/*
+ * Answers single query read by replica, returning its status
+ */
+static int answerQuery(ReplicaState *replica, int operation,
+                       const char *argument, FILE *output);
+
+Primary *primaryCreate(const char *path, unsigned replicas)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) return NULL;
+
+    Primary *primary = calloc(1, sizeof(Primary));
+    if (primary == NULL) return NULL;
+
+    primary->listener = -1;
+    primary->path = malloc(strlen(path) + 1);
+    primary->replicas = calloc(replicas > 0 ? replicas : 1,
+                               sizeof(ReplicaLink));
+    primary->pendingCapacity = RECORDS_INITIAL_CAPACITY;
+    primary->pending = malloc(primary->pendingCapacity);
+    if (primary->path == NULL || primary->replicas == NULL ||
+        primary->pending == NULL)
+    {
+        primaryDestroy(primary);
+        return NULL;
+    }
+    strcpy(primary->path, path);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    // socket left behind by primary that did not exit cleanly is replaced
+    unlink(path);
+    primary->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (primary->listener < 0 ||
+        bind(primary->listener, (struct sockaddr *) &address,
+             sizeof(address)) != 0 ||
+        listen(primary->listener, (int) replicas) != 0)
+    {
+        primaryDestroy(primary);
+        return NULL;
+    }
+
+    while (primary->replicasCount < replicas)
+    {
+        int connection = accept(primary->listener, NULL, NULL);
+        if (connection < 0 && errno == EINTR) continue;
+
+        // replicas are served without blocking, see shipTo
+        if (connection < 0 ||
+            fcntl(connection, F_SETFL,
+                  fcntl(connection, F_GETFL) | O_NONBLOCK) != 0)
+        {
+            if (connection >= 0) close(connection);
+            primaryDestroy(primary);
+            return NULL;
+        }
+
+        ReplicaLink *replica = &primary->replicas[primary->replicasCount++];
+        replica->socket = connection;
+        replica->acknowledged = 0;
+    }
+
+    return primary;
+}
+
+void primaryDestroy(Primary *primary)
+{
+    if (primary == NULL) return;
+
+    for (unsigned i = 0; i < primary->replicasCount; ++i)
+    {
+        dropReplica(&primary->replicas[i]);
+    }
+
+    if (primary->listener >= 0)
+    {
+        close(primary->listener);
+        unlink(primary->path);
+    }
+
+    free(primary->path);
+    free(primary->replicas);
+    free(primary->pending);
+    free(primary);
+}
+
+void primaryRecord(void *context, int operation, const char *argument1,
+                   const char *argument2, int status)
+{
+    Primary *primary = context;
+    bool recorded = true;
+    bool update = operation == DECLARE || operation == REMOVE ||
+                  operation == ENERGY || operation == EQUAL ||
+                  operation == LOAD;
+
+    // update that failed in histories is repeated, so that replica checks it
+    // fails too; one that never reached them, was reverted by memory limit,
+    // or any other command that failed left histories as they were, while
+    // commit that failed reverted the whole transaction
+    if (status != QUANT_OK && operation != COMMIT &&
+        !(update && status == QUANT_ERROR))
+        return;
+
+    switch (operation)
+    {
+        case DECLARE:
+            recorded = appendRecord(primary, status, "DECLARE", argument1,
+                                    NULL);
+            break;
+        case REMOVE:
+            recorded = appendRecord(primary, status, "REMOVE", argument1,
+                                    NULL);
+            break;
+        case ENERGY:
+            recorded = appendRecord(primary, status, "ENERGY", argument1,
+                                    argument2);
+            break;
+        case EQUAL:
+            recorded = appendRecord(primary, status, "EQUAL", argument1,
+                                    argument2);
+            break;
+        case LOAD:
+            recorded = appendRecord(primary, status, "LOAD", argument1, NULL);
+            break;
+        case FREEZE:
+            // updates fail after freezing, so replica freezes as well
+            recorded = appendRecord(primary, status, "FREEZE", NULL, NULL);
+            break;
+        case BEGIN:
+            primary->inTransaction = true;
+            return;
+        case COMMIT:
+            if (status != QUANT_OK)
+            {
+                primary->pendingLength = 0;
+                primary->pendingCount = 0;
+            }
+            primary->inTransaction = false;
+            break;
+        case ROLLBACK:
+            primary->pendingLength = 0;
+            primary->pendingCount = 0;
+            primary->inTransaction = false;
+            return;
+        default:
+            return;
+    }
+
+    // replica missing an update would answer wrongly, so it is cut off
+    if (!recorded)
+    {
+        for (unsigned i = 0; i < primary->replicasCount; ++i)
+        {
+            dropReplica(&primary->replicas[i]);
+        }
+    }
+
+    if (!primary->inTransaction) shipPending(primary);
+}
+
+static bool appendRecord(Primary *primary, int status, const char *name,
+                         const char *argument1, const char *argument2)
+{
+    char prefix[16];
+    size_t prefixLength = (size_t) sprintf(prefix, "%d ", status);
+    size_t nameLength = strlen(name);
+    size_t length1 = argument1 == NULL ? 0 : strlen(argument1) + 1;
+    size_t length2 = argument2 == NULL ? 0 : strlen(argument2) + 1;
+    size_t needed = primary->pendingLength + prefixLength + nameLength +
+                    length1 + length2 + 1;
+
+    if (needed > primary->pendingCapacity)
+    {
+        size_t capacity = primary->pendingCapacity;
+        while (capacity < needed) capacity *= 2;
+
+        char *expanded = realloc(primary->pending, capacity);
+        if (expanded == NULL) return false;
+
+        primary->pending = expanded;
+        primary->pendingCapacity = capacity;
+    }
+
+    char *end = primary->pending + primary->pendingLength;
+    memcpy(end, prefix, prefixLength);
+    end += prefixLength;
+    memcpy(end, name, nameLength);
+    end += nameLength;
+    if (argument1 != NULL)
+    {
+        *end++ = ' ';
+        memcpy(end, argument1, length1 - 1);
+        end += length1 - 1;
+    }
+    if (argument2 != NULL)
+    {
+        *end++ = ' ';
+        memcpy(end, argument2, length2 - 1);
+        end += length2 - 1;
+    }
+    *end++ = '\n';
+
+    primary->pendingLength = end - primary->pending;
+    ++primary->pendingCount;
+    return true;
+}
+
+static void shipPending(Primary *primary)
+{
+    if (primary->pendingCount == 0) return;
+
+    uint64_t shipped = primary->shipped + primary->pendingCount;
+
+    for (unsigned i = 0; i < primary->replicasCount; ++i)
+    {
+        ReplicaLink *replica = &primary->replicas[i];
+        if (replica->socket < 0) continue;
+
+        // updates of transaction longer than the limit are shipped once
+        // replica applied all earlier ones
+        uint64_t needed = shipped > REPLICATION_MAX_LAG ?
+                          shipped - REPLICATION_MAX_LAG : 0;
+        if (needed > primary->shipped) needed = primary->shipped;
+
+        if (!awaitReplica(replica, needed) ||
+            !shipTo(replica, primary->pending, primary->pendingLength))
+            dropReplica(replica);
+    }
+
+    primary->shipped = shipped;
+    primary->pendingLength = 0;
+    primary->pendingCount = 0;
+}
+
+static bool shipTo(ReplicaLink *replica, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        // replica that disconnected must not stop primary with SIGPIPE
+        ssize_t sent = send(replica->socket, data, length, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            data += sent;
+            length -= (size_t) sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+        // replica may be waiting to send acknowledgements before it reads
+        struct pollfd descriptor;
+        descriptor.fd = replica->socket;
+        descriptor.events = POLLIN | POLLOUT;
+        if (poll(&descriptor, 1, -1) < 0 && errno != EINTR) return false;
+        if ((descriptor.revents & POLLIN) && !takeAcknowledgements(replica))
+            return false;
+    }
+
+    return true;
+}
+
+static bool awaitReplica(ReplicaLink *replica, uint64_t acknowledged)
+{
+    if (!takeAcknowledgements(replica)) return false;
+
+    while (replica->acknowledged < acknowledged)
+    {
+        struct pollfd descriptor;
+        descriptor.fd = replica->socket;
+        descriptor.events = POLLIN;
+        if (poll(&descriptor, 1, -1) < 0 && errno != EINTR) return false;
+        if (!takeAcknowledgements(replica)) return false;
+    }
+
+    return true;
+}
+
+static bool takeAcknowledgements(ReplicaLink *replica)
+{
+    char acknowledgements[REPLICA_APPLY_SLICE];
+
+    while (true)
+    {
+        ssize_t received = recv(replica->socket, acknowledgements,
+                                sizeof(acknowledgements), 0);
+        if (received > 0)
+        {
+            replica->acknowledged += (uint64_t) received;
+            continue;
+        }
+
+        if (received < 0 && errno == EINTR) continue;
+        return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+static void dropReplica(ReplicaLink *replica)
+{
+    if (replica->socket < 0) return;
+
+    close(replica->socket);
+    replica->socket = -1;
+}
+
+int runReplica(Quantization *quantization, const char *path, FILE *input,
+               FILE *output, FILE *errors)
+{
+    ReplicaState replica;
+    replica.quantization = quantization;
+    replica.socket = connectPrimary(path);
+    atomic_init(&replica.received, 0);
+    atomic_init(&replica.applied, 0);
+    atomic_init(&replica.diverged, false);
+    if (replica.socket < 0) return 1;
+
+    pthread_t applier;
+    if (pthread_mutex_init(&replica.lock, NULL) != 0)
+    {
+        close(replica.socket);
+        return 1;
+    }
+    if (pthread_create(&applier, NULL, applyUpdates, &replica) != 0)
+    {
+        pthread_mutex_destroy(&replica.lock);
+        close(replica.socket);
+        return 1;
+    }
+
+    char *buffer = malloc(sizeof(char) * CHAR_BUFFER);
+    unsigned bufferSize = CHAR_BUFFER;
+    bool unexpectedFileEnd = false;
+    char *command;
+    int exitCode = buffer == NULL ? 1 : 0;
+
+    while (buffer != NULL &&
+           (command = readCommand(&buffer, &bufferSize, &unexpectedFileEnd,
+                                  input)) != NULL)
+    {
+        char *argument1 = NULL;
+        char *argument2 = NULL;
+        int operation = ERROR;
+
+        analyzeInput(command, &argument1, &argument2, &operation);
+        int status = answerQuery(&replica, operation, argument1, output);
+        free(command);
+
+        if (status == QUANT_NO_MEMORY)
+        {
+            exitCode = 1;
+            break;
+        }
+        if (status != QUANT_OK) printError(errors);
+    }
+
+    if (unexpectedFileEnd) printError(errors);
+    if (atomic_load(&replica.diverged)) exitCode = 1;
+
+    // applier waiting for updates is woken up by closed connection
+    shutdown(replica.socket, SHUT_RDWR);
+    pthread_join(applier, NULL);
+    pthread_mutex_destroy(&replica.lock);
+    close(replica.socket);
+    free(buffer);
+    return exitCode;
+}
+
+static int connectPrimary(const char *path)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    for (int attempt = 0; attempt < REPLICA_CONNECT_ATTEMPTS; ++attempt)
+    {
+        int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection < 0) return -1;
+
+        if (connect(connection, (struct sockaddr *) &address,
+                    sizeof(address)) == 0)
+            return connection;
+
+        close(connection);
+
+        struct timespec wait;
+        wait.tv_sec = 0;
+        wait.tv_nsec = REPLICA_CONNECT_WAIT_MS * 1000000L;
+        nanosleep(&wait, NULL);
+    }
+
+    return -1;
+}
+
+static void *applyUpdates(void *argument)
+{
+    ReplicaState *replica = argument;
+    size_t capacity = REPLICA_READ_BYTES;
+    size_t length = 0;
+    char *data = malloc(capacity);
+    bool following = data != NULL;
+    bool acknowledging = true;
+    size_t unacknowledged = 0;
+
+    while (following)
+    {
+        // primary that does not read acknowledgements while it has no
+        // updates to ship must not stop replica from applying them, so they
+        // are sent only when there is room, while waiting for updates
+        if (acknowledging && unacknowledged > 0)
+        {
+            struct pollfd descriptor;
+            descriptor.fd = replica->socket;
+            descriptor.events = POLLIN | POLLOUT;
+            if (poll(&descriptor, 1, -1) < 0 && errno != EINTR) break;
+
+            if (descriptor.revents & POLLOUT)
+                acknowledging = acknowledge(replica->socket,
+                                            &unacknowledged);
+            if (descriptor.revents == POLLOUT) continue;
+        }
+
+        // update longer than the buffer makes it grow
+        if (length == capacity)
+        {
+            char *expanded = realloc(data, capacity * 2);
+            if (expanded == NULL)
+            {
+                following = false;
+                break;
+            }
+
+            data = expanded;
+            capacity *= 2;
+        }
+
+        ssize_t received = recv(replica->socket, data + length,
+                                capacity - length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) break;
+
+        size_t records = 0;
+        for (size_t i = length; i < length + (size_t) received; ++i)
+        {
+            if (data[i] == '\n') ++records;
+        }
+        length += (size_t) received;
+        atomic_fetch_add(&replica->received, records);
+
+        // queries wait for one slice of updates at most
+        size_t start = 0;
+        while (records > 0 && following)
+        {
+            size_t slice = records < REPLICA_APPLY_SLICE ? records :
+                           REPLICA_APPLY_SLICE;
+
+            pthread_mutex_lock(&replica->lock);
+            for (size_t i = 0; i < slice && following; ++i)
+            {
+                char *end = memchr(data + start, '\n', length - start);
+                *end = '\0';
+                following = applyUpdate(replica->quantization, data + start);
+                start = end + 1 - data;
+            }
+            quantMaintain(replica->quantization);
+            pthread_mutex_unlock(&replica->lock);
+
+            if (!following) break;
+
+            atomic_fetch_add(&replica->applied, slice);
+            records -= slice;
+
+            // updates primary shipped before it exited are still applied
+            unacknowledged += slice;
+            acknowledging = acknowledging &&
+                            acknowledge(replica->socket, &unacknowledged);
+        }
+
+        memmove(data, data + start, length - start);
+        length -= start;
+    }
+
+    // primary stops waiting for replica that no longer follows it, and
+    // updates left unacknowledged are reported by queries instead
+    if (!following) atomic_store(&replica->diverged, true);
+    shutdown(replica->socket, SHUT_RDWR);
+    free(data);
+    return NULL;
+}
+
+static bool applyUpdate(Quantization *quantization, char *record)
+{
+    // records are made by primary, status it got, name and arguments are
+    // separated by spaces
+    char *name = strchr(record, ' ');
+    if (name == NULL) return false;
+    *name++ = '\0';
+    int expected = atoi(record);
+
+    char *argument1 = strchr(name, ' ');
+    if (argument1 != NULL) *argument1++ = '\0';
+
+    // histories of LOAD are split by loadRecord
+    char *argument2 = argument1 == NULL || strcmp(name, "LOAD") == 0 ? NULL :
+                      strchr(argument1, ' ');
+    if (argument2 != NULL) *argument2++ = '\0';
+
+    // record replica does not know cannot be followed either
+    int status = QUANT_INVALID_ARGUMENT;
+    Energy energy = 0;
+
+    if (strcmp(name, "FREEZE") == 0)
+        status = quantFreeze(quantization);
+    else if (argument1 == NULL)
+        status = QUANT_INVALID_ARGUMENT;
+    else if (strcmp(name, "DECLARE") == 0)
+        status = quantDeclare(quantization, argument1);
+    else if (strcmp(name, "REMOVE") == 0)
+        status = quantRemove(quantization, argument1);
+    else if (strcmp(name, "ENERGY") == 0 && argument2 != NULL &&
+             parseEnergy(argument2, &energy))
+        status = quantSetEnergy(quantization, argument1, energy);
+    else if (strcmp(name, "EQUAL") == 0 && argument2 != NULL)
+        status = quantEqual(quantization, argument1, argument2);
+    else if (strcmp(name, "LOAD") == 0)
+        status = loadRecord(quantization, argument1);
+
+    return status == expected;
+}
+
+static int loadRecord(Quantization *quantization, char *histories)
+{
+    size_t count = *histories == '\0' ? 0 : 1;
+    for (const char *c = histories; *c != '\0'; ++c)
+    {
+        if (*c == ' ') ++count;
+    }
+
+    const char **split = malloc(sizeof(char *) * (count > 0 ? count : 1));
+    if (split == NULL) return QUANT_NO_MEMORY;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        split[i] = histories;
+        histories = strchr(histories, ' ');
+        if (histories != NULL) *histories++ = '\0';
+    }
+
+    int status = quantLoad(quantization, split, count);
+    free(split);
+    return status;
+}
+
+static bool acknowledge(int socket, size_t *updates)
+{
+    static const char acknowledgements[REPLICA_APPLY_SLICE];
+
+    while (*updates > 0)
+    {
+        size_t length = *updates < REPLICA_APPLY_SLICE ? *updates :
+                        REPLICA_APPLY_SLICE;
+        ssize_t sent = send(socket, acknowledgements, length,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (sent <= 0) return false;
+
+        *updates -= (size_t) sent;
+    }
+
+    return true;
+}
+
+static int answerQuery(ReplicaState *replica, int operation,
+                       const char *argument, FILE *output)
+{
+    Quantization *quantization = replica->quantization;
+    int status = QUANT_OK;
+    bool valid = false;
+    Energy energy = 0;
+    Aggregate aggregate;
+    Statistics statistics;
+
+    if (operation == PASS) return QUANT_OK;
+
+    // histories no longer follow primary, so their answers would be wrong
+    if (atomic_load(&replica->diverged)) return QUANT_ERROR;
+
+    if (operation == LAG)
+    {
+        printLag(output, atomic_load(&replica->received) -
+                         atomic_load(&replica->applied));
+        return QUANT_OK;
+    }
+
+    pthread_mutex_lock(&replica->lock);
+    switch (operation)
+    {
+        case VALID:
+            status = quantValid(quantization, argument, &valid);
+            if (status == QUANT_OK) printValid(output, valid);
+            break;
+        case ENERGY_SHORT:
+            status = quantGetEnergy(quantization, argument, &energy);
+            if (status == QUANT_OK) printEnergy(output, energy);
+            break;
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            status = quantAggregate(quantization, argument, &aggregate);
+            if (status == QUANT_OK &&
+                !printAggregate(output, operation, &aggregate))
+                status = QUANT_ERROR;
+            break;
+        case STATS:
+            status = quantStatistics(quantization, &statistics);
+            if (status == QUANT_OK) printStatistics(output, &statistics);
+            break;
+        default:
+            // histories change only through primary
+            status = QUANT_ERROR;
+            break;
+    }
+    pthread_mutex_unlock(&replica->lock);
+
+    return status;
+}
@@ -0,0 +1,59 @@
+#ifndef QUANTIZATION_REPLICATION_H
+#define QUANTIZATION_REPLICATION_H
+
+#include <stdio.h>
+#include "quantization.h"
+
+/*
+ * Largest number of updates primary ships ahead of what a replica reported
+ * applied
+ */
+#define REPLICATION_MAX_LAG 4096
+
+/*
+ * Primary end of replication. Every update which reached histories of primary
+ * is shipped as a command line, DECLARE, REMOVE, ENERGY, EQUAL, LOAD or
+ * FREEZE, preceded by status it ended with, over a Unix socket to replicas,
+ * which repeat it on their own histories and answer queries. Updates of
+ * transaction are shipped once it is committed. LOAD ships the histories it
+ * declared, so replicas need no access to its file.
+ */
+typedef struct Primary Primary;
+
+/*
+ * Listens on Unix socket at given path and waits until "replicas" replicas
+ * connect. Returns NULL if socket could not be set up.
+ */
+Primary *primaryCreate(const char *path, unsigned replicas);
+
+/*
+ * Disconnects replicas and removes the socket. Passing NULL is allowed.
+ */
+void primaryDestroy(Primary *primary);
+
+/*
+ * Ships update to replicas if it succeeded, or failed with QUANT_ERROR
+ * outside of transaction, meant to be passed as UpdateLog
+ * to runLoggedCommands with primary as "context". Shipping waits while any
+ * replica is more than REPLICATION_MAX_LAG updates behind. Replica that
+ * disconnected is dropped.
+ */
+void primaryRecord(void *context, int operation, const char *argument1,
+                   const char *argument2, int status);
+
+/*
+ * Connects to primary listening at given path and applies updates it ships on
+ * given histories, while answering VALID, ENERGY, COUNT, SUM, MIN, MAX, STATS
+ * and LAG queries read from "input". Every other command is answered with an
+ * error, as histories change only through primary. LAG prints number of
+ * updates received but not applied yet. Update which ends with other status
+ * than it did on primary makes replica stop following it: the update is not
+ * acknowledged and every later query is answered with an error. Histories
+ * must have no memory limit, which primary does not share. Returns exit code
+ * like runCommands, 1 also when primary could not be reached or replica
+ * stopped following it.
+ */
+int runReplica(Quantization *quantization, const char *path, FILE *input,
+               FILE *output, FILE *errors);
+
+#endif //QUANTIZATION_REPLICATION_H
@@ -0,0 +1,1973 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sharded.h"
+#include "interface.h"
+#include "output.h"
+#include "quantization.h"
+#include "symbols.h"
+
+/*
+ * Number of commands read ahead of the oldest one not answered yet. Queue of
+ * every shard never holds more parts than that, so it cannot overflow.
+ */
+#ifndef SHARD_WINDOW
+#define SHARD_WINDOW 8192
+#endif
+
+/*
+ * Largest number of commands shard executes between two looks at the lock
+ */
+#define SHARD_RUN 256
+
+/*
+ * Largest number of routing prefixes, so that index of a prefix multiplied by
+ * number of shards fits in 64 bits
+ */
+#define SHARD_PREFIXES_MAX (UINT64_C(1) << 32)
+
+/*
+ * Position of shard which has nothing left to execute
+ */
+#define NO_POSITION UINT64_MAX
+
+/*
+ * Single command read from input, with place for its answer. It is executed in
+ * parts, one by each shard holding histories it touches, and answered once
+ * none of them is "pending". Parts combine their answers: failure of any of
+ * them is kept in "status", and history is "valid" if any of them found it.
+ * "loaded" are histories of LOAD grouped by shard, part of shard i starts at
+ * "loadedStart[i]". "contents" is file they point to, or pairs of EQUAL_BATCH
+ * and ENERGY_BATCH do, released with the command.
+ */
+struct ShardedCommand
+{
+    char *line;
+    char *contents;
+    char *argument1;
+    char *argument2;
+    int operation;
+    uint64_t sequence;
+    atomic_uint pending;
+    atomic_int status;
+    atomic_bool valid;
+    Energy energy;
+    Version version;
+    Aggregate aggregate;
+    Statistics statistics;
+    const char **loaded;
+    size_t *loadedStart;
+};
+typedef struct ShardedCommand ShardedCommand;
+
+/*
+ * Thread owning one part of histories, kept in its own context. "queue" holds
+ * parts of commands in the order they were read: reading thread appends them
+ * at "tail", shard executes them from "head". Shard which has "bridges" finds
+ * itself commands whose histories may be equal to histories of other shards,
+ * and stays "blocked" at such command until reading thread executes it,
+ * "pausing" shards of the same "component", which bridges join it with.
+ * "running" shard executes commands without the lock, "idle" one waits for
+ * "wake", given when a whole run is waiting in its queue past "woken", or when
+ * reading thread waits itself. "lookups" and the rest are space for run of
+ * queries answered with one batched lookup.
+ */
+struct Shard
+{
+    struct ShardedEngine *engine;
+    Quantization *quantization;
+    ShardedCommand **queue;
+    uint64_t head;
+    _Atomic uint64_t tail;
+    bool blocked;
+    bool running;
+    atomic_bool idle;
+    atomic_bool pausing;
+    uint64_t woken;
+    size_t bridges;
+    unsigned component;
+    pthread_cond_t wake;
+    pthread_t thread;
+    const char *lookups[SHARD_RUN];
+    ShardedCommand *looked[SHARD_RUN];
+    int statuses[SHARD_RUN];
+    bool valid[SHARD_RUN];
+    Energy energies[SHARD_RUN];
+};
+typedef struct Shard Shard;
+
+/*
+ * Equality of histories of two different shards. Contexts do not know about
+ * it, they only mark both classes it joins as shared, see quantShare.
+ * "visited" bridges were already crossed by energy being spread.
+ */
+struct Bridge
+{
+    unsigned shardA;
+    unsigned shardB;
+    char *historyA;
+    char *historyB;
+    bool visited;
+};
+typedef struct Bridge Bridge;
+
+/*
+ * Bridge added or removed in open transaction, so that it can be reverted.
+ * Histories of removed bridge are owned by the change until transaction ends.
+ */
+struct BridgeChange
+{
+    bool added;
+    Bridge bridge;
+};
+typedef struct BridgeChange BridgeChange;
+
+/*
+ * Histories are split among shards by their first "depth" symbols: each of
+ * "prefixes" of that length belongs to one shard, and consecutive prefixes to
+ * the same one, so that history shorter than that is usually kept by a single
+ * shard too. History kept by many shards is declared in the first of them, its
+ * "home", where its energy is kept.
+ *
+ * Reading thread appends parts of commands to queues of shards and prints
+ * answers in order as they come, at most SHARD_WINDOW commands behind. Shards
+ * execute their queues on their own, as commands of different shards touch
+ * different histories. Commands which touch histories of several shards at
+ * once, like equality across shards, or all of them, like transactions, wait
+ * until all commands read before them are answered and are executed by the
+ * reading thread alone.
+ *
+ * Equalities across shards are kept as "bridges". Command of a shard whose
+ * histories may be equal to histories of other shards through them is found
+ * by the shard itself, which stops there. Reading thread executes it once
+ * every shard which bridges join with it got past it, pausing them meanwhile.
+ * Commands of those shards executed earlier do not touch histories it may
+ * reach, as those are marked as shared and would stop their shards as well.
+ * Other shards keep running, as no bridge leads to their histories. Groups of
+ * shards joined by bridges are found again once "componentsStale".
+ *
+ * While transaction is open, "changes" record bridges it added or removed.
+ * "aborted" tells that one of its updates failed. Snapshots are taken by every
+ * shard at once, so they have the same version everywhere.
+ *
+ * Reading thread "waiting" for "changed" is woken once "awaited" command is
+ * done, or after every run of shards if it is NULL or some of them are
+ * blocked, as it may be able to execute their commands then.
+ *
+ * "failed" is set once command ran out of memory, which ends the session.
+ */
+struct ShardedEngine
+{
+    Shard *shards;
+    unsigned shardsCount;
+    unsigned depth;
+    uint64_t prefixes;
+    ShardedCommand *window;
+    uint64_t read;
+    uint64_t answered;
+    Bridge *bridges;
+    size_t bridgesCount;
+    size_t bridgesCapacity;
+    BridgeChange *changes;
+    size_t changesCount;
+    size_t changesCapacity;
+    bool transaction;
+    atomic_bool aborted;
+    bool frozen;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool waiting;
+    ShardedCommand *awaited;
+    bool componentsStale;
+    atomic_uint blockedShards;
+    bool stopping;
+};
+typedef struct ShardedEngine ShardedEngine;
+
+/*
+ * Creates engine with running shard threads, returns NULL on failure
+ */
+static ShardedEngine *createEngine(unsigned shards, unsigned depth);
+
+/*
+ * Stops shard threads and releases all histories
+ */
+static void destroyEngine(ShardedEngine *engine);
+
+/*
+ * Picks routing prefix long enough to spread histories evenly among shards
+ */
+static unsigned automaticDepth(unsigned shards);
+
+/*
+ * Body of shard thread, executes its queue in runs
+ */
+static void *shardWorker(void *argument);
+
+/*
+ * Executes commands of shard queue from position "first" up to "last", until
+ * shard is pausing or command needs reading thread, which sets "blocked".
+ * Returns position after the last command executed.
+ */
+static uint64_t executeRun(Shard *shard, uint64_t first, uint64_t last,
+                           bool *blocked);
+
+/*
+ * Answers run of VALID and ENERGY queries from shard queue, starting at
+ * position "first", with one batched lookup. Returns position after the run.
+ */
+static uint64_t executeLookups(Shard *shard, uint64_t first, uint64_t last);
+
+/*
+ * Executes part of command on histories of given shard
+ */
+static void executePart(Shard *shard, ShardedCommand *command);
+
+/*
+ * Checks whether command in queue of given shard may touch histories equal to
+ * histories of other shards, so that reading thread has to execute it
+ */
+static bool needsEngine(Shard *shard, const ShardedCommand *command);
+
+/*
+ * Executes part of command at which given shard is blocked. Every shard is
+ * idle meanwhile.
+ */
+static int executeBlocked(ShardedEngine *engine, unsigned shard,
+                          ShardedCommand *command);
+
+/*
+ * Stores answer of single part of command, which ended with given status.
+ * Failed update aborts open transaction.
+ */
+static void finishPart(ShardedEngine *engine, ShardedCommand *command,
+                       int status, bool valid);
+
+/*
+ * Checks whether failure of command with given operation makes transaction it
+ * belongs to fail
+ */
+static bool abortsTransaction(int operation);
+
+/*
+ * Executes command blocking a shard if every shard of its component got past
+ * it, pausing them meanwhile. Must be called with the lock held. Returns false
+ * if there was no such command.
+ */
+static bool coordinate(ShardedEngine *engine);
+
+/*
+ * Checks whether command given shard is blocked at can be executed, as no
+ * other shard of its component is behind it. Must be called with the lock
+ * held.
+ */
+static bool mayCoordinate(ShardedEngine *engine, unsigned shard);
+
+/*
+ * Assigns every shard to component of shards joined by bridges
+ */
+static void findComponents(ShardedEngine *engine);
+
+/*
+ * Returns sequence number of the oldest command given shard has not executed
+ * yet, NO_POSITION if it has none. Must be called with the lock held.
+ */
+static uint64_t positionOf(Shard *shard);
+
+/*
+ * Waits until no shard is running. Must be called with the lock held.
+ */
+static void awaitShards(ShardedEngine *engine);
+
+/*
+ * Wakes idle shards which have commands waiting, before reading thread waits
+ * for them
+ */
+static void wakeShards(ShardedEngine *engine);
+
+/*
+ * Returns next free place in the window for command read from input, waiting
+ * for the oldest one to be answered if window is full. Returns NULL if memory
+ * ran out meanwhile.
+ */
+static ShardedCommand *nextCommand(ShardedEngine *engine, FILE *output,
+                                   FILE *errors);
+
+/*
+ * Splits command into parts and gives them to shards, or answers it at once
+ */
+static void routeCommand(ShardedEngine *engine, ShardedCommand *command,
+                         FILE *output, FILE *errors);
+
+/*
+ * Gives parts of command to shards from "first" up to "last"
+ */
+static void dispatchCommand(ShardedEngine *engine, ShardedCommand *command,
+                            unsigned first, unsigned last);
+
+/*
+ * Answers command without giving it to shards
+ */
+static void answerCommand(ShardedEngine *engine, ShardedCommand *command,
+                          int status);
+
+/*
+ * Executes command which touches histories of several shards, or all of them,
+ * once all commands read before it are answered
+ */
+static void executeAlone(ShardedEngine *engine, ShardedCommand *command,
+                         FILE *output, FILE *errors);
+
+/*
+ * Reads histories of LOAD from file and gives each shard its part
+ */
+static void routeLoad(ShardedEngine *engine, ShardedCommand *command);
+
+/*
+ * Reads pairs of EQUAL_BATCH or ENERGY_BATCH from file and routes each of
+ * them as a separate command, answered like that command
+ */
+static void routePairs(ShardedEngine *engine, char *line, int operation,
+                       const char *path, FILE *output, FILE *errors);
+
+/*
+ * Prints answers of commands already done, in order, and releases them
+ */
+static void answerDone(ShardedEngine *engine, FILE *output, FILE *errors);
+
+/*
+ * Prints answers of all commands read so far, waiting for them
+ */
+static void answerAll(ShardedEngine *engine, FILE *output, FILE *errors);
+
+/*
+ * Waits until the oldest command not answered yet is done, executing commands
+ * shards are blocked at meanwhile
+ */
+static void awaitOldest(ShardedEngine *engine);
+
+/*
+ * Prints answer of single command
+ */
+static void printAnswer(ShardedEngine *engine, ShardedCommand *command,
+                        FILE *output, FILE *errors);
+
+/*
+ * Releases memory held by command
+ */
+static void releaseCommand(ShardedCommand *command);
+
+/*
+ * Stores in "first" and "last" range of shards keeping given history, invalid
+ * history is given to the first shard, which rejects it
+ */
+static void shardsOf(ShardedEngine *engine, const char *history,
+                     unsigned *first, unsigned *last);
+
+/*
+ * Returns shard owning routing prefix with given index
+ */
+static unsigned ownerOf(ShardedEngine *engine, uint64_t prefix);
+
+/*
+ * Finds shard which keeps energy of given history and stores it in "home".
+ * History kept by many shards, but not declared in its home, is declared
+ * there. Returns QUANT_ERROR if no shard knows the history.
+ */
+static int resolveHistory(ShardedEngine *engine, const char *history,
+                          unsigned *home);
+
+/*
+ * Assigns energy to history kept by given shard, and to every history equal to
+ * it, also across bridges
+ */
+static int spreadEnergy(ShardedEngine *engine, unsigned shard,
+                        const char *history, Energy energy);
+
+/*
+ * Executes ENERGY of history kept by many shards or shared with other shards
+ */
+static int energyEverywhere(ShardedEngine *engine, const char *history,
+                            Energy energy);
+
+/*
+ * Executes EQUAL of histories of different shards, kept by many shards or
+ * shared with other shards
+ */
+static int equalEverywhere(ShardedEngine *engine, const char *historyA,
+                           const char *historyB);
+
+/*
+ * Removes history from given shard together with bridges of histories it is
+ * prefix of
+ */
+static int removeShared(ShardedEngine *engine, unsigned shard,
+                        const char *history);
+
+/*
+ * Stores in "aggregate" summary of history kept by many shards
+ */
+static int aggregateEverywhere(ShardedEngine *engine, const char *history,
+                               Aggregate *aggregate);
+
+/*
+ * Adds to "aggregate" summaries of history written to "history", which is
+ * "length" characters long, and of all histories it is prefix of. Histories
+ * shorter than routing prefix are counted once, with energy of their home.
+ */
+static int aggregatePrefixes(ShardedEngine *engine, char *history,
+                             size_t length, Aggregate *aggregate);
+
+/*
+ * Executes BEGIN, COMMIT or ROLLBACK on all shards, returns its status
+ */
+static int transactionEverywhere(ShardedEngine *engine, int operation);
+
+/*
+ * Executes one of the commands applied to every shard in turn: SNAPSHOT,
+ * RELEASE, FREEZE, COMPACT, DEFRAG or STATS. Returns its status.
+ */
+static int applyEverywhere(ShardedEngine *engine, ShardedCommand *command);
+
+/*
+ * Returns position of bridge joining given histories, or SIZE_MAX if there is
+ * none
+ */
+static size_t findBridge(ShardedEngine *engine, unsigned shardA,
+                         const char *historyA, unsigned shardB,
+                         const char *historyB);
+
+/*
+ * Adds bridge joining given histories, recording it in open transaction.
+ * Returns false if memory ran out.
+ */
+static bool addBridge(ShardedEngine *engine, unsigned shardA,
+                      const char *historyA, unsigned shardB,
+                      const char *historyB);
+
+/*
+ * Puts bridge into the list, taking its histories. Returns false if memory
+ * ran out.
+ */
+static bool insertBridge(ShardedEngine *engine, const Bridge *bridge);
+
+/*
+ * Takes bridge at given position out of the list, recording it in open
+ * transaction or releasing its histories. Returns false if memory ran out.
+ */
+static bool removeBridge(ShardedEngine *engine, size_t position);
+
+/*
+ * Records change of bridges in open transaction, returns false if memory ran
+ * out
+ */
+static bool recordChange(ShardedEngine *engine, bool added,
+                         const Bridge *bridge);
+
+/*
+ * Reverts or keeps all changes of bridges recorded in transaction
+ */
+static void closeChanges(ShardedEngine *engine, bool revert);
+
+/*
+ * Returns copy of given history, or NULL if memory ran out
+ */
+static char *copyHistory(const char *history);
+
+int runShardedCommands(unsigned shards, unsigned depth, const char *bulkDeclare,
+                       FILE *input, FILE *output, FILE *errors)
+{
+    if (shards == 0) shards = 1;
+    if (depth == SHARD_DEPTH_AUTO) depth = automaticDepth(shards);
+    if (depth > SHARD_DEPTH_MAX) depth = SHARD_DEPTH_MAX;
+
+    char *buffer = malloc(sizeof(char) * CHAR_BUFFER);
+    if (buffer == NULL) return 1;
+    buffer[0] = '\0';
+
+    ShardedEngine *engine = createEngine(shards, depth);
+    if (engine == NULL)
+    {
+        free(buffer);
+        return 1;
+    }
+
+    if (bulkDeclare != NULL)
+    {
+        // declaration is executed like LOAD, but not answered
+        ShardedCommand *command = nextCommand(engine, output, errors);
+        command->operation = LOAD;
+        command->argument1 = (char *) bulkDeclare;
+        routeLoad(engine, command);
+        awaitOldest(engine);
+
+        int status = atomic_load(&command->status);
+        command->operation = PASS;
+        if (status != QUANT_OK)
+        {
+            fprintf(errors, "Cannot declare histories from %s\n", bulkDeclare);
+            destroyEngine(engine);
+            free(buffer);
+            return 1;
+        }
+    }
+
+    unsigned bufferSize = CHAR_BUFFER;
+    bool unexpectedFileEnd = false;
+    char *line;
+
+    while (!engine->failed &&
+           (line = readCommand(&buffer, &bufferSize, &unexpectedFileEnd,
+                               input)) != NULL)
+    {
+        char *argument1 = NULL;
+        char *argument2 = NULL;
+        int operation = ERROR;
+        analyzeInput(line, &argument1, &argument2, &operation);
+
+        if (operation == EQUAL_BATCH || operation == ENERGY_BATCH)
+        {
+            routePairs(engine, line, operation, argument1, output, errors);
+        }
+        else
+        {
+            ShardedCommand *command = nextCommand(engine, output, errors);
+            if (command == NULL)
+            {
+                free(line);
+                break;
+            }
+
+            command->line = line;
+            command->argument1 = argument1;
+            command->argument2 = argument2;
+            command->operation = operation;
+            routeCommand(engine, command, output, errors);
+        }
+
+        if (atomic_load(&engine->blockedShards) > 0)
+        {
+            pthread_mutex_lock(&engine->lock);
+            while (coordinate(engine));
+            pthread_mutex_unlock(&engine->lock);
+        }
+        answerDone(engine, output, errors);
+
+        // answers are held back only while more commands are waiting, so
+        // that interactive user gets them at once
+        if (!inputReady(input)) answerAll(engine, output, errors);
+    }
+
+    answerAll(engine, output, errors);
+    if (!engine->failed && unexpectedFileEnd) printError(errors);
+
+    int exitCode = engine->failed ? 1 : 0;
+    destroyEngine(engine);
+    free(buffer);
+    return exitCode;
+}
+
+static unsigned automaticDepth(unsigned shards)
+{
+    unsigned depth = 1;
+    unsigned long prefixes = STATES;
+
+    // a few prefixes per shard keep the load even
+    while (prefixes < 4UL * shards && depth < SHARD_DEPTH_MAX)
+    {
+        prefixes *= STATES;
+        ++depth;
+    }
+
+    return depth;
+}
+
+static ShardedEngine *createEngine(unsigned shards, unsigned depth)
+{
+    ShardedEngine *engine = calloc(1, sizeof(ShardedEngine));
+    if (engine == NULL) return NULL;
+
+    // prefixes beyond the limit would not spread histories any better
+    engine->prefixes = 1;
+    engine->depth = 0;
+    while (engine->depth < depth &&
+           engine->prefixes * STATES <= SHARD_PREFIXES_MAX)
+    {
+        engine->prefixes *= STATES;
+        ++engine->depth;
+    }
+
+    atomic_init(&engine->aborted, false);
+    atomic_init(&engine->blockedShards, 0);
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->changed, NULL);
+
+    engine->window = malloc(sizeof(ShardedCommand) * SHARD_WINDOW);
+    engine->shards = calloc(shards, sizeof(Shard));
+    if (engine->window == NULL || engine->shards == NULL)
+    {
+        destroyEngine(engine);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < shards; ++i)
+    {
+        Shard *shard = &engine->shards[i];
+        shard->engine = engine;
+        shard->quantization = quantCreate();
+        shard->queue = malloc(sizeof(ShardedCommand *) * SHARD_WINDOW);
+        atomic_init(&shard->tail, 0);
+        atomic_init(&shard->idle, false);
+        atomic_init(&shard->pausing, false);
+        shard->component = i;
+        pthread_cond_init(&shard->wake, NULL);
+
+        if (shard->quantization == NULL || shard->queue == NULL ||
+            pthread_create(&shard->thread, NULL, shardWorker, shard) != 0)
+        {
+            if (shard->quantization != NULL) quantDestroy(shard->quantization);
+            free(shard->queue);
+            pthread_cond_destroy(&shard->wake);
+            destroyEngine(engine);
+            return NULL;
+        }
+
+        // only shards with running thread are counted, so destroy can join them
+        engine->shardsCount = i + 1;
+    }
+
+    return engine;
+}
+
+static void destroyEngine(ShardedEngine *engine)
+{
+    pthread_mutex_lock(&engine->lock);
+    engine->stopping = true;
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        pthread_cond_signal(&engine->shards[i].wake);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        Shard *shard = &engine->shards[i];
+        pthread_join(shard->thread, NULL);
+        quantDestroy(shard->quantization);
+        free(shard->queue);
+        pthread_cond_destroy(&shard->wake);
+    }
+
+    // commands left after memory failure
+    for (uint64_t i = engine->answered; i < engine->read; ++i)
+    {
+        releaseCommand(&engine->window[i % SHARD_WINDOW]);
+    }
+
+    closeChanges(engine, false);
+    for (size_t i = 0; i < engine->bridgesCount; ++i)
+    {
+        free(engine->bridges[i].historyA);
+        free(engine->bridges[i].historyB);
+    }
+
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->changed);
+    free(engine->changes);
+    free(engine->bridges);
+    free(engine->shards);
+    free(engine->window);
+    free(engine);
+}
+
+static void *shardWorker(void *argument)
+{
+    Shard *shard = argument;
+    ShardedEngine *engine = shard->engine;
+
+    pthread_mutex_lock(&engine->lock);
+    while (!engine->stopping)
+    {
+        uint64_t tail = atomic_load(&shard->tail);
+        if (atomic_load(&shard->pausing) || shard->blocked ||
+            shard->head == tail)
+        {
+            // reading thread looks at "idle" after it appends a command, so
+            // either it wakes the shard or the shard sees the command
+            atomic_store(&shard->idle, true);
+            if (shard->head == atomic_load(&shard->tail) ||
+                atomic_load(&shard->pausing) || shard->blocked)
+                pthread_cond_wait(&shard->wake, &engine->lock);
+            atomic_store(&shard->idle, false);
+            continue;
+        }
+
+        uint64_t first = shard->head;
+        uint64_t last = tail - first > SHARD_RUN ? first + SHARD_RUN : tail;
+        shard->running = true;
+        pthread_mutex_unlock(&engine->lock);
+
+        bool blocked = false;
+        uint64_t next = executeRun(shard, first, last, &blocked);
+
+        pthread_mutex_lock(&engine->lock);
+        shard->head = next;
+        shard->running = false;
+        if (blocked)
+        {
+            shard->blocked = true;
+            atomic_fetch_add(&engine->blockedShards, 1);
+        }
+        if (engine->waiting &&
+            (atomic_load(&engine->blockedShards) > 0 ||
+             engine->awaited == NULL ||
+             atomic_load(&engine->awaited->pending) == 0))
+            pthread_cond_signal(&engine->changed);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    return NULL;
+}
+
+static uint64_t executeRun(Shard *shard, uint64_t first, uint64_t last,
+                           bool *blocked)
+{
+    uint64_t next = first;
+
+    while (next < last && !atomic_load_explicit(&shard->pausing,
+                                                memory_order_relaxed))
+    {
+        ShardedCommand *command = shard->queue[next % SHARD_WINDOW];
+        if (needsEngine(shard, command))
+        {
+            *blocked = true;
+            break;
+        }
+
+        if (command->operation == VALID || command->operation == ENERGY_SHORT)
+        {
+            next = executeLookups(shard, next, last);
+        }
+        else
+        {
+            executePart(shard, command);
+            ++next;
+        }
+
+        quantMaintain(shard->quantization);
+    }
+
+    return next;
+}
+
+static uint64_t executeLookups(Shard *shard, uint64_t first, uint64_t last)
+{
+    uint64_t next = first;
+    size_t count = 0;
+
+    for (; next < last; ++next, ++count)
+    {
+        ShardedCommand *command = shard->queue[next % SHARD_WINDOW];
+        if ((command->operation != VALID &&
+             command->operation != ENERGY_SHORT) ||
+            (next > first && needsEngine(shard, command))) break;
+
+        shard->looked[count] = command;
+        shard->lookups[count] = command->argument1;
+    }
+
+    quantLookupBatch(shard->quantization, shard->lookups, count,
+                     shard->statuses, shard->valid, shard->energies);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        ShardedCommand *command = shard->looked[i];
+        int status = shard->statuses[i];
+
+        // energy is kept only by home of the history, its only part
+        if (command->operation == ENERGY_SHORT && status == QUANT_OK)
+        {
+            command->energy = shard->energies[i];
+            if (command->energy == 0) status = QUANT_ERROR;
+        }
+        finishPart(shard->engine, command, status, shard->valid[i]);
+    }
+
+    return next;
+}
+
+static void executePart(Shard *shard, ShardedCommand *command)
+{
+    Quantization *quantization = shard->quantization;
+    size_t index = (size_t) (shard - shard->engine->shards);
+    int status = QUANT_OK;
+    bool valid = false;
+
+    switch (command->operation)
+    {
+        case DECLARE:
+            status = quantDeclare(quantization, command->argument1);
+            break;
+        case REMOVE:
+            status = quantRemove(quantization, command->argument1);
+            break;
+        case ENERGY:
+            status = quantSetEnergy(quantization, command->argument1,
+                                    command->energy);
+            break;
+        case EQUAL:
+            status = quantEqual(quantization, command->argument1,
+                                command->argument2);
+            break;
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            status = quantAggregate(quantization, command->argument1,
+                                    &command->aggregate);
+            break;
+        case VALID_AT:
+            status = quantValidAt(quantization, command->version,
+                                  command->argument2, &valid);
+            break;
+        case ENERGY_AT:
+            status = quantGetEnergyAt(quantization, command->version,
+                                      command->argument2, &command->energy);
+            break;
+        case LOAD:
+            status = quantLoad(quantization,
+                               command->loaded + command->loadedStart[index],
+                               command->loadedStart[index + 1] -
+                               command->loadedStart[index]);
+            break;
+        default:
+            break;
+    }
+
+    finishPart(shard->engine, command, status, valid);
+}
+
+static bool needsEngine(Shard *shard, const ShardedCommand *command)
+{
+    if (shard->bridges == 0) return false;
+
+    Quantization *quantization = shard->quantization;
+    bool shared = false;
+    bool sharedB = false;
+
+    switch (command->operation)
+    {
+        case ENERGY:
+        case ENERGY_SHORT:
+            quantShared(quantization, command->argument1, false, &shared);
+            break;
+        case EQUAL:
+            quantShared(quantization, command->argument1, false, &shared);
+            quantShared(quantization, command->argument2, false, &sharedB);
+            break;
+        case REMOVE:
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            quantShared(quantization, command->argument1, true, &shared);
+            break;
+        default:
+            break;
+    }
+
+    return shared || sharedB;
+}
+
+static int executeBlocked(ShardedEngine *engine, unsigned shard,
+                          ShardedCommand *command)
+{
+    Quantization *quantization = engine->shards[shard].quantization;
+
+    switch (command->operation)
+    {
+        case ENERGY:
+            return spreadEnergy(engine, shard, command->argument1,
+                                command->energy);
+        case ENERGY_SHORT:
+            return quantGetEnergy(quantization, command->argument1,
+                                  &command->energy);
+        case EQUAL:
+            return equalEverywhere(engine, command->argument1,
+                                   command->argument2);
+        case REMOVE:
+            return removeShared(engine, shard, command->argument1);
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            return quantAggregate(quantization, command->argument1,
+                                  &command->aggregate);
+        default:
+            return QUANT_OK;
+    }
+}
+
+static void finishPart(ShardedEngine *engine, ShardedCommand *command,
+                       int status, bool valid)
+{
+    if (valid) atomic_store(&command->valid, true);
+
+    // running out of memory is kept over other failures of the parts
+    int expected = QUANT_OK;
+    if (status == QUANT_NO_MEMORY) atomic_store(&command->status, status);
+    else if (status != QUANT_OK)
+        atomic_compare_exchange_strong(&command->status, &expected, status);
+
+    // transaction is opened only while shards are idle
+    if (status != QUANT_OK && engine->transaction &&
+        abortsTransaction(command->operation))
+        atomic_store(&engine->aborted, true);
+
+    atomic_fetch_sub(&command->pending, 1);
+}
+
+static bool abortsTransaction(int operation)
+{
+    return operation == DECLARE || operation == REMOVE ||
+           operation == ENERGY || operation == EQUAL || operation == LOAD ||
+           operation == ERROR;
+}
+
+static bool coordinate(ShardedEngine *engine)
+{
+    if (engine->componentsStale) findComponents(engine);
+
+    unsigned blocked = 0;
+    while (blocked < engine->shardsCount &&
+           (!engine->shards[blocked].blocked ||
+            !mayCoordinate(engine, blocked))) ++blocked;
+    if (blocked == engine->shardsCount) return false;
+
+    // shards of the component may have started another run meanwhile
+    unsigned component = engine->shards[blocked].component;
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        Shard *shard = &engine->shards[i];
+        if (shard->component != component) continue;
+
+        atomic_store(&shard->pausing, true);
+        while (shard->running)
+        {
+            engine->waiting = true;
+            pthread_cond_wait(&engine->changed, &engine->lock);
+            engine->waiting = false;
+        }
+    }
+
+    Shard *shard = &engine->shards[blocked];
+    ShardedCommand *command = shard->queue[shard->head % SHARD_WINDOW];
+    int status = executeBlocked(engine, blocked, command);
+    finishPart(engine, command, status, false);
+
+    ++shard->head;
+    shard->blocked = false;
+    atomic_fetch_sub(&engine->blockedShards, 1);
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        if (engine->shards[i].component != component) continue;
+
+        atomic_store(&engine->shards[i].pausing, false);
+        pthread_cond_signal(&engine->shards[i].wake);
+    }
+
+    return true;
+}
+
+static bool mayCoordinate(ShardedEngine *engine, unsigned shard)
+{
+    uint64_t sequence = positionOf(&engine->shards[shard]);
+
+    // part of the same command may block other shards too
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        Shard *other = &engine->shards[i];
+        if (i == shard || other->component != engine->shards[shard].component)
+            continue;
+
+        uint64_t position = positionOf(other);
+        if (position < sequence || (position == sequence && !other->blocked))
+            return false;
+    }
+
+    return true;
+}
+
+static void findComponents(ShardedEngine *engine)
+{
+    // each component is named by its first shard
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        engine->shards[i].component = i;
+    }
+
+    bool joined = true;
+    while (joined)
+    {
+        joined = false;
+        for (size_t i = 0; i < engine->bridgesCount; ++i)
+        {
+            Shard *shardA = &engine->shards[engine->bridges[i].shardA];
+            Shard *shardB = &engine->shards[engine->bridges[i].shardB];
+            if (shardA->component == shardB->component) continue;
+
+            unsigned component = shardA->component < shardB->component ?
+                                 shardA->component : shardB->component;
+            shardA->component = component;
+            shardB->component = component;
+            joined = true;
+        }
+    }
+
+    engine->componentsStale = false;
+}
+
+static void wakeShards(ShardedEngine *engine)
+{
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        Shard *shard = &engine->shards[i];
+        uint64_t tail = atomic_load(&shard->tail);
+
+        if (shard->woken != tail && atomic_load(&shard->idle))
+        {
+            shard->woken = tail;
+            pthread_cond_signal(&shard->wake);
+        }
+    }
+}
+
+static uint64_t positionOf(Shard *shard)
+{
+    if (shard->head == atomic_load(&shard->tail)) return NO_POSITION;
+
+    return shard->queue[shard->head % SHARD_WINDOW]->sequence;
+}
+
+static void awaitShards(ShardedEngine *engine)
+{
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        while (engine->shards[i].running)
+        {
+            engine->waiting = true;
+            pthread_cond_wait(&engine->changed, &engine->lock);
+            engine->waiting = false;
+        }
+    }
+}
+
+static ShardedCommand *nextCommand(ShardedEngine *engine, FILE *output,
+                                   FILE *errors)
+{
+    while (!engine->failed && engine->read - engine->answered == SHARD_WINDOW)
+    {
+        awaitOldest(engine);
+        answerDone(engine, output, errors);
+    }
+    if (engine->failed) return NULL;
+
+    ShardedCommand *command = &engine->window[engine->read % SHARD_WINDOW];
+    command->line = NULL;
+    command->contents = NULL;
+    command->argument1 = NULL;
+    command->argument2 = NULL;
+    command->operation = PASS;
+    command->sequence = engine->read++;
+    atomic_init(&command->pending, 1);
+    atomic_init(&command->status, QUANT_OK);
+    atomic_init(&command->valid, false);
+    command->energy = 0;
+    command->version = 0;
+    command->loaded = NULL;
+    command->loadedStart = NULL;
+
+    return command;
+}
+
+static void routeCommand(ShardedEngine *engine, ShardedCommand *command,
+                         FILE *output, FILE *errors)
+{
+    unsigned first = 0;
+    unsigned last = 0;
+    unsigned firstB = 0;
+    unsigned lastB = 0;
+
+    switch (command->operation)
+    {
+        case PASS:
+            answerCommand(engine, command, QUANT_OK);
+            return;
+        case DECLARE:
+        case ENERGY_SHORT:
+            // history kept by many shards is declared in its home
+            shardsOf(engine, command->argument1, &first, &last);
+            dispatchCommand(engine, command, first, first);
+            return;
+        case VALID:
+        case REMOVE:
+            shardsOf(engine, command->argument1, &first, &last);
+            dispatchCommand(engine, command, first, last);
+            return;
+        case ENERGY:
+            if (!parseEnergy(command->argument2, &command->energy))
+            {
+                answerCommand(engine, command, QUANT_INVALID_ARGUMENT);
+                return;
+            }
+            shardsOf(engine, command->argument1, &first, &last);
+            if (first == last) dispatchCommand(engine, command, first, last);
+            else executeAlone(engine, command, output, errors);
+            return;
+        case EQUAL:
+            shardsOf(engine, command->argument1, &first, &last);
+            shardsOf(engine, command->argument2, &firstB, &lastB);
+            if (first == last && firstB == lastB && first == firstB)
+                dispatchCommand(engine, command, first, last);
+            else executeAlone(engine, command, output, errors);
+            return;
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            shardsOf(engine, command->argument1, &first, &last);
+            if (first == last) dispatchCommand(engine, command, first, last);
+            else executeAlone(engine, command, output, errors);
+            return;
+        case VALID_AT:
+        case ENERGY_AT:
+            if (!parseVersion(command->argument1, &command->version))
+            {
+                answerCommand(engine, command, QUANT_ERROR);
+                return;
+            }
+            shardsOf(engine, command->argument2, &first, &last);
+            if (command->operation == ENERGY_AT) last = first;
+            dispatchCommand(engine, command, first, last);
+            return;
+        case LOAD:
+            routeLoad(engine, command);
+            return;
+        case RELEASE:
+            if (!parseVersion(command->argument1, &command->version))
+            {
+                answerCommand(engine, command, QUANT_ERROR);
+                return;
+            }
+            executeAlone(engine, command, output, errors);
+            return;
+        case BEGIN:
+        case COMMIT:
+        case ROLLBACK:
+        case SNAPSHOT:
+        case FREEZE:
+        case COMPACT:
+        case STATS:
+        case DEFRAG:
+            executeAlone(engine, command, output, errors);
+            return;
+        case ERROR:
+        default:
+            answerCommand(engine, command, QUANT_INVALID_ARGUMENT);
+            return;
+    }
+}
+
+static void dispatchCommand(ShardedEngine *engine, ShardedCommand *command,
+                            unsigned first, unsigned last)
+{
+    atomic_store(&command->pending, last - first + 1);
+
+    for (unsigned i = first; i <= last; ++i)
+    {
+        Shard *shard = &engine->shards[i];
+
+        // only this thread appends, queue has room for the whole window
+        uint64_t tail = atomic_load_explicit(&shard->tail,
+                                             memory_order_relaxed);
+        shard->queue[tail % SHARD_WINDOW] = command;
+        atomic_store(&shard->tail, tail + 1);
+
+        // shard is woken for whole runs, as waking it costs more than a
+        // command, the rest waits until reading thread waits itself
+        if (tail + 1 - shard->woken >= SHARD_RUN && atomic_load(&shard->idle))
+        {
+            pthread_mutex_lock(&engine->lock);
+            shard->woken = tail + 1;
+            pthread_cond_signal(&shard->wake);
+            pthread_mutex_unlock(&engine->lock);
+        }
+    }
+}
+
+static void answerCommand(ShardedEngine *engine, ShardedCommand *command,
+                          int status)
+{
+    atomic_store(&command->status, status);
+
+    // transaction changes only while no command is pending, so it is known
+    if (status != QUANT_OK && engine->transaction &&
+        (abortsTransaction(command->operation) ||
+         command->operation == EQUAL_BATCH ||
+         command->operation == ENERGY_BATCH))
+        atomic_store(&engine->aborted, true);
+
+    atomic_store(&command->pending, 0);
+}
+
+static void executeAlone(ShardedEngine *engine, ShardedCommand *command,
+                         FILE *output, FILE *errors)
+{
+    while (!engine->failed && engine->answered < command->sequence)
+    {
+        awaitOldest(engine);
+        answerDone(engine, output, errors);
+    }
+    if (engine->failed) return;
+
+    pthread_mutex_lock(&engine->lock);
+    awaitShards(engine);
+    pthread_mutex_unlock(&engine->lock);
+
+    int status = QUANT_OK;
+    switch (command->operation)
+    {
+        case ENERGY:
+            status = energyEverywhere(engine, command->argument1,
+                                      command->energy);
+            break;
+        case EQUAL:
+            status = equalEverywhere(engine, command->argument1,
+                                     command->argument2);
+            break;
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            status = aggregateEverywhere(engine, command->argument1,
+                                         &command->aggregate);
+            break;
+        case BEGIN:
+        case COMMIT:
+        case ROLLBACK:
+            status = transactionEverywhere(engine, command->operation);
+            break;
+        default:
+            status = applyEverywhere(engine, command);
+            break;
+    }
+
+    answerCommand(engine, command, status);
+}
+
+static void routeLoad(ShardedEngine *engine, ShardedCommand *command)
+{
+    const char **histories = NULL;
+    size_t count = 0;
+
+    if (!readHistoriesFile(command->argument1, &command->contents, &histories,
+                           &count))
+    {
+        answerCommand(engine, command, QUANT_ERROR);
+        return;
+    }
+
+    // nothing is declared unless all histories are correct
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!isSymbolSequence(histories[i], strlen(histories[i])))
+        {
+            free(histories);
+            answerCommand(engine, command, QUANT_INVALID_ARGUMENT);
+            return;
+        }
+    }
+
+    unsigned shards = engine->shardsCount;
+    command->loaded = malloc(sizeof(char *) * (count > 0 ? count : 1));
+    command->loadedStart = calloc(shards + 1, sizeof(size_t));
+    if (command->loaded == NULL || command->loadedStart == NULL)
+    {
+        free(histories);
+        answerCommand(engine, command, QUANT_NO_MEMORY);
+        return;
+    }
+
+    // histories are grouped by their home, counted first
+    unsigned first = 0;
+    unsigned last = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        shardsOf(engine, histories[i], &first, &last);
+        ++command->loadedStart[first + 1];
+    }
+    for (unsigned i = 0; i < shards; ++i)
+    {
+        command->loadedStart[i + 1] += command->loadedStart[i];
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        shardsOf(engine, histories[i], &first, &last);
+        command->loaded[command->loadedStart[first]++] = histories[i];
+    }
+    for (unsigned i = shards; i > 0; --i)
+    {
+        command->loadedStart[i] = command->loadedStart[i - 1];
+    }
+    command->loadedStart[0] = 0;
+
+    free(histories);
+    dispatchCommand(engine, command, 0, shards - 1);
+}
+
+static void routePairs(ShardedEngine *engine, char *line, int operation,
+                       const char *path, FILE *output, FILE *errors)
+{
+    char *contents = NULL;
+    const char **first = NULL;
+    const char **second = NULL;
+    size_t count = 0;
+    bool read = readPairsFile(path, &contents, &first, &second, &count);
+    ShardedCommand *routed = NULL;
+
+    for (size_t i = 0; read && i < count; ++i)
+    {
+        ShardedCommand *command = nextCommand(engine, output, errors);
+        if (command == NULL) break;
+        routed = command;
+
+        command->argument1 = (char *) first[i];
+        command->argument2 = (char *) second[i];
+        command->operation = operation == EQUAL_BATCH ? EQUAL : ENERGY;
+
+        // malformed energy is rejected like it is by the batch
+        if (operation == ENERGY_BATCH && command->argument2 == NULL)
+            answerCommand(engine, command, QUANT_INVALID_ARGUMENT);
+        else routeCommand(engine, command, output, errors);
+    }
+
+    // the batch itself is answered only if its file could not be read, it
+    // holds the file until all pairs are answered
+    ShardedCommand *command = nextCommand(engine, output, errors);
+    if (command == NULL)
+    {
+        // shards may still read pairs, so the file goes with the last of them
+        if (routed != NULL) routed->contents = contents;
+        else free(contents);
+        free(second);
+        free(first);
+        free(line);
+        return;
+    }
+
+    command->line = line;
+    command->contents = contents;
+    command->operation = operation;
+    answerCommand(engine, command, read ? QUANT_OK : QUANT_ERROR);
+
+    free(second);
+    free(first);
+}
+
+static void answerDone(ShardedEngine *engine, FILE *output, FILE *errors)
+{
+    while (!engine->failed && engine->answered < engine->read)
+    {
+        ShardedCommand *command = &engine->window[engine->answered %
+                                                  SHARD_WINDOW];
+        if (atomic_load(&command->pending) > 0) return;
+
+        printAnswer(engine, command, output, errors);
+        if (engine->failed) return;
+
+        releaseCommand(command);
+        ++engine->answered;
+    }
+}
+
+static void answerAll(ShardedEngine *engine, FILE *output, FILE *errors)
+{
+    while (!engine->failed && engine->answered < engine->read)
+    {
+        awaitOldest(engine);
+        answerDone(engine, output, errors);
+    }
+}
+
+static void awaitOldest(ShardedEngine *engine)
+{
+    ShardedCommand *oldest = &engine->window[engine->answered % SHARD_WINDOW];
+    if (atomic_load(&oldest->pending) == 0) return;
+
+    pthread_mutex_lock(&engine->lock);
+    while (atomic_load(&oldest->pending) > 0)
+    {
+        if (coordinate(engine)) continue;
+
+        wakeShards(engine);
+        engine->waiting = true;
+        engine->awaited = oldest;
+        pthread_cond_wait(&engine->changed, &engine->lock);
+        engine->waiting = false;
+        engine->awaited = NULL;
+    }
+    pthread_mutex_unlock(&engine->lock);
+}
+
+static void printAnswer(ShardedEngine *engine, ShardedCommand *command,
+                        FILE *output, FILE *errors)
+{
+    int status = atomic_load(&command->status);
+    int operation = command->operation;
+
+    if (status == QUANT_NO_MEMORY) engine->failed = true;
+    else if (operation == PASS) return;
+    else if (status != QUANT_OK) printError(errors);
+    else if (operation == VALID || operation == VALID_AT)
+        printValid(output, atomic_load(&command->valid));
+    else if (operation == ENERGY_SHORT || operation == ENERGY_AT)
+        printEnergy(output, command->energy);
+    else if (operation == SNAPSHOT)
+        printVersion(output, command->version);
+    else if (operation == STATS)
+        printStatistics(output, &command->statistics);
+    else if (operation >= COUNT && operation <= MAX)
+    {
+        if (!printAggregate(output, operation, &command->aggregate))
+            printError(errors);
+    }
+    else if (operation != EQUAL_BATCH && operation != ENERGY_BATCH)
+        printConfirmation(output);
+}
+
+static void releaseCommand(ShardedCommand *command)
+{
+    free(command->line);
+    free(command->contents);
+    free(command->loaded);
+    free(command->loadedStart);
+}
+
+static void shardsOf(ShardedEngine *engine, const char *history,
+                     unsigned *first, unsigned *last)
+{
+    size_t length = history == NULL ? 0 : strlen(history);
+    *first = 0;
+    *last = 0;
+    if (!isSymbolSequence(history, length)) return;
+
+    // history shorter than routing prefix stands for a range of prefixes
+    uint64_t prefix = 0;
+    uint64_t span = 1;
+    for (unsigned i = 0; i < engine->depth; ++i)
+    {
+        size_t offset = (size_t) i * SYMBOL_WIDTH;
+        prefix *= STATES;
+        if (offset < length) prefix += (uint64_t) symbolAt(history + offset);
+        else span *= STATES;
+    }
+
+    *first = ownerOf(engine, prefix);
+    *last = ownerOf(engine, prefix + span - 1);
+}
+
+static unsigned ownerOf(ShardedEngine *engine, uint64_t prefix)
+{
+    return (unsigned) (prefix * engine->shardsCount / engine->prefixes);
+}
+
+static int resolveHistory(ShardedEngine *engine, const char *history,
+                          unsigned *home)
+{
+    unsigned first = 0;
+    unsigned last = 0;
+    shardsOf(engine, history, &first, &last);
+    *home = first;
+
+    bool valid = false;
+    for (unsigned i = first; i <= last && !valid; ++i)
+    {
+        int status = quantValid(engine->shards[i].quantization, history,
+                                &valid);
+        if (status != QUANT_OK) return status;
+        if (valid && i > first)
+            return quantDeclare(engine->shards[first].quantization, history);
+    }
+
+    return valid ? QUANT_OK : QUANT_ERROR;
+}
+
+static int spreadEnergy(ShardedEngine *engine, unsigned shard,
+                        const char *history, Energy energy)
+{
+    int status = quantSetEnergy(engine->shards[shard].quantization, history,
+                                energy);
+    if (status != QUANT_OK || engine->bridgesCount == 0) return status;
+
+    // every history reached is looked for among ends of bridges not crossed
+    // yet, each end of a bridge is reached at most once
+    size_t *reached = malloc(sizeof(size_t) * (engine->bridgesCount + 1));
+    bool *sideB = malloc(sizeof(bool) * (engine->bridgesCount + 1));
+    if (reached == NULL || sideB == NULL)
+    {
+        free(reached);
+        free(sideB);
+        return QUANT_NO_MEMORY;
+    }
+
+    for (size_t i = 0; i < engine->bridgesCount; ++i)
+    {
+        engine->bridges[i].visited = false;
+    }
+
+    size_t count = 0;
+    unsigned fromShard = shard;
+    const char *from = history;
+    for (size_t next = 0; status == QUANT_OK; ++next)
+    {
+        for (size_t i = 0; i < engine->bridgesCount && status == QUANT_OK; ++i)
+        {
+            Bridge *bridge = &engine->bridges[i];
+            bool fromB = bridge->shardB == fromShard;
+            if (bridge->visited ||
+                (bridge->shardA != fromShard && !fromB)) continue;
+
+            const char *end = fromB ? bridge->historyB : bridge->historyA;
+            bool equivalent = strcmp(end, from) == 0;
+            if (!equivalent)
+                status = quantEquivalent(engine->shards[fromShard].quantization,
+                                         from, end, &equivalent);
+            if (status != QUANT_OK || !equivalent) continue;
+
+            bridge->visited = true;
+            reached[count] = i;
+            sideB[count++] = !fromB;
+            status = quantSetEnergy(
+                engine->shards[fromB ? bridge->shardA :
+                               bridge->shardB].quantization,
+                fromB ? bridge->historyA : bridge->historyB, energy);
+        }
+
+        if (next == count) break;
+        Bridge *bridge = &engine->bridges[reached[next]];
+        fromShard = sideB[next] ? bridge->shardB : bridge->shardA;
+        from = sideB[next] ? bridge->historyB : bridge->historyA;
+    }
+
+    free(sideB);
+    free(reached);
+    return status;
+}
+
+static int energyEverywhere(ShardedEngine *engine, const char *history,
+                            Energy energy)
+{
+    unsigned home = 0;
+    int status = resolveHistory(engine, history, &home);
+    if (status != QUANT_OK) return status;
+
+    return spreadEnergy(engine, home, history, energy);
+}
+
+static int equalEverywhere(ShardedEngine *engine, const char *historyA,
+                           const char *historyB)
+{
+    if (engine->frozen) return QUANT_ERROR;
+
+    unsigned shardA = 0;
+    unsigned shardB = 0;
+    int status = resolveHistory(engine, historyA, &shardA);
+    if (status == QUANT_OK) status = resolveHistory(engine, historyB, &shardB);
+    if (status != QUANT_OK) return status;
+
+    Quantization *quantizationA = engine->shards[shardA].quantization;
+    Quantization *quantizationB = engine->shards[shardB].quantization;
+    Energy energyA = 0;
+    Energy energyB = 0;
+
+    if (shardA == shardB)
+    {
+        // equality of one shard may still join classes with bridges
+        status = quantEqual(quantizationA, historyA, historyB);
+        if (status != QUANT_OK || engine->shards[shardA].bridges == 0 ||
+            quantGetEnergy(quantizationA, historyA, &energyA) != QUANT_OK)
+            return status;
+
+        return spreadEnergy(engine, shardA, historyA, energyA);
+    }
+
+    if (findBridge(engine, shardA, historyA, shardB, historyB) != SIZE_MAX)
+        return QUANT_OK;
+
+    // history with no energy is not an error here
+    quantGetEnergy(quantizationA, historyA, &energyA);
+    quantGetEnergy(quantizationB, historyB, &energyB);
+    Energy energy = quantEqualEnergy(energyA, energyB);
+    if (energy == 0) return QUANT_ERROR;
+
+    // both classes get energy before they are marked, so that no history of
+    // them is left shared with other ones by compaction
+    status = spreadEnergy(engine, shardA, historyA, energy);
+    if (status == QUANT_OK)
+        status = spreadEnergy(engine, shardB, historyB, energy);
+    if (status == QUANT_OK &&
+        !addBridge(engine, shardA, historyA, shardB, historyB))
+        status = QUANT_NO_MEMORY;
+    if (status == QUANT_OK) status = quantShare(quantizationA, historyA);
+    if (status == QUANT_OK) status = quantShare(quantizationB, historyB);
+
+    return status;
+}
+
+static int removeShared(ShardedEngine *engine, unsigned shard,
+                        const char *history)
+{
+    int status = quantRemove(engine->shards[shard].quantization, history);
+    if (status != QUANT_OK) return status;
+
+    size_t length = strlen(history);
+    for (size_t i = engine->bridgesCount; i > 0; --i)
+    {
+        Bridge *bridge = &engine->bridges[i - 1];
+        bool removed =
+            (bridge->shardA == shard &&
+             strncmp(bridge->historyA, history, length) == 0) ||
+            (bridge->shardB == shard &&
+             strncmp(bridge->historyB, history, length) == 0);
+
+        if (removed && !removeBridge(engine, i - 1)) return QUANT_NO_MEMORY;
+    }
+
+    return QUANT_OK;
+}
+
+static int aggregateEverywhere(ShardedEngine *engine, const char *history,
+                               Aggregate *aggregate)
+{
+    char prefix[SHARD_DEPTH_MAX * SYMBOL_WIDTH + 1];
+    size_t length = strlen(history);
+
+    aggregate->count = 0;
+    aggregate->energySum = 0;
+    aggregate->minEnergy = 0;
+    aggregate->maxEnergy = 0;
+
+    // only histories shorter than routing prefix are kept by many shards
+    memcpy(prefix, history, length + 1);
+    int status = aggregatePrefixes(engine, prefix, length, aggregate);
+    if (status == QUANT_OK && aggregate->count == 0) status = QUANT_ERROR;
+
+    return status;
+}
+
+static int aggregatePrefixes(ShardedEngine *engine, char *history,
+                             size_t length, Aggregate *aggregate)
+{
+    unsigned first = 0;
+    unsigned last = 0;
+    shardsOf(engine, history, &first, &last);
+
+    Aggregate part;
+    if (length == (size_t) engine->depth * SYMBOL_WIDTH)
+    {
+        // the whole subtree of routing prefix belongs to one shard
+        if (quantAggregate(engine->shards[first].quantization, history,
+                           &part) == QUANT_OK)
+            quantMergeAggregate(aggregate, &part);
+        return QUANT_OK;
+    }
+
+    bool valid = false;
+    for (unsigned i = first; i <= last && !valid; ++i)
+    {
+        int status = quantValid(engine->shards[i].quantization, history,
+                                &valid);
+        if (status != QUANT_OK) return status;
+    }
+    if (!valid) return QUANT_OK;
+
+    Energy energy = 0;
+    quantGetEnergy(engine->shards[first].quantization, history, &energy);
+    part.count = 1;
+    part.energySum = energy;
+    part.minEnergy = energy;
+    part.maxEnergy = energy;
+    quantMergeAggregate(aggregate, &part);
+
+    for (unsigned state = 0; state < STATES; ++state)
+    {
+#if SYMBOL_WIDTH == 1
+        history[length] = SYMBOL_ALPHABET[state];
+#else
+        history[length] = SYMBOL_ALPHABET[state / 16];
+        history[length + 1] = SYMBOL_ALPHABET[state % 16];
+#endif
+        history[length + SYMBOL_WIDTH] = '\0';
+
+        int status = aggregatePrefixes(engine, history, length + SYMBOL_WIDTH,
+                                       aggregate);
+        if (status != QUANT_OK) return status;
+    }
+    history[length] = '\0';
+
+    return QUANT_OK;
+}
+
+static int transactionEverywhere(ShardedEngine *engine, int operation)
+{
+    int status = QUANT_OK;
+
+    if (operation == BEGIN)
+    {
+        // every shard is in the same state, so only the first can refuse
+        for (unsigned i = 0; i < engine->shardsCount && status == QUANT_OK; ++i)
+        {
+            status = quantBegin(engine->shards[i].quantization);
+        }
+        if (status == QUANT_OK)
+        {
+            engine->transaction = true;
+            atomic_store(&engine->aborted, false);
+        }
+        return status;
+    }
+
+    if (!engine->transaction) return QUANT_ERROR;
+
+    // failed transaction is reverted instead of committed
+    bool revert = operation == ROLLBACK || atomic_load(&engine->aborted);
+    for (unsigned i = 0; i < engine->shardsCount; ++i)
+    {
+        Quantization *quantization = engine->shards[i].quantization;
+        int shardStatus = revert ? quantRollback(quantization) :
+                          quantCommit(quantization);
+        if (shardStatus != QUANT_OK && status != QUANT_NO_MEMORY)
+            status = shardStatus;
+    }
+    closeChanges(engine, revert);
+
+    engine->transaction = false;
+    atomic_store(&engine->aborted, false);
+
+    if (status == QUANT_OK && revert && operation == COMMIT)
+        status = QUANT_ERROR;
+    return status;
+}
+
+static int applyEverywhere(ShardedEngine *engine, ShardedCommand *command)
+{
+    int status = QUANT_OK;
+
+    if (command->operation == STATS)
+    {
+        command->statistics.nodes = 0;
+        command->statistics.bytes = 0;
+        command->statistics.reclaimed = 0;
+    }
+
+    // every shard is in the same state, so all of them fail the same way
+    for (unsigned i = 0; i < engine->shardsCount && status == QUANT_OK; ++i)
+    {
+        Quantization *quantization = engine->shards[i].quantization;
+        Statistics part;
+
+        switch (command->operation)
+        {
+            case SNAPSHOT:
+                status = quantSnapshot(quantization, &command->version);
+                break;
+            case RELEASE:
+                status = quantRelease(quantization, command->version);
+                break;
+            case FREEZE:
+                status = quantFreeze(quantization);
+                break;
+            case COMPACT:
+                status = quantCompact(quantization);
+                break;
+            case DEFRAG:
+                status = quantDefragment(quantization);
+                break;
+            case STATS:
+                status = quantStatistics(quantization, &part);
+                command->statistics.nodes += part.nodes;
+                command->statistics.bytes += part.bytes;
+                command->statistics.reclaimed += part.reclaimed;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // frozen histories keep no equalities
+    if (command->operation == FREEZE && status == QUANT_OK)
+    {
+        engine->frozen = true;
+        for (size_t i = 0; i < engine->bridgesCount; ++i)
+        {
+            free(engine->bridges[i].historyA);
+            free(engine->bridges[i].historyB);
+        }
+        engine->bridgesCount = 0;
+        engine->componentsStale = true;
+        for (unsigned i = 0; i < engine->shardsCount; ++i)
+        {
+            engine->shards[i].bridges = 0;
+        }
+    }
+
+    return status;
+}
+
+static size_t findBridge(ShardedEngine *engine, unsigned shardA,
+                         const char *historyA, unsigned shardB,
+                         const char *historyB)
+{
+    for (size_t i = 0; i < engine->bridgesCount; ++i)
+    {
+        Bridge *bridge = &engine->bridges[i];
+        if (bridge->shardA == shardA && bridge->shardB == shardB &&
+            strcmp(bridge->historyA, historyA) == 0 &&
+            strcmp(bridge->historyB, historyB) == 0) return i;
+        if (bridge->shardA == shardB && bridge->shardB == shardA &&
+            strcmp(bridge->historyA, historyB) == 0 &&
+            strcmp(bridge->historyB, historyA) == 0) return i;
+    }
+
+    return SIZE_MAX;
+}
+
+static bool addBridge(ShardedEngine *engine, unsigned shardA,
+                      const char *historyA, unsigned shardB,
+                      const char *historyB)
+{
+    Bridge bridge;
+    bridge.shardA = shardA;
+    bridge.shardB = shardB;
+    bridge.historyA = copyHistory(historyA);
+    bridge.historyB = copyHistory(historyB);
+    bridge.visited = false;
+
+    if (bridge.historyA == NULL || bridge.historyB == NULL ||
+        !recordChange(engine, true, &bridge) ||
+        !insertBridge(engine, &bridge))
+    {
+        // change recorded before is dropped with the bridge
+        if (engine->changesCount > 0 &&
+            engine->changes[engine->changesCount - 1].bridge.historyA ==
+            bridge.historyA) --engine->changesCount;
+        free(bridge.historyA);
+        free(bridge.historyB);
+        return false;
+    }
+
+    return true;
+}
+
+static bool insertBridge(ShardedEngine *engine, const Bridge *bridge)
+{
+    if (engine->bridgesCount == engine->bridgesCapacity)
+    {
+        size_t capacity = engine->bridgesCapacity == 0 ?
+                          16 : engine->bridgesCapacity * 2;
+        Bridge *expanded = realloc(engine->bridges,
+                                   sizeof(Bridge) * capacity);
+        if (expanded == NULL) return false;
+
+        engine->bridges = expanded;
+        engine->bridgesCapacity = capacity;
+    }
+
+    engine->bridges[engine->bridgesCount++] = *bridge;
+    engine->componentsStale = true;
+    ++engine->shards[bridge->shardA].bridges;
+    ++engine->shards[bridge->shardB].bridges;
+    return true;
+}
+
+static bool removeBridge(ShardedEngine *engine, size_t position)
+{
+    Bridge bridge = engine->bridges[position];
+    if (!recordChange(engine, false, &bridge)) return false;
+
+    if (!engine->transaction)
+    {
+        free(bridge.historyA);
+        free(bridge.historyB);
+    }
+
+    engine->bridges[position] = engine->bridges[--engine->bridgesCount];
+    engine->componentsStale = true;
+    --engine->shards[bridge.shardA].bridges;
+    --engine->shards[bridge.shardB].bridges;
+    return true;
+}
+
+static bool recordChange(ShardedEngine *engine, bool added,
+                         const Bridge *bridge)
+{
+    if (!engine->transaction) return true;
+
+    if (engine->changesCount == engine->changesCapacity)
+    {
+        size_t capacity = engine->changesCapacity == 0 ?
+                          16 : engine->changesCapacity * 2;
+        BridgeChange *expanded = realloc(engine->changes,
+                                         sizeof(BridgeChange) * capacity);
+        if (expanded == NULL) return false;
+
+        engine->changes = expanded;
+        engine->changesCapacity = capacity;
+    }
+
+    engine->changes[engine->changesCount].added = added;
+    engine->changes[engine->changesCount++].bridge = *bridge;
+    return true;
+}
+
+static void closeChanges(ShardedEngine *engine, bool revert)
+{
+    // changes are reverted from the last one, kept bridges need no memory
+    bool transaction = engine->transaction;
+    engine->transaction = false;
+
+    for (size_t i = engine->changesCount; i > 0; --i)
+    {
+        BridgeChange *change = &engine->changes[i - 1];
+
+        if (revert && change->added)
+        {
+            size_t position = findBridge(engine, change->bridge.shardA,
+                                         change->bridge.historyA,
+                                         change->bridge.shardB,
+                                         change->bridge.historyB);
+            removeBridge(engine, position);
+        }
+        else if (revert) insertBridge(engine, &change->bridge);
+        else if (!change->added)
+        {
+            free(change->bridge.historyA);
+            free(change->bridge.historyB);
+        }
+    }
+
+    engine->changesCount = 0;
+    engine->transaction = transaction;
+}
+
+static char *copyHistory(const char *history)
+{
+    size_t length = strlen(history);
+    char *copy = malloc(length + 1);
+    if (copy != NULL) memcpy(copy, history, length + 1);
+
+    return copy;
+}
@@ -0,0 +1,30 @@
+#ifndef QUANTIZATION_SHARDED_H
+#define QUANTIZATION_SHARDED_H
+
+#include <stdio.h>
+
+/*
+ * Default number of leading history symbols used to pick a shard, 0 means it
+ * is chosen from the number of shards
+ */
+#define SHARD_DEPTH_AUTO 0
+
+/*
+ * Longest supported routing prefix
+ */
+#define SHARD_DEPTH_MAX 16
+
+/*
+ * Executes commands from "input" like runCommands, but on histories
+ * partitioned among "shards" threads, each with its own context. Shards own
+ * consecutive ranges of the first "depth" symbols of histories, history
+ * shorter than that belongs to every shard its range touches and keeps its
+ * energy in the first of them. Commands are read ahead while shards execute
+ * them, answers are printed in input order. If "bulkDeclare" is not NULL,
+ * histories listed in that file are declared before reading commands.
+ * Returns exit code of the session, like runCommands.
+ */
+int runShardedCommands(unsigned shards, unsigned depth, const char *bulkDeclare,
+                       FILE *input, FILE *output, FILE *errors);
+
+#endif //QUANTIZATION_SHARDED_H
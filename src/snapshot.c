@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include "snapshot.h"
+#include "children.h"
+#include "pool.h"
+#include "symbols.h"
+#include "tiering.h"
+#include "tree.h"
+
+/*
+ * Returns number of nodes above given one
+ */
+static size_t depthOf(const Tree *node);
+
+/*
+ * Returns state under which node hangs from its parent
+ */
+static int symbolOf(const Tree *parent, const Tree *node);
+
+/*
+ * Replaces node, hanging from parent under given state, with a copy that is no
+ * longer shared. Parent must be writable. Equalities are moved to the copy.
+ * Returns NULL if there was not enough memory.
+ */
+static Tree *copyNode(Tree *parent, int symbol, Tree *node);
+
+/*
+ * Returns new node equal to given one, sharing its children, which gain one
+ * reference each, or NULL if there was not enough memory
+ */
+static Tree *duplicateNode(const Tree *node);
+
+Tree *snapshotTree(Tree *histories)
+{
+    Tree *snapshot = duplicateNode(histories);
+    if (snapshot == NULL) return NULL;
+
+    ++stateOf(histories)->versions;
+    return snapshot;
+}
+
+void releaseSnapshot(Tree *snapshot)
+{
+    --stateOf(snapshot)->versions;
+    dropReference(snapshot);
+}
+
+Tree *writableNode(Tree *node, bool *memFail)
+{
+    TreeState *state = stateOf(node);
+    if (state->versions == 0) return node;
+
+    // node below shared one is shared too, even if it has single reference
+    size_t depth = 0;
+    bool shared = false;
+    for (Tree *ancestor = node; ancestor->parent != NULL;
+         ancestor = ancestor->parent)
+    {
+        if (ancestor->references > 1) shared = true;
+        ++depth;
+    }
+    if (!shared) return node;
+
+    if (depth > state->pathCapacity)
+    {
+        Tree **expanded = realloc(state->path, sizeof(Tree *) * depth);
+        if (expanded == NULL)
+        {
+            *memFail = true;
+            return NULL;
+        }
+
+        state->path = expanded;
+        state->pathCapacity = depth;
+    }
+
+    size_t position = depth;
+    Tree *root = node;
+    for (; root->parent != NULL; root = root->parent)
+    {
+        state->path[--position] = root;
+    }
+
+    // copy of a node adds reference to its children, so once the first shared
+    // node is copied, all nodes below it are copied too
+    for (position = 0; position < depth; ++position)
+    {
+        Tree *shared = state->path[position];
+        if (shared->references == 1) continue;
+
+        Tree *parent = position == 0 ? root : state->path[position - 1];
+        state->path[position] = copyNode(parent, symbolOf(parent, shared),
+                                         shared);
+        if (state->path[position] == NULL)
+        {
+            *memFail = true;
+            return NULL;
+        }
+    }
+
+    return state->path[depth - 1];
+}
+
+bool writablePair(Tree **historyA, Tree **historyB, bool *memFail)
+{
+    if (stateOf(*historyA)->versions == 0 &&
+        stateOf(*historyB)->versions == 0) return true;
+
+    Tree **first = historyA;
+    Tree **second = historyB;
+    if (depthOf(*historyB) < depthOf(*historyA))
+    {
+        first = historyB;
+        second = historyA;
+    }
+
+    *first = writableNode(*first, memFail);
+    if (*first == NULL) return false;
+
+    *second = writableNode(*second, memFail);
+    return *second != NULL;
+}
+
+static size_t depthOf(const Tree *node)
+{
+    size_t depth = 0;
+    for (; node->parent != NULL; node = node->parent) ++depth;
+
+    return depth;
+}
+
+bool sharesNodes(const Tree *node)
+{
+    TreeState *state = stateOf(node);
+    return state->versions > 0 || state->compacted;
+}
+
+Tree *writablePrefix(const char *argument, size_t length,
+                     Tree *histories, bool *memFail)
+{
+    for (size_t i = 0; i < length; i += SYMBOL_WIDTH)
+    {
+        int symbol = symbolAt(argument + i);
+        Tree *next = getChild(histories, symbol);
+        if (next == NULL) return NULL;
+
+        if (next->references > 1)
+        {
+            next = copyNode(histories, symbol, next);
+            if (next == NULL)
+            {
+                *memFail = true;
+                return NULL;
+            }
+        }
+
+        next->parent = histories;
+        histories = next;
+    }
+
+    return histories;
+}
+
+Tree *writableHistory(const char *argument, Tree *histories, bool *memFail)
+{
+    size_t length = strlen(argument);
+    size_t walked = 0;
+
+    // spilled subtree on the way is brought back before it is copied
+    Tree *history = reachHistory(argument, length, histories, &walked,
+                                 memFail);
+    if (walked < length) return NULL;
+    if (!sharesNodes(histories)) return history;
+
+    return writablePrefix(argument, length, histories, memFail);
+}
+
+static int symbolOf(const Tree *parent, const Tree *node)
+{
+    Tree *child;
+    int symbol = -1;
+    while ((child = nextChild(parent, &symbol)) != node);
+
+    return symbol;
+}
+
+static Tree *copyNode(Tree *parent, int symbol, Tree *node)
+{
+    // copy and the node could not share image of spilled subtree
+    if (node->spilled && !thawSubtree(node)) return NULL;
+
+    Tree *copy = duplicateNode(node);
+    if (copy == NULL) return NULL;
+
+    // finger may hold the node, which stays only in snapshots
+    forgetNodes(stateOf(parent));
+
+    // replacing existing child never needs memory
+    setChild(parent, symbol, copy);
+    copy->parent = parent;
+    if (node->references < MAX_REFERENCES) --node->references;
+
+    // parents of shared nodes always point to the current histories
+    Tree *child;
+    for (int state = -1; (child = nextChild(copy, &state)) != NULL;)
+    {
+        child->parent = copy;
+    }
+
+    // only current histories have equalities
+    node->equalsList = NULL;
+    for (EqualsList *equals = copy->equalsList; equals != NULL;
+         equals = equals->next)
+    {
+        if (equals->this->historyA == node) equals->this->historyA = copy;
+        else equals->this->historyB = copy;
+    }
+
+    return copy;
+}
+
+static Tree *duplicateNode(const Tree *node)
+{
+    Tree *copy = poolAllocate(poolOf(node));
+    if (copy == NULL) return NULL;
+
+    *copy = *node;
+    if (!duplicateChildren(copy))
+    {
+        poolRelease(copy);
+        return NULL;
+    }
+
+    copy->references = 1;
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(copy, &symbol)) != NULL;)
+    {
+        addReference(child);
+    }
+
+    return copy;
+}
+
+void addReference(Tree *node)
+{
+    if (node->references < MAX_REFERENCES) ++node->references;
+}
+
+void dropReference(Tree *node)
+{
+    if (node->references == MAX_REFERENCES || --node->references > 0) return;
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        dropReference(child);
+    }
+
+    if (node->spilled) releaseSpilled(node);
+    releaseChildren(node);
+    poolRelease(node);
+}
+
+void stripEqualities(Tree *histories)
+{
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        stripEqualities(child);
+    }
+
+    removeAllEquals(histories);
+    histories->equalsList = NULL;
+}
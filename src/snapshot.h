@@ -0,0 +1,86 @@
+#ifndef QUANTIZATION_SNAPSHOT_H
+#define QUANTIZATION_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Returns read only snapshot of histories in their current state, which can be
+ * passed to validHistory and energyShortHistory. Takes constant time: nodes are
+ * shared until histories change, then changed nodes and their ancestors are
+ * copied. Returns NULL if allocation failed.
+ */
+Tree *snapshotTree(Tree *histories);
+
+/*
+ * Releases snapshot, together with nodes no longer used by anything else
+ */
+void releaseSnapshot(Tree *snapshot);
+
+/*
+ * Works like findHistory, but prepares the node to be changed: nodes on its
+ * path shared with snapshots or with other histories are replaced by their
+ * copies. Returns NULL if history is not declared, or, setting "memFail", if
+ * there was not enough memory.
+ */
+Tree *writableHistory(const char *argument, Tree *histories, bool *memFail);
+
+/*
+ * Largest value of reference counter. Counter that reached it saturates: it
+ * no longer changes, so node stays shared and is copied before every change,
+ * and it is never released before its pool. Can be lowered at compile time, so
+ * that tests reach it.
+ */
+#ifndef MAX_REFERENCES
+#define MAX_REFERENCES UINT32_MAX
+#endif
+
+/*
+ * Checks whether some nodes of histories given node belongs to may be shared,
+ * either with snapshots or by compaction
+ */
+bool sharesNodes(const Tree *node);
+
+/*
+ * Makes sure that node and all its ancestors can be changed without changing
+ * any snapshot: those shared with snapshots are replaced with their copies.
+ * Returns node that should be changed, which is the copy if node itself was
+ * copied, or NULL, setting "memFail", if there was not enough memory.
+ */
+Tree *writableNode(Tree *node, bool *memFail);
+
+/*
+ * Makes two nodes writable. Copying path of one of them replaces the other one
+ * too, if it is its ancestor, so the shallower one goes first. Returns false
+ * if there was not enough memory.
+ */
+bool writablePair(Tree **historyA, Tree **historyB, bool *memFail);
+
+/*
+ * Walks first "length" characters of history from the root, like findHistory,
+ * replacing shared nodes on the way with their copies. Parent pointers on the
+ * path are set too, as node shared by compaction keeps only one of its
+ * parents. Returns NULL if history is not declared, or, setting "memFail", if
+ * there was not enough memory.
+ */
+Tree *writablePrefix(const char *argument, size_t length,
+                     Tree *histories, bool *memFail);
+
+/*
+ * Adds one reference to node, unless its counter saturated
+ */
+void addReference(Tree *node);
+
+/*
+ * Drops one reference to node. Node which is no longer referenced is released,
+ * dropping references to its children. Equalities must already be removed.
+ */
+void dropReference(Tree *node);
+
+/*
+ * Removes equalities of all nodes in subtree
+ */
+void stripEqualities(Tree *histories);
+
+#endif //QUANTIZATION_SNAPSHOT_H
@@ -0,0 +1,159 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "spill.h"
+
+/*
+ * Alignment of blocks, enough for 64-bit words
+ */
+#define SPILL_ALIGNMENT 8
+
+/*
+ * Part of the file mapped at "base", "size" bytes long, of which the first
+ * "used" were given out and blocks of "live" bytes are still in use
+ */
+struct Segment
+{
+    char *base;
+    size_t size;
+    size_t used;
+    size_t live;
+};
+typedef struct Segment Segment;
+
+/*
+ * "length" is size of the file, "count" of "capacity" segments are mapped and
+ * "bytes" is sum of blocks in use
+ */
+struct SpillFile
+{
+    int descriptor;
+    size_t length;
+    Segment *segments;
+    size_t count;
+    size_t capacity;
+    size_t bytes;
+};
+
+/*
+ * Grows the file by segment of at least given size and maps it. Returns NULL
+ * if it could not be done.
+ */
+static Segment *addSegment(SpillFile *file, size_t bytes);
+
+SpillFile *spillCreate(const char *path)
+{
+    SpillFile *file = calloc(1, sizeof(SpillFile));
+    if (file == NULL) return NULL;
+
+    // existing file may belong to someone else, it is never overwritten
+    file->descriptor = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (file->descriptor < 0)
+    {
+        free(file);
+        return NULL;
+    }
+
+    // open descriptor keeps the file until it is closed
+    unlink(path);
+
+    return file;
+}
+
+void spillDestroy(SpillFile *file)
+{
+    if (file == NULL) return;
+
+    for (size_t i = 0; i < file->count; ++i)
+    {
+        munmap(file->segments[i].base, file->segments[i].size);
+    }
+
+    close(file->descriptor);
+    free(file->segments);
+    free(file);
+}
+
+void *spillAllocate(SpillFile *file, size_t bytes)
+{
+    bytes = (bytes + SPILL_ALIGNMENT - 1) & ~((size_t) SPILL_ALIGNMENT - 1);
+
+    Segment *segment = NULL;
+    for (size_t i = 0; i < file->count && segment == NULL; ++i)
+    {
+        Segment *candidate = &file->segments[i];
+        if (candidate->live == 0) candidate->used = 0;
+        if (candidate->size - candidate->used >= bytes) segment = candidate;
+    }
+
+    if (segment == NULL) segment = addSegment(file, bytes);
+    if (segment == NULL) return NULL;
+
+    void *block = segment->base + segment->used;
+    segment->used += bytes;
+    segment->live += bytes;
+    file->bytes += bytes;
+
+    return block;
+}
+
+void spillRelease(SpillFile *file, void *block, size_t bytes)
+{
+    bytes = (bytes + SPILL_ALIGNMENT - 1) & ~((size_t) SPILL_ALIGNMENT - 1);
+
+    for (size_t i = 0; i < file->count; ++i)
+    {
+        Segment *segment = &file->segments[i];
+        if ((char *) block < segment->base ||
+            (char *) block >= segment->base + segment->size)
+            continue;
+
+        segment->live -= bytes;
+        file->bytes -= bytes;
+        return;
+    }
+}
+
+size_t spillBytes(const SpillFile *file)
+{
+    return file->bytes;
+}
+
+static Segment *addSegment(SpillFile *file, size_t bytes)
+{
+    if (file->count == file->capacity)
+    {
+        size_t capacity = file->capacity == 0 ? 4 : file->capacity * 2;
+        Segment *segments = realloc(file->segments,
+                                    sizeof(Segment) * capacity);
+        if (segments == NULL) return NULL;
+
+        file->segments = segments;
+        file->capacity = capacity;
+    }
+
+    // offsets of mappings must be multiples of page size
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = bytes > SPILL_SEGMENT_BYTES ? bytes : SPILL_SEGMENT_BYTES;
+    size = (size + page - 1) / page * page;
+
+    // space is reserved on disk now, writing to sparse mapping of a full disk
+    // would kill the process instead of failing
+    if (posix_fallocate(file->descriptor, (off_t) file->length,
+                        (off_t) size) != 0)
+        return NULL;
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      file->descriptor, (off_t) file->length);
+    if (base == MAP_FAILED) return NULL;
+
+    Segment *segment = &file->segments[file->count++];
+    segment->base = base;
+    segment->size = size;
+    segment->used = 0;
+    segment->live = 0;
+    file->length += size;
+
+    return segment;
+}
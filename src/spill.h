@@ -0,0 +1,49 @@
+#ifndef QUANTIZATION_SPILL_H
+#define QUANTIZATION_SPILL_H
+
+#include <stddef.h>
+
+/*
+ * Number of bytes file grows by at once, blocks larger than that get segment
+ * of their own
+ */
+#define SPILL_SEGMENT_BYTES ((size_t) 1 << 26)
+
+/*
+ * Scratch file holding blocks of memory mapped from it. The system writes them
+ * out and drops them from memory when it needs room, and reads them back in
+ * when they are accessed, so the file may be much larger than memory. File
+ * grows by segments, each mapped once, so blocks never move. Space of segment
+ * is reused once every block in it is released.
+ */
+typedef struct SpillFile SpillFile;
+
+/*
+ * Creates file at given path, which must not exist yet. The file is removed
+ * from its directory at once, so that it never outlives the process. Returns
+ * NULL if it could not be created or allocation failed.
+ */
+SpillFile *spillCreate(const char *path);
+
+/*
+ * Unmaps and closes the file. Passing NULL is allowed.
+ */
+void spillDestroy(SpillFile *file);
+
+/*
+ * Returns writable block of given size in the file, aligned to 8 bytes, or
+ * NULL if file could not grow or allocation failed
+ */
+void *spillAllocate(SpillFile *file, size_t bytes);
+
+/*
+ * Gives back block of given size returned by spillAllocate
+ */
+void spillRelease(SpillFile *file, void *block, size_t bytes);
+
+/*
+ * Returns number of bytes of blocks currently in the file
+ */
+size_t spillBytes(const SpillFile *file);
+
+#endif //QUANTIZATION_SPILL_H
@@ -0,0 +1,84 @@
+#ifndef QUANTIZATION_SYMBOLS_H
+#define QUANTIZATION_SYMBOLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Characters used for quantum states, state i is written as i-th character.
+ * Up to 64 states every state is a single character, so default "0" - "3"
+ * stays the same. Larger alphabets write every state as two lowercase
+ * hexadecimal digits, "00" - "ff".
+ */
+#define SYMBOL_ALPHABET \
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ+/"
+
+#if STATES <= 64
+#define SYMBOL_WIDTH 1
+#else
+#define SYMBOL_WIDTH 2
+#endif
+
+/*
+ * For every character: its position in SYMBOL_ALPHABET increased by one, or 0 if
+ * character is not part of the alphabet.
+ */
+extern const unsigned char SYMBOL_VALUES[256];
+
+/*
+ * Returns value of single alphabet character, or -1 if it is not one
+ */
+static inline int characterValue(char character)
+{
+    return (int) SYMBOL_VALUES[(unsigned char) character] - 1;
+}
+
+/*
+ * Returns state written at the beginning of given string, which must already
+ * be known to be a correct history.
+ */
+static inline int symbolAt(const char *symbol)
+{
+#if STATES <= 10
+    return symbol[0] - '0';
+#elif SYMBOL_WIDTH == 1
+    return characterValue(symbol[0]);
+#else
+    return characterValue(symbol[0]) * 16 + characterValue(symbol[1]);
+#endif
+}
+
+/*
+ * Checks whether given string starts with a correct state
+ */
+static inline bool isSymbol(const char *symbol)
+{
+#if SYMBOL_WIDTH == 1
+    int value = characterValue(symbol[0]);
+    return value >= 0 && value < STATES;
+#else
+    int high = characterValue(symbol[0]);
+    int low = high >= 0 ? characterValue(symbol[1]) : -1;
+    return high >= 0 && high < 16 && low >= 0 && low < 16 &&
+           high * 16 + low < STATES;
+#endif
+}
+
+/*
+ * Checks whether first "length" characters of given string form non empty
+ * sequence of states.
+ */
+static inline bool isSymbolSequence(const char *history, size_t length)
+{
+    if (length == 0 || length % SYMBOL_WIDTH != 0) return false;
+
+    for (size_t i = 0; i < length; i += SYMBOL_WIDTH)
+    {
+        if (!isSymbol(history + i)) return false;
+    }
+
+    return true;
+}
+
+#endif //QUANTIZATION_SYMBOLS_H
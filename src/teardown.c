@@ -0,0 +1,484 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "teardown.h"
+#include "children.h"
+#include "pool.h"
+#include "snapshot.h"
+#include "tiering.h"
+#include "tree.h"
+
+/*
+ * Number of subtrees teardown is split into for each thread, at least, so
+ * that threads which get smaller ones have more to steal
+ */
+#define TEARDOWN_TASKS 16
+
+/*
+ * Subtrees torn down together in one pass. "lastPass" tells which of the two
+ * passes is made. "detached" is NULL when the whole tree is torn down,
+ * otherwise it is the removed subtree, whose nodes are released too. Nodes of
+ * every subtree are then chained through "parent" in "released" at its
+ * position, the last position holding the levels above them, and those which
+ * still hold shared children in "kept". "sharing" tells that nodes may have
+ * several references. Equalities with histories outside are unlinked from
+ * them, and spilled nodes released, under "lock".
+ */
+struct Teardown
+{
+    Tree **subtrees;
+    size_t count;
+    bool lastPass;
+    Tree *detached;
+    bool sharing;
+    Tree **released;
+    Tree **kept;
+    pthread_mutex_t lock;
+};
+typedef struct Teardown Teardown;
+
+/*
+ * Subtrees given to one thread, those not torn down yet are "tasks" from
+ * "top" to "bottom". The thread takes them from the bottom, other threads
+ * steal them from the top.
+ */
+struct TeardownQueue
+{
+    struct TeardownPool *pool;
+    size_t *tasks;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t lock;
+};
+typedef struct TeardownQueue TeardownQueue;
+
+/*
+ * "threads" wait for "started" until "round" changes, then tear down subtrees
+ * of "teardown" together with the calling thread, which owns the first of
+ * "queues". Threads still "busy" with the round signal "finished" when the
+ * last of them is done.
+ */
+struct TeardownPool
+{
+    pthread_t *threads;
+    size_t threadsCount;
+    TeardownQueue *queues;
+    Teardown *teardown;
+    unsigned long round;
+    size_t busy;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+};
+typedef struct TeardownPool TeardownPool;
+
+/*
+ * Starts threads of a new pool, returns NULL if there is only one processor or
+ * no thread could be started
+ */
+static TeardownPool *createPool(void);
+
+/*
+ * Thread body, takes part in every round until pool is stopped
+ */
+static void *poolWorker(void *argument);
+
+/*
+ * Makes pass of teardown over all its subtrees, spread evenly among queues as
+ * "order" of their positions
+ */
+static void runPass(TeardownPool *pool, Teardown *teardown, size_t *order);
+
+/*
+ * Tears down subtrees from queue with given position, then steals from the
+ * others until none are left
+ */
+static void runTasks(TeardownPool *pool, size_t queue);
+
+/*
+ * Takes position of subtree from the bottom of queue, or from its top if
+ * "steal" is set. Returns false if queue is empty.
+ */
+static bool takeTask(TeardownQueue *queue, bool steal, size_t *task);
+
+/*
+ * Makes pass of teardown over subtree, or over its root only if "recursive"
+ * is false, chaining nodes released in the last pass at position "slot"
+ */
+static void tearDown(Tree *histories, Teardown *teardown, bool recursive,
+                     size_t slot);
+
+/*
+ * Checks whether node is torn down by threads, being in subtree torn down
+ * with no node of several references on the way
+ */
+static bool isTornDown(const Tree *node, const Teardown *teardown);
+
+bool tearDownInParallel(Tree *histories, Tree *detached,
+                        void (*tearShared)(Tree *node))
+{
+    TreeState *state = stateOf(histories);
+    if (histories->references != 1) return false;
+
+    if (state->teardown == NULL) state->teardown = createPool();
+    TeardownPool *pool = state->teardown;
+    if (pool == NULL) return false;
+
+    // levels are put one after another, the last one holds the subtrees;
+    // shared nodes are left to the calling thread, so they are not split
+    size_t tasks = TEARDOWN_TASKS * (pool->threadsCount + 1);
+    size_t capacity = tasks;
+    size_t count = 1;
+    size_t level = 0;
+    Tree **nodes = malloc(sizeof(Tree *) * capacity);
+    if (nodes == NULL) return false;
+    nodes[0] = histories;
+
+    while (count - level < tasks)
+    {
+        size_t levelEnd = count;
+        for (size_t i = level; i < levelEnd; ++i)
+        {
+            Tree *child;
+            for (int symbol = -1;
+                 (child = nextChild(nodes[i], &symbol)) != NULL;)
+            {
+                if (child->references != 1) continue;
+
+                if (count == capacity)
+                {
+                    capacity *= 2;
+                    Tree **expanded = realloc(nodes, sizeof(Tree *) * capacity);
+                    if (expanded == NULL)
+                    {
+                        free(nodes);
+                        return false;
+                    }
+                    nodes = expanded;
+                }
+
+                nodes[count++] = child;
+            }
+        }
+
+        if (count == levelEnd) break; // the last level has no children
+        level = levelEnd;
+    }
+
+    Teardown teardown;
+    teardown.subtrees = nodes + level;
+    teardown.count = count - level;
+    teardown.detached = detached;
+    teardown.sharing = sharesNodes(histories);
+    teardown.released = calloc(teardown.count + 1, sizeof(Tree *));
+    teardown.kept = calloc(teardown.count + 1, sizeof(Tree *));
+    size_t *order = malloc(sizeof(size_t) * teardown.count);
+    if (teardown.released == NULL || teardown.kept == NULL || order == NULL ||
+        pthread_mutex_init(&teardown.lock, NULL) != 0)
+    {
+        free(order);
+        free(teardown.kept);
+        free(teardown.released);
+        free(nodes);
+        return false;
+    }
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        teardown.lastPass = pass == 1;
+
+        for (size_t i = 0; i < level; ++i)
+            tearDown(nodes[i], &teardown, false, teardown.count);
+        runPass(pool, &teardown, order);
+    }
+
+    // shared children are reached through nodes which keep them, before any
+    // node is given back to the pool
+    for (size_t i = 0; i <= teardown.count; ++i)
+    {
+        Tree *node = teardown.kept[i];
+        while (node != NULL)
+        {
+            Tree *next = node->parent;
+            Tree *child;
+            for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+            {
+                if (child->references != 1) tearShared(child);
+            }
+
+            releaseChildren(node);
+            node->parent = teardown.released[i];
+            teardown.released[i] = node;
+            node = next;
+        }
+    }
+
+    // nodes of the whole tree are released together with the pool
+    for (size_t i = 0; detached != NULL && i <= teardown.count; ++i)
+    {
+        Tree *node = teardown.released[i];
+        while (node != NULL)
+        {
+            Tree *next = node->parent;
+            poolRelease(node);
+            node = next;
+        }
+    }
+
+    pthread_mutex_destroy(&teardown.lock);
+    free(order);
+    free(teardown.kept);
+    free(teardown.released);
+    free(nodes);
+    return true;
+}
+
+void removeTeardownPool(TeardownPool *pool)
+{
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->started);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->threadsCount; ++i)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i <= pool->threadsCount; ++i)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->started);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
+
+static TeardownPool *createPool(void)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors < 2) return NULL;
+
+    TeardownPool *pool = calloc(1, sizeof(TeardownPool));
+    if (pool == NULL) return NULL;
+
+    // calling thread works too
+    size_t threads = (size_t) processors - 1;
+    pool->threads = malloc(sizeof(pthread_t) * threads);
+    pool->queues = calloc(threads + 1, sizeof(TeardownQueue));
+    if (pool->threads == NULL || pool->queues == NULL)
+    {
+        free(pool->queues);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->started, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    for (size_t i = 0; i <= threads; ++i)
+    {
+        pool->queues[i].pool = pool;
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    }
+
+    // pool works with as many threads as could be started
+    while (pool->threadsCount < threads &&
+           pthread_create(&pool->threads[pool->threadsCount], NULL, poolWorker,
+                          &pool->queues[pool->threadsCount + 1]) == 0)
+    {
+        ++pool->threadsCount;
+    }
+
+    if (pool->threadsCount == 0)
+    {
+        removeTeardownPool(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+static void *poolWorker(void *argument)
+{
+    TeardownQueue *queue = argument;
+    TeardownPool *pool = queue->pool;
+    size_t position = (size_t) (queue - pool->queues);
+    unsigned long round = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (!pool->stopping && pool->round == round)
+            pthread_cond_wait(&pool->started, &pool->lock);
+        if (pool->stopping) break;
+
+        round = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+
+        runTasks(pool, position);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void runPass(TeardownPool *pool, Teardown *teardown, size_t *order)
+{
+    // subtrees next to each other are given to different threads, as
+    // neighbouring subtrees are of similar size
+    size_t queues = pool->threadsCount + 1;
+    size_t start = 0;
+    for (size_t i = 0; i < queues; ++i)
+    {
+        TeardownQueue *queue = &pool->queues[i];
+        queue->tasks = order + start;
+        queue->top = 0;
+        queue->bottom = 0;
+
+        for (size_t task = i; task < teardown->count; task += queues)
+        {
+            queue->tasks[queue->bottom++] = task;
+        }
+        start += queue->bottom;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->teardown = teardown;
+    pool->busy = pool->threadsCount;
+    ++pool->round;
+    pthread_cond_broadcast(&pool->started);
+    pthread_mutex_unlock(&pool->lock);
+
+    runTasks(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void runTasks(TeardownPool *pool, size_t queue)
+{
+    Teardown *teardown = pool->teardown;
+    size_t queues = pool->threadsCount + 1;
+    size_t task = 0;
+
+    // no subtree is added during a pass, so once all queues are empty the
+    // thread is done
+    while (true)
+    {
+        bool found = takeTask(&pool->queues[queue], false, &task);
+        for (size_t i = 1; !found && i < queues; ++i)
+        {
+            found = takeTask(&pool->queues[(queue + i) % queues], true, &task);
+        }
+        if (!found) return;
+
+        tearDown(teardown->subtrees[task], teardown, true, task);
+    }
+}
+
+static bool takeTask(TeardownQueue *queue, bool steal, size_t *task)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    bool found = queue->top < queue->bottom;
+    if (found && steal) *task = queue->tasks[queue->top++];
+    else if (found) *task = queue->tasks[--queue->bottom];
+
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void tearDown(Tree *histories, Teardown *teardown, bool recursive,
+                     size_t slot)
+{
+    bool lastPass = teardown->lastPass;
+    bool keepsShared = false;
+
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(histories, &symbol)) != NULL;)
+    {
+        if (child->references != 1) keepsShared = true;
+        else if (recursive) tearDown(child, teardown, true, slot);
+    }
+
+    // equalities are not unlinked from the other history, if it is torn down
+    // too; each is released by the first of its histories torn down, or by
+    // the only one, in the last pass
+    EqualsList **cell = &histories->equalsList;
+    while (*cell != NULL)
+    {
+        EqualsList *current = *cell;
+        Equals *equals = current->this;
+        Tree *other = equals->historyA == histories ? equals->historyB :
+                      equals->historyA;
+
+        if (!lastPass && !isTornDown(other, teardown))
+        {
+            pthread_mutex_lock(&teardown->lock);
+            poolFree(poolOf(other), unlinkEquals(other, equals),
+                     sizeof(EqualsList));
+            pthread_mutex_unlock(&teardown->lock);
+            cell = &current->next;
+            continue;
+        }
+
+        if (!lastPass && equals->historyA == histories)
+        {
+            cell = &current->next;
+            continue;
+        }
+
+        *cell = current->next;
+        if (lastPass)
+            poolFree(poolOf(equals->historyA), equals, sizeof(Equals));
+        poolFree(poolOf(histories), current, sizeof(EqualsList));
+    }
+
+    if (!lastPass) return;
+
+    if (teardown->detached != NULL && histories->spilled)
+    {
+        pthread_mutex_lock(&teardown->lock);
+        releaseSpilled(histories);
+        pthread_mutex_unlock(&teardown->lock);
+    }
+
+    // node is not used any more, so its parent links the chain; one holding
+    // shared children keeps them for the calling thread
+    if (keepsShared)
+    {
+        histories->parent = teardown->kept[slot];
+        teardown->kept[slot] = histories;
+        return;
+    }
+
+    releaseChildren(histories);
+    histories->parent = teardown->released[slot];
+    teardown->released[slot] = histories;
+}
+
+static bool isTornDown(const Tree *node, const Teardown *teardown)
+{
+    if (teardown->detached == NULL && !teardown->sharing) return true;
+
+    // parents are not changed before the last pass
+    for (; node != NULL && node != teardown->detached; node = node->parent)
+    {
+        if (node->references != 1) return false;
+    }
+
+    return node == teardown->detached;
+}
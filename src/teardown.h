@@ -0,0 +1,44 @@
+#ifndef QUANTIZATION_TEARDOWN_H
+#define QUANTIZATION_TEARDOWN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Number of nodes from which histories needing work on every node, or removed
+ * subtree, are torn down by several threads
+ */
+#define TEARDOWN_PARALLEL_NODES ((size_t) 1 << 18)
+
+/*
+ * Threads tearing down histories of one data structure together with the
+ * thread which asked for it. They are started by the first teardown that
+ * needs them and wait for the next one until the data structure is removed.
+ */
+struct TeardownPool;
+
+/*
+ * Does work of clearSubtree, or of removal if "detached" is the subtree,
+ * split between threads of the pool by subtrees hanging from the first level
+ * of the tree with TEARDOWN_TASKS of them per thread. Each thread takes
+ * subtrees from its own queue and steals from the others once it is empty.
+ * Equality joins two nodes, possibly torn down by different threads, so in the
+ * first pass every node drops list cells of equalities it is the second
+ * history of, and in the second pass cells left, equalities themselves and
+ * children arrays. Nodes with several references, shared with snapshots or by
+ * compaction, are not touched by threads; calling thread gives each of them,
+ * found below node it tears down, to "tearShared" afterwards. Pool is used by
+ * one thread only, so nodes are given back to it afterwards too. Returns
+ * false, having done nothing, if memory ran out or there is only one
+ * processor, which would make the two passes slower than one.
+ */
+bool tearDownInParallel(Tree *histories, Tree *detached,
+                        void (*tearShared)(Tree *node));
+
+/*
+ * Stops threads of the pool and releases it, NULL is ignored
+ */
+void removeTeardownPool(struct TeardownPool *pool);
+
+#endif //QUANTIZATION_TEARDOWN_H
@@ -0,0 +1,596 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "tiering.h"
+#include "children.h"
+#include "finger.h"
+#include "index.h"
+#include "pool.h"
+#include "quantum_operations.h"
+#include "spill.h"
+#include "symbols.h"
+
+/*
+ * Subtree kept in spill file: its root "node" is left in histories as stub
+ * without children, the rest is read as "frozen" histories from "image" of
+ * "bytes" bytes in the file. "below", kept with SUBTREE_AGGREGATES,
+ * summarizes descendants of the stub, so that its extremes can be worked out
+ * again.
+ */
+struct Spilled
+{
+    Tree *node;
+    Frozen *frozen;
+    void *image;
+    size_t bytes;
+#if SUBTREE_AGGREGATES
+    Aggregate below;
+#endif
+};
+typedef struct Spilled Spilled;
+
+/*
+ * Spilled subtrees of tiered histories, kept in hash table by their stubs,
+ * "count" of them in "capacity" slots, of which empty ones have NULL node.
+ * Collisions are resolved by linear probing. Subtrees are spilled while nodes
+ * take more than "residentBytes".
+ *
+ * Passes of spilling walk the tree in depth first order, "epoch" counts them.
+ * Between slices of the pass "sweepPath" holds states leading from the root to
+ * the node whose children are looked at, "sweepDepth" of them, and
+ * "sweepSymbol" the state of child looked at last. Nodes on that path are
+ * looked up again by every slice, "sweepNodes" is space for them.
+ */
+struct Tiers
+{
+    SpillFile *file;
+    size_t residentBytes;
+    Spilled *slots;
+    size_t capacity;
+    size_t count;
+    uint16_t epoch;
+    int *sweepPath;
+    Tree **sweepNodes;
+    size_t sweepDepth;
+    size_t sweepCapacity;
+    int sweepSymbol;
+};
+typedef struct Tiers Tiers;
+
+/*
+ * Smallest subtree that is spilled, smaller ones are not worth a stub. Can be
+ * lowered at compile time, so that tests spill small histories too.
+ */
+#ifndef TIER_MIN_NODES
+#define TIER_MIN_NODES 1024
+#endif
+
+/*
+ * Number of passes of spilling node has to be left alone for to be spilled
+ */
+#define TIER_COLD_EPOCHS 2
+
+/*
+ * Number of slots table of spilled subtrees starts with
+ */
+#define TIERS_INITIAL_CAPACITY 64
+
+/*
+ * Returns slot of table holding given spilled node, or the empty slot where
+ * it would be put
+ */
+static Spilled *spilledSlot(const Tiers *tiers, const Tree *node);
+
+/*
+ * Puts spilled subtree into table, returns false if there was not enough
+ * memory to grow it
+ */
+static bool addSpilled(Tiers *tiers, const Spilled *spilled);
+
+/*
+ * Empties given slot of table
+ */
+static void removeSpilled(Tiers *tiers, Spilled *slot);
+
+/*
+ * Checks whether node is the smallest subtree worth spilling: it is large
+ * enough, but none of its children is
+ */
+static bool isSpillUnit(const Tree *node);
+
+/*
+ * Checks whether no descendant of node has equalities or is shared
+ */
+static bool isSpillable(const Tree *node);
+
+/*
+ * Writes subtree of node, reached by first "depth" states of sweep path, to
+ * spill file and releases its descendants. Returns false if there was not
+ * enough memory or space in the file, which leaves the subtree as it was.
+ */
+static bool spillSubtree(Tree *node, TreeState *state, size_t depth);
+
+/*
+ * Finds again nodes on the sweep path. Returns number of states of that path
+ * that still lead to a node which is not spilled.
+ */
+static size_t findSweepPath(Tree *histories, Tiers *tiers);
+
+/*
+ * Makes room for sweep path of given length, returns false if there was not
+ * enough memory
+ */
+static bool reserveSweepPath(Tiers *tiers, size_t depth);
+
+bool tierTree(Tree *histories, const char *path, size_t residentBytes)
+{
+    TreeState *state = stateOf(histories);
+    if (state->tiers != NULL) return false;
+
+    Tiers *tiers = malloc(sizeof(Tiers));
+    Spilled *slots = calloc(TIERS_INITIAL_CAPACITY, sizeof(Spilled));
+    SpillFile *file = tiers == NULL || slots == NULL ? NULL :
+                      spillCreate(path);
+    if (file == NULL)
+    {
+        free(tiers);
+        free(slots);
+        return false;
+    }
+
+    tiers->file = file;
+    tiers->residentBytes = residentBytes;
+    tiers->slots = slots;
+    tiers->capacity = TIERS_INITIAL_CAPACITY;
+    tiers->count = 0;
+    tiers->epoch = 0;
+    tiers->sweepPath = NULL;
+    tiers->sweepNodes = NULL;
+    tiers->sweepDepth = 0;
+    tiers->sweepCapacity = 0;
+    tiers->sweepSymbol = -1;
+    state->tiers = tiers;
+
+    return true;
+}
+
+void removeTiers(Tiers *tiers)
+{
+    if (tiers == NULL) return;
+
+    for (size_t i = 0; i < tiers->capacity; ++i)
+    {
+        if (tiers->slots[i].node != NULL) removeFrozen(tiers->slots[i].frozen);
+    }
+
+    free(tiers->slots);
+    free(tiers->sweepPath);
+    free(tiers->sweepNodes);
+    spillDestroy(tiers->file);
+    free(tiers);
+}
+
+bool hasSpilled(const Tree *histories)
+{
+    Tiers *tiers = stateOf(histories)->tiers;
+
+    return tiers != NULL && tiers->count > 0;
+}
+
+void touchPath(const TreeState *state, Tree *node)
+{
+    // after compaction parent of node may be one it no longer hangs from
+    if (state->tiers == NULL || state->compacted) return;
+
+    // ancestors of node used in this pass were marked together with it
+    uint16_t epoch = state->tiers->epoch;
+    for (; node != NULL && node->lastUsed != epoch; node = node->parent)
+    {
+        node->lastUsed = epoch;
+    }
+}
+
+Tree *reachHistory(const char *argument, size_t length,
+                   Tree *histories, size_t *walked, bool *memFail)
+{
+    Tree *reached = walkHistory(argument, length, histories, walked);
+
+    // spilled subtree holds no spilled nodes, so one of them is brought back
+    if (*walked < length && reached->spilled)
+    {
+        if (!thawSubtree(reached))
+        {
+            *memFail = true;
+            return reached;
+        }
+
+        reached = walkHistory(argument, length, histories, walked);
+    }
+
+    return reached;
+}
+
+const Frozen *spilledImage(const Tree *node)
+{
+    return spilledSlot(stateOf(node)->tiers, node)->frozen;
+}
+
+#if SUBTREE_AGGREGATES
+const Aggregate *spilledBelow(const Tree *node)
+{
+    return &spilledSlot(stateOf(node)->tiers, node)->below;
+}
+#endif
+
+static Spilled *spilledSlot(const Tiers *tiers, const Tree *node)
+{
+    size_t mask = tiers->capacity - 1;
+    uint64_t hash = (uint64_t) (uintptr_t) node * 0x9E3779B97F4A7C15u;
+    size_t slot = (size_t) (hash >> 32) & mask;
+
+    while (tiers->slots[slot].node != NULL && tiers->slots[slot].node != node)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    return &tiers->slots[slot];
+}
+
+static bool addSpilled(Tiers *tiers, const Spilled *spilled)
+{
+    // table is kept at most half full
+    if (2 * (tiers->count + 1) > tiers->capacity)
+    {
+        size_t capacity = tiers->capacity * 2;
+        Spilled *slots = calloc(capacity, sizeof(Spilled));
+        if (slots == NULL) return false;
+
+        Tiers grown = *tiers;
+        grown.slots = slots;
+        grown.capacity = capacity;
+
+        for (size_t i = 0; i < tiers->capacity; ++i)
+        {
+            Spilled *slot = &tiers->slots[i];
+            if (slot->node != NULL) *spilledSlot(&grown, slot->node) = *slot;
+        }
+
+        free(tiers->slots);
+        tiers->slots = slots;
+        tiers->capacity = capacity;
+    }
+
+    *spilledSlot(tiers, spilled->node) = *spilled;
+    ++tiers->count;
+    return true;
+}
+
+static void removeSpilled(Tiers *tiers, Spilled *slot)
+{
+    // entries after the removed one are moved back, unless it would put them
+    // before the slot they hash to
+    size_t mask = tiers->capacity - 1;
+    size_t hole = (size_t) (slot - tiers->slots);
+    size_t position = hole;
+
+    while (true)
+    {
+        position = (position + 1) & mask;
+        Spilled *next = &tiers->slots[position];
+        if (next->node == NULL) break;
+
+        uint64_t hash = (uint64_t) (uintptr_t) next->node *
+                        0x9E3779B97F4A7C15u;
+        size_t home = (size_t) (hash >> 32) & mask;
+        bool movable = hole <= position ? home <= hole || home > position :
+                       home <= hole && home > position;
+        if (movable)
+        {
+            tiers->slots[hole] = *next;
+            hole = position;
+        }
+    }
+
+    tiers->slots[hole].node = NULL;
+    --tiers->count;
+}
+
+void releaseSpilled(Tree *node)
+{
+    Tiers *tiers = stateOf(node)->tiers;
+    Spilled *slot = spilledSlot(tiers, node);
+
+    spillRelease(tiers->file, slot->image, slot->bytes);
+    removeFrozen(slot->frozen);
+    removeSpilled(tiers, slot);
+}
+
+void moveSpilled(const Tree *node, Tree *moved)
+{
+    // table is keyed by stubs, taking one out makes room for the other
+    Tiers *tiers = stateOf(moved)->tiers;
+    Spilled *slot = spilledSlot(tiers, node);
+    Spilled spilled = *slot;
+
+    removeSpilled(tiers, slot);
+    spilled.node = moved;
+    addSpilled(tiers, &spilled);
+}
+
+void spillTree(Tree *histories, size_t budget)
+{
+    TreeState *state = stateOf(histories);
+    Tiers *tiers = state->tiers;
+    Pool *pool = poolOf(histories);
+
+    // journal and snapshots keep pointers to nodes, which would be released,
+    // and use of compacted histories is not tracked
+    if (tiers == NULL || state->journal != NULL || state->versions > 0 ||
+        state->compacted)
+        return;
+    if (!reserveSweepPath(tiers, tiers->sweepDepth + 1)) return;
+
+    // the next node looked at is a child of node at "level" with state
+    // greater than "symbol"
+    size_t reached = findSweepPath(histories, tiers);
+    size_t level = reached;
+    int symbol = reached < tiers->sweepDepth ? tiers->sweepPath[reached] :
+                 tiers->sweepSymbol;
+
+    while (budget > 0 &&
+           poolLiveObjects(pool) * sizeof(Tree) > tiers->residentBytes)
+    {
+        Tree *next = nextChild(tiers->sweepNodes[level], &symbol);
+
+        if (next == NULL)
+        {
+            if (level > 0)
+            {
+                --level;
+                symbol = tiers->sweepPath[level];
+                continue;
+            }
+
+            // nodes not used since the pass before are cold in the next one
+            ++tiers->epoch;
+            symbol = -1;
+            break;
+        }
+
+        --budget;
+
+        // small subtrees stay resident, shared ones have many parents
+        if (next->spilled || next->references > 1 ||
+            countNodes(next, TIER_MIN_NODES) < TIER_MIN_NODES)
+            continue;
+
+        if (!reserveSweepPath(tiers, level + 2)) break;
+        tiers->sweepPath[level] = symbol;
+
+        if (!isSpillUnit(next))
+        {
+            tiers->sweepNodes[level + 1] = next;
+            ++level;
+            symbol = -1;
+            continue;
+        }
+
+        if ((uint16_t) (tiers->epoch - next->lastUsed) < TIER_COLD_EPOCHS)
+            continue;
+
+        // checking and writing out subtree costs a look at each of its nodes
+        uint64_t nodes = countNodes(next, UINT64_MAX);
+        budget -= budget < nodes ? budget : nodes;
+        if (isSpillable(next) && !spillSubtree(next, state, level + 1)) break;
+    }
+
+    tiers->sweepDepth = level;
+    tiers->sweepSymbol = symbol;
+}
+
+static bool isSpillUnit(const Tree *node)
+{
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        if (countNodes(child, TIER_MIN_NODES) >= TIER_MIN_NODES) return false;
+    }
+
+    return true;
+}
+
+static bool isSpillable(const Tree *node)
+{
+    Tree *child;
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        if (child->references > 1 || child->equalsList != NULL ||
+            !isSpillable(child))
+            return false;
+    }
+
+    return true;
+}
+
+static bool spillSubtree(Tree *node, TreeState *state, size_t depth)
+{
+    Tiers *tiers = state->tiers;
+    Frozen *frozen = freezeTree(node);
+    if (frozen == NULL) return false;
+
+    Spilled spilled;
+    spilled.node = node;
+    spilled.bytes = frozenImageBytes(frozen);
+    spilled.image = spillAllocate(tiers->file, spilled.bytes);
+    if (spilled.image != NULL) writeFrozenImage(frozen, spilled.image);
+    removeFrozen(frozen);
+
+    spilled.frozen = spilled.image == NULL ? NULL :
+                     openFrozenImage(spilled.image);
+
+    Tree *child;
+#if SUBTREE_AGGREGATES
+    spilled.below = (Aggregate) {0, 0, 0, 0};
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        mergeAggregate(&spilled.below, &child->aggregate);
+    }
+#endif
+
+    if (spilled.frozen == NULL || !addSpilled(tiers, &spilled))
+    {
+        removeFrozen(spilled.frozen);
+        if (spilled.image != NULL)
+            spillRelease(tiers->file, spilled.image, spilled.bytes);
+        return false;
+    }
+
+    // finger and index may hold descendants, which are released
+    cutFinger(state, depth * SYMBOL_WIDTH);
+    HistoryIndex *index = state->index;
+    if (index != NULL)
+    {
+        HistoryKey key = {0, 0, 0};
+        for (size_t i = 0; i < depth; ++i) extendKey(&key, tiers->sweepPath[i]);
+        unindexSubtree(index, node, &key);
+    }
+
+    for (int symbol = -1; (child = nextChild(node, &symbol)) != NULL;)
+    {
+        recurrentRemoval(child);
+    }
+
+    releaseChildren(node);
+    initializeChildren(node);
+    node->spilled = true;
+
+    return true;
+}
+
+bool thawSubtree(Tree *node)
+{
+    Tiers *tiers = stateOf(node)->tiers;
+    Spilled *slot = spilledSlot(tiers, node);
+    const Frozen *frozen = slot->frozen;
+    size_t count = frozenNodes(frozen);
+    Pool *pool = poolOf(node);
+
+    size_t *parents = malloc(sizeof(size_t) * count);
+    Tree **nodes = malloc(sizeof(Tree *) * count);
+    if (parents == NULL || nodes == NULL)
+    {
+        free(parents);
+        free(nodes);
+        return false;
+    }
+
+    // nodes are made in breadth first order, so parents come first
+    frozenParents(frozen, parents);
+    nodes[0] = node;
+    size_t made = 1;
+    bool linked = true;
+
+    for (; made < count && linked; ++made)
+    {
+        Tree *next = poolAllocateSequential(pool);
+        if (next == NULL) break;
+
+        allNull(next);
+        next->energy = frozenEnergy(frozen, made);
+#if SUBTREE_AGGREGATES
+        next->aggregate.energySum = next->energy;
+        next->aggregate.minEnergy = next->energy;
+        next->aggregate.maxEnergy = next->energy;
+#endif
+        next->lastUsed = tiers->epoch;
+        next->parent = nodes[parents[made]];
+        nodes[made] = next;
+
+        linked = setChild(next->parent, frozenState(frozen, made), next);
+    }
+    poolFinishSequential(pool);
+
+    if (made < count || !linked)
+    {
+        while (made > 1)
+        {
+            releaseChildren(nodes[--made]);
+            poolRelease(nodes[made]);
+        }
+
+        releaseChildren(node);
+        initializeChildren(node);
+        free(parents);
+        free(nodes);
+        return false;
+    }
+
+#if SUBTREE_AGGREGATES
+    // summary of the node itself is already complete
+    for (size_t i = count - 1; i > 0; --i)
+    {
+        if (parents[i] != 0)
+            mergeAggregate(&nodes[parents[i]]->aggregate, &nodes[i]->aggregate);
+    }
+#endif
+
+    spillRelease(tiers->file, slot->image, slot->bytes);
+    removeFrozen(slot->frozen);
+    removeSpilled(tiers, slot);
+    node->spilled = false;
+
+    free(parents);
+    free(nodes);
+    return true;
+}
+
+bool thawTree(Tree *histories)
+{
+    Tiers *tiers = stateOf(histories)->tiers;
+    if (tiers == NULL) return true;
+
+    // removal moves entries back only into slot just emptied, never into
+    // those emptied before
+    for (size_t i = 0; i < tiers->capacity;)
+    {
+        Tree *node = tiers->slots[i].node;
+        if (node == NULL) ++i;
+        else if (!thawSubtree(node)) return false;
+    }
+
+    return true;
+}
+
+static size_t findSweepPath(Tree *histories, Tiers *tiers)
+{
+    tiers->sweepNodes[0] = histories;
+
+    for (size_t level = 0; level < tiers->sweepDepth; ++level)
+    {
+        Tree *next = getChild(tiers->sweepNodes[level],
+                              tiers->sweepPath[level]);
+        if (next == NULL || next->spilled) return level;
+
+        tiers->sweepNodes[level + 1] = next;
+    }
+
+    return tiers->sweepDepth;
+}
+
+static bool reserveSweepPath(Tiers *tiers, size_t depth)
+{
+    if (depth <= tiers->sweepCapacity) return true;
+
+    size_t capacity = tiers->sweepCapacity == 0 ? 64 : tiers->sweepCapacity;
+    while (capacity < depth) capacity *= 2;
+
+    int *path = realloc(tiers->sweepPath, sizeof(int) * capacity);
+    if (path == NULL) return false;
+    tiers->sweepPath = path;
+
+    Tree **nodes = realloc(tiers->sweepNodes, sizeof(Tree *) * capacity);
+    if (nodes == NULL) return false;
+    tiers->sweepNodes = nodes;
+
+    tiers->sweepCapacity = capacity;
+    return true;
+}
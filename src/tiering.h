@@ -0,0 +1,89 @@
+#ifndef QUANTIZATION_TIERING_H
+#define QUANTIZATION_TIERING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "frozen.h"
+#include "tree.h"
+
+/*
+ * Keeps cold parts of histories in file created at given path, which must not
+ * exist, once their nodes take more than "residentBytes". Each part spilled
+ * is the smallest subtree of at least about a thousand nodes, which was not
+ * walked to for two whole passes of spillTree. Its nodes are written to the
+ * file in frozen form and released, the root is left as a stub. Queries
+ * read spilled histories from the file directly, while updates bring their
+ * subtree back first. Returns false if histories are already tiered, or the
+ * file could not be created.
+ */
+bool tierTree(Tree *histories, const char *path, size_t residentBytes);
+
+/*
+ * Looks at most at about "budget" nodes as part of pass of spilling, so that
+ * the pass can be spread over time between other operations. Nothing happens
+ * while histories are not tiered, take no more than resident bytes, or while
+ * transaction is open or any snapshot is not released. Subtrees with
+ * equalities are never spilled, and nothing is spilled after compaction, as
+ * nodes with several parents keep pointer to only one of them.
+ */
+void spillTree(Tree *histories, size_t budget);
+
+/*
+ * Brings every spilled subtree back. Returns false if there was not enough
+ * memory, in that case part of them stay spilled.
+ */
+bool thawTree(Tree *histories);
+
+/*
+ * Checks whether any subtree of histories is spilled
+ */
+bool hasSpilled(const Tree *histories);
+
+/*
+ * Releases spilled subtrees and the file. Passing NULL is allowed.
+ */
+void removeTiers(struct Tiers *tiers);
+
+/*
+ * Marks node and its ancestors as used in the current pass of spilling, if
+ * histories are tiered and were not compacted
+ */
+void touchPath(const TreeState *state, Tree *node);
+
+/*
+ * Returns frozen histories of spilled node, its root being the node
+ */
+const Frozen *spilledImage(const Tree *node);
+
+#if SUBTREE_AGGREGATES
+/*
+ * Returns summary of descendants of spilled node, which are kept in the file
+ */
+const Aggregate *spilledBelow(const Tree *node);
+#endif
+
+/*
+ * Walks history like walkHistory, but brings back subtree of spilled node it
+ * stops at and walks on. Sets "memFail" if there was not enough memory for it.
+ */
+Tree *reachHistory(const char *argument, size_t length,
+                   Tree *histories, size_t *walked, bool *memFail);
+
+/*
+ * Brings back subtree of spilled node. Returns false if there was not enough
+ * memory, which leaves the node spilled.
+ */
+bool thawSubtree(Tree *node);
+
+/*
+ * Gives back image of spilled node that is being released
+ */
+void releaseSpilled(Tree *node);
+
+/*
+ * Gives image of spilled node, which is being moved, to the node that takes
+ * its place
+ */
+void moveSpilled(const Tree *node, Tree *moved);
+
+#endif //QUANTIZATION_TIERING_H
@@ -0,0 +1,195 @@
+#ifndef QUANTIZATION_TREE_H
+#define QUANTIZATION_TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Internals of the tree of histories shared by quantum_operations.c and the
+ * modules implementing its features. Not meant for users of histories, who
+ * include quantum_operations.h and headers of those modules.
+ */
+
+/*
+ * State of whole data structure, reachable from each of its nodes through
+ * their pool. "versions" counts snapshots sharing its nodes, while there are
+ * none no node has to be copied before it is changed. "compacted" tells that
+ * identical subtrees were merged, from then on a node may have several
+ * parents and keeps pointer to only one of them. "path" is space for nodes on
+ * the path being copied.
+ *
+ * While defragmentation pass is in progress, "defragPath" holds states leading
+ * from the root to the node moved last, "defragDepth" of them. Histories may
+ * change between slices of the pass, so nodes on that path are looked up again
+ * by every slice, "defragNodes" is space for them. "defragReleased" is number
+ * of nodes released by the pool when the last pass ended.
+ *
+ * "fingerHistory" holds first "fingerLength" characters of the history walked
+ * last from "root", and "fingerNodes" nodes on its path, starting with the
+ * root, so that the next walk can start where the histories part, both in one
+ * block charged to the pool. Every change that releases or replaces nodes
+ * shortens the finger, so that it never holds node which is not in the
+ * histories.
+ *
+ * "equalized" tells that some equality was ever added, until then nodes own
+ * no memory besides children arrays of large alphabets. "joined" tells that
+ * some class was shared with histories kept elsewhere, see shareClass.
+ *
+ * "index" is NULL unless long histories are indexed, see HistoryIndex,
+ * "tiers" unless they are tiered, see Tiers, and "teardown" until large
+ * subtree was torn down, see TeardownPool.
+ */
+struct TreeState
+{
+    struct Journal *journal;
+    unsigned long versions;
+    bool compacted;
+    Tree **path;
+    size_t pathCapacity;
+    bool defragmenting;
+    int *defragPath;
+    Tree **defragNodes;
+    size_t defragDepth;
+    size_t defragCapacity;
+    size_t defragReleased;
+    Tree *root;
+    char *fingerHistory;
+    Tree **fingerNodes;
+    size_t fingerLength;
+    size_t fingerCapacity;
+    bool equalized;
+    bool joined;
+    struct HistoryIndex *index;
+    struct Tiers *tiers;
+    struct TeardownPool *teardown;
+};
+typedef struct TreeState TreeState;
+
+/*
+ * Returns state of data structure given node belongs to
+ */
+TreeState *stateOf(const Tree *node);
+
+/*
+ * Forgets every node finger and index hold, after nodes were replaced or
+ * released
+ */
+void forgetNodes(TreeState *state);
+
+/*
+ * Updates aggregates of given node and its ancestors after subtree of "added"
+ * was attached to the node
+ */
+void addSubtree(Tree *node, const Tree *added);
+
+/*
+ * Updates aggregates of given node and its ancestors after subtree of
+ * "removed" was detached from the node
+ */
+void subtractSubtree(Tree *node, const Tree *removed);
+
+/*
+ * Returns number of nodes in subtree of given node, spilled ones included,
+ * counting subtrees shared by compaction once for each parent. Stops counting
+ * at "limit", which bounds the walk when nodes keep no aggregates.
+ */
+uint64_t countNodes(const Tree *node, uint64_t limit);
+
+/*
+ * Assigns energy to single node and updates aggregates of all its ancestors,
+ * without recording anything
+ */
+void assignEnergy(Tree *node, Energy energy);
+
+/*
+ * Helper function for history removal. It calls itself on all available "next"
+ * nodes, and then removes node given as argument.
+ */
+void recurrentRemoval(Tree *histories);
+
+/*
+ * Releases subtree detached from histories, by several threads when it is
+ * large. Nodes shared with snapshots stay there, without equalities.
+ */
+void releaseSubtree(Tree *histories);
+
+/*
+ * Takes list cell holding given equality out of node`s equality list and
+ * returns it
+ */
+EqualsList *unlinkEquals(Tree *node, Equals *equals);
+
+/*
+ * This function removes all EqualsList and Equals associated with given node.
+ * It also removes appropriate EqualsList from each node it was equalized with
+ */
+void removeAllEquals(Tree *node);
+
+/*
+ * Checks if given node has been already visited in current run of energy update
+ * in entire equality relation
+ */
+bool isVisited(Tree *node);
+
+/*
+ * Marks node as visited in current run of energy update in entire equality relation
+ */
+void markVisited(Tree *node);
+
+/*
+ * Marks node as unvisited
+ */
+void unMarkVisited(Tree *node);
+
+/*
+ * Walks history like followHistory, but history kept in index is found there
+ * without a walk. Path to the node reached is marked as used for tiering.
+ */
+Tree *walkHistory(const char *argument, size_t length, Tree *histories,
+                  size_t *walked);
+
+/*
+ * Function sets all "next" pointers to NULL, and energy to 0, which means no
+ * energy assigned. Intended to be used on newly made nodes. Also sets visited
+ * to false.
+ */
+void allNull(Tree *newNode);
+
+/*
+ * Checks if histories are already equalized. Returns true if they are, false
+ * otherwise
+ */
+bool alreadyEqual(Tree *historyA, Tree *historyB);
+
+/*
+ * Calculates average of two energy values
+ */
+Energy average(Energy energyA, Energy energyB);
+
+/*
+ * Adds equality of two nodes, without changing their energies. Nodes are made
+ * writable first, which may replace them. Returns false, setting "memFail", if
+ * there was not enough memory.
+ */
+bool linkNodes(Tree **historyA, Tree **historyB, bool *memFail);
+
+/*
+ * Assigns energy to node and every node equal to it, walking equalities of
+ * each of them once
+ */
+void spreadEnergy(Tree *node, Energy energy, bool *memFail);
+
+/*
+ * Returns history equalized with given one by "equals"
+ */
+Tree *otherHistory(const Equals *equals, const Tree *history);
+
+/*
+ * Marks node and appends it to "queue" holding "length" of "capacity" nodes,
+ * unless it was already marked. Returns false if there was not enough memory
+ * to expand the queue.
+ */
+bool queueNode(Tree ***queue, size_t *length, size_t *capacity, Tree *node);
+
+#endif //QUANTIZATION_TREE_H
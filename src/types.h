@@ -7,11 +7,50 @@
 
 #include <stdint.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
 /*
- * Number of possible quantum states, default is 4: "0", "1", "2" and "3"
+ * Number of possible quantum states, default is 4: "0", "1", "2" and "3".
+ * Can be set at compile time to any value from 2 to 256, see symbols.h for the
+ * way states are written.
  */
+#ifndef STATES
 #define STATES 4
+#endif
+
+#if STATES < 2 || STATES > 256
+#error "STATES must be between 2 and 256"
+#endif
+
+/*
+ * Alphabets up to this size keep an array with pointer for every state in each
+ * node. Larger ones keep only existing children, packed in order, together with
+ * a bitmap of states they belong to.
+ */
+#ifndef DENSE_STATES_LIMIT
+#define DENSE_STATES_LIMIT 16
+#endif
+
+#if STATES <= DENSE_STATES_LIMIT
+#define DENSE_CHILDREN 1
+#else
+#define DENSE_CHILDREN 0
+#endif
+
+/*
+ * Number of 64-bit words in bitmap of existing children
+ */
+#define CHILDREN_WORDS ((STATES + 63) / 64)
+
+/*
+ * Set to 1 at compile time to keep summary of its subtree, see Aggregate, in
+ * every node, which makes subtree summaries take time proportional to length
+ * of the history. By default nodes stay small and summaries are counted by
+ * walking the subtree when asked for.
+ */
+#ifndef SUBTREE_AGGREGATES
+#define SUBTREE_AGGREGATES 0
+#endif
 
 /*
  * Type used to store energy value information - unsigned 64-bit integer
@@ -19,14 +58,74 @@
 typedef uint64_t Energy;
 
 /*
- * Structure used to store histories
+ * Type used to store sum of energies, wide enough to never overflow
+ */
+typedef unsigned __int128 EnergySum;
+
+/*
+ * Summary of all histories in a subtree: how many of them there are, sum of
+ * their energies and the smallest and largest assigned energy (0 if none of
+ * them has energy).
+ */
+struct Aggregate
+{
+    uint64_t count;
+    EnergySum energySum;
+    Energy minEnergy;
+    Energy maxEnergy;
+};
+typedef struct Aggregate Aggregate;
+
+/*
+ * Identifier of a snapshot of histories, snapshots are numbered from 1
+ */
+typedef uint64_t Version;
+
+/*
+ * Memory used by histories: number of nodes, bytes reserved for them and
+ * memory they own, and bytes given back by compaction so far.
+ */
+struct Statistics
+{
+    uint64_t nodes;
+    uint64_t bytes;
+    uint64_t reclaimed;
+};
+typedef struct Statistics Statistics;
+
+/*
+ * Structure used to store histories. Children should be accessed through
+ * functions from children.h, which work for both layouts. "aggregate", kept
+ * only with SUBTREE_AGGREGATES, describes the node together with all its
+ * descendants and is kept up to date by every operation that changes them.
+ * "references" counts nodes holding the node as their child, it is greater
+ * than 1 only for nodes shared with snapshots, or with other histories after
+ * compaction, and saturates instead of wrapping around, see MAX_REFERENCES.
+ * "spilled" node keeps its subtree in spill file instead of children, see
+ * tierTree, and "lastUsed" is the pass of spilling in which the node or any of
+ * its descendants was last walked to. "spanning" node belongs to class of
+ * equal histories shared with histories kept elsewhere, see spansTrees. Flags
+ * are bit fields, so that they fit in padding before "lastUsed".
  */
 struct Tree
 {
+    struct Tree *parent;
     struct EqualsList *equalsList;
+#if DENSE_CHILDREN
     struct Tree *next[STATES];
-    bool visited;
+#else
+    uint64_t present[CHILDREN_WORDS];
+    struct Tree **next;
+#endif
+    bool visited : 1;
+    bool spilled : 1;
+    bool spanning : 1;
+    uint16_t lastUsed;
+    uint32_t references;
     Energy energy;
+#if SUBTREE_AGGREGATES
+    Aggregate aggregate;
+#endif
 };
 typedef struct Tree Tree;
 
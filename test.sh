@@ -4,6 +4,9 @@ if (($# != 2)); then
     exit 1
 fi
 
+# memory is released before exit only on request, leak check needs it
+export QUANTIZATION_FULL_TEARDOWN=1
+
 VALGRIND="valgrind --error-exitcode=15 --leak-check=full --show-leak-kinds=all --errors-for-leak-kinds=all --quiet"
 PROGRAM=$1
 DIRECTORY=$2
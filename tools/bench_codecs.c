@@ -0,0 +1,165 @@
+//
+// Benchmark of energy parsing and printing against the standard library.
+//
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/interface.h"
+#include "../src/output.h"
+
+/*
+ * Number of energies parsed and printed by each round
+ */
+#define NUMBERS_COUNT 1000000
+
+/*
+ * Number of rounds, the fastest one is reported
+ */
+#define ROUNDS 5
+
+/*
+ * Longest text of a number made, leading zeros included
+ */
+#define NUMBER_TEXT 24
+
+/*
+ * Parses energy the way it was parsed before, with strtoull
+ */
+static bool parseEnergyLibrary(const char *argument, Energy *energy);
+
+/*
+ * Returns random 64-bit number, its length in digits spread evenly
+ */
+static uint64_t randomNumber(void);
+
+/*
+ * Returns time in seconds from arbitrary point
+ */
+static double now(void);
+
+static bool parseEnergyLibrary(const char *argument, Energy *energy)
+{
+    errno = 0;
+    Energy parsed = strtoull(argument, NULL, 10);
+
+    if (errno == EINVAL || errno == ERANGE || parsed == 0) return false;
+
+    *energy = parsed;
+    return true;
+}
+
+static uint64_t randomNumber(void)
+{
+    uint64_t number = 0;
+    for (int i = 0; i < 4; ++i)
+        number = (number << 16) ^ (uint64_t) (rand() & 0xFFFF);
+
+    unsigned digits = 1 + rand() % 20;
+    if (digits < 20)
+    {
+        uint64_t limit = 1;
+        for (unsigned i = 0; i < digits; ++i) limit *= 10;
+        number %= limit;
+    }
+
+    return number;
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    char (*texts)[NUMBER_TEXT] = malloc(NUMBERS_COUNT * sizeof(*texts));
+    Energy *energies = malloc(NUMBERS_COUNT * sizeof(Energy));
+    FILE *sink = fopen("/dev/null", "w");
+    if (texts == NULL || energies == NULL || sink == NULL) return 1;
+
+    srand(1);
+    for (size_t i = 0; i < NUMBERS_COUNT; ++i)
+    {
+        // a few leading zeros and numbers above the limit are mixed in
+        const char *zeros = rand() % 16 == 0 ? "000" : "";
+        if (rand() % 64 == 0)
+            snprintf(texts[i], NUMBER_TEXT, "%s%" PRIu64 "9", zeros,
+                     UINT64_MAX - (uint64_t) (rand() % 1000));
+        else
+            snprintf(texts[i], NUMBER_TEXT, "%s%" PRIu64, zeros,
+                     randomNumber());
+    }
+
+    // both parsers must agree before their times mean anything
+    for (size_t i = 0; i < NUMBERS_COUNT; ++i)
+    {
+        Energy library = 0;
+        Energy fast = 0;
+        bool libraryParsed = parseEnergyLibrary(texts[i], &library);
+        bool fastParsed = parseEnergy(texts[i], &fast);
+
+        if (libraryParsed != fastParsed || library != fast)
+        {
+            fprintf(stderr, "parsers differ on %s\n", texts[i]);
+            return 1;
+        }
+    }
+
+    double best[4] = {1e9, 1e9, 1e9, 1e9};
+    Energy checksum = 0;
+
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        double start = now();
+        for (size_t i = 0; i < NUMBERS_COUNT; ++i)
+        {
+            energies[i] = 0;
+            parseEnergyLibrary(texts[i], &energies[i]);
+        }
+        double time = now() - start;
+        if (time < best[0]) best[0] = time;
+
+        start = now();
+        for (size_t i = 0; i < NUMBERS_COUNT; ++i)
+        {
+            energies[i] = 0;
+            parseEnergy(texts[i], &energies[i]);
+        }
+        time = now() - start;
+        if (time < best[1]) best[1] = time;
+
+        start = now();
+        for (size_t i = 0; i < NUMBERS_COUNT; ++i)
+            fprintf(sink, "%" PRIu64 "\n", energies[i]);
+        fflush(sink);
+        time = now() - start;
+        if (time < best[2]) best[2] = time;
+
+        start = now();
+        for (size_t i = 0; i < NUMBERS_COUNT; ++i)
+            printEnergy(sink, energies[i]);
+        fflush(sink);
+        time = now() - start;
+        if (time < best[3]) best[3] = time;
+
+        for (size_t i = 0; i < NUMBERS_COUNT; ++i) checksum += energies[i];
+    }
+
+    printf("parse  strtoull %6.1f ns  parseEnergy %6.1f ns\n",
+           best[0] * 1e9 / NUMBERS_COUNT, best[1] * 1e9 / NUMBERS_COUNT);
+    printf("print  fprintf  %6.1f ns  printEnergy %6.1f ns\n",
+           best[2] * 1e9 / NUMBERS_COUNT, best[3] * 1e9 / NUMBERS_COUNT);
+    printf("checksum %" PRIu64 "\n", checksum);
+
+    fclose(sink);
+    free(texts);
+    free(energies);
+    return 0;
+}
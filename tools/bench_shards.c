@@ -0,0 +1,203 @@
+//
+// Benchmark of sharded execution on a mixed workload, for growing number of
+// shards. Most equalities join histories of the same shard, a few join
+// histories of different shards, so only commands on classes spread over
+// shards have to wait for the shards they join. Shards scale only up to the
+// number of processors, printed first.
+//
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/cli.h"
+#include "../src/quantization.h"
+#include "../src/sharded.h"
+#include "../src/symbols.h"
+
+/*
+ * Number of commands of the workload
+ */
+#define COMMANDS_COUNT 500000
+
+/*
+ * Histories are made in groups sharing the first GROUP_PREFIX symbols, which
+ * is longer than any routing prefix picked automatically for up to 64 shards,
+ * so that a group always belongs to one shard
+ */
+#define GROUPS_COUNT 4096
+#define GROUP_SIZE 16
+#define GROUP_PREFIX 6
+#define HISTORY_LENGTH 12
+#define HISTORY_TEXT (HISTORY_LENGTH * SYMBOL_WIDTH + 1)
+
+/*
+ * One of this many commands is EQUAL of histories from random groups, which
+ * usually belong to different shards
+ */
+#define CROSS_EQUAL_PERIOD 20000
+
+/*
+ * Numbers of shards compared, after the plain command loop
+ */
+#define SHARD_COUNTS 5
+static const unsigned SHARDS[SHARD_COUNTS] = {1, 2, 4, 8, 16};
+
+/*
+ * Number of rounds, the fastest one is reported
+ */
+#define ROUNDS 3
+
+/*
+ * Writes random symbols to "text" from position "from" to "to"
+ */
+static void randomSymbols(char *text, unsigned from, unsigned to);
+
+/*
+ * Writes workload to "input": declarations of all histories, then the mix of
+ * updates and queries
+ */
+static void writeWorkload(FILE *input, char (*histories)[HISTORY_TEXT]);
+
+/*
+ * Runs workload from "input" with given number of shards, or with the plain
+ * command loop if it is 0. Returns time it took in seconds.
+ */
+static double runWorkload(FILE *input, FILE *sink, unsigned shards);
+
+/*
+ * Returns time in seconds from arbitrary point
+ */
+static double now(void);
+
+static void randomSymbols(char *text, unsigned from, unsigned to)
+{
+    for (unsigned i = from; i < to; ++i)
+    {
+        unsigned state = (unsigned) rand() % STATES;
+#if SYMBOL_WIDTH == 1
+        text[i] = SYMBOL_ALPHABET[state];
+#else
+        text[2 * i] = SYMBOL_ALPHABET[state / 16];
+        text[2 * i + 1] = SYMBOL_ALPHABET[state % 16];
+#endif
+    }
+}
+
+static void writeWorkload(FILE *input, char (*histories)[HISTORY_TEXT])
+{
+    for (size_t group = 0; group < GROUPS_COUNT; ++group)
+    {
+        char *first = histories[group * GROUP_SIZE];
+        randomSymbols(first, 0, GROUP_PREFIX);
+
+        for (size_t i = 0; i < GROUP_SIZE; ++i)
+        {
+            char *history = histories[group * GROUP_SIZE + i];
+            memcpy(history, first, GROUP_PREFIX * SYMBOL_WIDTH);
+            randomSymbols(history, GROUP_PREFIX, HISTORY_LENGTH);
+            history[HISTORY_LENGTH * SYMBOL_WIDTH] = '\0';
+
+            fprintf(input, "DECLARE %s\nENERGY %s %d\n", history, history,
+                    1 + rand() % 1000);
+        }
+    }
+
+    for (size_t i = 0; i < COMMANDS_COUNT; ++i)
+    {
+        size_t group = (size_t) rand() % GROUPS_COUNT;
+        const char *history = histories[group * GROUP_SIZE +
+                                        (size_t) rand() % GROUP_SIZE];
+        const char *other = histories[group * GROUP_SIZE +
+                                      (size_t) rand() % GROUP_SIZE];
+        unsigned kind = (unsigned) rand() % 100;
+
+        if (i % CROSS_EQUAL_PERIOD == 0)
+            other = histories[(size_t) rand() % (GROUPS_COUNT * GROUP_SIZE)];
+
+        if (i % CROSS_EQUAL_PERIOD == 0 || kind < 10)
+            fprintf(input, "EQUAL %s %s\n", history, other);
+        else if (kind < 30)
+            fprintf(input, "ENERGY %s %d\n", history, 1 + rand() % 1000);
+        else if (kind < 55)
+            fprintf(input, "ENERGY %s\n", history);
+        else if (kind < 80)
+            fprintf(input, "VALID %s\n", history);
+        else if (kind < 98)
+            fprintf(input, "DECLARE %s\n", history);
+        else
+        {
+            // removes a few histories of the group, declared again later
+            fprintf(input, "REMOVE %.*s\n",
+                    (HISTORY_LENGTH - 1) * SYMBOL_WIDTH, history);
+        }
+    }
+}
+
+static double runWorkload(FILE *input, FILE *sink, unsigned shards)
+{
+    rewind(input);
+    double start = now();
+
+    if (shards > 0)
+    {
+        runShardedCommands(shards, SHARD_DEPTH_AUTO, NULL, input, sink, sink);
+        return now() - start;
+    }
+
+    Quantization *quantization = quantCreate();
+    if (quantization == NULL) return 0;
+
+    runCommands(quantization, input, sink, sink);
+    quantDestroy(quantization);
+    return now() - start;
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    char (*histories)[HISTORY_TEXT] = malloc(GROUPS_COUNT * GROUP_SIZE *
+                                             sizeof(*histories));
+    FILE *input = tmpfile();
+    FILE *sink = fopen("/dev/null", "w");
+    if (histories == NULL || input == NULL || sink == NULL) return 1;
+
+    srand(1);
+    writeWorkload(input, histories);
+
+    double best[SHARD_COUNTS + 1];
+    for (int i = 0; i <= SHARD_COUNTS; ++i) best[i] = 1e9;
+
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        for (int i = 0; i <= SHARD_COUNTS; ++i)
+        {
+            double time = runWorkload(input, sink, i == 0 ? 0 :
+                                                   SHARDS[i - 1]);
+            if (time < best[i]) best[i] = time;
+        }
+    }
+
+    double total = COMMANDS_COUNT + 2.0 * GROUPS_COUNT * GROUP_SIZE;
+    printf("%ld processors\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %12.0f commands/s\n", "plain", total / best[0]);
+    for (int i = 1; i <= SHARD_COUNTS; ++i)
+    {
+        printf("%2u shards  %12.0f commands/s  %5.2fx 1 shard\n",
+               SHARDS[i - 1], total / best[i], best[1] / best[i]);
+    }
+
+    fclose(sink);
+    fclose(input);
+    free(histories);
+    return 0;
+}
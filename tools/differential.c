@@ -0,0 +1,1811 @@
+//
+// Differential test of the library against a slow, obviously correct model.
+// Random streams of commands are run through the model and through the library
+// in a few configurations, every answer and error must agree. Throughput of
+// each of them is reported side by side.
+//
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/cli.h"
+#include "../src/interface.h"
+#include "../src/quantization.h"
+#include "../src/replication.h"
+#include "../src/sharded.h"
+#include "../src/symbols.h"
+
+/*
+ * Defaults for number of streams, commands in each and seed of the first one,
+ * stream i uses seed SEED + i
+ */
+#define DEFAULT_STREAMS 20
+#define DEFAULT_COMMANDS 20000
+#define DEFAULT_SEED 1
+
+/*
+ * Histories of a stream are prefixes of this many random histories, so that
+ * they overlap and commands hit declared ones often
+ */
+#define POOL_SIZE 256
+
+/*
+ * Longest history generated, in states. Each stream uses a shorter limit too,
+ * from 2 states up, so that classes of equal histories grow large.
+ */
+#define MAX_LENGTH 8
+#define HISTORY_TEXT (MAX_LENGTH * SYMBOL_WIDTH + 1)
+
+/*
+ * Every this many seeds stream is dense: histories come from a few short
+ * ones and most commands are EQUAL, so that there are many paths between
+ * histories of a class
+ */
+#define DENSE_PERIOD 4
+#define DENSE_POOL_SIZE 16
+#define DENSE_LENGTH 3
+
+/*
+ * One of this many EQUAL and ENERGY commands starts a batch of up to
+ * MAX_BATCH of them, run with quantEqualBatch or quantEnergyBatch
+ */
+#define BATCH_PERIOD 16
+#define MAX_BATCH 64
+
+/*
+ * LOAD declares up to MAX_LOAD histories. One of LOAD_MALFORMED_PERIOD of them
+ * lists MALFORMED_HISTORY as well, so that nothing is declared.
+ */
+#define MAX_LOAD 4
+#define LOAD_MALFORMED_PERIOD 8
+#define MALFORMED_HISTORY "!"
+
+/*
+ * Stream with seed giving FREEZE_PHASE modulo FREEZE_PERIOD freezes histories
+ * three quarters through, so that frozen histories are queried too. Only
+ * streams with even seeds take snapshots, the others COMPACT instead, which
+ * fails while any snapshot is held.
+ */
+#define FREEZE_PERIOD 5
+#define FREEZE_PHASE 3
+#define SNAPSHOT_PERIOD 2
+
+/*
+ * Number of operations commands of a stream are drawn from
+ */
+#define MIXED_OPERATIONS 19
+
+/*
+ * Engines with defragmentation start it again every this many commands
+ */
+#define DEFRAGMENT_PERIOD 1000
+
+/*
+ * Number of engines compared with the model
+ */
+#define ENGINES_COUNT 7
+
+/*
+ * Number of shards of the sharded engine
+ */
+#define SHARDS_COUNT 4
+
+/*
+ * Engine which finishes no command for this many milliseconds fails the test.
+ * Progress is checked BUDGET_CHECKS times as often.
+ */
+#define COMMAND_BUDGET_MS 2000
+#define BUDGET_CHECKS 4
+
+/*
+ * Replica has this many milliseconds after primary ended to answer like the
+ * model, it is asked again every REPLICA_RETRY_MS milliseconds until then
+ */
+#define REPLICA_BUDGET_MS 5000
+#define REPLICA_RETRY_MS 10
+
+/*
+ * Longest path of files made for a stream: LOAD files and replication socket
+ */
+#define PATH_TEXT 96
+
+/*
+ * Status of command text engine printed no answer to
+ */
+#define NO_ANSWER (-1)
+
+/*
+ * Single command of a stream. "other" is second history of EQUAL, "energy"
+ * is argument of ENERGY, "version" is argument of RELEASE, VALID_AT and
+ * ENERGY_AT, "loaded" are "loadedCount" histories of LOAD. ENERGY_SHORT stands
+ * for query of energy. First command of a batch holds in "batch" number of
+ * commands in it, all with the same operation, otherwise it is 0.
+ */
+struct Command
+{
+    int operation;
+    char history[HISTORY_TEXT];
+    char other[HISTORY_TEXT];
+    Energy energy;
+    Version version;
+    char loaded[MAX_LOAD][HISTORY_TEXT];
+    size_t loadedCount;
+    size_t batch;
+};
+typedef struct Command Command;
+
+/*
+ * Answer to a command: status and value printed on success, whether history is
+ * declared for VALID and VALID_AT, energy for ENERGY_SHORT and ENERGY_AT,
+ * version for SNAPSHOT, the aggregate for COUNT, SUM, MIN and MAX, 0 otherwise
+ */
+struct Answer
+{
+    int status;
+    EnergySum value;
+};
+typedef struct Answer Answer;
+
+/*
+ * Configuration of the library compared with the model. Engine with "shards"
+ * runs text of the stream with runShardedCommands, "replicated" one runs it
+ * through primary, whose replica must end with the same histories. Both answer
+ * with text, so only whether command failed is compared, not its status.
+ */
+struct Engine
+{
+    const char *name;
+    bool indexed;
+    size_t memoryLimit;
+    bool defragmented;
+    bool tiered;
+    unsigned shards;
+    bool replicated;
+};
+typedef struct Engine Engine;
+
+/*
+ * Declared history of the model with its energy, 0 if it has none
+ */
+struct Entry
+{
+    char history[HISTORY_TEXT];
+    Energy energy;
+};
+typedef struct Entry Entry;
+
+/*
+ * Equality added with EQUAL, histories are equal when they are connected by
+ * a path of those
+ */
+struct Equality
+{
+    char first[HISTORY_TEXT];
+    char second[HISTORY_TEXT];
+};
+typedef struct Equality Equality;
+
+/*
+ * Histories of the model, kept in plain arrays searched from start to end
+ */
+struct Histories
+{
+    Entry *entries;
+    size_t entriesCount;
+    Equality *equalities;
+    size_t equalitiesCount;
+};
+typedef struct Histories Histories;
+
+/*
+ * Snapshot of the model, copy of histories taken by SNAPSHOT
+ */
+struct Snapshot
+{
+    Histories histories;
+    bool released;
+};
+typedef struct Snapshot Snapshot;
+
+/*
+ * The model: current histories and, while transaction is open, copy of them
+ * from before it, restored by ROLLBACK or COMMIT of transaction that failed.
+ * Snapshot with version i is at position i - 1 of "snapshots".
+ */
+struct Model
+{
+    Histories current;
+    Histories saved;
+    bool inTransaction;
+    bool aborted;
+    bool frozen;
+    Snapshot *snapshots;
+    size_t snapshotsCount;
+};
+typedef struct Model Model;
+
+/*
+ * Primary of the replicated engine, run by its own thread, as it waits for
+ * replica to connect
+ */
+struct PrimaryRun
+{
+    Quantization *quantization;
+    const char *path;
+    FILE *input;
+    FILE *output;
+};
+typedef struct PrimaryRun PrimaryRun;
+
+/*
+ * Replica of the replicated engine, answering "queries" to "replies" from
+ * its own thread
+ */
+struct ReplicaRun
+{
+    Quantization *quantization;
+    const char *path;
+    FILE *queries;
+    FILE *replies;
+};
+typedef struct ReplicaRun ReplicaRun;
+
+/*
+ * Operations commands are drawn from, with number of commands of each of them
+ * per thousand in ordinary and in dense streams
+ */
+static const int OPERATIONS[MIXED_OPERATIONS] = {
+        DECLARE, REMOVE, VALID, ENERGY, ENERGY_SHORT, EQUAL, BEGIN, COMMIT,
+        ROLLBACK, SNAPSHOT, RELEASE, VALID_AT, ENERGY_AT, COMPACT, COUNT, SUM,
+        MIN, MAX, LOAD,
+};
+static const unsigned ORDINARY_MIX[MIXED_OPERATIONS] = {
+        230, 50, 180, 140, 150, 120, 20, 20, 10, 5, 5, 10, 10, 2, 8, 8, 8, 8,
+        16,
+};
+static const unsigned DENSE_MIX[MIXED_OPERATIONS] = {
+        120, 10, 50, 100, 100, 560, 20, 10, 10, 2, 2, 3, 3, 0, 2, 2, 2, 2, 2,
+};
+
+static const Engine ENGINES[ENGINES_COUNT] = {
+        {"tree", false, 0, false, false, 0, false},
+        {"indexed", true, 0, false, false, 0, false},
+        {"limited", false, SIZE_MAX, false, false, 0, false},
+        {"defragmented", false, 0, true, false, 0, false},
+        {"tiered", true, 0, false, true, 0, false},
+        {"sharded", false, 0, false, false, SHARDS_COUNT, false},
+        {"replicated", false, 0, false, false, 0, true},
+};
+
+/*
+ * State of random number generator of the current stream
+ */
+static uint64_t randomState;
+
+/*
+ * Engine run at the moment, watched by watchBudget, with stream it runs, or
+ * NULL between runs. "progress" counts commands it finished, "watchedInput"
+ * is text of the stream it reads, if it does, whose position tells its
+ * progress too.
+ */
+static const Engine *watchedEngine;
+static uint64_t watchedSeed;
+static FILE *watchedInput;
+static pthread_mutex_t watchedLock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t progress;
+
+/*
+ * Returns next random number, xorshift, so that a stream depends only on its
+ * seed
+ */
+static uint64_t nextRandom(void);
+
+/*
+ * Returns random number from 0 to limit - 1
+ */
+static unsigned randomBelow(unsigned limit);
+
+/*
+ * Fills "commands" with random stream made from given seed
+ */
+static void generateStream(uint64_t seed, Command *commands, size_t count);
+
+/*
+ * Returns random operation, drawn with frequencies of given mix
+ */
+static int pickOperation(const unsigned *mix);
+
+/*
+ * Stores in "history" random prefix of random history from first "size" ones
+ * of the pool
+ */
+static void pickHistory(char pool[POOL_SIZE][HISTORY_TEXT], size_t size,
+                        char *history);
+
+/*
+ * Prints command as it is written for the program. LOAD names "loadPath", or
+ * lists its histories if it is NULL.
+ */
+static void printCommand(FILE *output, const Command *command,
+                         const char *loadPath);
+
+/*
+ * Writes text of the stream to "output", together with files of its LOAD
+ * commands
+ */
+static void writeStream(FILE *output, uint64_t seed, const Command *commands,
+                        size_t count);
+
+/*
+ * Removes files of LOAD commands made by writeStream
+ */
+static void removeLoadFiles(uint64_t seed, const Command *commands,
+                            size_t count);
+
+/*
+ * Stores in "path" path of file with histories of LOAD at given position of
+ * the stream
+ */
+static void loadPath(char *path, uint64_t seed, size_t position);
+
+/*
+ * Runs commands through the model, storing its answers and committed
+ * histories it ends with in "final"
+ */
+static void runModel(const Command *commands, size_t count, Answer *answers,
+                     Histories *final);
+
+/*
+ * Runs commands through the library configured as given engine, storing its
+ * answers. Returns false if engine ended with histories other than "final",
+ * which only replicated engine checks, after reporting it.
+ */
+static bool runEngine(const Engine *engine, uint64_t seed,
+                      const Command *commands, size_t count, Answer *answers,
+                      const Histories *final);
+
+/*
+ * Runs single command, which is not in a batch, through the library
+ */
+static Answer engineCommand(Quantization *quantization,
+                            const Command *command);
+
+/*
+ * Runs batch starting with given command through the library, storing answer
+ * to each of its commands
+ */
+static void engineBatch(Quantization *quantization, const Command *commands,
+                        Answer *answers);
+
+/*
+ * Runs text of the stream through sharded engine
+ */
+static void runSharded(const Engine *engine, uint64_t seed,
+                       const Command *commands, size_t count,
+                       Answer *answers);
+
+/*
+ * Runs text of the stream through primary, with replica following it. Returns
+ * false if replica did not end with "final" histories.
+ */
+static bool runReplicated(uint64_t seed, const Command *commands, size_t count,
+                          Answer *answers, const Histories *final);
+
+/*
+ * Thread body, runs primary, see PrimaryRun
+ */
+static void *runPrimary(void *argument);
+
+/*
+ * Thread body, runs replica, see ReplicaRun
+ */
+static void *runReplicaThread(void *argument);
+
+/*
+ * Passes update to primaryRecord, counting finished command
+ */
+static void recordUpdate(void *context, int operation, const char *argument1,
+                         const char *argument2, int status);
+
+/*
+ * Asks replica about every history of "final", until it answers like the
+ * model or REPLICA_BUDGET_MS pass. Returns false if it did not, after
+ * reporting the first wrong answer.
+ */
+static bool checkReplica(uint64_t seed, FILE *queries, FILE *replies,
+                         const Histories *final);
+
+/*
+ * Reads answers of text engine to commands from "output"
+ */
+static void readAnswers(FILE *output, size_t count, Answer *answers);
+
+/*
+ * Returns answer printed by text engine in given line
+ */
+static Answer parseAnswer(const char *line);
+
+/*
+ * Returns answer of the model to single command
+ */
+static Answer modelCommand(Model *model, const Command *command);
+
+/*
+ * Returns whether command updates histories, so that its failure makes
+ * transaction fail
+ */
+static bool isUpdate(int operation);
+
+/*
+ * Returns snapshot of the model with given version, or NULL if there is none
+ */
+static const Histories *findSnapshot(const Model *model, Version version);
+
+/*
+ * Returns position of history in entries, or -1 if it is not declared
+ */
+static ptrdiff_t findEntry(const Histories *histories, const char *history);
+
+/*
+ * Declares history and all its prefixes
+ */
+static void declareEntry(Histories *histories, const char *history);
+
+/*
+ * Adds history with no energy to entries
+ */
+static void addEntry(Histories *histories, const char *history);
+
+/*
+ * Adds equality of two histories
+ */
+static void addEquality(Histories *histories, const char *first,
+                        const char *second);
+
+/*
+ * Returns whether history starts with given prefix
+ */
+static bool startsWith(const char *history, const char *prefix);
+
+/*
+ * Stores in "answer" COUNT, SUM, MIN or MAX of history and histories it is
+ * prefix of
+ */
+static void aggregateEntries(const Histories *histories, int operation,
+                             const char *history, Answer *answer);
+
+/*
+ * Assigns energy to declared history and every history equal to it, found by
+ * following equalities one by one
+ */
+static void spreadEnergy(Histories *histories, const char *history,
+                         Energy energy);
+
+/*
+ * Returns copy of histories
+ */
+static Histories copyHistories(const Histories *histories);
+
+/*
+ * Releases arrays of histories
+ */
+static void freeHistories(Histories *histories);
+
+/*
+ * Allocates memory, exits if there is none
+ */
+static void *allocate(void *memory, size_t size);
+
+/*
+ * Returns whether answers are the same. Text engine tells only that command
+ * failed, so any failure matches it.
+ */
+static bool sameAnswer(Answer expected, Answer answer, bool text);
+
+/*
+ * Prints answer the way the program would, status for errors
+ */
+static void printAnswer(FILE *output, Answer answer);
+
+/*
+ * Prints value of answer in decimal
+ */
+static void printValue(FILE *output, EnergySum value);
+
+/*
+ * Starts watching given engine running stream of given seed, reading "input"
+ * if it is not NULL, or stops watching if engine is NULL
+ */
+static void watchEngine(const Engine *engine, uint64_t seed, FILE *input);
+
+/*
+ * Thread body, ends the test as failed when engine being run makes no progress
+ * for COMMAND_BUDGET_MS
+ */
+static void *watchBudget(void *argument);
+
+/*
+ * Sleeps given number of milliseconds
+ */
+static void sleepMilliseconds(unsigned milliseconds);
+
+/*
+ * Returns time in seconds from arbitrary point
+ */
+static double now(void);
+
+static uint64_t nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static unsigned randomBelow(unsigned limit)
+{
+    return (unsigned) (nextRandom() % limit);
+}
+
+static void generateStream(uint64_t seed, Command *commands, size_t count)
+{
+    static char pool[POOL_SIZE][HISTORY_TEXT];
+
+    randomState = seed * 0x9E3779B97F4A7C15ULL + 1;
+    bool dense = seed % DENSE_PERIOD == 0;
+    bool freezing = seed % FREEZE_PERIOD == FREEZE_PHASE;
+    bool snapshots = seed % SNAPSHOT_PERIOD == 0;
+    size_t poolSize = dense ? DENSE_POOL_SIZE : POOL_SIZE;
+    unsigned longest = dense ? DENSE_LENGTH :
+                       2 + randomBelow(MAX_LENGTH - 1);
+    unsigned snapshotsTaken = 0;
+
+    for (size_t i = 0; i < poolSize; ++i)
+    {
+        unsigned length = 1 + randomBelow(longest);
+        for (unsigned j = 0; j < length; ++j)
+        {
+            unsigned state = randomBelow(STATES);
+#if SYMBOL_WIDTH == 1
+            pool[i][j] = SYMBOL_ALPHABET[state];
+#else
+            pool[i][2 * j] = SYMBOL_ALPHABET[state / 16];
+            pool[i][2 * j + 1] = SYMBOL_ALPHABET[state % 16];
+#endif
+        }
+        pool[i][length * SYMBOL_WIDTH] = '\0';
+    }
+
+    size_t batched = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Command *command = &commands[i];
+
+        // commands of a batch all have operation of the first one
+        command->operation = batched > 0 ? command[-1].operation :
+                             pickOperation(dense ? DENSE_MIX : ORDINARY_MIX);
+        if (command->operation == SNAPSHOT && !snapshots)
+            command->operation = COMPACT;
+        if (freezing && batched == 0 && i >= count / 4 * 3)
+        {
+            command->operation = FREEZE;
+            freezing = false;
+        }
+
+        command->batch = 0;
+        if (batched > 0) --batched;
+        else if ((command->operation == EQUAL ||
+                  command->operation == ENERGY) &&
+                 randomBelow(BATCH_PERIOD) == 0)
+        {
+            command->batch = 1 + randomBelow(MAX_BATCH);
+            if (command->batch > count - i) command->batch = count - i;
+            batched = command->batch - 1;
+        }
+
+        pickHistory(pool, poolSize, command->history);
+        command->other[0] = '\0';
+        command->energy = 0;
+        command->version = 0;
+        command->loadedCount = 0;
+
+        if (command->operation == EQUAL)
+            pickHistory(pool, poolSize, command->other);
+
+        // large energies check that averages and sums do not overflow
+        if (command->operation == ENERGY)
+        {
+            command->energy = randomBelow(10) == 0 ? nextRandom() :
+                              1 + randomBelow(1000);
+            if (command->energy == 0) command->energy = 1;
+        }
+
+        // versions are those taken if every SNAPSHOT succeeds, and one more
+        if (command->operation == SNAPSHOT) ++snapshotsTaken;
+        if (command->operation == RELEASE ||
+            command->operation == VALID_AT || command->operation == ENERGY_AT)
+            command->version = 1 + randomBelow(snapshotsTaken + 1);
+
+        if (command->operation == LOAD)
+        {
+            command->loadedCount = 1 + randomBelow(MAX_LOAD);
+            for (size_t j = 0; j < command->loadedCount; ++j)
+            {
+                pickHistory(pool, poolSize, command->loaded[j]);
+            }
+            if (randomBelow(LOAD_MALFORMED_PERIOD) == 0)
+                strcpy(command->loaded[command->loadedCount - 1],
+                       MALFORMED_HISTORY);
+        }
+    }
+}
+
+static int pickOperation(const unsigned *mix)
+{
+    unsigned kind = randomBelow(1000);
+
+    int operation = 0;
+    for (; operation < MIXED_OPERATIONS - 1 && kind >= mix[operation];
+         ++operation)
+    {
+        kind -= mix[operation];
+    }
+
+    return OPERATIONS[operation];
+}
+
+static void pickHistory(char pool[POOL_SIZE][HISTORY_TEXT], size_t size,
+                        char *history)
+{
+    const char *chosen = pool[randomBelow(size)];
+    size_t length = 1 + randomBelow(strlen(chosen) / SYMBOL_WIDTH);
+
+    memcpy(history, chosen, length * SYMBOL_WIDTH);
+    history[length * SYMBOL_WIDTH] = '\0';
+}
+
+static void printCommand(FILE *output, const Command *command,
+                         const char *loadPath)
+{
+    // commands of a batch are printed one by one, which has the same outcome
+    switch (command->operation)
+    {
+        case DECLARE:
+            fprintf(output, "DECLARE %s\n", command->history);
+            break;
+        case REMOVE:
+            fprintf(output, "REMOVE %s\n", command->history);
+            break;
+        case VALID:
+            fprintf(output, "VALID %s\n", command->history);
+            break;
+        case ENERGY:
+            fprintf(output, "ENERGY %s %" PRIu64 "\n", command->history,
+                    command->energy);
+            break;
+        case ENERGY_SHORT:
+            fprintf(output, "ENERGY %s\n", command->history);
+            break;
+        case EQUAL:
+            fprintf(output, "EQUAL %s %s\n", command->history,
+                    command->other);
+            break;
+        case BEGIN:
+            fprintf(output, "BEGIN\n");
+            break;
+        case COMMIT:
+            fprintf(output, "COMMIT\n");
+            break;
+        case ROLLBACK:
+            fprintf(output, "ROLLBACK\n");
+            break;
+        case SNAPSHOT:
+            fprintf(output, "SNAPSHOT\n");
+            break;
+        case RELEASE:
+            fprintf(output, "RELEASE %" PRIu64 "\n", command->version);
+            break;
+        case VALID_AT:
+            fprintf(output, "VALID_AT %" PRIu64 " %s\n", command->version,
+                    command->history);
+            break;
+        case ENERGY_AT:
+            fprintf(output, "ENERGY_AT %" PRIu64 " %s\n", command->version,
+                    command->history);
+            break;
+        case FREEZE:
+            fprintf(output, "FREEZE\n");
+            break;
+        case COMPACT:
+            fprintf(output, "COMPACT\n");
+            break;
+        case COUNT:
+            fprintf(output, "COUNT %s\n", command->history);
+            break;
+        case SUM:
+            fprintf(output, "SUM %s\n", command->history);
+            break;
+        case MIN:
+            fprintf(output, "MIN %s\n", command->history);
+            break;
+        case MAX:
+            fprintf(output, "MAX %s\n", command->history);
+            break;
+        default:
+            if (loadPath != NULL)
+            {
+                fprintf(output, "LOAD %s\n", loadPath);
+                break;
+            }
+
+            fprintf(output, "LOAD");
+            for (size_t i = 0; i < command->loadedCount; ++i)
+            {
+                fprintf(output, " %s", command->loaded[i]);
+            }
+            fprintf(output, "\n");
+            break;
+    }
+}
+
+static void writeStream(FILE *output, uint64_t seed, const Command *commands,
+                        size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (commands[i].operation != LOAD)
+        {
+            printCommand(output, &commands[i], NULL);
+            continue;
+        }
+
+        char path[PATH_TEXT];
+        loadPath(path, seed, i);
+
+        FILE *file = fopen(path, "w");
+        if (file == NULL)
+        {
+            fprintf(stderr, "Cannot write %s\n", path);
+            exit(1);
+        }
+        for (size_t j = 0; j < commands[i].loadedCount; ++j)
+        {
+            fprintf(file, "%s\n", commands[i].loaded[j]);
+        }
+        fclose(file);
+
+        printCommand(output, &commands[i], path);
+    }
+}
+
+static void removeLoadFiles(uint64_t seed, const Command *commands,
+                            size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (commands[i].operation != LOAD) continue;
+
+        char path[PATH_TEXT];
+        loadPath(path, seed, i);
+        unlink(path);
+    }
+}
+
+static void loadPath(char *path, uint64_t seed, size_t position)
+{
+    snprintf(path, PATH_TEXT, "/tmp/differential-%ld-%" PRIu64 "-%zu.load",
+             (long) getpid(), seed, position);
+}
+
+static void runModel(const Command *commands, size_t count, Answer *answers,
+                     Histories *final)
+{
+    Model model;
+    memset(&model, 0, sizeof(model));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        answers[i] = modelCommand(&model, &commands[i]);
+    }
+
+    // updates of transaction left open are never committed
+    *final = copyHistories(model.inTransaction ? &model.saved :
+                           &model.current);
+
+    freeHistories(&model.current);
+    freeHistories(&model.saved);
+    for (size_t i = 0; i < model.snapshotsCount; ++i)
+    {
+        freeHistories(&model.snapshots[i].histories);
+    }
+    free(model.snapshots);
+}
+
+static bool runEngine(const Engine *engine, uint64_t seed,
+                      const Command *commands, size_t count, Answer *answers,
+                      const Histories *final)
+{
+    if (engine->shards > 0)
+    {
+        runSharded(engine, seed, commands, count, answers);
+        return true;
+    }
+    if (engine->replicated)
+        return runReplicated(seed, commands, count, answers, final);
+
+    // spill file is removed as soon as it is created, so the name is free
+    // again for the next stream
+    char spillPath[PATH_TEXT];
+    snprintf(spillPath, sizeof(spillPath), "/tmp/differential-%ld.spill",
+             (long) getpid());
+
+    Quantization *quantization = quantCreate();
+    if (quantization == NULL ||
+        (engine->indexed && quantSetIndex(quantization, true) != QUANT_OK) ||
+        (engine->memoryLimit != 0 &&
+         quantSetMemoryLimit(quantization, engine->memoryLimit) != QUANT_OK) ||
+        (engine->tiered &&
+         quantSetTiering(quantization, spillPath, 0) != QUANT_OK))
+    {
+        fprintf(stderr, "Cannot set up engine %s\n", engine->name);
+        exit(1);
+    }
+
+    watchEngine(engine, seed, NULL);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (commands[i].batch > 0)
+        {
+            engineBatch(quantization, &commands[i], &answers[i]);
+            i += commands[i].batch - 1;
+        }
+        else
+        {
+            answers[i] = engineCommand(quantization, &commands[i]);
+        }
+        atomic_store(&progress, i + 1);
+
+        if (engine->defragmented && i % DEFRAGMENT_PERIOD == 0)
+            quantDefragment(quantization);
+        if (engine->defragmented || engine->tiered)
+            quantMaintain(quantization);
+    }
+    watchEngine(NULL, 0, NULL);
+
+    quantDestroy(quantization);
+    return true;
+}
+
+static Answer engineCommand(Quantization *quantization,
+                            const Command *command)
+{
+    Answer answer = {QUANT_OK, 0};
+    bool valid = false;
+    Energy energy = 0;
+    Version version = 0;
+    Aggregate aggregate;
+    const char *loaded[MAX_LOAD];
+
+    switch (command->operation)
+    {
+        case DECLARE:
+            answer.status = quantDeclare(quantization, command->history);
+            break;
+        case REMOVE:
+            answer.status = quantRemove(quantization, command->history);
+            break;
+        case VALID:
+            answer.status = quantValid(quantization, command->history,
+                                       &valid);
+            answer.value = valid;
+            break;
+        case ENERGY:
+            answer.status = quantSetEnergy(quantization, command->history,
+                                           command->energy);
+            break;
+        case ENERGY_SHORT:
+            answer.status = quantGetEnergy(quantization, command->history,
+                                           &energy);
+            answer.value = energy;
+            break;
+        case EQUAL:
+            answer.status = quantEqual(quantization, command->history,
+                                       command->other);
+            break;
+        case BEGIN:
+            answer.status = quantBegin(quantization);
+            break;
+        case COMMIT:
+            answer.status = quantCommit(quantization);
+            break;
+        case ROLLBACK:
+            answer.status = quantRollback(quantization);
+            break;
+        case SNAPSHOT:
+            answer.status = quantSnapshot(quantization, &version);
+            answer.value = version;
+            break;
+        case RELEASE:
+            answer.status = quantRelease(quantization, command->version);
+            break;
+        case VALID_AT:
+            answer.status = quantValidAt(quantization, command->version,
+                                         command->history, &valid);
+            answer.value = valid;
+            break;
+        case ENERGY_AT:
+            answer.status = quantGetEnergyAt(quantization, command->version,
+                                             command->history, &energy);
+            answer.value = energy;
+            break;
+        case FREEZE:
+            answer.status = quantFreeze(quantization);
+            break;
+        case COMPACT:
+            answer.status = quantCompact(quantization);
+            break;
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            answer.status = quantAggregate(quantization, command->history,
+                                           &aggregate);
+            answer.value = command->operation == COUNT ? aggregate.count :
+                           command->operation == SUM ? aggregate.energySum :
+                           command->operation == MIN ? aggregate.minEnergy :
+                           aggregate.maxEnergy;
+
+            // the program reports smallest and largest of no energies as
+            // error
+            if (answer.value == 0 &&
+                (command->operation == MIN || command->operation == MAX))
+                answer.status = QUANT_ERROR;
+            break;
+        default:
+            for (size_t i = 0; i < command->loadedCount; ++i)
+            {
+                loaded[i] = command->loaded[i];
+            }
+            answer.status = quantLoad(quantization, loaded,
+                                      command->loadedCount);
+            break;
+    }
+
+    if (answer.status != QUANT_OK) answer.value = 0;
+    return answer;
+}
+
+static void engineBatch(Quantization *quantization, const Command *commands,
+                        Answer *answers)
+{
+    size_t count = commands[0].batch;
+    const char *histories[MAX_BATCH];
+    const char *others[MAX_BATCH];
+    Energy energies[MAX_BATCH];
+    int statuses[MAX_BATCH];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        histories[i] = commands[i].history;
+        others[i] = commands[i].other;
+        energies[i] = commands[i].energy;
+    }
+
+    int status = commands[0].operation == EQUAL ?
+                 quantEqualBatch(quantization, histories, others, count,
+                                 statuses) :
+                 quantEnergyBatch(quantization, histories, energies, count,
+                                  statuses);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        answers[i].status = status != QUANT_OK ? status : statuses[i];
+        answers[i].value = 0;
+    }
+}
+
+static void runSharded(const Engine *engine, uint64_t seed,
+                       const Command *commands, size_t count,
+                       Answer *answers)
+{
+    FILE *input = tmpfile();
+    FILE *output = tmpfile();
+    if (input == NULL || output == NULL)
+    {
+        fprintf(stderr, "Cannot set up engine %s\n", engine->name);
+        exit(1);
+    }
+
+    writeStream(input, seed, commands, count);
+    rewind(input);
+
+    // answers and errors are printed in order to the same file
+    watchEngine(engine, seed, input);
+    runShardedCommands(engine->shards, SHARD_DEPTH_AUTO, NULL, input, output,
+                       output);
+    watchEngine(NULL, 0, NULL);
+
+    readAnswers(output, count, answers);
+    removeLoadFiles(seed, commands, count);
+    fclose(input);
+    fclose(output);
+}
+
+static bool runReplicated(uint64_t seed, const Command *commands, size_t count,
+                          Answer *answers, const Histories *final)
+{
+    char socketPath[PATH_TEXT];
+    snprintf(socketPath, sizeof(socketPath), "/tmp/differential-%ld.socket",
+             (long) getpid());
+
+    int queries[2];
+    int replies[2];
+    PrimaryRun primary = {quantCreate(), socketPath, tmpfile(), tmpfile()};
+    ReplicaRun replica = {quantCreate(), socketPath, NULL, NULL};
+    FILE *asked = NULL;
+    FILE *answered = NULL;
+
+    if (primary.quantization == NULL || primary.input == NULL ||
+        primary.output == NULL || replica.quantization == NULL ||
+        pipe(queries) != 0 || pipe(replies) != 0 ||
+        (replica.queries = fdopen(queries[0], "r")) == NULL ||
+        (replica.replies = fdopen(replies[1], "w")) == NULL ||
+        (asked = fdopen(queries[1], "w")) == NULL ||
+        (answered = fdopen(replies[0], "r")) == NULL)
+    {
+        fprintf(stderr, "Cannot set up engine replicated\n");
+        exit(1);
+    }
+
+    // replies are read one by one, as soon as they are printed
+    setvbuf(replica.replies, NULL, _IOLBF, 0);
+
+    writeStream(primary.input, seed, commands, count);
+    rewind(primary.input);
+
+    pthread_t primaryThread;
+    pthread_t replicaThread;
+    if (pthread_create(&primaryThread, NULL, runPrimary, &primary) != 0 ||
+        pthread_create(&replicaThread, NULL, runReplicaThread, &replica) != 0)
+    {
+        fprintf(stderr, "Cannot set up engine replicated\n");
+        exit(1);
+    }
+
+    watchEngine(&ENGINES[ENGINES_COUNT - 1], seed, NULL);
+    pthread_join(primaryThread, NULL);
+    bool same = checkReplica(seed, asked, answered, final);
+    watchEngine(NULL, 0, NULL);
+
+    // replica ends at the end of its queries
+    fclose(asked);
+    pthread_join(replicaThread, NULL);
+
+    readAnswers(primary.output, count, answers);
+    removeLoadFiles(seed, commands, count);
+    fclose(answered);
+    fclose(primary.input);
+    fclose(primary.output);
+    quantDestroy(primary.quantization);
+    quantDestroy(replica.quantization);
+    return same;
+}
+
+static void *runPrimary(void *argument)
+{
+    PrimaryRun *run = argument;
+
+    Primary *primary = primaryCreate(run->path, 1);
+    if (primary == NULL)
+    {
+        fprintf(stderr, "Cannot listen for replica at %s\n", run->path);
+        exit(1);
+    }
+
+    runLoggedCommands(run->quantization, run->input, run->output, run->output,
+                      recordUpdate, primary);
+    primaryDestroy(primary);
+    return NULL;
+}
+
+static void *runReplicaThread(void *argument)
+{
+    ReplicaRun *run = argument;
+
+    runReplica(run->quantization, run->path, run->queries, run->replies,
+               run->replies);
+    fclose(run->queries);
+    fclose(run->replies);
+    return NULL;
+}
+
+static void recordUpdate(void *context, int operation, const char *argument1,
+                         const char *argument2, int status)
+{
+    atomic_fetch_add(&progress, 1);
+    primaryRecord(context, operation, argument1, argument2, status);
+}
+
+static bool checkReplica(uint64_t seed, FILE *queries, FILE *replies,
+                         const Histories *final)
+{
+    // every history is checked, and COUNT and SUM of every state catch
+    // histories and energies replica has but should not
+    size_t checksCount = 2 * final->entriesCount + 2 * STATES;
+    Command *checks = allocate(NULL, checksCount * sizeof(Command));
+    Answer *expected = allocate(NULL, checksCount * sizeof(Answer));
+    Model model;
+    memset(&model, 0, sizeof(model));
+    model.current = *final;
+
+    for (size_t i = 0; i < checksCount; ++i)
+    {
+        Command *check = &checks[i];
+        memset(check, 0, sizeof(Command));
+
+        if (i < 2 * final->entriesCount)
+        {
+            check->operation = i % 2 == 0 ? VALID : ENERGY_SHORT;
+            strcpy(check->history, final->entries[i / 2].history);
+        }
+        else
+        {
+            unsigned state = (unsigned) (i - 2 * final->entriesCount) / 2;
+            check->operation = i % 2 == 0 ? COUNT : SUM;
+#if SYMBOL_WIDTH == 1
+            check->history[0] = SYMBOL_ALPHABET[state];
+#else
+            check->history[0] = SYMBOL_ALPHABET[state / 16];
+            check->history[1] = SYMBOL_ALPHABET[state % 16];
+#endif
+        }
+
+        expected[i] = modelCommand(&model, check);
+    }
+
+    // replica applies updates after primary is done with them
+    double deadline = now() + REPLICA_BUDGET_MS / 1000.0;
+    size_t wrong = 0;
+    Answer answer = {QUANT_OK, 0};
+    char line[CHAR_BUFFER];
+
+    do
+    {
+        for (wrong = 0; wrong < checksCount; ++wrong)
+        {
+            printCommand(queries, &checks[wrong], NULL);
+            fflush(queries);
+            answer = fgets(line, sizeof(line), replies) == NULL ?
+                     (Answer) {NO_ANSWER, 0} : parseAnswer(line);
+            atomic_fetch_add(&progress, 1);
+
+            if (!sameAnswer(expected[wrong], answer, true)) break;
+        }
+        if (wrong < checksCount) sleepMilliseconds(REPLICA_RETRY_MS);
+    } while (wrong < checksCount && answer.status != NO_ANSWER &&
+             now() < deadline);
+
+    if (wrong < checksCount)
+    {
+        printf("stream %" PRIu64 ", replicated: replica after the stream: ",
+               seed);
+        printCommand(stdout, &checks[wrong], NULL);
+        printf("    expected ");
+        printAnswer(stdout, expected[wrong]);
+        printf(", got ");
+        printAnswer(stdout, answer);
+        printf("\n");
+    }
+
+    free(checks);
+    free(expected);
+    return wrong == checksCount;
+}
+
+static void readAnswers(FILE *output, size_t count, Answer *answers)
+{
+    char line[CHAR_BUFFER];
+    rewind(output);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        answers[i] = fgets(line, sizeof(line), output) == NULL ?
+                     (Answer) {NO_ANSWER, 0} : parseAnswer(line);
+    }
+}
+
+static Answer parseAnswer(const char *line)
+{
+    Answer answer = {QUANT_OK, 0};
+
+    // OK and NO leave value 0
+    if (strncmp(line, "ERROR", strlen("ERROR")) == 0)
+        answer.status = QUANT_ERROR;
+    else if (strncmp(line, "YES", strlen("YES")) == 0)
+        answer.value = 1;
+
+    for (const char *digit = line; *digit >= '0' && *digit <= '9'; ++digit)
+    {
+        answer.value = answer.value * 10 + (EnergySum) (*digit - '0');
+    }
+
+    return answer;
+}
+
+static Answer modelCommand(Model *model, const Command *command)
+{
+    Histories *histories = &model->current;
+    const Histories *snapshot = NULL;
+    Answer answer = {QUANT_OK, 0};
+    ptrdiff_t found = findEntry(histories, command->history);
+    ptrdiff_t other = -1;
+
+    // malformed histories are reported before anything else
+    for (size_t i = 0; i < command->loadedCount; ++i)
+    {
+        if (strcmp(command->loaded[i], MALFORMED_HISTORY) == 0)
+            answer.status = QUANT_INVALID_ARGUMENT;
+    }
+
+    // frozen histories only answer queries
+    if (answer.status == QUANT_OK && model->frozen &&
+        (isUpdate(command->operation) || command->operation == BEGIN ||
+         command->operation == SNAPSHOT))
+        return (Answer) {QUANT_ERROR, 0};
+
+    switch (command->operation)
+    {
+        case DECLARE:
+            declareEntry(histories, command->history);
+            break;
+        case REMOVE:
+        {
+            size_t kept = 0;
+            for (size_t i = 0; i < histories->entriesCount; ++i)
+            {
+                if (!startsWith(histories->entries[i].history,
+                                command->history))
+                    histories->entries[kept++] = histories->entries[i];
+            }
+            histories->entriesCount = kept;
+
+            kept = 0;
+            for (size_t i = 0; i < histories->equalitiesCount; ++i)
+            {
+                const Equality *equality = &histories->equalities[i];
+                if (!startsWith(equality->first, command->history) &&
+                    !startsWith(equality->second, command->history))
+                    histories->equalities[kept++] = *equality;
+            }
+            histories->equalitiesCount = kept;
+            break;
+        }
+        case VALID:
+            answer.value = found >= 0;
+            break;
+        case ENERGY:
+            if (found < 0) answer.status = QUANT_ERROR;
+            else spreadEnergy(histories, command->history, command->energy);
+            break;
+        case ENERGY_SHORT:
+            if (found < 0 || histories->entries[found].energy == 0)
+                answer.status = QUANT_ERROR;
+            else
+                answer.value = histories->entries[found].energy;
+            break;
+        case EQUAL:
+        {
+            other = findEntry(histories, command->other);
+            if (found < 0 || other < 0)
+            {
+                answer.status = QUANT_ERROR;
+                break;
+            }
+            if (found == other) break;
+
+            bool known = false;
+            for (size_t i = 0; i < histories->equalitiesCount && !known; ++i)
+            {
+                const Equality *equality = &histories->equalities[i];
+                known = (strcmp(equality->first, command->history) == 0 &&
+                         strcmp(equality->second, command->other) == 0) ||
+                        (strcmp(equality->first, command->other) == 0 &&
+                         strcmp(equality->second, command->history) == 0);
+            }
+            if (known) break;
+
+            Energy first = histories->entries[found].energy;
+            Energy second = histories->entries[other].energy;
+            if (first == 0 && second == 0)
+            {
+                answer.status = QUANT_ERROR;
+                break;
+            }
+
+            Energy energy = first == 0 ? second : second == 0 ? first :
+                            first / 2 + second / 2 +
+                            (first % 2 + second % 2) / 2;
+            addEquality(histories, command->history, command->other);
+            spreadEnergy(histories, command->history, energy);
+            break;
+        }
+        case BEGIN:
+            if (model->inTransaction)
+                return (Answer) {QUANT_ERROR, 0};
+
+            model->saved = copyHistories(histories);
+            model->inTransaction = true;
+            model->aborted = false;
+            return answer;
+        case COMMIT:
+        case ROLLBACK:
+            if (!model->inTransaction)
+                return (Answer) {QUANT_ERROR, 0};
+
+            if (command->operation == ROLLBACK || model->aborted)
+            {
+                freeHistories(histories);
+                *histories = model->saved;
+            }
+            else
+            {
+                freeHistories(&model->saved);
+            }
+            memset(&model->saved, 0, sizeof(model->saved));
+
+            if (command->operation == COMMIT && model->aborted)
+                answer.status = QUANT_ERROR;
+            model->inTransaction = false;
+            model->aborted = false;
+            return answer;
+        case SNAPSHOT:
+            if (model->inTransaction) return (Answer) {QUANT_ERROR, 0};
+
+            model->snapshots = allocate(model->snapshots,
+                                        (model->snapshotsCount + 1) *
+                                        sizeof(Snapshot));
+            model->snapshots[model->snapshotsCount].histories =
+                    copyHistories(histories);
+            model->snapshots[model->snapshotsCount].released = false;
+            answer.value = ++model->snapshotsCount;
+            break;
+        case RELEASE:
+            if (findSnapshot(model, command->version) == NULL)
+                return (Answer) {QUANT_ERROR, 0};
+
+            model->snapshots[command->version - 1].released = true;
+            freeHistories(&model->snapshots[command->version - 1].histories);
+            break;
+        case VALID_AT:
+        case ENERGY_AT:
+            snapshot = findSnapshot(model, command->version);
+            if (snapshot == NULL) return (Answer) {QUANT_ERROR, 0};
+
+            found = findEntry(snapshot, command->history);
+            if (command->operation == VALID_AT)
+                answer.value = found >= 0;
+            else if (found < 0 || snapshot->entries[found].energy == 0)
+                answer.status = QUANT_ERROR;
+            else
+                answer.value = snapshot->entries[found].energy;
+            break;
+        case FREEZE:
+        case COMPACT:
+        {
+            bool held = false;
+            for (size_t i = 0; i < model->snapshotsCount; ++i)
+            {
+                held = held || !model->snapshots[i].released;
+            }
+            if (model->inTransaction || model->frozen || held)
+                return (Answer) {QUANT_ERROR, 0};
+
+            // frozen histories drop equalities, but keep energies
+            if (command->operation == FREEZE)
+            {
+                model->frozen = true;
+                histories->equalitiesCount = 0;
+            }
+            break;
+        }
+        case COUNT:
+        case SUM:
+        case MIN:
+        case MAX:
+            if (found < 0) answer.status = QUANT_ERROR;
+            else aggregateEntries(histories, command->operation,
+                                  command->history, &answer);
+            break;
+        case LOAD:
+            for (size_t i = 0; i < command->loadedCount &&
+                               answer.status == QUANT_OK; ++i)
+            {
+                declareEntry(histories, command->loaded[i]);
+            }
+            break;
+    }
+
+    // only failed updates abort transaction, failed queries do not
+    if (answer.status != QUANT_OK && isUpdate(command->operation) &&
+        model->inTransaction)
+        model->aborted = true;
+
+    return answer;
+}
+
+static bool isUpdate(int operation)
+{
+    return operation == DECLARE || operation == REMOVE ||
+           operation == ENERGY || operation == EQUAL || operation == LOAD;
+}
+
+static const Histories *findSnapshot(const Model *model, Version version)
+{
+    if (version == 0 || version > model->snapshotsCount ||
+        model->snapshots[version - 1].released)
+        return NULL;
+
+    return &model->snapshots[version - 1].histories;
+}
+
+static ptrdiff_t findEntry(const Histories *histories, const char *history)
+{
+    for (size_t i = 0; i < histories->entriesCount; ++i)
+    {
+        if (strcmp(histories->entries[i].history, history) == 0)
+            return (ptrdiff_t) i;
+    }
+
+    return -1;
+}
+
+static void declareEntry(Histories *histories, const char *history)
+{
+    for (size_t length = SYMBOL_WIDTH; length <= strlen(history);
+         length += SYMBOL_WIDTH)
+    {
+        char prefix[HISTORY_TEXT];
+        memcpy(prefix, history, length);
+        prefix[length] = '\0';
+
+        if (findEntry(histories, prefix) < 0) addEntry(histories, prefix);
+    }
+}
+
+static void addEntry(Histories *histories, const char *history)
+{
+    histories->entries = allocate(histories->entries,
+                                  (histories->entriesCount + 1) *
+                                  sizeof(Entry));
+
+    Entry *entry = &histories->entries[histories->entriesCount++];
+    strcpy(entry->history, history);
+    entry->energy = 0;
+}
+
+static void addEquality(Histories *histories, const char *first,
+                        const char *second)
+{
+    histories->equalities = allocate(histories->equalities,
+                                     (histories->equalitiesCount + 1) *
+                                     sizeof(Equality));
+
+    Equality *equality = &histories->equalities[histories->equalitiesCount++];
+    strcpy(equality->first, first);
+    strcpy(equality->second, second);
+}
+
+static bool startsWith(const char *history, const char *prefix)
+{
+    return strncmp(history, prefix, strlen(prefix)) == 0;
+}
+
+static void aggregateEntries(const Histories *histories, int operation,
+                             const char *history, Answer *answer)
+{
+    uint64_t count = 0;
+    EnergySum sum = 0;
+    Energy smallest = 0;
+    Energy largest = 0;
+
+    for (size_t i = 0; i < histories->entriesCount; ++i)
+    {
+        const Entry *entry = &histories->entries[i];
+        if (!startsWith(entry->history, history)) continue;
+
+        ++count;
+        if (entry->energy == 0) continue;
+
+        sum += entry->energy;
+        if (smallest == 0 || entry->energy < smallest)
+            smallest = entry->energy;
+        if (entry->energy > largest) largest = entry->energy;
+    }
+
+    answer->value = operation == COUNT ? count : operation == SUM ? sum :
+                    operation == MIN ? smallest : largest;
+    if (answer->value == 0 && (operation == MIN || operation == MAX))
+        answer->status = QUANT_ERROR;
+}
+
+static void spreadEnergy(Histories *histories, const char *history,
+                         Energy energy)
+{
+    bool *reached = allocate(NULL, (histories->entriesCount + 1) *
+                                   sizeof(bool));
+    size_t *queue = allocate(NULL, (histories->entriesCount + 1) *
+                                   sizeof(size_t));
+    size_t queued = 0;
+
+    memset(reached, 0, histories->entriesCount * sizeof(bool));
+    queue[queued++] = (size_t) findEntry(histories, history);
+    reached[queue[0]] = true;
+
+    for (size_t i = 0; i < queued; ++i)
+    {
+        const char *current = histories->entries[queue[i]].history;
+        histories->entries[queue[i]].energy = energy;
+
+        for (size_t j = 0; j < histories->equalitiesCount; ++j)
+        {
+            const Equality *equality = &histories->equalities[j];
+            const char *next = NULL;
+
+            if (strcmp(equality->first, current) == 0)
+                next = equality->second;
+            else if (strcmp(equality->second, current) == 0)
+                next = equality->first;
+            if (next == NULL) continue;
+
+            size_t position = (size_t) findEntry(histories, next);
+            if (reached[position]) continue;
+
+            reached[position] = true;
+            queue[queued++] = position;
+        }
+    }
+
+    free(reached);
+    free(queue);
+}
+
+static Histories copyHistories(const Histories *histories)
+{
+    Histories copy = *histories;
+
+    // empty arrays may be NULL, which memcpy must not be given
+    copy.entries = allocate(NULL, (histories->entriesCount + 1) *
+                                  sizeof(Entry));
+    copy.equalities = allocate(NULL, (histories->equalitiesCount + 1) *
+                                     sizeof(Equality));
+    if (histories->entriesCount > 0)
+        memcpy(copy.entries, histories->entries,
+               histories->entriesCount * sizeof(Entry));
+    if (histories->equalitiesCount > 0)
+        memcpy(copy.equalities, histories->equalities,
+               histories->equalitiesCount * sizeof(Equality));
+
+    return copy;
+}
+
+static void freeHistories(Histories *histories)
+{
+    free(histories->entries);
+    free(histories->equalities);
+    memset(histories, 0, sizeof(Histories));
+}
+
+static void *allocate(void *memory, size_t size)
+{
+    void *allocated = realloc(memory, size);
+    if (allocated == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    return allocated;
+}
+
+static bool sameAnswer(Answer expected, Answer answer, bool text)
+{
+    if (text && expected.status != QUANT_OK && answer.status != NO_ANSWER)
+        return answer.status != QUANT_OK;
+
+    return expected.status == answer.status && expected.value == answer.value;
+}
+
+static void printAnswer(FILE *output, Answer answer)
+{
+    if (answer.status == NO_ANSWER)
+        fprintf(output, "no answer");
+    else if (answer.status != QUANT_OK)
+        fprintf(output, "status %d", answer.status);
+    else
+        printValue(output, answer.value);
+}
+
+static void printValue(FILE *output, EnergySum value)
+{
+    if (value >= 10) printValue(output, value / 10);
+    fputc('0' + (int) (value % 10), output);
+}
+
+static void watchEngine(const Engine *engine, uint64_t seed, FILE *input)
+{
+    pthread_mutex_lock(&watchedLock);
+    watchedEngine = engine;
+    watchedSeed = seed;
+    watchedInput = input;
+    atomic_store(&progress, 0);
+    pthread_mutex_unlock(&watchedLock);
+}
+
+static void *watchBudget(void *argument)
+{
+    (void) argument;
+    const Engine *lastEngine = NULL;
+    size_t lastProgress = 0;
+    long lastPosition = 0;
+    unsigned unchanged = 0;
+
+    while (true)
+    {
+        sleepMilliseconds(COMMAND_BUDGET_MS / BUDGET_CHECKS);
+
+        pthread_mutex_lock(&watchedLock);
+        const Engine *engine = watchedEngine;
+        uint64_t seed = watchedSeed;
+        size_t current = atomic_load(&progress);
+        long position = watchedInput == NULL ? 0 : ftell(watchedInput);
+        pthread_mutex_unlock(&watchedLock);
+
+        if (engine == NULL || engine != lastEngine ||
+            current != lastProgress || position != lastPosition)
+        {
+            lastEngine = engine;
+            lastProgress = current;
+            lastPosition = position;
+            unchanged = 0;
+            continue;
+        }
+        if (++unchanged < BUDGET_CHECKS) continue;
+
+        // engine may never return, so the test ends here
+        printf("stream %" PRIu64 ", %s: no command finished in %d ms, after "
+               "%zu commands\n", seed, engine->name, COMMAND_BUDGET_MS,
+               current);
+        exit(1);
+    }
+
+    return NULL;
+}
+
+static void sleepMilliseconds(unsigned milliseconds)
+{
+    struct timespec wait;
+    wait.tv_sec = milliseconds / 1000;
+    wait.tv_nsec = (long) (milliseconds % 1000) * 1000000L;
+    nanosleep(&wait, NULL);
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *program = argv[0];
+
+    // --dump prints a stream, so that it can be fed to the program, leaving
+    // files of its LOAD commands in /tmp
+    bool dump = argc > 1 && strcmp(argv[1], "--dump") == 0;
+    if (dump)
+    {
+        --argc;
+        ++argv;
+    }
+
+    size_t streams = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_STREAMS;
+    size_t count = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_COMMANDS;
+    uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_SEED;
+    if (argc > 4 || streams == 0 || count == 0)
+    {
+        fprintf(stderr, "Usage: %s [--dump] [STREAMS [COMMANDS [SEED]]]\n",
+                program);
+        return 1;
+    }
+
+    pthread_t watchdog;
+    if (!dump && pthread_create(&watchdog, NULL, watchBudget, NULL) != 0)
+    {
+        fprintf(stderr, "Cannot start watching time budget\n");
+        return 1;
+    }
+
+    Command *commands = allocate(NULL, count * sizeof(Command));
+    Answer *expected = allocate(NULL, count * sizeof(Answer));
+    Answer *answers = allocate(NULL, count * sizeof(Answer));
+    double modelTime = 0;
+    double engineTimes[ENGINES_COUNT] = {0};
+    size_t mismatches = 0;
+
+    for (size_t stream = 0; stream < streams; ++stream)
+    {
+        generateStream(seed + stream, commands, count);
+
+        if (dump)
+        {
+            writeStream(stdout, seed + stream, commands, count);
+            continue;
+        }
+
+        Histories final;
+        double start = now();
+        runModel(commands, count, expected, &final);
+        modelTime += now() - start;
+
+        for (int engine = 0; engine < ENGINES_COUNT; ++engine)
+        {
+            const Engine *configuration = &ENGINES[engine];
+            bool text = configuration->shards > 0 ||
+                        configuration->replicated;
+
+            start = now();
+            if (!runEngine(configuration, seed + stream, commands, count,
+                           answers, &final))
+                ++mismatches;
+            engineTimes[engine] += now() - start;
+
+            // later answers follow from the first difference, it is enough
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (sameAnswer(expected[i], answers[i], text)) continue;
+
+                printf("stream %" PRIu64 " command %zu, %s: ", seed + stream,
+                       i + 1, configuration->name);
+                printCommand(stdout, &commands[i], NULL);
+                printf("    expected ");
+                printAnswer(stdout, expected[i]);
+                printf(", got ");
+                printAnswer(stdout, answers[i]);
+                printf("\n");
+                ++mismatches;
+                break;
+            }
+        }
+
+        freeHistories(&final);
+    }
+
+    if (!dump)
+    {
+        double total = (double) streams * count;
+
+        printf("%zu streams of %zu commands, %zu mismatches\n", streams,
+               count, mismatches);
+        printf("%-14s %12.0f commands/s\n", "model", total / modelTime);
+        for (int engine = 0; engine < ENGINES_COUNT; ++engine)
+        {
+            printf("%-14s %12.0f commands/s  %6.1fx model\n",
+                   ENGINES[engine].name, total / engineTimes[engine],
+                   modelTime / engineTimes[engine]);
+        }
+    }
+
+    free(commands);
+    free(expected);
+    free(answers);
+    return mismatches == 0 ? 0 : 1;
+}